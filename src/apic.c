@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/apic.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/interrupt.h"
+#include "header/cpu/portio.h"
+#include "header/memory/paging.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+#include "header/text/console.h"
+
+struct APICState apic_state = {
+    .active = false,
+};
+
+uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*) (apic_state.lapic + reg);
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*) (apic_state.lapic + reg) = value;
+}
+
+static uint32_t ioapic_read(uint8_t reg) {
+    apic_state.ioapic[IOAPIC_REGSEL / 4] = reg;
+    return apic_state.ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint8_t reg, uint32_t value) {
+    apic_state.ioapic[IOAPIC_REGSEL / 4] = reg;
+    apic_state.ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+static bool acpi_checksum(const void *table, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t*) table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++)
+        sum += bytes[i];
+    return sum == 0;
+}
+
+static struct ACPIRSDP* acpi_scan_rsdp(uintptr_t start, uintptr_t end) {
+    for (uintptr_t addr = start; addr + sizeof(struct ACPIRSDP) <= end; addr += 16) {
+        struct ACPIRSDP *rsdp = (struct ACPIRSDP*) PHYS_TO_VIRT(addr);
+        if (memcmp(rsdp->signature, ACPI_RSDP_SIGNATURE, 8) == 0 && acpi_checksum(rsdp, sizeof(*rsdp)))
+            return rsdp;
+    }
+    return NULL;
+}
+
+// tables usually sit at the top of RAM, maybe above the direct map; the length is only known from the header
+static struct ACPISDTHeader* acpi_map_table(uint32_t address) {
+    struct ACPISDTHeader *header = paging_map_physical(address, sizeof(*header), 0);
+    if (!header)
+        return NULL;
+    return paging_map_physical(address, header->length, 0);
+}
+
+static struct ACPIMADT* acpi_find_madt(void) {
+    uintptr_t ebda = (uintptr_t) *(volatile uint16_t*) PHYS_TO_VIRT(ACPI_EBDA_SEGMENT_POINTER) << 4;
+    struct ACPIRSDP *rsdp = NULL;
+    if (ebda)
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp)
+        rsdp = acpi_scan_rsdp(ACPI_BIOS_AREA_START, ACPI_BIOS_AREA_END);
+    if (!rsdp)
+        return NULL;
+
+    // ACPI 1.0 RSDT, 32-bit table pointers follow the header
+    struct ACPISDTHeader *rsdt = acpi_map_table(rsdp->rsdt_address);
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0 || !acpi_checksum(rsdt, rsdt->length))
+        return NULL;
+    uint32_t count  = (rsdt->length - sizeof(*rsdt)) / 4;
+    uint32_t *table = (uint32_t*) (rsdt + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        struct ACPISDTHeader *header = acpi_map_table(table[i]);
+        if (header && memcmp(header->signature, ACPI_MADT_SIGNATURE, 4) == 0 && acpi_checksum(header, header->length))
+            return (struct ACPIMADT*) header;
+    }
+    return NULL;
+}
+
+static void apic_parse_madt(struct ACPIMADT *madt) {
+    apic_state.lapic     = paging_map_physical(madt->lapic_address, PAGE_SIZE, PAGE_UNCACHED);
+    apic_state.cpu_count = 0;
+    for (uint8_t irq = 0; irq < APIC_ISA_IRQ_COUNT; irq++) {
+        apic_state.irq_gsi[irq]   = irq; // identity unless overridden
+        apic_state.irq_flags[irq] = 0;
+    }
+
+    uint8_t *entry = madt->entries;
+    uint8_t *end   = (uint8_t*) madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2) {
+        switch (entry[0]) {
+            case MADT_TYPE_LAPIC:
+                // processor id, apic id, flags
+                if ((*(uint32_t*) (entry + 4) & MADT_LAPIC_ENABLED) && apic_state.cpu_count < APIC_MAX_CPUS)
+                    apic_state.cpu_apic_id[apic_state.cpu_count++] = entry[3];
+                break;
+            case MADT_TYPE_IOAPIC:
+                // only the first IOAPIC is used, it carries the ISA IRQs on PCs
+                if (!apic_state.ioapic) {
+                    apic_state.ioapic          = paging_map_physical(*(uint32_t*) (entry + 4), PAGE_SIZE, PAGE_UNCACHED);
+                    apic_state.ioapic_gsi_base = *(uint32_t*) (entry + 8);
+                }
+                break;
+            case MADT_TYPE_OVERRIDE:
+                // bus, source irq, gsi, flags
+                if (entry[3] < APIC_ISA_IRQ_COUNT) {
+                    apic_state.irq_gsi[entry[3]]   = *(uint32_t*) (entry + 4);
+                    apic_state.irq_flags[entry[3]] = *(uint16_t*) (entry + 8);
+                }
+                break;
+        }
+        entry += entry[1];
+    }
+}
+
+static void ioapic_set_entry(uint32_t gsi, uint32_t low, uint8_t destination) {
+    uint32_t index = gsi - apic_state.ioapic_gsi_base;
+    if (gsi < apic_state.ioapic_gsi_base || index >= apic_state.ioapic_entries)
+        return;
+    // high half first, the entry takes effect when the low half is written
+    ioapic_write(IOAPIC_REG_REDIRECTION + 2 * index + 1, (uint32_t) destination << 24);
+    ioapic_write(IOAPIC_REG_REDIRECTION + 2 * index, low);
+}
+
+static void apic_error_handler(struct InterruptFrame *frame, void *ctx) {
+    (void) frame;
+    (void) ctx;
+    // ESR latches on write
+    lapic_write(LAPIC_ESR, 0);
+    apic_state.last_error = lapic_read(LAPIC_ESR);
+    apic_state.errors++;
+    apic_eoi();
+}
+
+// every processor has its own LAPIC, all share apic_state.lapic as the address decodes locally
+static void lapic_local_init(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, APIC_ERROR_VECTOR);
+    lapic_write(LAPIC_SPURIOUS, LAPIC_SPURIOUS_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+bool apic_init(void) {
+    uint32_t edx;
+    cpu_cpuid(CPUID_FEATURES, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_FEATURE_EDX_APIC) || !(edx & CPUID_FEATURE_EDX_MSR))
+        return false;
+
+    struct ACPIMADT *madt = acpi_find_madt();
+    if (!madt)
+        return false;
+    apic_parse_madt(madt);
+    if (!apic_state.ioapic)
+        return false;
+
+    // the MSR holds the base actually decoded, and enabling it there is needed if firmware left it off
+    uint64_t base = cpu_rdmsr(IA32_APIC_BASE_MSR);
+    cpu_wrmsr(IA32_APIC_BASE_MSR, base | IA32_APIC_BASE_ENABLE);
+    apic_state.lapic = paging_map_physical((uint32_t) base & IA32_APIC_BASE_ADDRESS, PAGE_SIZE, PAGE_UNCACHED);
+    if (!apic_state.lapic)
+        return false;
+
+    register_irq_handler(APIC_ERROR_VECTOR, apic_error_handler, NULL);
+    lapic_local_init();
+
+    apic_state.ioapic_entries = ((ioapic_read(IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+    for (uint8_t i = 0; i < apic_state.ioapic_entries; i++)
+        ioapic_set_entry(apic_state.ioapic_gsi_base + i, IOAPIC_MASKED, 0);
+
+    // 8259 stays remapped and fully masked, its spurious IRQ7 / IRQ15 still land on the stub vectors
+    out(PIC1_DATA, PIC_DISABLE_ALL_MASK);
+    out(PIC2_DATA, PIC_DISABLE_ALL_MASK);
+    apic_state.active = true;
+    return true;
+}
+
+void apic_init_ap(void) {
+    cpu_wrmsr(IA32_APIC_BASE_MSR, cpu_rdmsr(IA32_APIC_BASE_MSR) | IA32_APIC_BASE_ENABLE);
+    lapic_local_init();
+}
+
+void apic_send_ipi(uint8_t apic_id, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t) apic_id << LAPIC_ICR_DESTINATION_SHIFT);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING);
+}
+
+void apic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static uint32_t apic_irq_entry(uint8_t irq) {
+    uint32_t low   = PIC1_OFFSET + irq; // same vectors as the remapped 8259, handlers need no change
+    uint16_t flags = apic_state.irq_flags[irq];
+    if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW)
+        low |= IOAPIC_ACTIVE_LOW;
+    if ((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL)
+        low |= IOAPIC_LEVEL_TRIGGERED;
+    return low;
+}
+
+void apic_enable_irq(uint8_t irq) {
+    if (irq < APIC_ISA_IRQ_COUNT)
+        ioapic_set_entry(apic_state.irq_gsi[irq], apic_irq_entry(irq), apic_current_id());
+}
+
+void apic_disable_irq(uint8_t irq) {
+    if (irq < APIC_ISA_IRQ_COUNT)
+        ioapic_set_entry(apic_state.irq_gsi[irq], apic_irq_entry(irq) | IOAPIC_MASKED, apic_current_id());
+}
+
+uint8_t apic_current_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void apic_eoi_benchmark(void) {
+    uint32_t flags = cpu_interrupt_save();
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t i = 0; i < APIC_EOI_BENCHMARK_ROUNDS; i++)
+        pic_ack(0);
+    uint64_t master = cpu_rdtsc() - start;
+
+    start = cpu_rdtsc();
+    for (uint32_t i = 0; i < APIC_EOI_BENCHMARK_ROUNDS; i++)
+        pic_ack(8);
+    uint64_t slave = cpu_rdtsc() - start;
+
+    uint64_t lapic = 0;
+    if (apic_state.active) {
+        start = cpu_rdtsc();
+        for (uint32_t i = 0; i < APIC_EOI_BENCHMARK_ROUNDS; i++)
+            apic_eoi();
+        lapic = cpu_rdtsc() - start;
+    }
+    cpu_interrupt_restore(flags);
+
+    kprintf("eoi: %u rounds, 8259 master %u cycles, 8259 slave %u cycles\n", APIC_EOI_BENCHMARK_ROUNDS,
+            (uint32_t) div64_32(master, APIC_EOI_BENCHMARK_ROUNDS, NULL),
+            (uint32_t) div64_32(slave, APIC_EOI_BENCHMARK_ROUNDS, NULL));
+    if (apic_state.active)
+        kprintf("eoi: lapic %u cycles\n", (uint32_t) div64_32(lapic, APIC_EOI_BENCHMARK_ROUNDS, NULL));
+    else
+        kprintf("eoi: no lapic, 8259 in use\n");
+}
@@ -0,0 +1,320 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/memory/buddy.h"
+#include "header/boot/multiboot.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/lock.h"
+#include "header/text/console.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+
+struct BuddyState buddy_state = {
+    .lock = SPINLOCK_INIT("buddy"),
+};
+
+/* -- Free lists, called with the lock held -- */
+
+static void free_list_push(struct Page *page, uint8_t order) {
+    struct Page *head = buddy_state.free_list[order];
+    page->order = order;
+    page->flags = PAGE_FREE;
+    page->prev  = NULL;
+    page->next  = head;
+    if (head)
+        head->prev = page;
+    buddy_state.free_list[order] = page;
+    buddy_state.bitmap |= 1u << order;
+    buddy_state.free_blocks[order]++;
+}
+
+static void free_list_remove(struct Page *page) {
+    uint8_t order = page->order;
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        buddy_state.free_list[order] = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+    if (!buddy_state.free_list[order])
+        buddy_state.bitmap &= ~(1u << order);
+    buddy_state.free_blocks[order]--;
+    page->flags &= ~PAGE_FREE;
+    page->next = NULL;
+    page->prev = NULL;
+}
+
+/* -- Allocation -- */
+
+uint32_t buddy_alloc(uint8_t order) {
+    if (order > BUDDY_MAX_ORDER)
+        return 0;
+    uint32_t flags = spin_lock_irqsave(&buddy_state.lock);
+    // smallest non empty list of at least the asked order, one ctz instead of a walk
+    uint32_t candidates = buddy_state.bitmap & ~((1u << order) - 1);
+    if (!candidates) {
+        buddy_state.failures++;
+        spin_unlock_irqrestore(&buddy_state.lock, flags);
+        return 0;
+    }
+
+    uint8_t     current = __builtin_ctz(candidates);
+    struct Page *page   = buddy_state.free_list[current];
+    free_list_remove(page);
+    // keep the lower half, the upper half goes back one order down
+    while (current > order) {
+        current--;
+        free_list_push(page + (1u << current), current);
+        buddy_state.splits++;
+    }
+    buddy_state.free_pages -= 1u << order;
+    buddy_state.allocations++;
+    uint32_t index = page - buddy_state.pages;
+    spin_unlock_irqrestore(&buddy_state.lock, flags);
+    return index << PAGE_SHIFT;
+}
+
+void buddy_free(uint32_t address, uint8_t order) {
+    uint32_t index = address >> PAGE_SHIFT;
+    if (order > BUDDY_MAX_ORDER || index >= buddy_state.page_count || (index & ((1u << order) - 1)))
+        return;
+    uint32_t flags = spin_lock_irqsave(&buddy_state.lock);
+    if (buddy_state.pages[index].flags & (PAGE_FREE | PAGE_RESERVED)) {
+        spin_unlock_irqrestore(&buddy_state.lock, flags);
+        return;
+    }
+    buddy_state.free_pages += 1u << order;
+    buddy_state.frees++;
+
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t    buddy = index ^ (1u << order);
+        struct Page *page = &buddy_state.pages[buddy];
+        // reserved pages are never free, so memory the allocator does not own is never merged in
+        if (buddy >= buddy_state.page_count || !(page->flags & PAGE_FREE) || page->order != order)
+            break;
+        free_list_remove(page);
+        buddy_state.merges++;
+        index &= ~(1u << order);
+        order++;
+    }
+    free_list_push(&buddy_state.pages[index], order);
+    spin_unlock_irqrestore(&buddy_state.lock, flags);
+}
+
+struct Page* buddy_page(uint32_t address) {
+    uint32_t index = address >> PAGE_SHIFT;
+    return index < buddy_state.page_count ? &buddy_state.pages[index] : NULL;
+}
+
+uint8_t buddy_order(uint32_t size) {
+    uint8_t order = 0;
+    while (order < BUDDY_ORDERS && (PAGE_SIZE << order) < size)
+        order++;
+    return order;
+}
+
+/* -- Setup -- */
+
+// next usable range of the memory map, page aligned inwards and clipped to [BUDDY_MIN_ADDRESS, BUDDY_ADDRESS_LIMIT)
+static bool buddy_next_region(struct MultibootInfo *mb, uint32_t *offset, uint32_t *start, uint32_t *end) {
+    while (true) {
+        uint64_t base, length;
+        if (mb->flags & MULTIBOOT_INFO_MEM_MAP) {
+            if (*offset >= mb->mmap_length)
+                return false;
+            struct MultibootMemoryMap *entry = (struct MultibootMemoryMap*) PHYS_TO_VIRT(mb->mmap_addr + *offset);
+            *offset += entry->size + sizeof(entry->size);
+            if (entry->type != MULTIBOOT_MEMORY_AVAILABLE)
+                continue;
+            base   = entry->addr;
+            length = entry->length;
+        } else {
+            // mem_upper is the memory from 1 MiB up to the first hole
+            if (*offset || !(mb->flags & MULTIBOOT_INFO_MEMORY))
+                return false;
+            *offset = 1;
+            base    = BUDDY_MIN_ADDRESS;
+            length  = (uint64_t) mb->mem_upper * 1024;
+        }
+
+        uint64_t first = (base + PAGE_SIZE - 1) & ~(uint64_t) (PAGE_SIZE - 1);
+        uint64_t last  = (base + length) & ~(uint64_t) (PAGE_SIZE - 1);
+        if (first < BUDDY_MIN_ADDRESS)
+            first = BUDDY_MIN_ADDRESS;
+        if (last > BUDDY_ADDRESS_LIMIT)
+            last = BUDDY_ADDRESS_LIMIT;
+        if (first >= last)
+            continue;
+        *start = first;
+        *end   = last;
+        return true;
+    }
+}
+
+static void buddy_mark(uint32_t start, uint32_t end, bool reserved) {
+    uint32_t first = start >> PAGE_SHIFT;
+    uint32_t last  = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (last > buddy_state.page_count)
+        last = buddy_state.page_count;
+    for (uint32_t i = first; i < last; i++)
+        buddy_state.pages[i].flags = reserved ? PAGE_RESERVED : 0;
+}
+
+// free a run of usable pages as the largest aligned blocks that fit
+static void buddy_add_run(uint32_t first, uint32_t last) {
+    while (first < last) {
+        uint8_t order = BUDDY_MAX_ORDER;
+        while ((first & ((1u << order) - 1)) || first + (1u << order) > last)
+            order--;
+        free_list_push(&buddy_state.pages[first], order);
+        buddy_state.total_pages += 1u << order;
+        buddy_state.free_pages  += 1u << order;
+        first += 1u << order;
+    }
+}
+
+void buddy_init(uint32_t magic, struct MultibootInfo *mb) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || mb == NULL)
+        return;
+
+    uint32_t offset = 0, start, end, limit = 0;
+    while (buddy_next_region(mb, &offset, &start, &end))
+        if (end > limit)
+            limit = end;
+    if (limit == 0)
+        return;
+    buddy_state.page_count = limit >> PAGE_SHIFT;
+
+    // the Page array goes into the first usable range with room for it above the kernel
+    uint32_t kernel_end = VIRT_TO_PHYS(_kernel_end);
+    uint32_t size       = (buddy_state.page_count * sizeof(struct Page) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t array      = 0;
+    offset = 0;
+    while (!array && buddy_next_region(mb, &offset, &start, &end)) {
+        if (start < kernel_end)
+            start = kernel_end;
+        if (start < end && end - start >= size)
+            array = start;
+    }
+    if (!array) {
+        buddy_state.page_count = 0;
+        return;
+    }
+    buddy_state.pages = (struct Page*) PHYS_TO_VIRT(array);
+
+    // everything starts reserved, then usable ranges are opened and what the kernel uses is closed again
+    memset(buddy_state.pages, 0, size);
+    buddy_mark(0, limit, true);
+    offset = 0;
+    while (buddy_next_region(mb, &offset, &start, &end))
+        buddy_mark(start, end, false);
+    buddy_mark(VIRT_TO_PHYS(_kernel_start), kernel_end, true);
+    buddy_mark(array, array + size, true);
+    buddy_mark(VIRT_TO_PHYS(mb), VIRT_TO_PHYS(mb) + sizeof(*mb), true);
+    if (mb->flags & MULTIBOOT_INFO_MEM_MAP)
+        buddy_mark(mb->mmap_addr, mb->mmap_addr + mb->mmap_length, true);
+
+    uint32_t flags = spin_lock_irqsave(&buddy_state.lock);
+    uint32_t run   = 0;
+    for (uint32_t i = 0; i <= buddy_state.page_count; i++) {
+        bool usable = i < buddy_state.page_count && !(buddy_state.pages[i].flags & PAGE_RESERVED);
+        if (usable)
+            continue;
+        if (run < i)
+            buddy_add_run(run, i);
+        run = i + 1;
+    }
+    spin_unlock_irqrestore(&buddy_state.lock, flags);
+}
+
+/* -- Statistics -- */
+
+// called with the lock held
+static uint32_t buddy_free_pages_from(uint8_t order) {
+    uint32_t pages = 0;
+    for (uint8_t k = order; k < BUDDY_ORDERS; k++)
+        pages += buddy_state.free_blocks[k] << k;
+    return pages;
+}
+
+uint32_t buddy_fragmentation(uint8_t order) {
+    if (order > BUDDY_MAX_ORDER)
+        return 100;
+    uint32_t flags  = spin_lock_irqsave(&buddy_state.lock);
+    uint32_t free   = buddy_state.free_pages;
+    uint32_t usable = buddy_free_pages_from(order);
+    spin_unlock_irqrestore(&buddy_state.lock, flags);
+    if (free == 0)
+        return 0;
+    return 100 - div64_32((uint64_t) usable * 100, free, NULL);
+}
+
+void buddy_dump(void) {
+    kprintf("buddy: %u of %u pages free, %u KiB\n", buddy_state.free_pages, buddy_state.total_pages,
+            buddy_state.free_pages * (PAGE_SIZE / 1024));
+    kprintf("buddy: %u allocations, %u frees, %u failures, %u splits, %u merges\n", buddy_state.allocations,
+            buddy_state.frees, buddy_state.failures, buddy_state.splits, buddy_state.merges);
+    for (uint8_t order = 0; order < BUDDY_ORDERS; order++)
+        kprintf("buddy: order %2u %6u free blocks, fragmentation %3u%%\n",
+                order, buddy_state.free_blocks[order], buddy_fragmentation(order));
+}
+
+/* -- Benchmark -- */
+
+struct BuddySlot {
+    uint32_t address;
+    uint8_t  order;
+};
+
+static uint32_t buddy_benchmark_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+void buddy_benchmark(void) {
+    static struct BuddySlot slots[BUDDY_BENCHMARK_SLOTS];
+    uint32_t before[BUDDY_ORDERS];
+    memcpy(before, buddy_state.free_blocks, sizeof(before));
+    uint32_t free_before = buddy_state.free_pages;
+
+    // the same page every round, splits and merges all the way up to BUDDY_MAX_ORDER when memory is unfragmented
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t i = 0; i < BUDDY_BENCHMARK_ROUNDS; i++)
+        buddy_free(buddy_alloc(0), 0);
+    uint32_t single = div64_32(cpu_rdtsc() - start, BUDDY_BENCHMARK_ROUNDS, NULL);
+
+    // random frees and allocations of orders 0 to 4, small ones more often, with up to SLOTS blocks live
+    uint32_t random = 2463534242u, operations = 0, failed = 0;
+    start = cpu_rdtsc();
+    for (uint32_t i = 0; i < BUDDY_BENCHMARK_ROUNDS; i++) {
+        uint32_t         value = buddy_benchmark_random(&random);
+        struct BuddySlot *slot = &slots[value % BUDDY_BENCHMARK_SLOTS];
+        if (slot->address) {
+            buddy_free(slot->address, slot->order);
+            slot->address = 0;
+        } else {
+            slot->order   = __builtin_ctz((value >> 16) | 0x10);
+            slot->address = buddy_alloc(slot->order);
+            failed += slot->address == 0;
+        }
+        operations++;
+    }
+    uint32_t mixed = div64_32(cpu_rdtsc() - start, operations, NULL);
+
+    kprintf("buddy: alloc+free order 0 %u cycles, mixed orders %u cycles per operation, %u failed\n",
+            single, mixed, failed);
+    kprintf("buddy: after churn fragmentation order 2 %u%%, order 5 %u%%, order %u %u%%\n",
+            buddy_fragmentation(2), buddy_fragmentation(5), BUDDY_MAX_ORDER, buddy_fragmentation(BUDDY_MAX_ORDER));
+
+    for (uint32_t i = 0; i < BUDDY_BENCHMARK_SLOTS; i++) {
+        if (slots[i].address)
+            buddy_free(slots[i].address, slots[i].order);
+        slots[i].address = 0;
+    }
+    bool merged = buddy_state.free_pages == free_before
+               && memcmp(before, buddy_state.free_blocks, sizeof(before)) == 0;
+    kprintf("buddy: everything freed, blocks %s\n", merged ? "merged back to the initial layout" : "DID NOT MERGE BACK");
+}
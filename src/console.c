@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/text/console.h"
+#include "header/text/framebuffer.h"
+#include "header/text/graphics.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/format.h"
+#include "header/stdlib/div64.h"
+#include "header/cpu/cpu.h"
+#include "header/driver/timer.h"
+
+struct ConsoleState console_state = {
+    .top = 0,
+    .row = 0,
+    .col = 0,
+    .fg   = 0xF,
+    .bg   = 0,
+    .lock = SPINLOCK_INIT("console"),
+};
+
+static void console_scroll(void) {
+    // the top row leaves the screen, keep it for scrollback
+    memcpy(console_state.history[console_state.history_count % CONSOLE_HISTORY_LINES],
+           framebuffer_row(console_state.top), sizeof(console_state.history[0]));
+    console_state.history_count++;
+
+    if (console_state.top + SCREEN_HEIGHT == CONSOLE_RING_ROWS) {
+        // end of the ring, move the rows that stay visible back to the start
+        for (uint8_t i = 1; i < SCREEN_HEIGHT; i++)
+            framebuffer_copy_row(i - 1, console_state.top + i);
+        console_state.top = 0;
+    } else {
+        console_state.top++;
+    }
+
+    // the new bottom row still holds output from the previous lap of the ring
+    framebuffer_clear_row(console_state.top + SCREEN_HEIGHT - 1, console_state.fg, console_state.bg);
+    framebuffer_set_start(console_state.top);
+}
+
+void console_init(void) {
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    framebuffer_clear();
+    console_state.top           = 0;
+    console_state.row           = 0;
+    console_state.col           = 0;
+    console_state.history_count = 0;
+    console_state.view_offset   = 0;
+    framebuffer_set_start(0);
+    framebuffer_set_cursor(0, 0);
+    spin_unlock_irqrestore(&console_state.lock, flags);
+}
+
+// the _locked helpers expect console_state.lock held, console_write_locked() calls them in the middle of a batch
+static void console_newline_locked(void) {
+    console_state.col = 0;
+    if (console_state.row + 1 < SCREEN_HEIGHT)
+        console_state.row++;
+    else
+        console_scroll();
+}
+
+static void console_view_live_locked(void) {
+    if (graphics_active())
+        return;
+    console_state.view_offset = 0;
+    framebuffer_set_start(console_state.top);
+}
+
+void console_newline(void) {
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    console_newline_locked();
+    framebuffer_set_cursor(console_state.top + console_state.row, console_state.col);
+    spin_unlock_irqrestore(&console_state.lock, flags);
+}
+
+// control characters only move the cursor, the caller updates the hardware cursor
+static void console_control(char c) {
+    switch (c) {
+        case '\n':
+            console_newline_locked();
+            break;
+        case '\r':
+            console_state.col = 0;
+            break;
+        case '\t': {
+            uint8_t spaces = CONSOLE_TAB_WIDTH - console_state.col % CONSOLE_TAB_WIDTH;
+            framebuffer_write_n(console_state.top + console_state.row, console_state.col, "    ", spaces,
+                                console_state.fg, console_state.bg);
+            console_state.col += spaces;
+            if (console_state.col >= BUFFER_WIDTH)
+                console_newline_locked();
+            break;
+        }
+        case '\b':
+            if (console_state.col > 0) {
+                console_state.col--;
+                framebuffer_write(console_state.top + console_state.row, console_state.col, ' ',
+                                  console_state.fg, console_state.bg);
+            }
+            break;
+    }
+}
+
+static void console_write_locked(const char *s, size_t n) {
+    if (graphics_active()) {
+        graphics_console_write(s, n, console_state.fg, console_state.bg);
+        return;
+    }
+    if (console_state.view_offset)
+        console_view_live_locked();
+
+    size_t i = 0;
+    while (i < n) {
+        if ((uint8_t) s[i] < ' ') {
+            console_control(s[i++]);
+            continue;
+        }
+
+        // printable run up to the next control character or the end of the row, written in one pass
+        size_t room = BUFFER_WIDTH - console_state.col;
+        size_t run  = 1;
+        while (i + run < n && run < room && (uint8_t) s[i + run] >= ' ')
+            run++;
+        framebuffer_write_n(console_state.top + console_state.row, console_state.col, s + i, run,
+                            console_state.fg, console_state.bg);
+        console_state.col += run;
+        i += run;
+        if (console_state.col == BUFFER_WIDTH)
+            console_newline_locked();
+    }
+
+    // one cursor update and flush for the whole batch
+    framebuffer_set_cursor(console_state.top + console_state.row, console_state.col);
+}
+
+void console_write(const char *s, size_t n) {
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    console_write_locked(s, n);
+    spin_unlock_irqrestore(&console_state.lock, flags);
+}
+
+void console_puts(const char *s) {
+    console_write(s, strlen(s));
+}
+
+void console_putchar(char c) {
+    console_write(&c, 1);
+}
+
+int kprintf(const char *fmt, ...) {
+    static char buf[CONSOLE_PRINTF_BUFFER]; // shared, formatted under the lock too
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    console_write_locked(buf, (size_t) len < sizeof(buf) ? (size_t) len : sizeof(buf) - 1);
+    spin_unlock_irqrestore(&console_state.lock, flags);
+    return len;
+}
+
+void console_set_color(uint8_t fg, uint8_t bg) {
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    console_state.fg = fg;
+    console_state.bg = bg;
+    spin_unlock_irqrestore(&console_state.lock, flags);
+}
+
+void console_scroll_view(int32_t lines) {
+    if (graphics_active())
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    uint32_t saved = console_state.history_count < CONSOLE_HISTORY_LINES
+                   ? console_state.history_count : CONSOLE_HISTORY_LINES;
+    int32_t offset = (int32_t) console_state.view_offset + lines;
+    if (offset < 0)
+        offset = 0;
+    if ((uint32_t) offset > saved)
+        offset = saved;
+
+    console_state.view_offset = offset;
+    if (offset == 0) {
+        framebuffer_set_start(console_state.top);
+        spin_unlock_irqrestore(&console_state.lock, flags);
+        return;
+    }
+
+    // history followed by the live screen is one sequence of lines, show the page ending offset lines before its end
+    for (uint8_t i = 0; i < SCREEN_HEIGHT; i++) {
+        uint32_t line = console_state.history_count - offset + i;
+        if (line < console_state.history_count)
+            framebuffer_write_row(CONSOLE_VIEW_ROW + i, console_state.history[line % CONSOLE_HISTORY_LINES]);
+        else
+            framebuffer_copy_row(CONSOLE_VIEW_ROW + i, console_state.top + (line - console_state.history_count));
+    }
+    framebuffer_set_start(CONSOLE_VIEW_ROW);
+    spin_unlock_irqrestore(&console_state.lock, flags);
+}
+
+void console_view_live(void) {
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    console_view_live_locked();
+    spin_unlock_irqrestore(&console_state.lock, flags);
+}
+
+struct ConsoleBenchmarkResult {
+    uint32_t per_second;
+    uint32_t cycles_per_line;
+};
+
+static struct ConsoleBenchmarkResult console_benchmark_run(const char *line, size_t n) {
+    uint64_t start_ns = clock_monotonic_ns();
+    uint64_t start    = cpu_rdtsc();
+    for (uint32_t i = 0; i < CONSOLE_BENCHMARK_LINES; i++)
+        console_write(line, n);
+    uint64_t cycles = cpu_rdtsc() - start;
+    uint64_t us     = div64_32(clock_monotonic_ns() - start_ns, 1000, NULL);
+
+    // every line past the first screen scrolls, so this is the scrolling rate
+    struct ConsoleBenchmarkResult result = {
+        .per_second      = us ? (uint32_t) div64_32((uint64_t) CONSOLE_BENCHMARK_LINES * 1000000,
+                                                    us >> 32 ? UINT32_MAX : (uint32_t) us, NULL) : 0,
+        .cycles_per_line = (uint32_t) div64_32(cycles, CONSOLE_BENCHMARK_LINES, NULL),
+    };
+    return result;
+}
+
+void console_benchmark(void) {
+    static char line[BUFFER_WIDTH];
+    memset(line, '#', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+
+    // printed after both runs, each run scrolls everything before it off the screen
+    struct ConsoleBenchmarkResult brief = console_benchmark_run("benchmark\n", 10);
+    struct ConsoleBenchmarkResult full  = console_benchmark_run(line, sizeof(line));
+    kprintf("console short lines: %u lines, %u lines/s, %u cycles per line\n",
+            CONSOLE_BENCHMARK_LINES, brief.per_second, brief.cycles_per_line);
+    kprintf("console full rows:   %u lines, %u lines/s, %u cycles per line\n",
+            CONSOLE_BENCHMARK_LINES, full.per_second, full.cycles_per_line);
+}
@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include "header/cpu/cpu.h"
+
+uint64_t cpu_rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile(
+        "rdtsc"
+        : "=a"(low), "=d"(high)
+    );
+    return (uint64_t) high << 32 | low;
+}
+
+void cpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    uint32_t a, b, c, d;
+    __asm__ volatile(
+        "cpuid"
+        : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+        : "a"(leaf), "c"(0)
+    );
+    if (eax) *eax = a;
+    if (ebx) *ebx = b;
+    if (ecx) *ecx = c;
+    if (edx) *edx = d;
+}
+
+uint64_t cpu_rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile(
+        "rdmsr"
+        : "=a"(low), "=d"(high)
+        : "c"(msr)
+    );
+    return (uint64_t) high << 32 | low;
+}
+
+void cpu_wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile(
+        "wrmsr"
+        : // <Empty output operand>
+        : "c"(msr), "a"((uint32_t) value), "d"((uint32_t) (value >> 32))
+    );
+}
+
+uint32_t cpu_interrupt_save(void) {
+    uint32_t flags;
+    __asm__ volatile(
+        "pushf\n\t"
+        "pop %0\n\t"
+        "cli"
+        : "=r"(flags)
+        : // <Empty input operand>
+        : "memory"
+    );
+    return flags;
+}
+
+void cpu_interrupt_restore(uint32_t flags) {
+    if (flags & EFLAGS_INTERRUPT_ENABLE)
+        __asm__ volatile("sti" ::: "memory");
+}
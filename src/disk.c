@@ -1,6 +1,23 @@
 #include "header/filesystem/disk.h"
 #include "header/cpu/portio.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/interrupt.h"
+#include "header/cpu/workqueue.h"
+#include "header/process/thread.h"
+#include "header/process/wait.h"
+#include "header/driver/timer.h"
+#include "header/text/console.h"
+#include "header/stdlib/div64.h"
 
+// the channel takes one command at a time and callers may run on any processor
+struct ATAState ata_state = {
+    .channel   = WAIT_QUEUE_INIT("ata"),
+    .busy      = false,
+    .irq_mode  = false,
+    .active    = false,
+    .done      = COMPLETION_INIT("ata done"),
+    .lost_irqs = 0,
+};
 
 static void ATA_busy_wait()
 {
@@ -14,46 +31,285 @@ static void ATA_DRQ_wait()
         ;
 }
 
-void read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count)
+// one sector between the data port and the request buffer
+static void ATA_transfer_sector(void)
 {
-    ATA_busy_wait();
-    out(0x1F6, 0xE0 | ((logical_block_address >> 24) & 0xF));
-    out(0x1F2, block_count);
-    out(0x1F3, (uint8_t)logical_block_address);
-    out(0x1F4, (uint8_t)(logical_block_address >> 8));
-    out(0x1F5, (uint8_t)(logical_block_address >> 16));
-    out(0x1F7, 0x20);
+    uint16_t *buffer = ata_state.buffer;
+    if (ata_state.write)
+        for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
+            out16(0x1F0, buffer[j]);
+    else
+        for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
+            buffer[j] = in16(0x1F0);
+    // Note : uint16_t => 2 bytes, HALF_BLOCK_SIZE*2 = BLOCK_SIZE with pointer arithmetic
+    ata_state.buffer = buffer + HALF_BLOCK_SIZE;
+}
 
-    uint16_t *target = (uint16_t *)ptr;
+// keeps the status of a failed request for ATA_request() to report
+static bool ATA_status_ok(void)
+{
+    uint8_t status = in(0x1F7);
+    if (!(status & (ATA_STATUS_ERR | ATA_STATUS_DF)))
+        return true;
+    ata_state.status = status;
+    return false;
+}
 
-    for (uint32_t i = 0; i < block_count; i++)
+static void ATA_poll(void)
+{
+    while (ata_state.remaining)
     {
         ATA_busy_wait();
+        if (!ATA_status_ok())
+            return;
         ATA_DRQ_wait();
-        for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
-            target[j] = in16(0x1F0);
-        // Note : uint16_t => 2 bytes, HALF_BLOCK_SIZE*2 = BLOCK_SIZE with pointer arithmetic
-        target += HALF_BLOCK_SIZE;
+        ATA_transfer_sector();
+        ata_state.remaining--;
+    }
+    // a write fails only once the device tried to store the last sector
+    if (ata_state.write)
+    {
+        ATA_busy_wait();
+        ATA_status_ok();
+    }
+}
+
+// bottom half of IRQ14, runs with interrupts enabled so the 256 word moves do not hold off other IRQs
+static void ata_work(void *arg)
+{
+    (void) arg;
+    if (!ata_state.active)
+        return;
+
+    if (!(ata_state.status & (ATA_STATUS_ERR | ATA_STATUS_DF)) && ata_state.remaining)
+    {
+        ATA_transfer_sector();
+        ata_state.remaining--;
+        // a read is done with its last sector, a write waits for the interrupt saying it was stored
+        if (ata_state.remaining || ata_state.write)
+            return;
     }
+    ata_state.active = false;
+    complete(&ata_state.done);
 }
 
-void write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count)
+static void ata_isr(struct InterruptFrame *frame, void *ctx)
+{
+    (void) frame;
+    (void) ctx;
+    // reading status also acknowledges the device interrupt
+    uint8_t status = in(0x1F7);
+    irq_eoi(IRQ_PRIMARY_ATA);
+    if (!ata_state.active)
+        return;
+
+    // the device raises the next IRQ only after the work item moved this sector, so no status is overwritten
+    ata_state.status = status;
+    work_queue(&ata_state.work);
+}
+
+void ata_init(void)
+{
+    work_init(&ata_state.work, ata_work, NULL);
+    register_irq_handler(PIC1_OFFSET + IRQ_PRIMARY_ATA, ata_isr, NULL);
+    irq_enable(IRQ_PRIMARY_ATA);
+    ata_state.irq_mode = true;
+}
+
+static bool ATA_channel_free(void *arg)
+{
+    (void) arg;
+    return !ata_state.busy;
+}
+
+// returns true when the request may sleep until IRQ14 ends it
+static bool ATA_acquire(void)
+{
+    bool     sleep = ata_state.irq_mode && thread_can_block();
+    uint32_t flags = spin_lock_irqsave(&ata_state.channel.lock);
+    if (sleep)
+        wait_event_locked(&ata_state.channel, ATA_channel_free, NULL);
+    else
+        while (ata_state.busy)
+        {
+            spin_unlock_irqrestore(&ata_state.channel.lock, flags);
+            __asm__ volatile("pause");
+            flags = spin_lock_irqsave(&ata_state.channel.lock);
+        }
+    ata_state.busy = true;
+    spin_unlock_irqrestore(&ata_state.channel.lock, flags);
+    return sleep;
+}
+
+static void ATA_release(void)
+{
+    uint32_t flags = spin_lock_irqsave(&ata_state.channel.lock);
+    ata_state.busy = false;
+    spin_unlock_irqrestore(&ata_state.channel.lock, flags);
+    wake_up(&ata_state.channel);
+}
+
+// the status belongs to the request until the channel is released
+static bool ATA_end(void)
+{
+    bool ok = !(ata_state.status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+    ATA_release();
+    return ok;
+}
+
+static void ATA_command(uint32_t logical_block_address, uint8_t block_count, uint8_t command, bool irq)
 {
     ATA_busy_wait();
+    out(ATA_CONTROL_PORT, irq ? 0 : ATA_CONTROL_NIEN);
     out(0x1F6, 0xE0 | ((logical_block_address >> 24) & 0xF));
     out(0x1F2, block_count);
     out(0x1F3, (uint8_t)logical_block_address);
     out(0x1F4, (uint8_t)(logical_block_address >> 8));
     out(0x1F5, (uint8_t)(logical_block_address >> 16));
-    out(0x1F7, 0x30);
-    for (uint32_t i = 0; i < block_count; i++)
+    out(0x1F7, command);
+}
+
+// IRQ14 did not arrive, e.g. it is not routed: take the request back, finish it polled and stop sleeping
+static void ATA_recover(void)
+{
+    uint32_t flags = cpu_interrupt_save();
+    bool     lost  = ata_state.active;
+    ata_state.active = false;
+    cpu_interrupt_restore(flags);
+    if (!lost)
+        return;
+
+    ata_state.lost_irqs++;
+    ata_state.irq_mode = false;
+    out(ATA_CONTROL_PORT, ATA_CONTROL_NIEN);
+    ATA_poll();
+    ATA_busy_wait();
+}
+
+static bool ATA_request(uint16_t *buffer, uint32_t logical_block_address, uint8_t block_count, bool write)
+{
+    if (block_count == 0)
+        return true;
+    bool irq = ATA_acquire();
+    ata_state.buffer    = buffer;
+    ata_state.remaining = block_count;
+    ata_state.write     = write;
+    ata_state.status    = 0;
+    uint8_t command     = write ? 0x30 : 0x20;
+
+    if (!irq)
     {
+        ATA_command(logical_block_address, block_count, command, false);
+        ATA_poll();
+        return ATA_end();
+    }
+
+    completion_reinit(&ata_state.done);
+    // the handler may only see the request once it is complete, IRQ14 is held off until then
+    uint32_t flags = cpu_interrupt_save();
+    ATA_command(logical_block_address, block_count, command, true);
+    if (write)
+    {
+        // the first sector is sent without an interrupt, each later one follows the IRQ for the previous
         ATA_busy_wait();
         ATA_DRQ_wait();
-        /* Note : uint16_t => 2 bytes, i is current block number to write
-           HALF_BLOCK_SIZE*i = block_offset with pointer arithmetic
-        */
-        for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
-            out16(0x1F0, ((uint16_t *)ptr)[HALF_BLOCK_SIZE * i + j]);
+        ATA_transfer_sector();
+        ata_state.remaining--;
+    }
+    ata_state.active = true;
+    cpu_interrupt_restore(flags);
+
+    if (!wait_for_completion_timeout(&ata_state.done, ATA_IRQ_TIMEOUT_NS))
+        ATA_recover();
+    return ATA_end();
+}
+
+bool read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count)
+{
+    return ATA_request((uint16_t *)ptr, logical_block_address, block_count, false);
+}
+
+bool write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count)
+{
+    // only read from while writing
+    return ATA_request((uint16_t *)(uintptr_t)ptr, logical_block_address, block_count, true);
+}
+
+/* -- Benchmark -- */
+
+static struct BlockBuffer ata_benchmark_buffer[ATA_BENCHMARK_SECTORS];
+static volatile uint32_t  ata_benchmark_sink;
+
+static void ata_benchmark_reads(void)
+{
+    for (uint32_t i = 0; i < ATA_BENCHMARK_READS; i++)
+        read_blocks(ata_benchmark_buffer, i * ATA_BENCHMARK_SECTORS, ATA_BENCHMARK_SECTORS);
+}
+
+// stand-in for useful work, stays in registers
+static void ata_benchmark_compute(uint32_t rounds)
+{
+    uint32_t x = 2463534242u;
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    ata_benchmark_sink = x;
+}
+
+static void ata_benchmark_reader(void *arg)
+{
+    ata_benchmark_reads();
+    complete((struct Completion *)arg);
+}
+
+static uint32_t ata_benchmark_us_since(uint64_t start)
+{
+    uint64_t us = div64_32(clock_monotonic_ns() - start, 1000, NULL);
+    return us >> 32 ? UINT32_MAX : (uint32_t)us;
+}
+
+void ata_overlap_benchmark(void)
+{
+    if (!ata_state.irq_mode || !thread_can_block())
+    {
+        kprintf("ata overlap: needs ata_init() and a thread to block\n");
+        return;
     }
-}
\ No newline at end of file
+
+    uint64_t start = clock_monotonic_ns();
+    ata_benchmark_reads();
+    uint32_t read_us = ata_benchmark_us_since(start);
+
+    // computing as long as the reads take is where overlapping them gains the most
+    start = clock_monotonic_ns();
+    ata_benchmark_compute(ATA_BENCHMARK_PROBE);
+    uint32_t probe_us = ata_benchmark_us_since(start);
+    uint64_t rounds   = div64_32((uint64_t)read_us * ATA_BENCHMARK_PROBE, probe_us ? probe_us : 1, NULL);
+    if (rounds > UINT32_MAX)
+        rounds = UINT32_MAX;
+
+    start = clock_monotonic_ns();
+    ata_benchmark_compute(rounds);
+    uint32_t compute_us = ata_benchmark_us_since(start);
+
+    // the reader runs above the caller, each finished request preempts the computation to issue the next
+    struct Thread     *self = thread_current();
+    struct Completion finished;
+    completion_init(&finished, "ata benchmark");
+    start = clock_monotonic_ns();
+    if (!thread_create(ata_benchmark_reader, &finished, self->priority > 0 ? self->priority - 1 : 0, "ata reader"))
+        return;
+    ata_benchmark_compute(rounds);
+    wait_for_completion(&finished);
+    uint32_t overlap_us = ata_benchmark_us_since(start);
+
+    uint32_t serial_us = read_us + compute_us;
+    uint32_t gain      = div64_32((uint64_t)serial_us * 100, overlap_us ? overlap_us : 1, NULL);
+    kprintf("ata overlap: %u reads of %u sectors %u us, compute %u us\n",
+            ATA_BENCHMARK_READS, ATA_BENCHMARK_SECTORS, read_us, compute_us);
+    kprintf("ata overlap: serial %u us, overlapped %u us, %u.%02ux, %u lost irqs\n",
+            serial_us, overlap_us, gain / 100, gain % 100, ata_state.lost_irqs);
+}
@@ -1,95 +1,36 @@
 #include "header/filesystem/ext2.h"
-
-const uint8_t fs_signature[BLOCK_SIZE] = {
-    'C',
-    'o',
-    'u',
-    'r',
-    's',
-    'e',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    'D',
-    'e',
-    's',
-    'i',
-    'g',
-    'n',
-    'e',
-    'd',
-    ' ',
-    'b',
-    'y',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    'L',
-    'a',
-    'b',
-    ' ',
-    'S',
-    'i',
-    's',
-    't',
-    'e',
-    'r',
-    ' ',
-    'I',
-    'T',
-    'B',
-    ' ',
-    ' ',
-    'M',
-    'a',
-    'd',
-    'e',
-    ' ',
-    'w',
-    'i',
-    't',
-    'h',
-    ' ',
-    '<',
-    '3',
-    ' ',
-    ' ',
-    ' ',
-    ' ',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '-',
-    '2',
-    '0',
-    '2',
-    '3',
-    '\n',
-    [BLOCK_SIZE - 2] = 'O',
-    [BLOCK_SIZE - 1] = 'k',
-};
-
+#include "header/stdlib/string.h"
+#include "header/stdlib/lz4.h"
+#include "header/driver/timer.h"
+#include "header/cpu/smp.h"
+#include "header/process/task.h"
+#include "header/cpu/lock.h"
+#include "header/process/thread.h"
+#include "header/process/wait.h"
+#include "header/text/console.h"
+#include "header/stdlib/div64.h"
+#include "header/cpu/cpu.h"
+#include "header/memory/buddy.h"
+#include "header/memory/paging.h"
 
 struct EXT2Superblock sblock = {}; 
-struct BlockBuffer block_buffer = {}; 
+struct EXT2Geometry ext2_geometry = {};
+struct EXT2BlockBuffer block_buffer = {}; 
+struct EXT2BlockBuffer indirect_buffer[3] = {}; // one per indirect depth, the kernel stack is too small for 4 KiB locals
+struct EXT2BlockBuffer dir_table_buf = {};
+struct EXT2BlockBuffer defrag_bitmap = {};
 struct EXT2BlockGroupDescriptorTable bgd_table = {};
-struct EXT2INodeTable inode_table_buf = {};
+struct RWLock ext2_metadata_lock = RWLOCK_INIT("ext2 metadata"); // free counts in bgd_table and sblock
+struct EXT2FreeBatch free_batch = {};
+struct WaitQueue ext2_nodes_queue = WAIT_QUEUE_INIT("ext2 nodes"); // lock protects ext2_nodes_busy and ext2_nodes_seq
+bool ext2_nodes_busy = false;
+uint32_t ext2_nodes_seq = 0; // releases of the node lock, tells the defragmenter whether anyone else held it
+uint32_t defrag_old[DEFRAG_MAX_BLOCKS] = {};
+uint32_t defrag_new[DEFRAG_MAX_BLOCKS] = {};
+uint8_t defrag_buffer[DEFRAG_CHUNK_SIZE] = {};
+uint32_t node_locations[EXT2_MAX_FILE_BLOCKS + EXT2_MAX_FILE_BLOCKS / 64u] = {};
+uint8_t compress_buffer[EXT2_COMPRESS_BUFFER_SIZE] = {};
+struct EXT2BlockBuffer mkfs_buffer[SMP_MAX_CPUS] = {}; // init_block_group() runs on every processor at once
 
 /* REGULAR FUNCTION */
 
@@ -110,12 +51,7 @@ struct EXT2DirectoryEntry *get_next_directory_entry(struct EXT2DirectoryEntry *e
 uint16_t get_entry_record_len(uint8_t name_len)
 {
     uint16_t len = sizeof(struct EXT2DirectoryEntry) + name_len + 1;
-
-    uint32_t cmp = len / 4; 
-    if (len % 4 == 0){
-        return cmp;
-    }
-    return cmp + 1;
+    return (len + 3u) & ~3u;
 }
 
 uint32_t get_dir_first_child_offset(void *ptr)
@@ -128,67 +64,407 @@ uint32_t get_dir_first_child_offset(void *ptr)
     return offset; 
 }
 
-/* ========================== MAIN FUNCTION ========================= */
-
-uint32_t inode_to_bgd(uint32_t inode){
-    return (inode - 1) / INODES_PER_GROUP;
-}
-
-uint32_t inode_to_local(uint32_t inode){
-    return (inode - 1) % INODES_PER_GROUP;
-}
-
-void init_directory_table(struct EXT2INode *node, uint32_t inode, uint32_t parent_inode){
-    struct BlockBuffer block;
+void build_directory_table(void *ptr, uint32_t inode, uint32_t parent_inode)
+{
+    memset(ptr, 0, ext2_geometry.block_size);
 
-    struct EXT2DirectoryEntry *table = get_directory_entry(&block, 0); // .
+    struct EXT2DirectoryEntry *table = get_directory_entry(ptr, 0); // .
     table->inode = inode;
     table->file_type = EXT2_FT_DIR;
     table->name_len = 1;
-    memcpy(get_entry_name(table), ".", 2); // !remindme to include header for memcpy
-    table->rec_len = get_entry_record_len(table->name_len); // to add "padding" to the dynamic name size to mod4 for optimization
-  
-    struct EXT2DirectoryEntry *parent_table = get_next_directory_entry(table); // ..
+    memcpy(get_entry_name(table), ".", 2);
+    table->rec_len = get_entry_record_len(table->name_len);
+
+    // .. owns the rest of the block, entries may never stop short of the block end
+    struct EXT2DirectoryEntry *parent_table = get_next_directory_entry(table);
     parent_table->inode = parent_inode;
     parent_table->file_type = EXT2_FT_DIR;
     parent_table->name_len = 2;
     memcpy(get_entry_name(parent_table), "..", 3);
-    parent_table->rec_len = get_entry_record_len(parent_table->name_len); 
-  
-    struct EXT2DirectoryEntry *first_file = get_next_directory_entry(parent_table); // initialize inode for first file
-    first_file->inode = 0;
+    parent_table->rec_len = ext2_geometry.block_size - table->rec_len;
+}
+
+bool insert_directory_entry(void *ptr, uint32_t inode, char *name, uint8_t name_len, uint8_t file_type)
+{
+    uint16_t needed = get_entry_record_len(name_len);
+    uint32_t offset = 0;
+    while (offset < ext2_geometry.block_size)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(ptr, offset);
+        if (entry->rec_len == 0)
+        {
+            return false; // corrupted block
+        }
+
+        uint16_t used = entry->inode == 0 ? 0 : get_entry_record_len(entry->name_len);
+        if (entry->rec_len >= used + needed)
+        {
+            struct EXT2DirectoryEntry *new_entry = entry;
+            if (used > 0)
+            {
+                new_entry = get_directory_entry(ptr, offset + used);
+                new_entry->rec_len = entry->rec_len - used;
+                entry->rec_len = used;
+            }
+            new_entry->inode = inode;
+            new_entry->name_len = name_len;
+            new_entry->file_type = file_type;
+            memcpy(get_entry_name(new_entry), name, name_len);
+            get_entry_name(new_entry)[name_len] = '\0';
+            return true;
+        }
+        offset += entry->rec_len;
+    }
+    return false;
+}
+
+/* ========================== MAIN FUNCTION ========================= */
+
+uint32_t inode_to_bgd(uint32_t inode){
+    return (inode - 1) / sblock.inodes_per_group;
+}
+
+uint32_t inode_to_local(uint32_t inode){
+    return (inode - 1) % sblock.inodes_per_group;
+}
+
+bool init_directory_table(struct EXT2INode *node, uint32_t inode, uint32_t parent_inode){
+    build_directory_table(&dir_table_buf, inode, parent_inode);
+    if (!allocate_node_blocks(&dir_table_buf, node, 1, inode_to_bgd(inode)))
+    {
+      return false;
+    }
   
-    node->mode = EXT2_S_IFDIR; // this is a directory
-    node->size_low = 0;
+    node->mode = EXT2_S_IFDIR | EXT2_DIR_PERMISSION; // this is a directory
+    node->size_low = ext2_geometry.block_size;
     node->size_high = 0;
+    node->links_count = 2; // its parent entry and its own "."
   
-    // get_timestamp(); implement after shell?
-    // node->mtime = node->ctime = node->atime = get_timestamp();
-    // node->dtime = 0;
-  
-    node->blocks = 1;
-    allocate_node_blocks(&block, node, inode_to_bgd(inode));
-  
+    node->mtime = node->ctime = node->atime = clock_realtime();
+    node->dtime = 0;
     sync_node(node, inode);
+
+    uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+    bgd_table.table[inode_to_bgd(inode)].used_dirs_count++;
+    write_unlock_irqrestore(&ext2_metadata_lock, flags);
+    sync_bgd_table();
+    return true;
+}
+
+bool read_fs_blocks(void *ptr, uint32_t block, uint32_t count){
+  uint8_t *buf = (uint8_t *)ptr;
+  uint32_t sector = block * ext2_geometry.sectors_per_block;
+  uint32_t sectors = count * ext2_geometry.sectors_per_block;
+
+  // read_blocks() takes an 8 bit sector count
+  while (sectors > 0)
+  {
+    uint32_t chunk = sectors < 128 ? sectors : 128;
+    if (!read_blocks(buf, sector, chunk))
+    {
+      return false;
+    }
+    buf += chunk * BLOCK_SIZE;
+    sector += chunk;
+    sectors -= chunk;
+  }
+  return true;
+}
+
+bool write_fs_blocks(const void *ptr, uint32_t block, uint32_t count){
+  const uint8_t *buf = (const uint8_t *)ptr;
+  uint32_t sector = block * ext2_geometry.sectors_per_block;
+  uint32_t sectors = count * ext2_geometry.sectors_per_block;
+
+  while (sectors > 0)
+  {
+    uint32_t chunk = sectors < 128 ? sectors : 128;
+    if (!write_blocks(buf, sector, chunk))
+    {
+      return false;
+    }
+    buf += chunk * BLOCK_SIZE;
+    sector += chunk;
+    sectors -= chunk;
+  }
+  return true;
+}
+
+bool load_geometry(void){
+  if (sblock.magic != EXT2_SUPER_MAGIC || sblock.log_block_size > 2 ||
+      sblock.blocks_per_group == 0 || sblock.inodes_per_group == 0)
+  {
+    return false;
+  }
+
+  struct EXT2Geometry *geo = &ext2_geometry;
+  geo->block_size = 1024u << sblock.log_block_size;
+  geo->sectors_per_block = geo->block_size / BLOCK_SIZE;
+  geo->pointers_per_block = geo->block_size / sizeof(uint32_t);
+  geo->groups_count = (sblock.blocks_count - sblock.first_data_block + sblock.blocks_per_group - 1) / sblock.blocks_per_group;
+  geo->bgd_blocks = (geo->groups_count * sizeof(struct EXT2BlockGroupDescriptor) + geo->block_size - 1) / geo->block_size;
+
+  if (sblock.rev_level == EXT2_GOOD_OLD_REV)
+  {
+    geo->inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+    geo->first_ino = EXT2_GOOD_OLD_FIRST_INO;
+  }
+  else
+  {
+    // unknown incompat features change the on-disk format, unknown ro_compat ones only forbid writes,
+    // and this driver always writes
+    if ((sblock.feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPP) ||
+        (sblock.feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPP))
+    {
+      return false;
+    }
+    geo->inode_size = sblock.inode_size;
+    geo->first_ino = sblock.first_ino;
+  }
+
+  if (geo->inode_size < sizeof(struct EXT2INode) || geo->inode_size > geo->block_size ||
+      (geo->inode_size & (geo->inode_size - 1)) != 0)
+  {
+    return false;
+  }
+  geo->inodes_per_block = geo->block_size / geo->inode_size;
+
+  // bitmaps are a single block, and the whole bgd table is cached in bgd_table
+  return geo->groups_count <= EXT2_MAX_GROUPS &&
+         sblock.blocks_per_group <= geo->block_size * 8 &&
+         sblock.inodes_per_group <= geo->block_size * 8;
+}
+
+void sync_bgd_table(void){
+  uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+  uint32_t free_blocks = 0;
+  uint32_t free_inodes = 0;
+  for (uint32_t i = 0; i < ext2_geometry.groups_count; i++)
+  {
+    free_blocks += bgd_table.table[i].free_blocks_count;
+    free_inodes += bgd_table.table[i].free_inodes_count;
+  }
+  sblock.free_blocks_count = free_blocks;
+  sblock.free_inodes_count = free_inodes;
+  sblock.wtime = clock_realtime();
+  write_unlock_irqrestore(&ext2_metadata_lock, flags);
+
+  // backup copies in the other groups are only written by create_ext2(), like Linux does
+  write_fs_blocks(&bgd_table, sblock.first_data_block + 1, ext2_geometry.bgd_blocks);
+  write_blocks(&sblock, EXT2_SUPERBLOCK_SECTOR, EXT2_SUPERBLOCK_SECTORS);
+}
+
+bool group_has_super(uint32_t bgd){
+  if (bgd <= 1 || !(sblock.feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER))
+  {
+    return true;
+  }
+  if (bgd % 2 == 0)
+  {
+    return false;
+  }
+  for (uint32_t base = 3; base <= 7; base += 2)
+  {
+    uint32_t power = base;
+    while (power < bgd)
+    {
+      power *= base;
+    }
+    if (power == bgd)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t group_block_count(uint32_t bgd){
+  if (bgd + 1 < ext2_geometry.groups_count)
+  {
+    return sblock.blocks_per_group;
+  }
+  return sblock.blocks_count - sblock.first_data_block - bgd * sblock.blocks_per_group;
+}
+
+void init_block_group(uint32_t bgd){
+  struct EXT2BlockGroupDescriptor *desc = &bgd_table.table[bgd];
+  uint32_t block_size = ext2_geometry.block_size;
+  uint32_t first = sblock.first_data_block + bgd * sblock.blocks_per_group;
+  uint32_t blocks = group_block_count(bgd);
+  uint32_t table_blocks = sblock.inodes_per_group / ext2_geometry.inodes_per_block;
+  uint32_t overhead = group_has_super(bgd) ? 1 + ext2_geometry.bgd_blocks : 0;
+  struct EXT2BlockBuffer *buffer = &mkfs_buffer[cpu_local()->index];
+
+  desc->block_bitmap = first + overhead;
+  desc->inode_bitmap = first + overhead + 1;
+  desc->inode_table = first + overhead + 2;
+  overhead += 2 + table_blocks;
+  desc->free_blocks_count = blocks - overhead;
+  desc->free_inodes_count = sblock.inodes_per_group;
+  desc->used_dirs_count = 0;
+
+  // metadata at the group start is in use, bits past the end of the group are set so they are never handed out
+  memset(buffer, 0, block_size);
+  set_bitmap_range(buffer, 0, overhead);
+  set_bitmap_range(buffer, blocks, block_size * 8 - blocks);
+  write_fs_blocks(buffer, desc->block_bitmap, 1);
+
+  memset(buffer, 0, block_size);
+  if (bgd == 0)
+  {
+    // reserved inodes, 2 becomes the root directory
+    set_bitmap_range(buffer, 0, ext2_geometry.first_ino - 1);
+    desc->free_inodes_count -= ext2_geometry.first_ino - 1;
+  }
+  set_bitmap_range(buffer, sblock.inodes_per_group, block_size * 8 - sblock.inodes_per_group);
+  write_fs_blocks(buffer, desc->inode_bitmap, 1);
+
+  memset(buffer, 0, block_size);
+  for (uint32_t i = 0; i < table_blocks; i++)
+  {
+    write_fs_blocks(buffer, desc->inode_table + i, 1);
+  }
+}
+
+void ext2_usage(uint32_t *free_blocks, uint32_t *free_inodes){
+  uint32_t flags = read_lock_irqsave(&ext2_metadata_lock);
+  *free_blocks = sblock.free_blocks_count;
+  *free_inodes = sblock.free_inodes_count;
+  read_unlock_irqrestore(&ext2_metadata_lock, flags);
 }
 
 bool is_empty_storage(void){
-    read_blocks(&block_buffer, BOOT_SECTOR, 1);
-    return memcmp(&block_buffer, fs_signature, BLOCK_SIZE);
+  // a superblock that cannot be read is no reason to format over it
+  if (!read_blocks(&block_buffer, EXT2_SUPERBLOCK_SECTOR, EXT2_SUPERBLOCK_SECTORS))
+  {
+    return false;
+  }
+  return ((struct EXT2Superblock *)&block_buffer)->magic != EXT2_SUPER_MAGIC;
+}
+
+static void init_block_group_task(uint32_t bgd, void *arg){
+  (void)arg;
+  init_block_group(bgd);
 }
 
-void create_ext2(void);
+void create_ext2(void){
+  uint32_t block_size = 1024u << EXT2_MKFS_LOG_BLOCK_SIZE;
+
+  memset(&sblock, 0, sizeof(sblock));
+  sblock.blocks_count = DISK_SPACE / block_size;
+  sblock.first_data_block = block_size == 1024 ? 1 : 0; // block 0 holds the boot sector, and the superblock too when blocks are larger
+  sblock.log_block_size = EXT2_MKFS_LOG_BLOCK_SIZE;
+  sblock.log_frag_size = EXT2_MKFS_LOG_BLOCK_SIZE;
+  sblock.blocks_per_group = block_size * 8;
+  sblock.frags_per_group = block_size * 8;
+  sblock.magic = EXT2_SUPER_MAGIC;
+  sblock.state = EXT2_VALID_FS;
+  sblock.errors = EXT2_ERRORS_CONTINUE;
+  sblock.max_mnt_count = 0xFFFF; // no forced fsck
+  sblock.lastcheck = clock_realtime();
+  sblock.creator_os = EXT2_OS_LINUX;
+  sblock.rev_level = EXT2_DYNAMIC_REV;
+  sblock.first_ino = EXT2_GOOD_OLD_FIRST_INO;
+  sblock.inode_size = sizeof(struct EXT2INode);
+  sblock.feature_incompat = EXT2_FEATURE_INCOMPAT_FILETYPE;
+  sblock.feature_ro_compat = EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER;
+  memcpy(sblock.volume_name, "IF2230", 7);
+
+  // inodes per group must fill whole inode table blocks
+  uint32_t groups = (sblock.blocks_count - sblock.first_data_block + sblock.blocks_per_group - 1) / sblock.blocks_per_group;
+  uint32_t inodes_per_block = block_size / sizeof(struct EXT2INode);
+  uint32_t inodes_per_group = (DISK_SPACE / EXT2_MKFS_INODE_RATIO + groups - 1) / groups;
+  inodes_per_group = (inodes_per_group + inodes_per_block - 1) / inodes_per_block * inodes_per_block;
+  if (inodes_per_group > block_size * 8)
+  {
+    inodes_per_group = block_size * 8;
+  }
+  sblock.inodes_per_group = inodes_per_group;
+  sblock.inodes_count = inodes_per_group * groups;
+
+  load_geometry();
+  memset(&bgd_table, 0, sizeof(bgd_table));
+  parallel_for(0, groups, 1, init_block_group_task, NULL);
+  sync_bgd_table();
+
+  // a fresh filesystem always has room for the two directory tables
+  struct EXT2INode node;
+  memset(&node, 0, sizeof(node));
+  init_directory_table(&node, EXT2_ROOT_INO, EXT2_ROOT_INO);
+
+  // lost+found is the first non reserved inode, e2fsck reconnects orphans into it
+  struct EXT2INode lost_found;
+  memset(&lost_found, 0, sizeof(lost_found));
+  uint32_t lost_found_inode = allocate_node();
+  if (lost_found_inode != 0 && init_directory_table(&lost_found, lost_found_inode, EXT2_ROOT_INO))
+  {
+    read_fs_blocks(&dir_table_buf, node.block[0], 1);
+    insert_directory_entry(&dir_table_buf, lost_found_inode, "lost+found", 10, EXT2_FT_DIR);
+    write_fs_blocks(&dir_table_buf, node.block[0], 1);
+    node.links_count++; // ".." of lost+found
+    sync_node(&node, EXT2_ROOT_INO);
+  }
+
+  // superblock and bgd table backups
+  for (uint32_t i = 1; i < groups; i++)
+  {
+    if (!group_has_super(i))
+    {
+      continue;
+    }
+    uint32_t first = sblock.first_data_block + i * sblock.blocks_per_group;
+    sblock.block_group_nr = i;
+    write_blocks(&sblock, first * ext2_geometry.sectors_per_block, EXT2_SUPERBLOCK_SECTORS);
+    write_fs_blocks(&bgd_table, first + 1, ext2_geometry.bgd_blocks);
+  }
+  sblock.block_group_nr = 0;
+}
 
-void initialize_filesystem_ext2(void){
+bool initialize_filesystem_ext2(void){
     if (is_empty_storage())
     {
       create_ext2();
+      return true;
     }
-    else
+
+    if (!read_blocks(&sblock, EXT2_SUPERBLOCK_SECTOR, EXT2_SUPERBLOCK_SECTORS) || !load_geometry())
+    {
+      return false;
+    }
+    return read_fs_blocks(&bgd_table, sblock.first_data_block + 1, ext2_geometry.bgd_blocks);
+}
+
+static bool ext2_nodes_free(void *arg){
+  (void)arg;
+  return !ext2_nodes_busy;
+}
+
+void ext2_lock_nodes(void){
+  bool sleep = thread_can_block();
+  uint32_t flags = spin_lock_irqsave(&ext2_nodes_queue.lock);
+  if (sleep)
+  {
+    wait_event_locked(&ext2_nodes_queue, ext2_nodes_free, NULL);
+  }
+  else
+  {
+    while (ext2_nodes_busy)
     {
-      read_blocks(&sblock, 1, 1);
-      read_blocks(&bgd_table, 2, 1);
+      spin_unlock_irqrestore(&ext2_nodes_queue.lock, flags);
+      __asm__ volatile("pause");
+      flags = spin_lock_irqsave(&ext2_nodes_queue.lock);
     }
+  }
+  ext2_nodes_busy = true;
+  spin_unlock_irqrestore(&ext2_nodes_queue.lock, flags);
+}
+
+void ext2_unlock_nodes(void){
+  uint32_t flags = spin_lock_irqsave(&ext2_nodes_queue.lock);
+  ext2_nodes_busy = false;
+  ext2_nodes_seq++;
+  spin_unlock_irqrestore(&ext2_nodes_queue.lock, flags);
+  wake_up(&ext2_nodes_queue);
 }
 
 /* =============================== CRUD FUNC ======================================== */
@@ -205,12 +481,70 @@ int8_t delete_entry(struct EXT2DriverRequest request);
 
 // int8_t move_dir(struct EXT2DriverRequest request_src, struct EXT2DriverRequest dst_request);
 
+bool write_node_data(struct EXT2INode *node, void *buf, uint32_t size, uint32_t preferred_bgd){
+  uint32_t block_size = ext2_geometry.block_size;
+  uint32_t blocks = (size + block_size - 1) / block_size;
+  uint32_t flags = node->flags;
+  void *data = buf;
+
+  // revision 0 has no feature flags to keep other drivers from reading frames as file data
+  if ((flags & EXT2_LZ4_FL) && sblock.rev_level == EXT2_GOOD_OLD_REV)
+  {
+    flags &= ~EXT2_LZ4_FL;
+  }
+  if (flags & EXT2_LZ4_FL)
+  {
+    uint32_t compressed = compress_node_data(buf, size, compress_buffer);
+    if (compressed > 0)
+    {
+      data = compress_buffer;
+      blocks = (compressed + block_size - 1) / block_size;
+    }
+    else
+    {
+      flags &= ~EXT2_LZ4_FL; // incompressible, stored as is
+    }
+  }
+
+  if (!allocate_node_blocks(data, node, blocks, preferred_bgd))
+  {
+    return false;
+  }
+  node->size_low = size;
+  node->flags = flags;
+  node->mtime = node->ctime = clock_realtime();
+
+  if ((flags & EXT2_LZ4_FL) && !(sblock.feature_incompat & EXT2_FEATURE_INCOMPAT_LZ4_FRAMES))
+  {
+    uint32_t lock_flags = write_lock_irqsave(&ext2_metadata_lock);
+    sblock.feature_incompat |= EXT2_FEATURE_INCOMPAT_LZ4_FRAMES;
+    write_unlock_irqrestore(&ext2_metadata_lock, lock_flags);
+    sync_bgd_table();
+  }
+  return true;
+}
+
+bool read_node_data(struct EXT2INode *node, void *buf){
+  if (!(node->flags & EXT2_LZ4_FL))
+  {
+    load_inode_blocks(buf, node->block, node->size_low);
+    return true;
+  }
+
+  uint32_t compressed = data_block_count(node->blocks / ext2_geometry.sectors_per_block) * ext2_geometry.block_size;
+  if (compressed > EXT2_COMPRESS_BUFFER_SIZE)
+  {
+    return false;
+  }
+  load_inode_blocks(compress_buffer, node->block, compressed);
+  return decompress_node_data(compress_buffer, compressed, buf, node->size_low);
+}
+
 /* =============================== MEMORY ==========================================*/
 
-// assume node always available
 uint32_t allocate_node(void){
-  uint32_t bgd = -1;
-  for (uint32_t i = 0; i < GROUPS_COUNT; i++) //find first bgd with free inode
+  uint32_t bgd = ext2_geometry.groups_count;
+  for (uint32_t i = 0; i < ext2_geometry.groups_count; i++) //find first bgd with free inode
   {
     if (bgd_table.table[i].free_inodes_count > 0)
     {
@@ -218,63 +552,1212 @@ uint32_t allocate_node(void){
       break;
     }
   }
+  if (bgd == ext2_geometry.groups_count)
+  {
+    return 0;
+  }
 
-  // search free node
-  read_blocks(&block_buffer, bgd_table.table[bgd].inode_bitmap, 1);
-  uint32_t inode = bgd * INODES_PER_GROUP + 1;
-  uint32_t location = 0;
-  for (uint32_t i = 0; i < INODES_PER_GROUP; i++)
+  // search free node, a bitmap that disagrees with free_inodes_count is left alone
+  read_fs_blocks(&block_buffer, bgd_table.table[bgd].inode_bitmap, 1);
+  uint32_t location = sblock.inodes_per_group;
+  for (uint32_t i = 0; i < sblock.inodes_per_group; i++)
   {
-    uint8_t byte = block_buffer.buf[i / 8]; //byte & offset logic unexplored
-    uint8_t offset = 7 - i % 8;
-    if (!((byte >> offset) & 1u))
+    if (!is_bitmap_set(&block_buffer, i))
     {
       location = i;
-      // set flag of the inode
-      block_buffer.buf[i / 8] |= 1u << offset;
       break;
     }
   }
+  if (location == sblock.inodes_per_group)
+  {
+    return 0;
+  }
   // update inode_bitmap, mark inode as 1 (used)
-  write_blocks(&block_buffer, bgd_table.table[bgd].inode_bitmap, 1); 
+  set_bitmap_range(&block_buffer, location, 1);
+  write_fs_blocks(&block_buffer, bgd_table.table[bgd].inode_bitmap, 1); 
 
-  inode += location;
+  uint32_t inode = bgd * sblock.inodes_per_group + 1 + location;
 
+  uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
   bgd_table.table[bgd].free_inodes_count--;
+  write_unlock_irqrestore(&ext2_metadata_lock, flags);
 
-  write_blocks(&bgd_table, 2, 1);
+  sync_bgd_table();
 
   return inode;
 }
 
-void deallocate_node(uint32_t inode);
+static void queue_node_free(uint32_t inode, uint16_t mode){
+  if (free_batch.inode_count == FREE_BATCH_CAPACITY)
+  {
+    flush_free_batch();
+  }
+  free_batch.inodes[free_batch.inode_count++] = inode;
+  if ((mode & EXT2_S_IFMT) == EXT2_S_IFDIR)
+  {
+    free_batch.dirs_freed[inode_to_bgd(inode)]++;
+  }
+}
 
-void deallocate_blocks(void *loc, uint32_t blocks);
+void deallocate_node(uint32_t inode){
+  struct EXT2INode node;
+  ext2_lock_nodes();
+  load_node(&node, inode);
 
-uint32_t deallocate_block(uint32_t *locations, uint32_t blocks, struct BlockBuffer *bitmap, uint32_t depth, uint32_t *last_bgd, bool bgd_loaded);
+  free_batch_begin();
+  if (node.blocks > 0) // fast symlinks keep their target in block[]
+  {
+    deallocate_blocks(node.block);
+  }
 
-void allocate_node_blocks(void *ptr, struct EXT2INode *node, uint32_t preferred_bgd);
+  // e2fsck takes any non zero dtime as deleted, keep it non zero if the RTC reads the epoch
+  node.links_count = 0;
+  node.dtime = clock_realtime();
+  if (node.dtime == 0)
+  {
+    node.dtime = 1;
+  }
+  sync_node(&node, inode);
 
-void sync_node(struct EXT2INode *node, uint32_t inode);
+  queue_node_free(inode, node.mode);
+  free_batch_end();
+  ext2_unlock_nodes();
+}
 
-/* ============================== UTILS ================================================ */
+uint32_t ext2_create_node(uint16_t mode, uint32_t flags, void *buf, uint32_t size){
+  ext2_lock_nodes();
+  uint32_t inode = allocate_node();
+  if (inode == 0)
+  {
+    ext2_unlock_nodes();
+    return 0;
+  }
 
-uint32_t map_node_blocks(void *ptr, uint32_t blocks, uint32_t *locations, uint32_t *mapped_count, uint8_t depth);
+  struct EXT2INode node;
+  memset(&node, 0, sizeof(node));
+  node.mode = mode;
+  node.flags = flags;
+  node.links_count = 1;
+  if (!write_node_data(&node, buf, size, inode_to_bgd(inode)))
+  {
+    free_batch_begin();
+    queue_node_free(inode, mode);
+    free_batch_end();
+    ext2_unlock_nodes();
+    return 0;
+  }
+  node.atime = node.mtime;
+  sync_node(&node, inode);
+  ext2_unlock_nodes();
+  return inode;
+}
 
-void search_blocks(uint32_t preferred_bgd, uint32_t *locations, uint32_t blocks, uint32_t *found_count);
+bool ext2_read_node(uint32_t inode, void *buf, uint32_t capacity, uint32_t *size){
+  struct EXT2INode node;
+  ext2_lock_nodes();
+  load_node(&node, inode);
+  bool ok = node.size_low <= capacity && read_node_data(&node, buf);
+  ext2_unlock_nodes();
+  *size = node.size_low;
+  return ok;
+}
+
+void deallocate_blocks(void *loc){
+  uint32_t *locations = (uint32_t *)loc;
 
-void search_blocks_in_bgd(uint32_t bgd, uint32_t *locations, uint32_t blocks, uint32_t *found_count);
+  // node->blocks also counts indirect blocks and sparse files have holes, it says nothing about which direct entries are used
+  free_batch_begin();
+  deallocate_block(locations, 12, 0);
+  for (uint32_t depth = 1; depth <= 3; depth++) // 13th, 14th and 15th entry: single, double, triple indirect
+  {
+    deallocate_block(&locations[11 + depth], 1, depth);
+  }
+  free_batch_end();
+}
 
-void load_inode_blocks(void *ptr, void *_block, uint32_t size);
+void deallocate_block(uint32_t *locations, uint32_t blocks, uint32_t depth){
+  for (uint32_t i = 0; i < blocks; i++)
+  {
+    if (locations[i] == 0)
+    {
+      continue;
+    }
 
-uint32_t load_blocks_rec(void *ptr, uint32_t block, uint32_t block_size, uint32_t size, uint8_t depth);
+    if (depth > 0)
+    {
+      // children first, the indirect block itself is freed after its table is walked
+      struct EXT2BlockBuffer *indirect = &indirect_buffer[depth - 1];
+      read_fs_blocks(indirect, locations[i], 1);
+      deallocate_block((uint32_t *)indirect->buf, ext2_geometry.pointers_per_block, depth - 1);
+    }
 
-bool is_same_dir_entry(struct EXT2DirectoryEntry *entry, struct EXT2DriverRequest request, bool is_file);
+    if (free_batch.block_count == FREE_BATCH_CAPACITY)
+    {
+      flush_free_batch();
+    }
+    free_batch.blocks[free_batch.block_count++] = locations[i];
+  }
+}
+
+void free_batch_begin(void){
+  free_batch.depth++;
+}
+
+void free_batch_end(void){
+  if (--free_batch.depth == 0)
+  {
+    flush_free_batch();
+  }
+}
+
+void flush_free_batch(void){
+  if (free_batch.block_count == 0 && free_batch.inode_count == 0)
+  {
+    return;
+  }
+
+  // blocks come out of the tree walk mostly in allocation order, so insertion sort is close to linear here
+  sort_locations(free_batch.blocks, free_batch.block_count);
+  sort_locations(free_batch.inodes, free_batch.inode_count);
+
+  uint32_t i = 0;
+  while (i < free_batch.block_count)
+  {
+    uint32_t bgd = block_to_bgd(free_batch.blocks[i]);
+    uint32_t freed = 0;
+    read_fs_blocks(&block_buffer, bgd_table.table[bgd].block_bitmap, 1);
+    while (i < free_batch.block_count && block_to_bgd(free_batch.blocks[i]) == bgd)
+    {
+      // coalesce consecutive block numbers into a single bit-range clear
+      uint32_t start = i;
+      while (i + 1 < free_batch.block_count && free_batch.blocks[i + 1] == free_batch.blocks[i] + 1 &&
+             block_to_bgd(free_batch.blocks[i + 1]) == bgd)
+      {
+        i++;
+      }
+      i++;
+      clear_bitmap_range(&block_buffer, block_to_local(free_batch.blocks[start]), i - start);
+      freed += i - start;
+    }
+    write_fs_blocks(&block_buffer, bgd_table.table[bgd].block_bitmap, 1);
+    free_batch.bitmap_writes++;
+    uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+    bgd_table.table[bgd].free_blocks_count += freed;
+    write_unlock_irqrestore(&ext2_metadata_lock, flags);
+  }
+
+  i = 0;
+  while (i < free_batch.inode_count)
+  {
+    uint32_t bgd = inode_to_bgd(free_batch.inodes[i]);
+    uint32_t freed = 0;
+    read_fs_blocks(&block_buffer, bgd_table.table[bgd].inode_bitmap, 1);
+    while (i < free_batch.inode_count && inode_to_bgd(free_batch.inodes[i]) == bgd)
+    {
+      clear_bitmap_range(&block_buffer, inode_to_local(free_batch.inodes[i]), 1);
+      freed++;
+      i++;
+    }
+    write_fs_blocks(&block_buffer, bgd_table.table[bgd].inode_bitmap, 1);
+    free_batch.bitmap_writes++;
+    uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+    bgd_table.table[bgd].free_inodes_count += freed;
+    write_unlock_irqrestore(&ext2_metadata_lock, flags);
+  }
+
+  uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+  for (uint32_t bgd = 0; bgd < ext2_geometry.groups_count; bgd++)
+  {
+    bgd_table.table[bgd].used_dirs_count -= free_batch.dirs_freed[bgd];
+    free_batch.dirs_freed[bgd] = 0;
+  }
+  write_unlock_irqrestore(&ext2_metadata_lock, flags);
+
+  // one bgd table write for the whole batch instead of one per freed block
+  sync_bgd_table();
+
+  free_batch.block_count = 0;
+  free_batch.inode_count = 0;
+  free_batch.flushes++;
+}
+
+bool allocate_node_blocks(void *ptr, struct EXT2INode *node, uint32_t data_blocks, uint32_t preferred_bgd){
+  if (data_blocks > EXT2_MAX_FILE_BLOCKS)
+  {
+    return false;
+  }
+  uint32_t total = data_blocks + indirect_block_count(data_blocks);
 
+  uint32_t found = 0;
+  search_blocks(preferred_bgd, node_locations, total, &found);
+  if (found < total)
+  {
+    return false;
+  }
+  mark_blocks_used(node_locations, found);
+
+  // data takes the front of the found blocks and the indirect tables the tail,
+  // so a file that fit in one free run is a single extent of data
+  uint32_t data_count = 0;
+  uint32_t meta_count = 0;
+  for (uint32_t i = 0; i < 12 && data_count < data_blocks; i++)
+  {
+    node->block[i] = map_node_blocks(node_locations, data_blocks, &data_count, &meta_count, 0);
+  }
+  for (uint32_t depth = 1; depth <= 3; depth++)
+  {
+    node->block[11 + depth] = data_count < data_blocks
+      ? map_node_blocks(node_locations, data_blocks, &data_count, &meta_count, depth)
+      : 0;
+  }
+
+  // data blocks that are consecutive on disk go out in a single command
+  uint8_t *data = (uint8_t *)ptr;
+  uint32_t i = 0;
+  while (i < data_blocks)
+  {
+    uint32_t run = 1;
+    while (i + run < data_blocks && node_locations[i + run] == node_locations[i] + run)
+    {
+      run++;
+    }
+    write_fs_blocks(data + i * ext2_geometry.block_size, node_locations[i], run);
+    i += run;
+  }
+
+  node->blocks = total * ext2_geometry.sectors_per_block;
+  return true;
+}
+
+void load_node(struct EXT2INode *node, uint32_t inode){
+  uint32_t bgd = inode_to_bgd(inode);
+  uint32_t offset = inode_to_local(inode) * ext2_geometry.inode_size;
+  // inode_size is a power of two, so a record never straddles a sector and only that sector is read
+  uint32_t sector = bgd_table.table[bgd].inode_table * ext2_geometry.sectors_per_block + offset / BLOCK_SIZE;
+  read_blocks(&block_buffer, sector, 1);
+  memcpy(node, block_buffer.buf + offset % BLOCK_SIZE, sizeof(struct EXT2INode));
+}
 
+void sync_node(struct EXT2INode *node, uint32_t inode){
+  uint32_t bgd = inode_to_bgd(inode);
+  uint32_t offset = inode_to_local(inode) * ext2_geometry.inode_size;
+  uint32_t sector = bgd_table.table[bgd].inode_table * ext2_geometry.sectors_per_block + offset / BLOCK_SIZE;
+  // records larger than struct EXT2INode keep their extra bytes
+  read_blocks(&block_buffer, sector, 1);
+  memcpy(block_buffer.buf + offset % BLOCK_SIZE, node, sizeof(struct EXT2INode));
+  write_blocks(&block_buffer, sector, 1);
+}
+
+/* ============================== UTILS ================================================ */
 
+uint32_t map_node_blocks(uint32_t *locations, uint32_t blocks, uint32_t *data_count, uint32_t *meta_count, uint8_t depth){
+  if (depth == 0)
+  {
+    return locations[(*data_count)++];
+  }
 
+  uint32_t block = locations[blocks + (*meta_count)++];
+  struct EXT2BlockBuffer *table = &indirect_buffer[depth - 1];
+  uint32_t *entries = (uint32_t *)table->buf;
+  memset(table, 0, ext2_geometry.block_size);
+  for (uint32_t i = 0; i < ext2_geometry.pointers_per_block && *data_count < blocks; i++)
+  {
+    entries[i] = map_node_blocks(locations, blocks, data_count, meta_count, depth - 1);
+  }
+  write_fs_blocks(table, block, 1);
+  return block;
+}
 
+void search_blocks(uint32_t preferred_bgd, uint32_t *locations, uint32_t blocks, uint32_t *found_count){
+  for (uint32_t i = 0; i < ext2_geometry.groups_count && *found_count < blocks; i++)
+  {
+    search_blocks_in_bgd((preferred_bgd + i) % ext2_geometry.groups_count, locations, blocks, found_count);
+  }
+}
 
+void search_blocks_in_bgd(uint32_t bgd, uint32_t *locations, uint32_t blocks, uint32_t *found_count){
+  if (bgd_table.table[bgd].free_blocks_count == 0)
+  {
+    return;
+  }
 
+  read_fs_blocks(&block_buffer, bgd_table.table[bgd].block_bitmap, 1);
+  uint32_t needed = blocks - *found_count;
+  uint32_t first = sblock.first_data_block + bgd * sblock.blocks_per_group;
+  uint32_t group_blocks = group_block_count(bgd);
 
+  // first fit, a single free run long enough for the whole request keeps it in one extent
+  uint32_t run_start = 0;
+  uint32_t run_len = 0;
+  for (uint32_t i = 0; i < group_blocks; i++)
+  {
+    if (is_bitmap_set(&block_buffer, i))
+    {
+      run_len = 0;
+      continue;
+    }
+    if (run_len++ == 0)
+    {
+      run_start = i;
+    }
+    if (run_len == needed)
+    {
+      for (uint32_t j = 0; j < needed; j++)
+      {
+        locations[(*found_count)++] = first + run_start + j;
+      }
+      return;
+    }
+  }
+
+  // no run is long enough, take whatever is free in block order
+  for (uint32_t i = 0; i < group_blocks && *found_count < blocks; i++)
+  {
+    if (!is_bitmap_set(&block_buffer, i))
+    {
+      locations[(*found_count)++] = first + i;
+    }
+  }
+}
+
+void load_inode_blocks(void *ptr, void *_block, uint32_t size){
+  uint32_t *locations = (uint32_t *)_block;
+  uint8_t *buf = (uint8_t *)ptr;
+
+  uint32_t loaded = load_block_run(buf, locations, 12, size);
+  for (uint32_t depth = 1; depth <= 3 && loaded < size; depth++)
+  {
+    loaded += load_blocks_rec(buf + loaded, locations[11 + depth], size - loaded, depth);
+  }
+}
+
+uint32_t load_blocks_rec(void *ptr, uint32_t block, uint32_t size, uint8_t depth){
+  struct EXT2BlockBuffer *table = &indirect_buffer[depth - 1];
+  uint32_t *entries = (uint32_t *)table->buf;
+  uint32_t count = ext2_geometry.pointers_per_block;
+  read_fs_blocks(table, block, 1);
+
+  if (depth == 1)
+  {
+    return load_block_run(ptr, entries, count, size);
+  }
+
+  uint32_t loaded = 0;
+  for (uint32_t i = 0; i < count && loaded < size && entries[i] != 0; i++)
+  {
+    loaded += load_blocks_rec((uint8_t *)ptr + loaded, entries[i], size - loaded, depth - 1);
+  }
+  return loaded;
+}
+
+uint32_t load_block_run(uint8_t *ptr, uint32_t *entries, uint32_t count, uint32_t size){
+  uint32_t loaded = 0;
+  uint32_t i = 0;
+  while (i < count && loaded < size && entries[i] != 0)
+  {
+    uint32_t whole = (size - loaded) / ext2_geometry.block_size;
+    if (whole == 0)
+    {
+      // partial tail, bounce through block_buffer so ptr is not overrun
+      read_fs_blocks(&block_buffer, entries[i], 1);
+      memcpy(ptr + loaded, &block_buffer, size - loaded);
+      return size;
+    }
+
+    uint32_t run = 1;
+    while (i + run < count && run < whole && entries[i + run] == entries[i] + run)
+    {
+      run++;
+    }
+    read_fs_blocks(ptr + loaded, entries[i], run);
+    loaded += run * ext2_geometry.block_size;
+    i += run;
+  }
+  return loaded;
+}
+
+uint32_t indirect_block_count(uint32_t blocks){
+  uint32_t per_block = ext2_geometry.pointers_per_block;
+  uint32_t count = 0;
+
+  if (blocks <= 12)
+  {
+    return 0;
+  }
+  blocks -= 12;
+
+  // single indirect
+  count++;
+  if (blocks <= per_block)
+  {
+    return count;
+  }
+  blocks -= per_block;
+
+  // double indirect and its single indirect tables
+  uint32_t double_span = per_block * per_block;
+  uint32_t in_double = blocks < double_span ? blocks : double_span;
+  count += 1 + (in_double + per_block - 1) / per_block;
+  if (blocks <= double_span)
+  {
+    return count;
+  }
+  blocks -= double_span;
+
+  // triple indirect
+  return count + 1 + (blocks + double_span - 1) / double_span + (blocks + per_block - 1) / per_block;
+}
+
+uint32_t data_block_count(uint32_t total){
+  uint32_t blocks = total;
+  while (blocks > 0 && blocks + indirect_block_count(blocks) > total)
+  {
+    blocks--;
+  }
+  return blocks;
+}
+
+void mark_blocks_used(uint32_t *locations, uint32_t count){
+  // search_blocks() hands out blocks one group at a time, so each group is one segment here
+  uint32_t i = 0;
+  while (i < count)
+  {
+    uint32_t bgd = block_to_bgd(locations[i]);
+    uint32_t marked = 0;
+    read_fs_blocks(&block_buffer, bgd_table.table[bgd].block_bitmap, 1);
+    while (i < count && block_to_bgd(locations[i]) == bgd)
+    {
+      set_bitmap_range(&block_buffer, block_to_local(locations[i]), 1);
+      marked++;
+      i++;
+    }
+    write_fs_blocks(&block_buffer, bgd_table.table[bgd].block_bitmap, 1);
+    uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+    bgd_table.table[bgd].free_blocks_count -= marked;
+    write_unlock_irqrestore(&ext2_metadata_lock, flags);
+  }
+  sync_bgd_table();
+}
+
+bool is_same_dir_entry(struct EXT2DirectoryEntry *entry, struct EXT2DriverRequest request, bool is_file);
+
+uint32_t block_to_bgd(uint32_t block){
+  return (block - sblock.first_data_block) / sblock.blocks_per_group;
+}
+
+uint32_t block_to_local(uint32_t block){
+  return (block - sblock.first_data_block) % sblock.blocks_per_group;
+}
+
+bool is_bitmap_set(struct EXT2BlockBuffer *bitmap, uint32_t bit){
+  return (bitmap->buf[bit / 8] >> (bit % 8)) & 1u;
+}
+
+void set_bitmap_range(struct EXT2BlockBuffer *bitmap, uint32_t start, uint32_t count){
+  for (uint32_t i = start; i < start + count; i++)
+  {
+    bitmap->buf[i / 8] |= 1u << (i % 8);
+  }
+}
+
+void clear_bitmap_range(struct EXT2BlockBuffer *bitmap, uint32_t start, uint32_t count){
+  uint32_t end = start + count;
+
+  // leading bits up to the next byte boundary
+  while (start < end && start % 8 != 0)
+  {
+    bitmap->buf[start / 8] &= ~(1u << (start % 8));
+    start++;
+  }
+
+  // whole bytes
+  uint32_t bytes = (end - start) / 8;
+  memset(&bitmap->buf[start / 8], 0, bytes);
+  start += bytes * 8;
+
+  // trailing bits
+  while (start < end)
+  {
+    bitmap->buf[start / 8] &= ~(1u << (start % 8));
+    start++;
+  }
+}
+
+void sort_locations(uint32_t *locations, uint32_t count){
+  for (uint32_t i = 1; i < count; i++)
+  {
+    uint32_t key = locations[i];
+    uint32_t j = i;
+    while (j > 0 && locations[j - 1] > key)
+    {
+      locations[j] = locations[j - 1];
+      j--;
+    }
+    locations[j] = key;
+  }
+}
+
+
+
+
+
+
+
+
+
+
+/* ============================== DEFRAG ================================================ */
+
+bool walk_block_map(uint32_t *entries, uint32_t count, uint32_t depth, uint32_t *locations, uint32_t *index, uint32_t max, bool remap){
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (entries[i] == 0)
+    {
+      continue;
+    }
+
+    if (depth == 0)
+    {
+      if (*index == max)
+      {
+        return false;
+      }
+      if (remap)
+      {
+        entries[i] = locations[*index];
+      }
+      else
+      {
+        locations[*index] = entries[i];
+      }
+      (*index)++;
+      continue;
+    }
+
+    struct EXT2BlockBuffer *indirect = &indirect_buffer[depth - 1];
+    read_fs_blocks(indirect, entries[i], 1);
+    if (!walk_block_map((uint32_t *)indirect->buf, ext2_geometry.pointers_per_block, depth - 1, locations, index, max, remap))
+    {
+      return false;
+    }
+    if (remap)
+    {
+      // indirect blocks stay where they are, only their pointers change
+      write_fs_blocks(indirect, entries[i], 1);
+    }
+  }
+  return true;
+}
+
+bool walk_node_blocks(void *loc, uint32_t *locations, uint32_t *count, bool remap){
+  uint32_t *entries = (uint32_t *)loc;
+  *count = 0;
+  if (!walk_block_map(entries, 12, 0, locations, count, DEFRAG_MAX_BLOCKS, remap))
+  {
+    return false;
+  }
+  for (uint32_t depth = 1; depth <= 3; depth++)
+  {
+    if (!walk_block_map(&entries[11 + depth], 1, depth, locations, count, DEFRAG_MAX_BLOCKS, remap))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t count_extents(uint32_t *locations, uint32_t count){
+  uint32_t extents = count > 0 ? 1 : 0;
+  for (uint32_t i = 1; i < count; i++)
+  {
+    if (locations[i] != locations[i - 1] + 1)
+    {
+      extents++;
+    }
+  }
+  return extents;
+}
+
+bool reserve_extent(uint32_t preferred_bgd, uint32_t blocks, uint32_t *start){
+  for (uint32_t i = 0; i < ext2_geometry.groups_count; i++)
+  {
+    uint32_t bgd = (preferred_bgd + i) % ext2_geometry.groups_count;
+    if (bgd_table.table[bgd].free_blocks_count < blocks)
+    {
+      continue;
+    }
+
+    uint32_t found = 0;
+    search_blocks_in_bgd(bgd, defrag_new, blocks, &found);
+    if (found < blocks || count_extents(defrag_new, blocks) != 1)
+    {
+      continue;
+    }
+
+    // block_buffer still holds the bitmap search_blocks_in_bgd() scanned
+    set_bitmap_range(&block_buffer, block_to_local(defrag_new[0]), blocks);
+    write_fs_blocks(&block_buffer, bgd_table.table[bgd].block_bitmap, 1);
+    uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+    bgd_table.table[bgd].free_blocks_count -= blocks;
+    write_unlock_irqrestore(&ext2_metadata_lock, flags);
+    sync_bgd_table();
+
+    *start = defrag_new[0];
+    return true;
+  }
+  return false;
+}
+
+uint32_t copy_to_extent(uint32_t *locations, uint32_t count, uint32_t start, uint32_t *done, uint32_t block_budget){
+  uint32_t chunk_blocks = DEFRAG_CHUNK_SIZE / ext2_geometry.block_size;
+  uint32_t spent = 0;
+  while (*done < count && (spent == 0 || spent < block_budget))
+  {
+    // every block is read once and written once, a chunk is cut short where the budget ends
+    uint32_t chunk = count - *done < chunk_blocks ? count - *done : chunk_blocks;
+    uint32_t allowed = spent < block_budget ? (block_budget - spent) / 2 : 0;
+    if (chunk > allowed)
+    {
+      chunk = allowed > 0 ? allowed : 1;
+    }
+
+    // source runs that are already consecutive are read with a single command
+    uint32_t i = 0;
+    while (i < chunk)
+    {
+      uint32_t run = 1;
+      while (i + run < chunk && locations[*done + i + run] == locations[*done + i] + run)
+      {
+        run++;
+      }
+      read_fs_blocks(defrag_buffer + i * ext2_geometry.block_size, locations[*done + i], run);
+      i += run;
+    }
+    write_fs_blocks(defrag_buffer, start + *done, chunk);
+    *done += chunk;
+    spent += chunk * 2;
+  }
+  return spent;
+}
+
+bool defragment_node(uint32_t inode, struct EXT2DefragState *state){
+  // reserved inodes (bad blocks, resize) have block maps with their own meaning
+  if (inode < ext2_geometry.first_ino && inode != EXT2_ROOT_INO)
+  {
+    return false;
+  }
+
+  struct EXT2INode node;
+  load_node(&node, inode);
+  uint16_t format = node.mode & EXT2_S_IFMT;
+  if ((format != EXT2_S_IFREG && format != EXT2_S_IFDIR) || node.blocks == 0)
+  {
+    return false;
+  }
+
+  uint32_t count;
+  if (!walk_node_blocks(node.block, defrag_old, &count, false))
+  {
+    state->files_skipped++;
+    return false;
+  }
+
+  uint32_t extents = count_extents(defrag_old, count);
+  state->files_scanned++;
+  state->extents_before += extents;
+
+  uint32_t start;
+  if (extents < DEFRAG_MIN_EXTENTS || !reserve_extent(inode_to_bgd(inode), count, &start))
+  {
+    state->extents_after += extents;
+    return false;
+  }
+
+  state->move_inode = inode;
+  state->move_start = start;
+  state->move_count = count;
+  state->move_done = 0;
+  state->move_seq = ext2_nodes_seq;
+  return true;
+}
+
+uint32_t defragment_continue(struct EXT2DefragState *state, uint32_t block_budget){
+  uint32_t inode = state->move_inode;
+  uint32_t count = state->move_count;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    defrag_new[i] = state->move_start + i;
+  }
+
+  // someone else held the node lock since the last step, the node or its blocks may have changed
+  if (state->move_seq != ext2_nodes_seq)
+  {
+    free_batch_begin();
+    deallocate_block(defrag_new, count, 0);
+    free_batch_end();
+    // score the inode again, its scan counted into extents_before already
+    state->files_scanned--;
+    state->extents_before -= count_extents(defrag_old, count);
+    state->moves_restarted++;
+    state->next_inode = inode;
+    state->move_inode = 0;
+    return 0;
+  }
+
+  uint32_t spent = copy_to_extent(defrag_old, count, state->move_start, &state->move_done, block_budget);
+  if (state->move_done < count)
+  {
+    // ext2_unlock_nodes() at the end of this step counts one release
+    state->move_seq = ext2_nodes_seq + 1;
+    return spent;
+  }
+
+  /**
+   * Copy first, then repoint, then free. The old blocks are untouched until the
+   * last step, so an interruption at any point leaves every pointer on a block
+   * holding the right data; the worst case is the new or old copy staying allocated.
+   */
+  struct EXT2INode node;
+  load_node(&node, inode);
+  walk_node_blocks(node.block, defrag_new, &count, true);
+  sync_node(&node, inode);
+
+  free_batch_begin();
+  deallocate_block(defrag_old, count, 0);
+  free_batch_end();
+
+  state->files_moved++;
+  state->blocks_moved += count;
+  state->extents_after++;
+  state->move_inode = 0;
+  return spent;
+}
+
+void defragment_init(struct EXT2DefragState *state){
+  memset(state, 0, sizeof(struct EXT2DefragState));
+  state->next_inode = 1;
+}
+
+bool defragment_step(struct EXT2DefragState *state, uint32_t block_budget){
+  uint32_t loaded_bgd = EXT2_MAX_GROUPS;
+  uint32_t spent = 0;
+
+  ext2_lock_nodes();
+  if (state->move_inode != 0)
+  {
+    spent += defragment_continue(state, block_budget);
+  }
+
+  while (state->move_inode == 0 && state->next_inode <= sblock.inodes_count && spent < block_budget)
+  {
+    uint32_t inode = state->next_inode++;
+    uint32_t bgd = inode_to_bgd(inode);
+    if (bgd != loaded_bgd)
+    {
+      read_fs_blocks(&defrag_bitmap, bgd_table.table[bgd].inode_bitmap, 1);
+      loaded_bgd = bgd;
+    }
+
+    spent++; // scanning an inode costs one block read
+    if (is_bitmap_set(&defrag_bitmap, inode_to_local(inode)) && defragment_node(inode, state))
+    {
+      spent += defragment_continue(state, spent < block_budget ? block_budget - spent : 0);
+    }
+  }
+  ext2_unlock_nodes();
+
+  return state->move_inode != 0 || state->next_inode <= sblock.inodes_count;
+}
+
+// read every regular file and directory like a reader would, one command per run of consecutive blocks
+static void defragment_read_all(uint32_t *blocks, uint32_t *commands, uint64_t *ns){
+  uint32_t chunk_blocks = DEFRAG_CHUNK_SIZE / ext2_geometry.block_size;
+  uint32_t loaded_bgd = EXT2_MAX_GROUPS;
+  *blocks = 0;
+  *commands = 0;
+  uint64_t start = clock_monotonic_ns();
+  for (uint32_t inode = 1; inode <= sblock.inodes_count; inode++)
+  {
+    if (inode < ext2_geometry.first_ino && inode != EXT2_ROOT_INO)
+    {
+      continue;
+    }
+
+    ext2_lock_nodes();
+    uint32_t bgd = inode_to_bgd(inode);
+    if (bgd != loaded_bgd)
+    {
+      read_fs_blocks(&defrag_bitmap, bgd_table.table[bgd].inode_bitmap, 1);
+      loaded_bgd = bgd;
+    }
+    struct EXT2INode node;
+    uint32_t count = 0;
+    if (is_bitmap_set(&defrag_bitmap, inode_to_local(inode)))
+    {
+      load_node(&node, inode);
+      uint16_t format = node.mode & EXT2_S_IFMT;
+      if ((format != EXT2_S_IFREG && format != EXT2_S_IFDIR) || node.blocks == 0 ||
+          !walk_node_blocks(node.block, defrag_new, &count, false))
+      {
+        count = 0;
+      }
+    }
+
+    uint32_t i = 0;
+    while (i < count)
+    {
+      uint32_t run = 1;
+      while (i + run < count && run < chunk_blocks && defrag_new[i + run] == defrag_new[i] + run)
+      {
+        run++;
+      }
+      read_fs_blocks(defrag_buffer, defrag_new[i], run);
+      (*commands)++;
+      i += run;
+    }
+    *blocks += count;
+    ext2_unlock_nodes();
+  }
+  *ns = clock_monotonic_ns() - start;
+}
+
+static uint32_t defragment_kib_per_s(uint32_t blocks, uint64_t ns){
+  uint32_t us = (uint32_t)div64_32(ns, 1000, NULL);
+  return us ? (uint32_t)div64_32((uint64_t)blocks * ext2_geometry.block_size * 1000000u / 1024u, us, NULL) : 0;
+}
+
+static void defragment_thread(void *arg){
+  (void)arg;
+  struct EXT2DefragState state;
+  uint32_t blocks_before, commands_before, blocks_after, commands_after;
+  uint64_t ns_before, ns_after;
+
+  defragment_read_all(&blocks_before, &commands_before, &ns_before);
+  defragment_init(&state);
+  while (defragment_step(&state, DEFRAG_STEP_BUDGET))
+  {
+    thread_sleep_ns(DEFRAG_STEP_INTERVAL_MS * NS_PER_MS);
+  }
+  defragment_read_all(&blocks_after, &commands_after, &ns_after);
+
+  kprintf("defrag: %u files scanned, %u moved, %u skipped, %u restarted, %u blocks moved\n",
+          state.files_scanned, state.files_moved, state.files_skipped, state.moves_restarted, state.blocks_moved);
+  kprintf("defrag: extents %u before, %u after\n", state.extents_before, state.extents_after);
+  kprintf("defrag: read all files, %u blocks in %u commands %u KiB/s before, %u blocks in %u commands %u KiB/s after\n",
+          blocks_before, commands_before, defragment_kib_per_s(blocks_before, ns_before),
+          blocks_after, commands_after, defragment_kib_per_s(blocks_after, ns_after));
+}
+
+bool defragment_start(void){
+  return thread_create(defragment_thread, NULL, DEFRAG_THREAD_PRIORITY, "defrag") != NULL;
+}
+
+
+/* ============================== COMPRESSION =========================================== */
+
+uint32_t compress_node_data(const void *src, uint32_t size, uint8_t *dst){
+  if (size > EXT2_COMPRESS_MAX_SIZE)
+  {
+    return 0;
+  }
+
+  const uint8_t *raw = (const uint8_t *)src;
+  uint32_t out = 0;
+  for (uint32_t offset = 0; offset < size; offset += EXT2_COMPRESS_GROUP_SIZE)
+  {
+    uint32_t chunk = size - offset < EXT2_COMPRESS_GROUP_SIZE ? size - offset : EXT2_COMPRESS_GROUP_SIZE;
+    uint8_t *header = dst + out;
+    uint32_t packed = lz4_compress(raw + offset, chunk, header + 2, chunk);
+    uint16_t frame = packed;
+    if (packed == 0 || packed >= chunk)
+    {
+      // frame would not shrink, keep the group raw
+      memcpy(header + 2, raw + offset, chunk);
+      packed = chunk;
+      frame = chunk | EXT2_COMPRESS_RAW_FRAME;
+    }
+    header[0] = (uint8_t)frame;
+    header[1] = (uint8_t)(frame >> 8);
+    out += 2 + packed;
+  }
+
+  // only worth it if at least one block less goes over the wire
+  uint32_t block_size = ext2_geometry.block_size;
+  if ((out + block_size - 1) / block_size >= (size + block_size - 1) / block_size)
+  {
+    return 0;
+  }
+  return out;
+}
+
+bool decompress_node_data(const uint8_t *src, uint32_t src_size, void *dst, uint32_t size){
+  uint8_t *raw = (uint8_t *)dst;
+  uint32_t in = 0;
+  for (uint32_t offset = 0; offset < size; offset += EXT2_COMPRESS_GROUP_SIZE)
+  {
+    uint32_t chunk = size - offset < EXT2_COMPRESS_GROUP_SIZE ? size - offset : EXT2_COMPRESS_GROUP_SIZE;
+    if (in + 2 > src_size)
+    {
+      return false;
+    }
+    uint16_t frame = src[in] | (src[in + 1] << 8);
+    uint32_t packed = frame & ~EXT2_COMPRESS_RAW_FRAME;
+    in += 2;
+    if (in + packed > src_size)
+    {
+      return false;
+    }
+
+    if (frame & EXT2_COMPRESS_RAW_FRAME)
+    {
+      if (packed != chunk)
+      {
+        return false;
+      }
+      memcpy(raw + offset, src + in, chunk);
+    }
+    else if (lz4_decompress(src + in, packed, raw + offset, chunk) != (int32_t)chunk)
+    {
+      return false;
+    }
+    in += packed;
+  }
+  return true;
+}
+
+
+/* ============================== BENCHMARK ============================================= */
+
+uint32_t benchmark_inodes[EXT2_BENCHMARK_FILES] = {};
+
+static void delete_benchmark_report(const char *what, uint32_t files, uint32_t flushes, uint32_t writes, uint64_t cycles){
+  kprintf("ext2: delete %s: %u bitmap writes in %u flushes, %u cycles per file\n",
+          what, free_batch.bitmap_writes - writes, free_batch.flushes - flushes,
+          files ? (uint32_t)div64_32(cycles, files, NULL) : 0);
+}
+
+static void delete_benchmark_files(void *data, bool batched){
+  uint32_t files = 0;
+  while (files < EXT2_BENCHMARK_FILES)
+  {
+    uint32_t inode = ext2_create_node(EXT2_S_IFREG | 0644, 0, data, ext2_geometry.block_size);
+    if (inode == 0)
+    {
+      break;
+    }
+    benchmark_inodes[files++] = inode;
+  }
+
+  uint32_t flushes = free_batch.flushes;
+  uint32_t writes = free_batch.bitmap_writes;
+  uint64_t start = cpu_rdtsc();
+  if (batched)
+  {
+    free_batch_begin();
+  }
+  for (uint32_t i = 0; i < files; i++)
+  {
+    deallocate_node(benchmark_inodes[i]);
+  }
+  if (batched)
+  {
+    free_batch_end();
+  }
+  uint64_t cycles = cpu_rdtsc() - start;
+
+  kprintf("ext2: %u of %u files created\n", files, EXT2_BENCHMARK_FILES);
+  delete_benchmark_report(batched ? "small files in one batch" : "small files one by one", files, flushes, writes, cycles);
+}
+
+void ext2_delete_benchmark(void){
+  uint32_t buffer = buddy_alloc(EXT2_BENCHMARK_ORDER);
+  if (!buffer)
+  {
+    kprintf("ext2: no memory for the benchmark\n");
+    return;
+  }
+  void *data = PHYS_TO_VIRT(buffer);
+  memset(data, 0x5A, PAGE_SIZE << EXT2_BENCHMARK_ORDER);
+
+  delete_benchmark_files(data, false);
+  delete_benchmark_files(data, true);
+
+  uint32_t inode = ext2_create_node(EXT2_S_IFREG | 0644, 0, data, PAGE_SIZE << EXT2_BENCHMARK_ORDER);
+  if (inode == 0)
+  {
+    kprintf("ext2: no room for a %u KiB file\n", (PAGE_SIZE << EXT2_BENCHMARK_ORDER) / 1024);
+  }
+  else
+  {
+    uint32_t flushes = free_batch.flushes;
+    uint32_t writes = free_batch.bitmap_writes;
+    uint64_t start = cpu_rdtsc();
+    deallocate_node(inode);
+    delete_benchmark_report("one large file", 1, flushes, writes, cpu_rdtsc() - start);
+  }
+  buddy_free(buffer, EXT2_BENCHMARK_ORDER);
+}
+
+static uint32_t benchmark_random(uint32_t *state){
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// prose from a small vocabulary, compresses like documentation or source text
+static void benchmark_text(char *out, uint32_t size){
+  static const char *words[] = {"the ", "block ", "group ", "of ", "inode ", "is ", "written ", "to ", "disk ",
+                                "and ", "each ", "file ", "has ", "a ", "bitmap ", "table ", "when ", "free ", ". ", "\n"};
+  uint32_t state = 2463534242u;
+  uint32_t used = 0;
+  while (used < size)
+  {
+    const char *word = words[benchmark_random(&state) % (sizeof(words) / sizeof(words[0]))];
+    while (*word && used < size)
+    {
+      out[used++] = *word++;
+    }
+  }
+}
+
+// kernel log lines, the same few formats with changing numbers
+static void benchmark_log(char *out, uint32_t size){
+  static const char *formats[] = {"ata: read lba ", "ata: write lba ", "timer: tick ", "keyboard: scancode "};
+  uint32_t state = 88172645u;
+  uint32_t used = 0;
+  for (uint32_t line = 0; used < size; line++)
+  {
+    char text[64];
+    uint32_t length = 0;
+    text[length++] = '[';
+    for (uint32_t digit = 100000; digit > 0; digit /= 10)
+    {
+      text[length++] = '0' + (line * 37 / digit) % 10;
+    }
+    text[length++] = ']';
+    text[length++] = ' ';
+    for (const char *format = formats[line % 4]; *format; format++)
+    {
+      text[length++] = *format;
+    }
+    uint32_t value = benchmark_random(&state) % 100000;
+    for (uint32_t digit = 10000; digit > 0; digit /= 10)
+    {
+      text[length++] = '0' + (value / digit) % 10;
+    }
+    text[length++] = '\n';
+    for (uint32_t i = 0; i < length && used < size; i++)
+    {
+      out[used++] = text[i];
+    }
+  }
+}
+
+static void compress_benchmark_file(const char *what, void *data, void *check, uint32_t flags){
+  uint32_t size = EXT2_COMPRESS_MAX_SIZE;
+  uint64_t start = cpu_rdtsc();
+  uint32_t inode = ext2_create_node(EXT2_S_IFREG | 0644, flags, data, size);
+  uint64_t write_cycles = cpu_rdtsc() - start;
+  if (inode == 0)
+  {
+    kprintf("ext2: no room for the %s file\n", what);
+    return;
+  }
+
+  uint32_t read_size;
+  start = cpu_rdtsc();
+  bool ok = ext2_read_node(inode, check, size, &read_size);
+  uint64_t read_cycles = cpu_rdtsc() - start;
+  ok = ok && read_size == size && memcmp(data, check, size) == 0;
+
+  struct EXT2INode node;
+  ext2_lock_nodes();
+  load_node(&node, inode);
+  ext2_unlock_nodes();
+  kprintf("ext2: %s %s: %u sectors, write %u kcycles, read %u kcycles%s\n",
+          what, (node.flags & EXT2_LZ4_FL) ? "compressed" : "raw", node.blocks,
+          (uint32_t)div64_32(write_cycles, 1000, NULL), (uint32_t)div64_32(read_cycles, 1000, NULL),
+          ok ? "" : ", READ BACK DIFFERS");
+  deallocate_node(inode);
+}
+
+void ext2_compress_benchmark(void){
+  uint32_t buffer = buddy_alloc(EXT2_BENCHMARK_ORDER);
+  if (!buffer)
+  {
+    kprintf("ext2: no memory for the benchmark\n");
+    return;
+  }
+  bool had_feature = sblock.feature_incompat & EXT2_FEATURE_INCOMPAT_LZ4_FRAMES;
+  char *data = PHYS_TO_VIRT(buffer);
+  char *check = data + EXT2_COMPRESS_MAX_SIZE;
+
+  benchmark_text(data, EXT2_COMPRESS_MAX_SIZE);
+  compress_benchmark_file("text", data, check, 0);
+  compress_benchmark_file("text", data, check, EXT2_LZ4_FL);
+  benchmark_log(data, EXT2_COMPRESS_MAX_SIZE);
+  compress_benchmark_file("log", data, check, 0);
+  compress_benchmark_file("log", data, check, EXT2_LZ4_FL);
+
+  // the feature flag marks compressed nodes on disk, the benchmark's are gone again
+  if (!had_feature && (sblock.feature_incompat & EXT2_FEATURE_INCOMPAT_LZ4_FRAMES))
+  {
+    uint32_t flags = write_lock_irqsave(&ext2_metadata_lock);
+    sblock.feature_incompat &= ~EXT2_FEATURE_INCOMPAT_LZ4_FRAMES;
+    write_unlock_irqrestore(&ext2_metadata_lock, flags);
+    sync_bgd_table();
+  }
+  buddy_free(buffer, EXT2_BENCHMARK_ORDER);
+}
+
+// the previous load_node(): the whole inode table block for one record
+static void load_node_block(struct EXT2INode *node, uint32_t inode){
+  uint32_t offset = inode_to_local(inode) * ext2_geometry.inode_size;
+  read_fs_blocks(&block_buffer, bgd_table.table[inode_to_bgd(inode)].inode_table + offset / ext2_geometry.block_size, 1);
+  memcpy(node, block_buffer.buf + offset % ext2_geometry.block_size, sizeof(struct EXT2INode));
+}
+
+static void inode_benchmark_pass(const char *what, bool whole_block, bool random){
+  struct EXT2INode node;
+  uint32_t count = random ? EXT2_BENCHMARK_LOOKUPS : sblock.inodes_count;
+  uint32_t state = 2463534242u;
+  uint64_t start = cpu_rdtsc();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t inode = random ? benchmark_random(&state) % sblock.inodes_count + 1 : i + 1;
+    if (whole_block)
+    {
+      load_node_block(&node, inode);
+    }
+    else
+    {
+      load_node(&node, inode);
+    }
+  }
+  uint64_t cycles = cpu_rdtsc() - start;
+  kprintf("ext2: %s of %u inodes, %s: %u sectors, %u cycles per inode\n", what, count,
+          whole_block ? "whole blocks" : "single sectors", count * (whole_block ? ext2_geometry.sectors_per_block : 1),
+          (uint32_t)div64_32(cycles, count, NULL));
+}
+
+void ext2_inode_benchmark(void){
+  ext2_lock_nodes();
+  inode_benchmark_pass("scan", true, false);
+  inode_benchmark_pass("scan", false, false);
+  inode_benchmark_pass("lookup", true, true);
+  inode_benchmark_pass("lookup", false, true);
+  ext2_unlock_nodes();
+}
+
+static void create_ext2_job(void *arg){
+  (void)arg;
+  create_ext2();
+}
+
+void ext2_mkfs_benchmark(void){
+  // every run formats the disk again, the last one is the filesystem that stays
+  ext2_lock_nodes();
+  task_benchmark("ext2 mkfs", create_ext2_job, NULL);
+  ext2_unlock_nodes();
+}
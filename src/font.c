@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include "header/text/font.h"
+
+/**
+ * 8x16 glyphs for printable ASCII, rasterized from DejaVu Sans Mono Bold at 15 px
+ * (Bitstream Vera / DejaVu fonts license, free to embed). One byte per row, msb is the left pixel.
+ */
+const uint8_t font_glyphs[FONT_GLYPH_COUNT][FONT_HEIGHT] = {
+    [0x20] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+    [0x21] = {0x00, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00}, // '!'
+    [0x22] = {0x00, 0x33, 0x33, 0x33, 0x33, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '"'
+    [0x23] = {0x00, 0x19, 0x1B, 0x1B, 0x7F, 0x36, 0x36, 0x36, 0xFF, 0x64, 0x6C, 0x6C, 0x00, 0x00, 0x00, 0x00}, // '#'
+    [0x24] = {0x08, 0x08, 0x3E, 0x6A, 0x68, 0x78, 0x3E, 0x0F, 0x0B, 0x0B, 0x6B, 0x3E, 0x08, 0x08, 0x00, 0x00}, // '$'
+    [0x25] = {0x00, 0x70, 0x88, 0x88, 0x88, 0x71, 0x1E, 0xE7, 0x08, 0x08, 0x08, 0x07, 0x00, 0x00, 0x00, 0x00}, // '%'
+    [0x26] = {0x00, 0x1C, 0x30, 0x30, 0x10, 0x38, 0x3B, 0x6F, 0x6F, 0x6E, 0x76, 0x3F, 0x00, 0x00, 0x00, 0x00}, // '&'
+    [0x27] = {0x00, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '\''
+    [0x28] = {0x00, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x00, 0x00}, // '('
+    [0x29] = {0x00, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x00, 0x00}, // ')'
+    [0x2A] = {0x00, 0x08, 0x6B, 0x3E, 0x3E, 0x6B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '*'
+    [0x2B] = {0x00, 0x00, 0x00, 0x0C, 0x0C, 0x0C, 0x7F, 0x7F, 0x0C, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00}, // '+'
+    [0x2C] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x30, 0x00, 0x00}, // ','
+    [0x2D] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '-'
+    [0x2E] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00}, // '.'
+    [0x2F] = {0x00, 0x01, 0x03, 0x03, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x00, 0x00, 0x00}, // '/'
+    [0x30] = {0x00, 0x1C, 0x36, 0x63, 0x63, 0x6B, 0x6B, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00, 0x00, 0x00, 0x00}, // '0'
+    [0x31] = {0x00, 0x1C, 0x2C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00, 0x00, 0x00, 0x00}, // '1'
+    [0x32] = {0x00, 0x3C, 0x43, 0x03, 0x03, 0x07, 0x06, 0x0E, 0x1C, 0x38, 0x70, 0x7F, 0x00, 0x00, 0x00, 0x00}, // '2'
+    [0x33] = {0x00, 0x3E, 0x43, 0x03, 0x03, 0x1C, 0x06, 0x03, 0x03, 0x03, 0x47, 0x3C, 0x00, 0x00, 0x00, 0x00}, // '3'
+    [0x34] = {0x00, 0x06, 0x0E, 0x1E, 0x16, 0x36, 0x66, 0x46, 0x7F, 0x06, 0x06, 0x06, 0x00, 0x00, 0x00, 0x00}, // '4'
+    [0x35] = {0x00, 0x7E, 0x60, 0x60, 0x60, 0x7C, 0x46, 0x03, 0x03, 0x03, 0x46, 0x3C, 0x00, 0x00, 0x00, 0x00}, // '5'
+    [0x36] = {0x00, 0x1C, 0x32, 0x60, 0x60, 0x7E, 0x63, 0x63, 0x63, 0x63, 0x23, 0x1E, 0x00, 0x00, 0x00, 0x00}, // '6'
+    [0x37] = {0x00, 0x7F, 0x03, 0x07, 0x06, 0x06, 0x0C, 0x0C, 0x1C, 0x18, 0x18, 0x30, 0x00, 0x00, 0x00, 0x00}, // '7'
+    [0x38] = {0x00, 0x3E, 0x63, 0x63, 0x63, 0x1C, 0x36, 0x63, 0x63, 0x63, 0x77, 0x3E, 0x00, 0x00, 0x00, 0x00}, // '8'
+    [0x39] = {0x00, 0x3C, 0x62, 0x63, 0x63, 0x63, 0x63, 0x3F, 0x03, 0x03, 0x26, 0x1C, 0x00, 0x00, 0x00, 0x00}, // '9'
+    [0x3A] = {0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00}, // ':'
+    [0x3B] = {0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x30, 0x00, 0x00}, // ';'
+    [0x3C] = {0x00, 0x00, 0x00, 0x00, 0x07, 0x1E, 0x70, 0x70, 0x1E, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '<'
+    [0x3D] = {0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '='
+    [0x3E] = {0x00, 0x00, 0x00, 0x40, 0x78, 0x1E, 0x03, 0x03, 0x1E, 0x78, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00}, // '>'
+    [0x3F] = {0x00, 0x3C, 0x46, 0x06, 0x0E, 0x1C, 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00}, // '?'
+    [0x40] = {0x00, 0x00, 0x1E, 0x23, 0x63, 0xCF, 0xDB, 0xDB, 0xDB, 0xDB, 0xDB, 0xCF, 0x60, 0x32, 0x1F, 0x00}, // '@'
+    [0x41] = {0x00, 0x1C, 0x1C, 0x1C, 0x1C, 0x36, 0x36, 0x36, 0x3E, 0x36, 0x77, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'A'
+    [0x42] = {0x00, 0x7E, 0x63, 0x63, 0x63, 0x63, 0x7C, 0x63, 0x63, 0x63, 0x63, 0x7E, 0x00, 0x00, 0x00, 0x00}, // 'B'
+    [0x43] = {0x00, 0x1E, 0x31, 0x20, 0x60, 0x60, 0x60, 0x60, 0x60, 0x20, 0x31, 0x1E, 0x00, 0x00, 0x00, 0x00}, // 'C'
+    [0x44] = {0x00, 0x7C, 0x66, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x66, 0x7C, 0x00, 0x00, 0x00, 0x00}, // 'D'
+    [0x45] = {0x00, 0x7F, 0x60, 0x60, 0x60, 0x60, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7F, 0x00, 0x00, 0x00, 0x00}, // 'E'
+    [0x46] = {0x00, 0x7F, 0x60, 0x60, 0x60, 0x60, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00}, // 'F'
+    [0x47] = {0x00, 0x1E, 0x31, 0x20, 0x60, 0x60, 0x60, 0x67, 0x63, 0x63, 0x33, 0x1F, 0x00, 0x00, 0x00, 0x00}, // 'G'
+    [0x48] = {0x00, 0x63, 0x63, 0x63, 0x63, 0x63, 0x7F, 0x63, 0x63, 0x63, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'H'
+    [0x49] = {0x00, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7E, 0x00, 0x00, 0x00, 0x00}, // 'I'
+    [0x4A] = {0x00, 0x1F, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x43, 0x3E, 0x00, 0x00, 0x00, 0x00}, // 'J'
+    [0x4B] = {0x00, 0x63, 0x67, 0x6E, 0x6C, 0x78, 0x7C, 0x7E, 0x66, 0x67, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'K'
+    [0x4C] = {0x00, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x7F, 0x00, 0x00, 0x00, 0x00}, // 'L'
+    [0x4D] = {0x00, 0x77, 0x77, 0x77, 0x77, 0x77, 0x7F, 0x6B, 0x63, 0x63, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'M'
+    [0x4E] = {0x00, 0x73, 0x73, 0x73, 0x7B, 0x7B, 0x6B, 0x6F, 0x6F, 0x67, 0x67, 0x67, 0x00, 0x00, 0x00, 0x00}, // 'N'
+    [0x4F] = {0x00, 0x1C, 0x36, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00, 0x00, 0x00, 0x00}, // 'O'
+    [0x50] = {0x00, 0x7E, 0x67, 0x63, 0x63, 0x63, 0x67, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00}, // 'P'
+    [0x51] = {0x00, 0x1C, 0x36, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x36, 0x1E, 0x06, 0x02, 0x00, 0x00}, // 'Q'
+    [0x52] = {0x00, 0x7E, 0x63, 0x63, 0x63, 0x63, 0x63, 0x7C, 0x66, 0x67, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'R'
+    [0x53] = {0x00, 0x1E, 0x61, 0x60, 0x60, 0x78, 0x3E, 0x0F, 0x03, 0x03, 0x43, 0x3E, 0x00, 0x00, 0x00, 0x00}, // 'S'
+    [0x54] = {0x00, 0xFF, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00}, // 'T'
+    [0x55] = {0x00, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x3E, 0x00, 0x00, 0x00, 0x00}, // 'U'
+    [0x56] = {0x00, 0x63, 0x63, 0x36, 0x36, 0x36, 0x36, 0x36, 0x14, 0x1C, 0x1C, 0x1C, 0x00, 0x00, 0x00, 0x00}, // 'V'
+    [0x57] = {0x00, 0xC1, 0xC1, 0xC1, 0xDD, 0xDD, 0x5D, 0x55, 0x55, 0x77, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'W'
+    [0x58] = {0x00, 0x63, 0x36, 0x36, 0x1C, 0x1C, 0x08, 0x1C, 0x1C, 0x36, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'X'
+    [0x59] = {0x00, 0xE7, 0x66, 0x66, 0x3C, 0x3C, 0x3C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00}, // 'Y'
+    [0x5A] = {0x00, 0x7F, 0x03, 0x07, 0x0E, 0x0C, 0x1C, 0x18, 0x30, 0x70, 0x60, 0x7F, 0x00, 0x00, 0x00, 0x00}, // 'Z'
+    [0x5B] = {0x00, 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00, 0x00}, // '['
+    [0x5C] = {0x00, 0x60, 0x20, 0x30, 0x10, 0x18, 0x18, 0x0C, 0x0C, 0x04, 0x06, 0x02, 0x03, 0x00, 0x00, 0x00}, // '\\'
+    [0x5D] = {0x00, 0x3C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x3C, 0x00, 0x00}, // ']'
+    [0x5E] = {0x00, 0x18, 0x3C, 0x66, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '^'
+    [0x5F] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF}, // '_'
+    [0x60] = {0x60, 0x30, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '`'
+    [0x61] = {0x00, 0x00, 0x00, 0x00, 0x1E, 0x23, 0x03, 0x3F, 0x63, 0x63, 0x67, 0x3F, 0x00, 0x00, 0x00, 0x00}, // 'a'
+    [0x62] = {0x00, 0x60, 0x60, 0x60, 0x7E, 0x77, 0x63, 0x63, 0x63, 0x63, 0x77, 0x7E, 0x00, 0x00, 0x00, 0x00}, // 'b'
+    [0x63] = {0x00, 0x00, 0x00, 0x00, 0x1E, 0x31, 0x60, 0x60, 0x60, 0x60, 0x31, 0x1E, 0x00, 0x00, 0x00, 0x00}, // 'c'
+    [0x64] = {0x00, 0x03, 0x03, 0x03, 0x3F, 0x77, 0x63, 0x63, 0x63, 0x63, 0x77, 0x3F, 0x00, 0x00, 0x00, 0x00}, // 'd'
+    [0x65] = {0x00, 0x00, 0x00, 0x00, 0x1E, 0x23, 0x63, 0x7F, 0x60, 0x60, 0x31, 0x1E, 0x00, 0x00, 0x00, 0x00}, // 'e'
+    [0x66] = {0x00, 0x0F, 0x18, 0x18, 0x7F, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00}, // 'f'
+    [0x67] = {0x00, 0x00, 0x00, 0x00, 0x3F, 0x37, 0x63, 0x63, 0x63, 0x63, 0x37, 0x3F, 0x03, 0x23, 0x1E, 0x00}, // 'g'
+    [0x68] = {0x00, 0x60, 0x60, 0x60, 0x7E, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'h'
+    [0x69] = {0x0C, 0x0C, 0x0C, 0x00, 0x3C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x7F, 0x00, 0x00, 0x00, 0x00}, // 'i'
+    [0x6A] = {0x0C, 0x0C, 0x0C, 0x00, 0x3C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x78, 0x00}, // 'j'
+    [0x6B] = {0x00, 0x60, 0x60, 0x60, 0x66, 0x6C, 0x78, 0x78, 0x6C, 0x6C, 0x66, 0x67, 0x00, 0x00, 0x00, 0x00}, // 'k'
+    [0x6C] = {0x00, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x0F, 0x00, 0x00, 0x00, 0x00}, // 'l'
+    [0x6D] = {0x00, 0x00, 0x00, 0x00, 0x7F, 0x6D, 0x6D, 0x6D, 0x6D, 0x6D, 0x6D, 0x6D, 0x00, 0x00, 0x00, 0x00}, // 'm'
+    [0x6E] = {0x00, 0x00, 0x00, 0x00, 0x7E, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'n'
+    [0x6F] = {0x00, 0x00, 0x00, 0x00, 0x1C, 0x36, 0x63, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00, 0x00, 0x00, 0x00}, // 'o'
+    [0x70] = {0x00, 0x00, 0x00, 0x00, 0x7E, 0x77, 0x63, 0x63, 0x63, 0x63, 0x77, 0x7E, 0x60, 0x60, 0x60, 0x00}, // 'p'
+    [0x71] = {0x00, 0x00, 0x00, 0x00, 0x3F, 0x77, 0x63, 0x63, 0x63, 0x63, 0x77, 0x3F, 0x03, 0x03, 0x03, 0x00}, // 'q'
+    [0x72] = {0x00, 0x00, 0x00, 0x00, 0x3F, 0x38, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00}, // 'r'
+    [0x73] = {0x00, 0x00, 0x00, 0x00, 0x3E, 0x61, 0x60, 0x7C, 0x1F, 0x03, 0x43, 0x3E, 0x00, 0x00, 0x00, 0x00}, // 's'
+    [0x74] = {0x00, 0x00, 0x18, 0x18, 0x7F, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x0F, 0x00, 0x00, 0x00, 0x00}, // 't'
+    [0x75] = {0x00, 0x00, 0x00, 0x00, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x3F, 0x00, 0x00, 0x00, 0x00}, // 'u'
+    [0x76] = {0x00, 0x00, 0x00, 0x00, 0x63, 0x77, 0x36, 0x36, 0x36, 0x14, 0x1C, 0x1C, 0x00, 0x00, 0x00, 0x00}, // 'v'
+    [0x77] = {0x00, 0x00, 0x00, 0x00, 0xC1, 0xC1, 0xC9, 0x5D, 0x77, 0x77, 0x63, 0x63, 0x00, 0x00, 0x00, 0x00}, // 'w'
+    [0x78] = {0x00, 0x00, 0x00, 0x00, 0x77, 0x36, 0x1C, 0x1C, 0x1C, 0x1E, 0x36, 0x77, 0x00, 0x00, 0x00, 0x00}, // 'x'
+    [0x79] = {0x00, 0x00, 0x00, 0x00, 0x63, 0x37, 0x36, 0x36, 0x1E, 0x1C, 0x0C, 0x0C, 0x0C, 0x18, 0x38, 0x00}, // 'y'
+    [0x7A] = {0x00, 0x00, 0x00, 0x00, 0x7F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x7F, 0x00, 0x00, 0x00, 0x00}, // 'z'
+    [0x7B] = {0x00, 0x07, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x30, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x07, 0x00}, // '{'
+    [0x7C] = {0x00, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C}, // '|'
+    [0x7D] = {0x00, 0x38, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x03, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x38, 0x00}, // '}'
+    [0x7E] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x38, 0x7F, 0x47, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '~'
+};
@@ -6,30 +6,104 @@
 #include "header/cpu/portio.h"
 
 struct FramebufferState framebuffer_state = {
-    .row = 0, 
+    .row = -1, // unknown hardware cursor, the first framebuffer_set_cursor() always programs it
     .col = 0, 
     .fg = 0xF, 
     .bg = 0
 };
 
+struct FramebufferShadow framebuffer_shadow = {};
+
+static void framebuffer_mark_dirty(uint8_t row) {
+    framebuffer_shadow.dirty[row / 32] |= 1u << (row % 32);
+}
+
 void framebuffer_set_cursor(uint8_t r, uint8_t c) {
     uint16_t pos = r * BUFFER_WIDTH + c; 
-    out(CURSOR_PORT_CMD, 0x0F);
-	out(CURSOR_PORT_DATA, (uint8_t) (pos & 0xFF));
-	out(CURSOR_PORT_CMD, 0x0E);
-	out(CURSOR_PORT_DATA, (uint8_t) ((pos >> 8) & 0xFF));
+    // the CRTC registers are slow port writes, skip them when the cursor stays put
+    if (framebuffer_state.row != r || framebuffer_state.col != c) {
+        out(CURSOR_PORT_CMD, 0x0F);
+        out(CURSOR_PORT_DATA, (uint8_t) (pos & 0xFF));
+        out(CURSOR_PORT_CMD, 0x0E);
+        out(CURSOR_PORT_DATA, (uint8_t) ((pos >> 8) & 0xFF));
+    }
     framebuffer_state.row = r; 
     framebuffer_state.col = c;
+
+    // a cursor move means the writer is done with its burst
+    framebuffer_flush();
 }
 
 void framebuffer_write(uint8_t row, uint8_t col, char c, uint8_t fg, uint8_t bg) {
-    uint16_t idx = (row * BUFFER_WIDTH) +  col; 
-    uint16_t *where = (uint16_t *)FRAMEBUFFER_MEMORY_OFFSET + idx;
     uint16_t attrib = (bg << 4) | (fg & 0x0F);
-    *where = c | (attrib << 8);
+    framebuffer_shadow.cells[row][col] = (uint8_t) c | (attrib << 8);
+    framebuffer_mark_dirty(row);
+}
+
+void framebuffer_write_n(uint8_t row, uint8_t col, const char *s, size_t n, uint8_t fg, uint8_t bg) {
+    uint16_t attrib = ((bg << 4) | (fg & 0x0F)) << 8;
+    uint16_t *cell = &framebuffer_shadow.cells[row][col];
+    for (size_t i = 0; i < n; i++)
+        cell[i] = (uint8_t) s[i] | attrib;
+    framebuffer_mark_dirty(row);
+}
+
+void framebuffer_puts(uint8_t row, uint8_t col, const char *s, uint8_t fg, uint8_t bg) {
+    size_t n = 0;
+    while (s[n] && col + n < BUFFER_WIDTH)
+        n++;
+    framebuffer_write_n(row, col, s, n, fg, bg);
 }
 
 void framebuffer_clear(void) {
-    size_t framebuffer_size = BUFFER_WIDTH * BUFFER_HEIGHT + sizeof(FRAMEBUFFER_MEMORY_OFFSET);
-    memset(FRAMEBUFFER_MEMORY_OFFSET, 0, framebuffer_size);
-}
\ No newline at end of file
+    uint16_t blank = FRAMEBUFFER_BLANK_CELL;
+    for (size_t i = 0; i < BUFFER_WIDTH; i++)
+        framebuffer_shadow.cells[0][i] = blank;
+    for (size_t row = 1; row < BUFFER_HEIGHT; row++)
+        memcpy(framebuffer_shadow.cells[row], framebuffer_shadow.cells[0], sizeof(framebuffer_shadow.cells[0]));
+    memset(framebuffer_shadow.dirty, 0xFF, sizeof(framebuffer_shadow.dirty));
+}
+
+void framebuffer_flush(void) {
+    uint16_t (*vga)[BUFFER_WIDTH] = (uint16_t (*)[BUFFER_WIDTH]) FRAMEBUFFER_MEMORY_OFFSET;
+    for (size_t word = 0; word < FRAMEBUFFER_DIRTY_WORDS; word++) {
+        uint32_t dirty = framebuffer_shadow.dirty[word];
+        framebuffer_shadow.dirty[word] = 0;
+        while (dirty) {
+            uint32_t bit = __builtin_ctz(dirty);
+            dirty &= dirty - 1;
+            size_t row = word * 32 + bit;
+            if (row < BUFFER_HEIGHT)
+                memcpy(vga[row], framebuffer_shadow.cells[row], sizeof(framebuffer_shadow.cells[row]));
+        }
+    }
+}
+
+const uint16_t *framebuffer_row(uint8_t row) {
+    return framebuffer_shadow.cells[row];
+}
+
+void framebuffer_write_row(uint8_t row, const uint16_t *cells) {
+    memcpy(framebuffer_shadow.cells[row], cells, sizeof(framebuffer_shadow.cells[row]));
+    framebuffer_mark_dirty(row);
+}
+
+void framebuffer_copy_row(uint8_t dst, uint8_t src) {
+    framebuffer_write_row(dst, framebuffer_shadow.cells[src]);
+}
+
+void framebuffer_clear_row(uint8_t row, uint8_t fg, uint8_t bg) {
+    uint16_t blank = ' ' | (((bg << 4) | (fg & 0x0F)) << 8);
+    for (size_t i = 0; i < BUFFER_WIDTH; i++)
+        framebuffer_shadow.cells[row][i] = blank;
+    framebuffer_mark_dirty(row);
+}
+
+void framebuffer_set_start(uint8_t row) {
+    uint16_t pos = row * BUFFER_WIDTH;
+    framebuffer_flush();
+    out(CURSOR_PORT_CMD, CRTC_START_ADDRESS_HIGH);
+    out(CURSOR_PORT_DATA, (uint8_t) ((pos >> 8) & 0xFF));
+    out(CURSOR_PORT_CMD, CRTC_START_ADDRESS_LOW);
+    out(CURSOR_PORT_DATA, (uint8_t) (pos & 0xFF));
+}
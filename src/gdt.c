@@ -40,6 +40,25 @@ struct GlobalDescriptorTable global_descriptor_table = {
             .default_operation_size = 1,
             .granularity = 1,
             .base_high = 0,
+        },
+        {
+            // TSS, only present in the per processor copies
+            0
+        },
+        {
+            // CPU local data, flat until smp_cpu_local_init() gives each processor its own base
+            .segment_low = 0xFFFF,
+            .base_low = 0,
+            .base_mid = 0,
+            .type_bit = 0x2,
+            .non_system = 1,
+            .descriptor_privilege_level = 0,
+            .p_flag = 1,
+            .segment_mid = 0xF,
+            .bit64_segment = 0,
+            .default_operation_size = 1,
+            .granularity = 1,
+            .base_high = 0,
         }
     }
 };
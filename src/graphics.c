@@ -0,0 +1,357 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/text/graphics.h"
+#include "header/text/font.h"
+#include "header/cpu/portio.h"
+#include "header/memory/paging.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+#include "header/text/console.h"
+#include "header/cpu/cpu.h"
+#include "header/driver/timer.h"
+
+// standard VGA text palette as 0x00RRGGBB, indexed by the same 4-bit colors the text console uses
+static const uint32_t graphics_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+uint32_t graphics_back_buffer[GRAPHICS_WIDTH * GRAPHICS_HEIGHT] __attribute__((aligned(64)));
+
+struct GraphicsState graphics_state = {
+    .active    = false,
+    .expand_fg = 0xFF, // no valid color, the first glyph builds the table
+    .expand_bg = 0xFF,
+};
+
+static void dispi_write(uint16_t index, uint16_t value) {
+    out16(VBE_DISPI_IOPORT_INDEX, index);
+    out16(VBE_DISPI_IOPORT_DATA, value);
+}
+
+static uint16_t dispi_read(uint16_t index) {
+    out16(VBE_DISPI_IOPORT_INDEX, index);
+    return in16(VBE_DISPI_IOPORT_DATA);
+}
+
+static uint32_t pci_config_read(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    out32(PCI_CONFIG_ADDRESS, 0x80000000u | (uint32_t) bus << 16 | (uint32_t) device << 11
+                              | (uint32_t) function << 8 | (offset & 0xFC));
+    return in32(PCI_CONFIG_DATA);
+}
+
+// BAR0 of the Bochs / QEMU std VGA device holds the framebuffer address
+static uint32_t bochs_lfb_address(void) {
+    for (uint8_t device = 0; device < 32; device++) {
+        uint32_t id = pci_config_read(0, device, 0, 0);
+        if ((id & 0xFFFF) == BOCHS_VGA_VENDOR_ID && id >> 16 == BOCHS_VGA_DEVICE_ID)
+            return pci_config_read(0, device, 0, PCI_BAR0) & 0xFFFFFFF0;
+    }
+    return BOCHS_VGA_DEFAULT_LFB;
+}
+
+static bool bochs_set_mode(void) {
+    uint16_t id = dispi_read(VBE_DISPI_INDEX_ID);
+    if (id < VBE_DISPI_ID_MIN || id > VBE_DISPI_ID_MAX)
+        return false;
+    // no MMIO slot left, better stay in text mode than draw into nothing
+    uint8_t *lfb = paging_map_physical(bochs_lfb_address(), GRAPHICS_WIDTH * 4 * GRAPHICS_HEIGHT, 0);
+    if (!lfb)
+        return false;
+
+    dispi_write(VBE_DISPI_INDEX_ENABLE, 0);
+    dispi_write(VBE_DISPI_INDEX_XRES, GRAPHICS_WIDTH);
+    dispi_write(VBE_DISPI_INDEX_YRES, GRAPHICS_HEIGHT);
+    dispi_write(VBE_DISPI_INDEX_BPP, GRAPHICS_BPP);
+    dispi_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
+
+    graphics_state.lfb    = lfb;
+    graphics_state.pitch  = GRAPHICS_WIDTH * 4;
+    graphics_state.width  = GRAPHICS_WIDTH;
+    graphics_state.height = GRAPHICS_HEIGHT;
+    return true;
+}
+
+static bool multiboot_framebuffer(uint32_t magic, struct MultibootInfo *mb) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || mb == NULL || !(mb->flags & MULTIBOOT_INFO_FRAMEBUFFER))
+        return false;
+    if (mb->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB || mb->framebuffer_bpp != 32
+            || mb->framebuffer_addr >> 32)
+        return false;
+    if (mb->framebuffer_width > GRAPHICS_WIDTH || mb->framebuffer_height > GRAPHICS_HEIGHT)
+        return false;
+
+    // write combining, if any, comes from the MTRRs, so the mapping keeps the cache flags clear
+    graphics_state.lfb    = paging_map_physical((uint32_t) mb->framebuffer_addr,
+                                                mb->framebuffer_pitch * mb->framebuffer_height, 0);
+    if (!graphics_state.lfb)
+        return false;
+    graphics_state.pitch  = mb->framebuffer_pitch;
+    graphics_state.width  = mb->framebuffer_width;
+    graphics_state.height = mb->framebuffer_height;
+    return true;
+}
+
+bool graphics_init(uint32_t magic, struct MultibootInfo *mb) {
+    if (!multiboot_framebuffer(magic, mb) && !bochs_set_mode())
+        return false;
+
+    graphics_state.columns    = graphics_state.width / FONT_WIDTH;
+    graphics_state.rows       = graphics_state.height / FONT_HEIGHT;
+    graphics_state.cursor_row = 0;
+    graphics_state.cursor_col = 0;
+    graphics_state.active     = true;
+    graphics_console_clear(0);
+    return true;
+}
+
+bool graphics_active(void) {
+    return graphics_state.active;
+}
+
+static void graphics_mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    if (graphics_state.dirty_x1 == 0) {
+        graphics_state.dirty_x0 = x;
+        graphics_state.dirty_y0 = y;
+        graphics_state.dirty_x1 = x + w;
+        graphics_state.dirty_y1 = y + h;
+        return;
+    }
+    if (x < graphics_state.dirty_x0)
+        graphics_state.dirty_x0 = x;
+    if (y < graphics_state.dirty_y0)
+        graphics_state.dirty_y0 = y;
+    if (x + w > graphics_state.dirty_x1)
+        graphics_state.dirty_x1 = x + w;
+    if (y + h > graphics_state.dirty_y1)
+        graphics_state.dirty_y1 = y + h;
+}
+
+static void fill_pixels(uint32_t *dst, uint32_t color, size_t count) {
+    __asm__ volatile (
+        "rep stosl"
+        : "+D"(dst), "+c"(count)
+        : "a"(color)
+        : "memory"
+    );
+}
+
+void graphics_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color) {
+    if (x >= graphics_state.width || y >= graphics_state.height)
+        return;
+    if (w > graphics_state.width - x)
+        w = graphics_state.width - x;
+    if (h > graphics_state.height - y)
+        h = graphics_state.height - y;
+    if (w == 0 || h == 0)
+        return;
+
+    uint32_t *dst = graphics_back_buffer + y * graphics_state.width + x;
+    for (uint32_t i = 0; i < h; i++, dst += graphics_state.width)
+        fill_pixels(dst, color, w);
+    graphics_mark_dirty(x, y, w, h);
+}
+
+static void graphics_set_expand(uint8_t fg, uint8_t bg) {
+    if (fg == graphics_state.expand_fg && bg == graphics_state.expand_bg)
+        return;
+
+    uint32_t fg_pixel = graphics_palette[fg & 0xF];
+    uint32_t bg_pixel = graphics_palette[bg & 0xF];
+    for (uint8_t bits = 0; bits < 16; bits++)
+        for (uint8_t i = 0; i < 4; i++)
+            graphics_state.expand[bits][i] = bits & (0x8 >> i) ? fg_pixel : bg_pixel;
+    graphics_state.expand_fg = fg;
+    graphics_state.expand_bg = bg;
+}
+
+// glyph into the back buffer without dirty tracking, the caller marks the whole run
+static void graphics_blit_glyph(uint32_t row, uint32_t col, char c) {
+    uint8_t index         = (uint8_t) c < FONT_GLYPH_COUNT ? (uint8_t) c : 0;
+    const uint8_t *glyph  = font_glyphs[index];
+    uint32_t stride       = graphics_state.width;
+    uint32_t *dst         = graphics_back_buffer + row * FONT_HEIGHT * stride + col * FONT_WIDTH;
+
+    // each row of glyph bits is two table lookups and eight dword stores
+    for (uint8_t y = 0; y < FONT_HEIGHT; y++, dst += stride) {
+        const uint32_t *left  = graphics_state.expand[glyph[y] >> 4];
+        const uint32_t *right = graphics_state.expand[glyph[y] & 0xF];
+        dst[0] = left[0];
+        dst[1] = left[1];
+        dst[2] = left[2];
+        dst[3] = left[3];
+        dst[4] = right[0];
+        dst[5] = right[1];
+        dst[6] = right[2];
+        dst[7] = right[3];
+    }
+}
+
+void graphics_put_char(uint32_t row, uint32_t col, char c, uint8_t fg, uint8_t bg) {
+    if (row >= graphics_state.rows || col >= graphics_state.columns)
+        return;
+    graphics_set_expand(fg, bg);
+    graphics_blit_glyph(row, col, c);
+    graphics_mark_dirty(col * FONT_WIDTH, row * FONT_HEIGHT, FONT_WIDTH, FONT_HEIGHT);
+}
+
+static void graphics_scroll(uint8_t bg) {
+    // one block move of every text row but the first, the flush rewrites the whole screen
+    uint32_t row_pixels = FONT_HEIGHT * graphics_state.width;
+    memmove(graphics_back_buffer, graphics_back_buffer + row_pixels,
+            (graphics_state.rows - 1) * row_pixels * sizeof(uint32_t));
+    graphics_fill_rect(0, (graphics_state.rows - 1) * FONT_HEIGHT, graphics_state.width, FONT_HEIGHT,
+                       graphics_palette[bg & 0xF]);
+    graphics_mark_dirty(0, 0, graphics_state.width, graphics_state.rows * FONT_HEIGHT);
+}
+
+static void graphics_newline(uint8_t bg) {
+    graphics_state.col = 0;
+    if (graphics_state.row + 1 < graphics_state.rows)
+        graphics_state.row++;
+    else
+        graphics_scroll(bg);
+}
+
+static void graphics_control(char c, uint8_t fg, uint8_t bg) {
+    switch (c) {
+        case '\n':
+            graphics_newline(bg);
+            break;
+        case '\r':
+            graphics_state.col = 0;
+            break;
+        case '\t': {
+            uint32_t spaces = GRAPHICS_TAB_WIDTH - graphics_state.col % GRAPHICS_TAB_WIDTH;
+            for (uint32_t i = 0; i < spaces; i++)
+                graphics_put_char(graphics_state.row, graphics_state.col + i, ' ', fg, bg);
+            graphics_state.col += spaces;
+            if (graphics_state.col >= graphics_state.columns)
+                graphics_newline(bg);
+            break;
+        }
+        case '\b':
+            if (graphics_state.col > 0) {
+                graphics_state.col--;
+                graphics_put_char(graphics_state.row, graphics_state.col, ' ', fg, bg);
+            }
+            break;
+    }
+}
+
+void graphics_console_write(const char *s, size_t n, uint8_t fg, uint8_t bg) {
+    graphics_set_expand(fg, bg);
+
+    size_t i = 0;
+    while (i < n) {
+        if ((uint8_t) s[i] < ' ') {
+            graphics_control(s[i++], fg, bg);
+            continue;
+        }
+
+        // printable run up to the next control character or the end of the row, one dirty update per run
+        uint32_t start = graphics_state.col;
+        while (i < n && (uint8_t) s[i] >= ' ' && graphics_state.col < graphics_state.columns)
+            graphics_blit_glyph(graphics_state.row, graphics_state.col++, s[i++]);
+        graphics_mark_dirty(start * FONT_WIDTH, graphics_state.row * FONT_HEIGHT,
+                            (graphics_state.col - start) * FONT_WIDTH, FONT_HEIGHT);
+        if (graphics_state.col == graphics_state.columns)
+            graphics_newline(bg);
+    }
+
+    graphics_flush();
+}
+
+void graphics_console_clear(uint8_t bg) {
+    graphics_fill_rect(0, 0, graphics_state.width, graphics_state.height, graphics_palette[bg & 0xF]);
+    graphics_state.row = 0;
+    graphics_state.col = 0;
+    graphics_flush();
+}
+
+void graphics_flush(void) {
+    if (!graphics_state.active)
+        return;
+
+    // the cursor is drawn on the framebuffer only, restore the cell it was drawn on if it moved
+    if (graphics_state.cursor_row != graphics_state.row || graphics_state.cursor_col != graphics_state.col) {
+        if (graphics_state.cursor_row < graphics_state.rows && graphics_state.cursor_col < graphics_state.columns)
+            graphics_mark_dirty(graphics_state.cursor_col * FONT_WIDTH, graphics_state.cursor_row * FONT_HEIGHT,
+                                FONT_WIDTH, FONT_HEIGHT);
+        graphics_state.cursor_row = graphics_state.row;
+        graphics_state.cursor_col = graphics_state.col;
+    }
+
+    if (graphics_state.dirty_x1) {
+        uint32_t bytes = (graphics_state.dirty_x1 - graphics_state.dirty_x0) * sizeof(uint32_t);
+        for (uint32_t y = graphics_state.dirty_y0; y < graphics_state.dirty_y1; y++)
+            memcpy(graphics_state.lfb + y * graphics_state.pitch + graphics_state.dirty_x0 * sizeof(uint32_t),
+                   graphics_back_buffer + y * graphics_state.width + graphics_state.dirty_x0, bytes);
+        graphics_state.dirty_x1 = 0;
+    }
+
+    // underline on the bottom two pixel rows of the cursor cell
+    if (graphics_state.cursor_row < graphics_state.rows && graphics_state.cursor_col < graphics_state.columns) {
+        for (uint32_t y = FONT_HEIGHT - 2; y < FONT_HEIGHT; y++) {
+            uint32_t *dst = (uint32_t*) (graphics_state.lfb + (graphics_state.cursor_row * FONT_HEIGHT + y) * graphics_state.pitch)
+                          + graphics_state.cursor_col * FONT_WIDTH;
+            fill_pixels(dst, graphics_palette[0x7], FONT_WIDTH);
+        }
+    }
+}
+
+static uint32_t graphics_cycles_to_us(uint64_t cycles) {
+    uint64_t us = div64_32(cycles * 1000, timer_state.tsc_khz ? timer_state.tsc_khz : 1, NULL);
+    return us >> 32 ? UINT32_MAX : (uint32_t) us;
+}
+
+// every cell of the screen once, printable characters in turn so no glyph stays in the cache
+static void graphics_benchmark_fill(uint32_t screen) {
+    for (uint32_t row = 0; row < graphics_state.rows; row++)
+        for (uint32_t col = 0; col < graphics_state.columns; col++)
+            graphics_blit_glyph(row, col, (char) (' ' + (screen + row + col) % ('~' - ' ' + 1)));
+}
+
+void graphics_benchmark(void) {
+    if (!graphics_state.active) {
+        kprintf("graphics: text mode, nothing to measure\n");
+        return;
+    }
+
+    // the console draws on the same back buffer, keep it out until the screen is cleared again
+    uint32_t flags = spin_lock_irqsave(&console_state.lock);
+    graphics_set_expand(0xF, 0);
+
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t i = 0; i < GRAPHICS_BENCHMARK_SCREENS; i++)
+        graphics_benchmark_fill(i);
+    uint64_t glyph_cycles = cpu_rdtsc() - start;
+
+    start = cpu_rdtsc();
+    for (uint32_t i = 0; i < GRAPHICS_BENCHMARK_SCREENS; i++) {
+        graphics_mark_dirty(0, 0, graphics_state.width, graphics_state.height);
+        graphics_flush();
+    }
+    uint64_t flush_cycles = cpu_rdtsc() - start;
+
+    start = cpu_rdtsc();
+    for (uint32_t i = 0; i < GRAPHICS_BENCHMARK_SCREENS; i++) {
+        graphics_benchmark_fill(i);
+        graphics_mark_dirty(0, 0, graphics_state.width, graphics_state.height);
+        graphics_flush();
+    }
+    uint64_t redraw_cycles = cpu_rdtsc() - start;
+
+    graphics_console_clear(console_state.bg);
+    spin_unlock_irqrestore(&console_state.lock, flags);
+
+    uint32_t glyphs    = GRAPHICS_BENCHMARK_SCREENS * graphics_state.rows * graphics_state.columns;
+    uint32_t glyph_us  = graphics_cycles_to_us(glyph_cycles);
+    kprintf("graphics: %u glyphs, %u glyphs/s, %u cycles per glyph\n", glyphs,
+            glyph_us ? (uint32_t) div64_32((uint64_t) glyphs * 1000000, glyph_us, NULL) : 0,
+            (uint32_t) div64_32(glyph_cycles, glyphs, NULL));
+    kprintf("graphics: %ux%u flush %u us, full-screen redraw %u us\n", graphics_state.width, graphics_state.height,
+            graphics_cycles_to_us(div64_32(flush_cycles, GRAPHICS_BENCHMARK_SCREENS, NULL)),
+            graphics_cycles_to_us(div64_32(redraw_cycles, GRAPHICS_BENCHMARK_SCREENS, NULL)));
+}
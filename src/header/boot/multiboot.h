@@ -0,0 +1,81 @@
+#ifndef _MULTIBOOT_H
+#define _MULTIBOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Multiboot (version 1) boot information
+ * - reference: https://www.gnu.org/software/grub/manual/multiboot/multiboot.html#Boot-information-format
+ * The bootloader leaves MULTIBOOT_BOOTLOADER_MAGIC in eax and the address of
+ * struct MultibootInfo in ebx, loader passes both to kernel_setup().
+ */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* -- MultibootInfo.flags, which fields are valid -- */
+#define MULTIBOOT_INFO_MEMORY      0x00000001 // mem_lower, mem_upper
+#define MULTIBOOT_INFO_CMDLINE     0x00000004
+#define MULTIBOOT_INFO_MEM_MAP     0x00000040 // mmap_length, mmap_addr
+#define MULTIBOOT_INFO_VBE_INFO    0x00000800
+#define MULTIBOOT_INFO_FRAMEBUFFER 0x00001000 // framebuffer_*
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1 // MultibootMemoryMap.type of RAM the kernel may use
+
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED 0
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB     1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_TEXT    2
+
+struct MultibootInfo {
+    uint32_t flags;
+
+    uint32_t mem_lower; // KiB of memory below 1 MiB
+    uint32_t mem_upper; // KiB of memory from 1 MiB to the first hole
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+
+    uint64_t framebuffer_addr;
+    uint32_t framebuffer_pitch; // bytes per scanline
+    uint32_t framebuffer_width;
+    uint32_t framebuffer_height;
+    uint8_t  framebuffer_bpp;
+    uint8_t  framebuffer_type;
+    uint8_t  color_info[6];
+} __attribute__((packed));
+
+/**
+ * MultibootMemoryMap, one entry of the BIOS memory map at mmap_addr.
+ * size does not count itself, the next entry starts size + 4 bytes later.
+ *
+ * @param size   Bytes of the entry after this field
+ * @param addr   Physical start of the range
+ * @param length Bytes in the range
+ * @param type   MULTIBOOT_MEMORY_AVAILABLE for usable RAM, anything else is reserved
+ */
+struct MultibootMemoryMap {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t length;
+    uint32_t type;
+} __attribute__((packed));
+
+#endif
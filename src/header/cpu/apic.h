@@ -0,0 +1,219 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -- Local APIC, Intel x86 Vol 3a - 10.4 -- */
+#define IA32_APIC_BASE_MSR        0x1B
+#define IA32_APIC_BASE_ENABLE     (1 << 11)
+#define IA32_APIC_BASE_ADDRESS    0xFFFFF000
+
+// register offsets from the LAPIC base, every register is a 32-bit word on a 16-byte boundary
+#define LAPIC_ID                  0x020
+#define LAPIC_VERSION             0x030
+#define LAPIC_TPR                 0x080
+#define LAPIC_EOI                 0x0B0
+#define LAPIC_SPURIOUS            0x0F0
+#define LAPIC_ESR                 0x280
+#define LAPIC_ICR_LOW             0x300
+#define LAPIC_ICR_HIGH            0x310
+#define LAPIC_LVT_LINT0           0x350
+#define LAPIC_LVT_LINT1           0x360
+#define LAPIC_LVT_TIMER           0x320
+#define LAPIC_LVT_ERROR           0x370
+#define LAPIC_TIMER_INITIAL       0x380
+#define LAPIC_TIMER_CURRENT       0x390
+#define LAPIC_TIMER_DIVIDE        0x3E0
+
+#define LAPIC_SPURIOUS_ENABLE     (1 << 8)
+#define LAPIC_LVT_MASKED          (1 << 16)
+#define LAPIC_TIMER_PERIODIC      (1 << 17) // else one-shot
+#define LAPIC_TIMER_DIVIDE_BY_16  0x3
+
+// interrupt command register, the IPI is sent when the low half is written
+#define LAPIC_ICR_INIT            (5 << 8)
+#define LAPIC_ICR_STARTUP         (6 << 8)  // vector is the 4 KiB page the processor starts at
+#define LAPIC_ICR_PENDING         (1 << 12)
+#define LAPIC_ICR_ASSERT          (1 << 14)
+#define LAPIC_ICR_DESTINATION_SHIFT 24
+
+#define APIC_EOI_BENCHMARK_ROUNDS 10000
+
+// last vector with an isr_stub_table entry, low nibble 0xF as older APICs require
+#define APIC_SPURIOUS_VECTOR      0x3F
+#define APIC_ERROR_VECTOR         0x3E
+#define APIC_TIMER_VECTOR         0x3D
+
+/* -- I/O APIC, 82093AA datasheet -- */
+#define IOAPIC_REGSEL             0x00 // byte offset of the index register
+#define IOAPIC_WINDOW             0x10 // byte offset of the data register
+#define IOAPIC_REG_VERSION        0x01
+#define IOAPIC_REG_REDIRECTION    0x10 // entry n is registers 0x10 + 2n (low) and 0x11 + 2n (high)
+
+#define IOAPIC_ACTIVE_LOW         (1 << 13)
+#define IOAPIC_LEVEL_TRIGGERED    (1 << 15)
+#define IOAPIC_MASKED             (1 << 16)
+
+/* -- ACPI tables used to find the APICs -- */
+#define ACPI_RSDP_SIGNATURE       "RSD PTR "
+#define ACPI_MADT_SIGNATURE       "APIC"
+#define ACPI_EBDA_SEGMENT_POINTER 0x040E
+#define ACPI_BIOS_AREA_START      0x000E0000
+#define ACPI_BIOS_AREA_END        0x00100000
+
+#define MADT_TYPE_LAPIC           0
+#define MADT_TYPE_IOAPIC          1
+#define MADT_TYPE_OVERRIDE        2
+#define MADT_LAPIC_ENABLED        (1 << 0)
+#define MADT_POLARITY_MASK        0x3
+#define MADT_POLARITY_LOW         0x3
+#define MADT_TRIGGER_MASK         0xC
+#define MADT_TRIGGER_LEVEL        0xC
+
+#define APIC_MAX_CPUS             16
+#define APIC_ISA_IRQ_COUNT        16
+
+/**
+ * ACPIRSDP, root system description pointer (ACPI 1.0 part)
+ * Found on a 16-byte boundary in the EBDA or the BIOS area below 1 MiB
+ */
+struct ACPIRSDP {
+    char     signature[8];
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt_address;
+} __attribute__((packed));
+
+/**
+ * ACPISDTHeader, common header of every ACPI table. Bytes of the whole table sum to 0.
+ */
+struct ACPISDTHeader {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+/**
+ * ACPIMADT, multiple APIC description table. entries is a list of
+ * (type, length, ...) records up to header.length.
+ */
+struct ACPIMADT {
+    struct ACPISDTHeader header;
+    uint32_t             lapic_address;
+    uint32_t             flags;
+    uint8_t              entries[];
+} __attribute__((packed));
+
+/**
+ * APICState, interrupt controller configuration found at boot
+ *
+ * @param active           IRQs go through the IOAPIC and are acknowledged at the LAPIC, else the 8259 is used
+ * @param lapic            LAPIC register base
+ * @param ioapic           IOAPIC register base
+ * @param ioapic_gsi_base  First global system interrupt of the IOAPIC
+ * @param ioapic_entries   Redirection entries of the IOAPIC
+ * @param cpu_count        Enabled processors listed in the MADT
+ * @param cpu_apic_id      LAPIC ID of each processor, the boot processor included
+ * @param irq_gsi          Global system interrupt of each ISA IRQ after MADT overrides
+ * @param irq_flags        MADT polarity and trigger flags of each ISA IRQ
+ * @param errors           LAPIC error interrupts received
+ * @param last_error       LAPIC error status register read by the last error interrupt
+ */
+struct APICState {
+    bool              active;
+    volatile uint8_t  *lapic;
+    volatile uint32_t *ioapic;
+    uint32_t          ioapic_gsi_base;
+    uint8_t           ioapic_entries;
+    uint8_t           cpu_count;
+    uint8_t           cpu_apic_id[APIC_MAX_CPUS];
+    uint32_t          irq_gsi[APIC_ISA_IRQ_COUNT];
+    uint16_t          irq_flags[APIC_ISA_IRQ_COUNT];
+    uint32_t          errors;
+    uint32_t          last_error;
+};
+
+extern struct APICState apic_state;
+
+/**
+ * Switch interrupt delivery from the 8259 to the LAPIC and IOAPIC.
+ * Needs CPUID APIC support and an ACPI MADT with an IOAPIC, else nothing is
+ * changed and the 8259 stays in use. Call after pic_remap(), which leaves the
+ * 8259 masked. Every IOAPIC entry starts masked, see apic_enable_irq().
+ *
+ * @return True when the APIC is active
+ */
+bool apic_init(void);
+
+/**
+ * Enable the LAPIC of an application processor the way apic_init() set up the
+ * boot processor's. Only after apic_init() returned true.
+ */
+void apic_init_ap(void);
+
+/**
+ * Send an interprocessor interrupt and wait until the LAPIC accepted it
+ *
+ * @param apic_id LAPIC ID of the target processor
+ * @param command ICR low half, LAPIC_ICR_* delivery mode and vector
+ */
+void apic_send_ipi(uint8_t apic_id, uint32_t command);
+
+/**
+ * Read a LAPIC register of the running processor
+ *
+ * @param reg Register offset, LAPIC_*
+ * @return    Register value
+ */
+uint32_t lapic_read(uint32_t reg);
+
+/**
+ * Write a LAPIC register of the running processor
+ *
+ * @param reg   Register offset, LAPIC_*
+ * @param value Value
+ */
+void lapic_write(uint32_t reg, uint32_t value);
+
+/**
+ * Signal end of interrupt to the LAPIC
+ */
+void apic_eoi(void);
+
+/**
+ * Route ISA IRQ to vector PIC1_OFFSET + irq on the boot processor and unmask it
+ *
+ * @param irq ISA IRQ number 0-15
+ */
+void apic_enable_irq(uint8_t irq);
+
+/**
+ * Mask ISA IRQ at the IOAPIC
+ *
+ * @param irq ISA IRQ number 0-15
+ */
+void apic_disable_irq(uint8_t irq);
+
+/**
+ * @return LAPIC ID of the running processor
+ */
+uint8_t apic_current_id(void);
+
+/**
+ * Time APIC_EOI_BENCHMARK_ROUNDS apic_eoi() calls against as many pic_ack()
+ * calls for an IRQ on the master and on the slave 8259, with interrupts off,
+ * and print cycles per EOI with kprintf(). Nothing is in service, so every
+ * EOI is ignored by the controller; only the cost of the write is measured.
+ */
+void apic_eoi_benchmark(void);
+
+#endif
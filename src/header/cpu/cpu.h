@@ -0,0 +1,63 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define EFLAGS_INTERRUPT_ENABLE (1 << 9) // IF
+
+#define CPUID_FEATURES          0x1
+#define CPUID_FEATURE_EDX_TSC   (1 << 4)
+#define CPUID_FEATURE_EDX_MSR   (1 << 5)
+#define CPUID_FEATURE_EDX_APIC  (1 << 9)
+
+/**
+ * Read the time stamp counter, cycles since reset at a constant rate on current CPUs
+ *
+ * @return TSC value
+ */
+uint64_t cpu_rdtsc(void);
+
+/**
+ * Execute cpuid for leaf, subleaf 0
+ *
+ * @param leaf Value of eax
+ * @param eax  Output, may be NULL
+ * @param ebx  Output, may be NULL
+ * @param ecx  Output, may be NULL
+ * @param edx  Output, may be NULL
+ */
+void cpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx);
+
+/**
+ * Read a model specific register
+ *
+ * @param msr MSR index
+ * @return    edx:eax
+ */
+uint64_t cpu_rdmsr(uint32_t msr);
+
+/**
+ * Write a model specific register
+ *
+ * @param msr   MSR index
+ * @param value Written as edx:eax
+ */
+void cpu_wrmsr(uint32_t msr, uint64_t value);
+
+/**
+ * Disable interrupts and return the previous eflags, for cpu_interrupt_restore()
+ *
+ * @return eflags before cli
+ */
+uint32_t cpu_interrupt_save(void);
+
+/**
+ * Enable interrupts again if they were enabled when flags was saved
+ *
+ * @param flags Value returned by cpu_interrupt_save()
+ */
+void cpu_interrupt_restore(uint32_t flags);
+
+#endif
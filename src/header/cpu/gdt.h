@@ -11,6 +11,9 @@
 */ 
 #define GDT_KERNEL_CODE_SEGMENT_SELECTOR 0x8
 #define GDT_KERNEL_DATA_SEGMENT_SELECTOR 0x10
+// Set per processor by smp_cpu_local_init(), its GDT points both at the processor's own TSS and CPULocal
+#define GDT_TSS_SELECTOR                 0x18
+#define GDT_CPU_LOCAL_SELECTOR           0x20
 
 extern struct GDTR _gdt_gdtr;
 
@@ -64,6 +67,28 @@ struct SegmentDescriptor {
         struct SegmentDescriptor table[GDT_MAX_ENTRY_COUNT];
     } __attribute__((packed));
 
+extern struct GlobalDescriptorTable global_descriptor_table;
+
+/**
+ * TaskStateSegment, 32-bit TSS (Intel x86 Vol 3a - 7.2.1). Without hardware task
+ * switching only ss0 / esp0, the stack of ring 0 entries from a lower privilege,
+ * and the I/O map base are used.
+ *
+ * @param prev_task   Unused link field
+ * @param esp0        Stack pointer loaded on a privilege change into ring 0
+ * @param ss0         Stack segment loaded with esp0
+ * @param unused      Register save area of hardware task switching
+ * @param iomap_base  Offset of the I/O permission bitmap, past the limit means none
+ */
+struct TaskStateSegment {
+    uint32_t prev_task;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t unused[22];
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
 /**
  * GDTR, carrying information where's the GDT located and GDT size.
  * Global kernel variable defined at memory.c.
@@ -19,6 +19,15 @@
 #define PIC2_COMMAND         PIC2
 #define PIC2_DATA            (PIC2 + 1)
 
+// Vectors with an entry in isr_stub_table, and so in the handler table
+#define INTERRUPT_VECTOR_COUNT 64
+
+// Latency histogram buckets, bucket i counts interrupts taking [2^i, 2^(i+1)) cycles
+#define INTERRUPT_HISTOGRAM_BUCKETS 32
+
+// 8259 OCW3 command to read the in-service register, used to tell spurious IRQ7 / IRQ15 apart
+#define PIC_READ_ISR         0x0B
+
 // PIC ACK & mask constant
 #define PIC_ACK              0x20
 #define PIC_DISABLE_ALL_MASK 0xFF
@@ -127,9 +136,141 @@ struct InterruptFrame {
 
 
 
-// Activate PIC mask for keyboard only
+/**
+ * Interrupt handler called by main_interrupt_handler() for its vector.
+ * Handlers of PIC IRQs send their own pic_ack().
+ *
+ * @param frame CPU state saved on interrupt entry, changes are restored on return
+ * @param ctx   Pointer given to register_irq_handler()
+ */
+typedef void (*irq_handler_t)(struct InterruptFrame *frame, void *ctx);
+
+/**
+ * InterruptHandlerEntry, one slot of the dispatch table indexed by vector
+ *
+ * @param handler Function called for the vector
+ * @param ctx     Passed to handler unchanged
+ */
+struct InterruptHandlerEntry {
+    irq_handler_t handler;
+    void          *ctx;
+};
+
+/**
+ * InterruptVectorStats, cost of one vector measured by call_generic_handler
+ * from after the registers are saved until main_interrupt_handler() returns,
+ * deferred work included
+ *
+ * @param count        Interrupts taken
+ * @param total_cycles Sum of TSC cycles of all of them
+ * @param max_cycles   Slowest one, saturated at UINT32_MAX
+ * @param histogram    Count per log2 of the cycles taken
+ */
+struct InterruptVectorStats {
+    uint32_t count;
+    uint64_t total_cycles;
+    uint32_t max_cycles;
+    uint32_t histogram[INTERRUPT_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * InterruptStats, instrumentation of every vector in isr_stub_table. Every
+ * processor keeps its own in CPULocal, so the counters are plain increments.
+ *
+ * @param vectors        Per-vector statistics
+ * @param spurious_irq7  IRQ7 raised by the master 8259 with no interrupt in service
+ * @param spurious_irq15 IRQ15 raised by the slave 8259 with no interrupt in service
+ */
+struct InterruptStats {
+    struct InterruptVectorStats vectors[INTERRUPT_VECTOR_COUNT];
+    uint32_t                    spurious_irq7;
+    uint32_t                    spurious_irq15;
+};
+
+// Interrupts raised per vector that had no registered handler
+extern uint32_t unhandled_interrupt_count[INTERRUPT_VECTOR_COUNT];
+
+// Longest handler run in TSC cycles, the time interrupts stay disabled before deferred work starts
+extern uint64_t interrupt_disabled_max_cycles;
+
+// Interrupt handlers running, deferred work included, 0 in thread context
+extern uint32_t interrupt_nesting;
+
+/**
+ * Install fn as the handler of vector, replacing the previous one
+ *
+ * @param vector Interrupt vector, below INTERRUPT_VECTOR_COUNT
+ * @param fn     Handler
+ * @param ctx    Passed to fn on every call
+ * @return       False when vector has no stub in isr_stub_table
+ */
+bool register_irq_handler(uint8_t vector, irq_handler_t fn, void *ctx);
+
+/**
+ * Return vector to the default handler, which only counts it and acknowledges PIC IRQs
+ *
+ * @param vector Interrupt vector, below INTERRUPT_VECTOR_COUNT
+ */
+void unregister_irq_handler(uint8_t vector);
+
+/**
+ * Add one interrupt to the statistics of its vector. Called by call_generic_handler
+ * after main_interrupt_handler() returns, with interrupts disabled.
+ * DO NOT CALL THIS FUNCTION.
+ *
+ * @param vector    Interrupt vector
+ * @param entry_tsc TSC read on interrupt entry
+ */
+void interrupt_stats_record(uint32_t vector, uint64_t entry_tsc);
+
+/**
+ * Sum the statistics of a vector over all processors. Only the running
+ * processor's share is consistent, the others may be counting meanwhile.
+ *
+ * @param vector Interrupt vector, below INTERRUPT_VECTOR_COUNT
+ * @param stats  Destination
+ * @return       False when vector is out of range
+ */
+bool interrupt_get_stats(uint8_t vector, struct InterruptVectorStats *stats);
+
+/**
+ * Clear the interrupt statistics of every processor. Counts other processors
+ * record while this runs may survive partly.
+ */
+void interrupt_stats_reset(void);
+
+/**
+ * Print every vector that fired with its count, average and maximum cycles and
+ * non empty histogram buckets, then the spurious IRQ counts, with kprintf().
+ * Also meant to be run from the debugger: (gdb) call interrupt_stats_dump()
+ */
+void interrupt_stats_dump(void);
+
+// Unmask the keyboard IRQ at the active interrupt controller
 void activate_keyboard_interrupt(void);
 
+/**
+ * Signal end of interrupt for an ISA IRQ to the active controller,
+ * the LAPIC when apic_init() succeeded, else the 8259s
+ *
+ * @param irq ISA IRQ number 0-15, not the vector
+ */
+void irq_eoi(uint8_t irq);
+
+/**
+ * Unmask an ISA IRQ at the active controller, it is raised as vector PIC1_OFFSET + irq
+ *
+ * @param irq ISA IRQ number 0-15
+ */
+void irq_enable(uint8_t irq);
+
+/**
+ * Mask an ISA IRQ at the active controller
+ *
+ * @param irq ISA IRQ number 0-15
+ */
+void irq_disable(uint8_t irq);
+
 // I/O port wait, around 1-4 microsecond, for I/O synchronization purpose
 void io_wait(void);
 
@@ -139,19 +280,35 @@ void pic_ack(uint8_t irq);
 // Shift PIC interrupt number to PIC1_OFFSET and PIC2_OFFSET (master and slave)
 void pic_remap(void);
 
+/**
+ * Halt the CPU until ready() returns true. ready() is checked with interrupts
+ * disabled and the CPU sleeps with "sti; hlt": sti takes effect only after hlt
+ * starts, so an interrupt that makes ready() true cannot slip in between the
+ * check and the halt. Every ISR wakes the CPU for another check.
+ * Must be called with interrupts enabled, they are enabled again on return.
+ *
+ * @param ready Condition set by an interrupt handler, e.g. keyboard_has_input
+ */
+void interrupt_wait_until(bool (*ready)(void));
+
 /**
  * Main interrupt handler when any interrupt / exception is raised.
  * DO NOT CALL THIS FUNCTION.
  * 
  * This function will be called first if any INT 0x00 - 0x40 is raised, 
- * and will call proper ISR for respective interrupt / exception.
+ * and will call the handler registered for the vector with register_irq_handler(),
+ * then run deferred work queued with work_queue() with interrupts enabled.
  * 
  * If inter-privilege interrupt raised, SS and ESP is automatically out of main_interrupt_handler()
  * parameter. Can be checked with ((int*) info) + 4 for user $esp, 5 for user $ss
  * 
+ * On the outermost interrupt the scheduler may pick another thread, call_generic_handler
+ * then restores the frame returned instead of the one it saved.
+ *
  * Again, this function is not for normal function call, all parameter will be automatically set when interrupt is called.
- * @param frame Information about CPU during interrupt is raised
+ * @param frame Information about CPU during interrupt is raised, on the interrupted stack
+ * @return      Frame to resume
  */
-void main_interrupt_handler(struct InterruptFrame frame);
+struct InterruptFrame* main_interrupt_handler(struct InterruptFrame *frame);
 
 #endif
\ No newline at end of file
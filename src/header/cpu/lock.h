@@ -0,0 +1,208 @@
+#ifndef _LOCK_H
+#define _LOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RWLOCK_WRITER   (1u << 0)  // a writer holds the lock
+#define RWLOCK_WAITING  (1u << 1)  // a writer waits, new readers hold back so it is not starved
+#define RWLOCK_READER   (1u << 2)  // one reader, the count is state / RWLOCK_READER
+
+/**
+ * LockStats, contention of one lock, recorded when built with LOCK_STATS.
+ * Fields other than the reader counts are only written while the lock is held
+ * exclusively, so they need no atomics.
+ *
+ * @param name            Name given to the lock initializer
+ * @param acquisitions    Times the lock was taken
+ * @param contended       Acquisitions that had to wait
+ * @param wait_cycles     TSC cycles spent waiting, all acquisitions
+ * @param hold_cycles     TSC cycles held exclusively, all acquisitions
+ * @param max_hold_cycles Longest exclusive hold
+ * @param hold_start      TSC of the current exclusive acquisition
+ * @param registered      Linked into the list lock_stats_dump() prints
+ * @param next            Next registered lock
+ */
+struct LockStats {
+    const char       *name;
+    uint32_t         acquisitions;
+    uint32_t         contended;
+    uint64_t         wait_cycles;
+    uint64_t         hold_cycles;
+    uint64_t         max_hold_cycles;
+    uint64_t         hold_start;
+    volatile bool    registered;
+    struct LockStats *next;
+};
+
+#ifdef LOCK_STATS
+#define LOCK_STATS_FIELD          struct LockStats stats;
+#define LOCK_STATS_INIT(lock_name) , .stats = {.name = (lock_name)}
+#else
+#define LOCK_STATS_FIELD
+#define LOCK_STATS_INIT(lock_name)
+#endif
+
+/**
+ * Spinlock, FIFO ticket lock. An acquirer takes the next ticket and spins until
+ * owner reaches it, so waiters are served in arrival order.
+ *
+ * @param next  Next ticket handed out
+ * @param owner Ticket allowed to hold the lock
+ */
+struct Spinlock {
+    volatile uint16_t next;
+    volatile uint16_t owner;
+    LOCK_STATS_FIELD
+};
+
+#define SPINLOCK_INIT(lock_name) {.next = 0, .owner = 0 LOCK_STATS_INIT(lock_name)}
+
+/**
+ * RWLock, spinning reader-writer lock for read-mostly data. Readers share it,
+ * a waiting writer blocks new readers and gets it once the current ones leave.
+ *
+ * @param state RWLOCK_WRITER, RWLOCK_WAITING and the reader count in units of RWLOCK_READER
+ */
+struct RWLock {
+    volatile uint32_t state;
+    LOCK_STATS_FIELD
+};
+
+#define RWLOCK_INIT(lock_name) {.state = 0 LOCK_STATS_INIT(lock_name)}
+
+/**
+ * Seqlock, for small data read far more often than written, like clock state.
+ * Writers serialize on lock and make sequence odd while they write; readers do
+ * not write shared memory at all and retry when sequence changed under them.
+ *
+ * @param sequence Even when no write is in progress
+ * @param lock     Serializes writers
+ */
+struct Seqlock {
+    volatile uint32_t sequence;
+    struct Spinlock   lock;
+};
+
+#define SEQLOCK_INIT(lock_name) {.sequence = 0, .lock = SPINLOCK_INIT(lock_name)}
+
+/**
+ * @param lock Lock to set up unlocked, same as SPINLOCK_INIT
+ * @param name Name in lock statistics
+ */
+void spinlock_init(struct Spinlock *lock, const char *name);
+
+/**
+ * Take lock, spinning while it is held. Interrupts are left as they are, use
+ * spin_lock_irqsave() if an interrupt handler takes the same lock.
+ *
+ * @param lock Lock
+ */
+void spin_lock(struct Spinlock *lock);
+
+/**
+ * @param lock Lock held by the caller
+ */
+void spin_unlock(struct Spinlock *lock);
+
+/**
+ * Take lock without waiting
+ *
+ * @param lock Lock
+ * @return     True when the lock is now held
+ */
+bool spin_trylock(struct Spinlock *lock);
+
+/**
+ * Disable interrupts, then take lock
+ *
+ * @param lock Lock
+ * @return     eflags for spin_unlock_irqrestore()
+ */
+uint32_t spin_lock_irqsave(struct Spinlock *lock);
+
+/**
+ * Release lock, then enable interrupts again if they were enabled before
+ *
+ * @param lock  Lock held by the caller
+ * @param flags Value returned by spin_lock_irqsave()
+ */
+void spin_unlock_irqrestore(struct Spinlock *lock, uint32_t flags);
+
+/**
+ * @param lock Lock to set up unlocked, same as RWLOCK_INIT
+ * @param name Name in lock statistics
+ */
+void rwlock_init(struct RWLock *lock, const char *name);
+
+/**
+ * Take lock shared with interrupts disabled
+ *
+ * @param lock Lock
+ * @return     eflags for read_unlock_irqrestore()
+ */
+uint32_t read_lock_irqsave(struct RWLock *lock);
+
+/**
+ * @param lock  Lock held shared by the caller
+ * @param flags Value returned by read_lock_irqsave()
+ */
+void read_unlock_irqrestore(struct RWLock *lock, uint32_t flags);
+
+/**
+ * Take lock exclusive with interrupts disabled
+ *
+ * @param lock Lock
+ * @return     eflags for write_unlock_irqrestore()
+ */
+uint32_t write_lock_irqsave(struct RWLock *lock);
+
+/**
+ * @param lock  Lock held exclusive by the caller
+ * @param flags Value returned by write_lock_irqsave()
+ */
+void write_unlock_irqrestore(struct RWLock *lock, uint32_t flags);
+
+/**
+ * @param lock Lock to set up, same as SEQLOCK_INIT
+ * @param name Name in lock statistics
+ */
+void seqlock_init(struct Seqlock *lock, const char *name);
+
+/**
+ * Start a write, readers that overlap it will retry
+ *
+ * @param lock Lock
+ * @return     eflags for write_sequnlock_irqrestore()
+ */
+uint32_t write_seqlock_irqsave(struct Seqlock *lock);
+
+/**
+ * @param lock  Lock written by the caller
+ * @param flags Value returned by write_seqlock_irqsave()
+ */
+void write_sequnlock_irqrestore(struct Seqlock *lock, uint32_t flags);
+
+/**
+ * Start a read, waits while a write is in progress
+ *
+ * @param lock Lock
+ * @return     Sequence to pass to read_seqretry()
+ */
+uint32_t read_seqbegin(const struct Seqlock *lock);
+
+/**
+ * @param lock  Lock
+ * @param start Value returned by read_seqbegin()
+ * @return      True when a write overlapped the read and it must be repeated
+ */
+bool read_seqretry(const struct Seqlock *lock, uint32_t start);
+
+/**
+ * Print acquisitions, contention, average wait and average / max hold cycles of
+ * every lock taken so far with kprintf(). Needs a build with LOCK_STATS=1.
+ */
+void lock_stats_dump(void);
+
+#endif
@@ -33,4 +33,16 @@ void out16(uint16_t port, uint16_t data);
  */
 uint16_t in16(uint16_t port);
 
+/**
+ * out32:
+ * Sends the given double word to the given I/O port
+ */
+void out32(uint16_t port, uint32_t data);
+
+/**
+ * in32:
+ * Read a double word from the given I/O port
+ */
+uint32_t in32(uint16_t port);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/gdt.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/interrupt.h"
+#include "header/driver/timer.h"
+
+#define SMP_MAX_CPUS          APIC_MAX_CPUS
+#define SMP_STACK_SIZE        8192
+#define SMP_TRAMPOLINE_ADDR   0x8000       // 4 KiB page below 1 MiB, free once the multiboot info was read
+#define SMP_INIT_DELAY_NS     (10 * NS_PER_MS)
+#define SMP_STARTUP_DELAY_NS  (200 * 1000)
+#define SMP_ONLINE_TIMEOUT_NS (100 * NS_PER_MS)
+
+/**
+ * CPULocal, data owned by one processor. The GDT of the processor gives
+ * GDT_CPU_LOCAL_SELECTOR the address of its CPULocal as base, so with gs loaded
+ * with that selector gs:0 is always the running processor's self pointer.
+ *
+ * @param self        Address of this CPULocal, read through gs by cpu_local()
+ * @param index       Processor number, 0 is the boot processor
+ * @param apic_id     LAPIC ID
+ * @param online      Set by the processor once it runs its idle loop
+ * @param boot_ns     From the first startup IPI until online, 0 for the boot processor
+ * @param idle_wakeups Interrupts that ended a hlt of the worker idle loop
+ * @param tlb_generation paging_state.tlb_generation at this processor's last TLB flush
+ * @param stack       Bottom of the kernel stack, NULL for the boot processor which keeps kernel_stack
+ * @param gdt         Copy of global_descriptor_table with this processor's TSS and CPULocal
+ * @param gdtr        Points at gdt
+ * @param tss         Ring 0 stack for entries from lower privilege
+ * @param interrupt_stats Interrupts taken by this processor, only it writes them
+ */
+struct CPULocal {
+    struct CPULocal              *self;
+    uint32_t                     index;
+    uint8_t                      apic_id;
+    volatile bool                online;
+    uint64_t                     boot_ns;
+    uint32_t                     idle_wakeups;
+    volatile uint32_t            tlb_generation;
+    uint8_t                      *stack;
+    struct GlobalDescriptorTable gdt;
+    struct GDTR                  gdtr;
+    struct TaskStateSegment      tss;
+    struct InterruptStats        interrupt_stats;
+};
+
+/**
+ * SMPState
+ *
+ * @param cpu_count Processors online
+ * @param booting   CPULocal the trampoline is bringing up, read by the new processor
+ * @param cpus      CPULocal of each processor, indexed like apic_state.cpu_apic_id
+ */
+struct SMPState {
+    uint32_t        cpu_count;
+    struct CPULocal *volatile booting;
+    struct CPULocal cpus[SMP_MAX_CPUS];
+};
+
+extern struct SMPState smp_state;
+
+/**
+ * Give the boot processor its own GDT, TSS and CPULocal.
+ * Call right after load_gdt(), before interrupts are enabled.
+ */
+void smp_init_bsp(void);
+
+/**
+ * Start every other processor listed in the MADT with INIT-SIPI-SIPI, one at a
+ * time, and print how long each took to come online with kprintf(). Application
+ * processors run task_worker_main(), IRQs stay routed to the boot processor.
+ * Call after apic_init() and timer_init(), the delays use clock_monotonic_ns().
+ *
+ * @return Processors online, the boot processor included
+ */
+uint32_t smp_init(void);
+
+/**
+ * First C code of an application processor, called by the trampoline.
+ * DO NOT CALL THIS FUNCTION.
+ */
+void smp_ap_main(void);
+
+/**
+ * @return CPULocal of the running processor
+ */
+struct CPULocal* cpu_local(void);
+
+/**
+ * @return True on the boot processor
+ */
+bool smp_is_bsp(void);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Deferred work (bottom halves)
+ *
+ * An ISR acknowledges its interrupt, saves what it read from the device and
+ * queues a WorkItem. main_interrupt_handler() runs queued items after the
+ * handler returns, with interrupts enabled, so slow processing does not hold
+ * off other interrupts. Items run one at a time in queue order; an interrupt
+ * arriving meanwhile only appends to the queue and the running loop picks it up.
+ *
+ * An item is queued at most once: queueing it again before it runs is counted
+ * in coalesced and the item runs once. It may be queued again while it runs.
+ *
+ * @param fn         Function to run
+ * @param arg        Passed to fn
+ * @param next       Next queued item, owned by the queue
+ * @param pending    Item is in the queue
+ * @param queued     Times work_queue() added the item
+ * @param coalesced  Times work_queue() found the item already queued
+ * @param runs       Times fn returned
+ * @param max_cycles Longest single run of fn in TSC cycles
+ */
+struct WorkItem {
+    void            (*fn)(void *arg);
+    void            *arg;
+    struct WorkItem *next;
+    bool            pending;
+    uint32_t        queued;
+    uint32_t        coalesced;
+    uint32_t        runs;
+    uint64_t        max_cycles;
+};
+
+/**
+ * WorkQueueState, global FIFO of pending items
+ *
+ * @param head    Oldest pending item
+ * @param tail    Newest pending item
+ * @param running work_run_pending() is running items, nested calls return at once
+ */
+struct WorkQueueState {
+    struct WorkItem *head;
+    struct WorkItem *tail;
+    bool            running;
+};
+
+/**
+ * Set the function of an item and clear its counters
+ *
+ * @param item Item, must not be queued
+ * @param fn   Function to run
+ * @param arg  Passed to fn
+ */
+void work_init(struct WorkItem *item, void (*fn)(void *arg), void *arg);
+
+/**
+ * Queue item to run after the current interrupt handler, or on the next
+ * interrupt when called outside one. Safe to call from ISRs.
+ *
+ * @param item Initialized item
+ * @return     False when the item was already queued
+ */
+bool work_queue(struct WorkItem *item);
+
+/**
+ * Run queued items until the queue is empty. Interrupts are enabled while an
+ * item runs and restored to their previous state on return.
+ */
+void work_run_pending(void);
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "header/cpu/interrupt.h"
+#include "header/process/wait.h"
 
 #define EXT_SCANCODE_UP        0x48
 #define EXT_SCANCODE_DOWN      0x50
@@ -14,6 +15,11 @@
 #define KEYBOARD_DATA_PORT     0x60
 #define EXTENDED_SCANCODE_BYTE 0xE0
 
+#define KEYBOARD_RING_SIZE     256 // entries per ring, must be a power of two
+#define KEYBOARD_RING_MASK     (KEYBOARD_RING_SIZE - 1)
+
+_Static_assert((KEYBOARD_RING_SIZE & KEYBOARD_RING_MASK) == 0, "KEYBOARD_RING_SIZE must be a power of two");
+
 /**
  * keyboard_scancode_1_to_ascii_map[256], Convert scancode values that correspond to ASCII printables
  * How to use this array: ascii_char = k[scancode]
@@ -22,18 +28,40 @@
  */
 extern const char keyboard_scancode_1_to_ascii_map[256];
 
+/**
+ * KeyboardRing - Single producer, single consumer byte queue
+ * keyboard_isr() is the only writer of head, the reader the only writer of tail,
+ * so neither side needs a lock. Both indices run freely and wrap at 2^32,
+ * head - tail is the number of queued bytes.
+ *
+ * @param head     Next slot the producer writes, published with release order after the data
+ * @param tail     Next slot the consumer reads, published with release order after the data is copied out
+ * @param overflow Bytes dropped because the ring was full
+ * @param data     Ring storage, indexed by index & KEYBOARD_RING_MASK
+ */
+struct KeyboardRing {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t overflow;
+    uint8_t  data[KEYBOARD_RING_SIZE];
+};
+
 /**
  * KeyboardDriverState - Contain all driver states
  * 
  * @param read_extended_mode Optional, can be used for signaling next read is extended scancode (ex. arrow keys)
  * @param keyboard_input_on  Indicate whether keyboard ISR is activated or not
- * @param keyboard_buffer    Storing keyboard input values in ASCII
+ * @param scancodes          Every raw scancode byte received, including break and extended codes
+ * @param chars              Scancodes decoded to ASCII, keys without a character are not queued
+ * @param input              Threads in keyboard_wait_input(), woken when a character is queued
  */
 struct KeyboardDriverState {
     bool read_extended_mode;
     bool keyboard_input_on;
-    char keyboard_buffer;
-} __attribute((packed));
+    struct KeyboardRing scancodes;
+    struct KeyboardRing chars;
+    struct WaitQueue input;
+};
 
 
 
@@ -41,21 +69,65 @@ struct KeyboardDriverState {
 
 /* -- Driver Interfaces -- */
 
-// Activate keyboard ISR / start listen keyboard & save to buffer
+// Register keyboard_isr() for IRQ1 and start listen keyboard & save to buffer
 void keyboard_state_activate(void);
 
 // Deactivate keyboard ISR / stop listening keyboard interrupt
 void keyboard_state_deactivate(void);
 
-// Get keyboard buffer value and flush the buffer - @param buf Pointer to char buffer
+// Take the oldest queued character, '\0' when none is queued - @param buf Pointer to char buffer
 void get_keyboard_buffer(char *buf);
 
+/**
+ * Take up to n queued characters in arrival order
+ *
+ * @param buf Destination
+ * @param n   Size of buf
+ * @return    Number of characters copied
+ */
+size_t keyboard_read(char *buf, size_t n);
+
+/**
+ * Take up to n queued raw scancodes in arrival order
+ *
+ * @param buf Destination
+ * @param n   Size of buf
+ * @return    Number of scancodes copied
+ */
+size_t keyboard_read_scancodes(uint8_t *buf, size_t n);
+
+/**
+ * @return True when at least one character is queued
+ */
+bool keyboard_has_input(void);
+
+/**
+ * Wait until keyboard_has_input(). A thread sleeps on keyboard_state.input and
+ * the CPU runs other threads or halts; before threads exist the CPU halts in
+ * interrupt_wait_until(). Must be called with interrupts enabled.
+ */
+void keyboard_wait_input(void);
+
+/**
+ * @return Characters dropped because the character ring was full
+ */
+uint32_t keyboard_char_overflow(void);
+
+/**
+ * @return Scancodes dropped because the scancode ring was full
+ */
+uint32_t keyboard_scancode_overflow(void);
+
 /* -- Keyboard Interrupt Service Routine -- */
 
 /**
  * Handling keyboard interrupt & process scancodes into ASCII character.
  * Will start listen and process keyboard scancode if keyboard_input_on.
+ * Registered for IRQ1 by keyboard_state_activate().
+ *
+ * @param frame Unused
+ * @param ctx   Unused
  */
-void keyboard_isr(void);
+void keyboard_isr(struct InterruptFrame *frame, void *ctx);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef _RTC_H
+#define _RTC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* CMOS real-time clock, MC146818 compatible */
+#define CMOS_ADDRESS           0x70
+#define CMOS_DATA              0x71
+
+#define RTC_SECONDS            0x00
+#define RTC_MINUTES            0x02
+#define RTC_HOURS              0x04
+#define RTC_DAY                0x07
+#define RTC_MONTH              0x08
+#define RTC_YEAR               0x09
+#define RTC_STATUS_A           0x0A
+#define RTC_STATUS_B           0x0B
+
+#define RTC_STATUS_A_UPDATING  0x80 // registers are being updated, reads may be torn
+#define RTC_STATUS_B_24_HOUR   0x02
+#define RTC_STATUS_B_BINARY    0x04 // values are binary instead of BCD
+#define RTC_HOUR_PM            0x80 // in 12 hour mode
+
+#define RTC_CENTURY            2000 // the year register holds two digits, the century register is not standard
+
+/**
+ * RTCTime, calendar time read from the CMOS clock, assumed UTC
+ *
+ * @param year   Full year, e.g. 2024
+ * @param month  1-12
+ * @param day    1-31
+ * @param hour   0-23
+ * @param minute 0-59
+ * @param second 0-59
+ */
+struct RTCTime {
+    uint16_t year;
+    uint8_t  month;
+    uint8_t  day;
+    uint8_t  hour;
+    uint8_t  minute;
+    uint8_t  second;
+};
+
+/**
+ * Read the CMOS clock. The registers are read until two reads outside an update agree.
+ *
+ * @param time Destination
+ */
+void rtc_read(struct RTCTime *time);
+
+/**
+ * Convert a calendar time to seconds since 1970-01-01 00:00:00 UTC
+ *
+ * @param time Calendar time, year 1970 or later
+ * @return     Unix time
+ */
+uint32_t rtc_to_unix(const struct RTCTime *time);
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/lock.h"
+
+/* 8253 / 8254 programmable interval timer */
+#define PIT_FREQUENCY          1193182 // input clock in Hz
+#define PIT_CHANNEL0           0x40
+#define PIT_CHANNEL2           0x42
+#define PIT_COMMAND            0x43
+#define PIT_CHANNEL0_ONESHOT   0x30    // channel 0, lobyte/hibyte, mode 0 interrupt on terminal count
+#define PIT_CHANNEL0_PERIODIC  0x34    // channel 0, lobyte/hibyte, mode 2 rate generator
+#define PIT_CHANNEL2_ONESHOT   0xB0    // channel 2, lobyte/hibyte, mode 0
+#define PIT_GATE_PORT          0x61    // bit 0 gates channel 2, bit 1 speaker, bit 5 channel 2 output
+#define PIT_GATE_CHANNEL2      0x01
+#define PIT_GATE_SPEAKER       0x02
+#define PIT_OUTPUT_CHANNEL2    0x20
+#define PIT_MAX_COUNT          0xFFFF
+
+#define TIMER_CALIBRATE_MS     10      // PIT window the TSC and LAPIC timer are measured over
+#define TIMER_HZ               100     // tick rate when not tickless
+#define TIMER_MIN_DELTA_NS     10000   // closest deadline programmed, earlier ones fire after this
+#define TIMER_HEAP_CAPACITY    64
+
+#define NS_PER_SEC             1000000000u
+#define NS_PER_MS              1000000u
+
+struct Timer;
+
+/**
+ * Called when a timer expires, from the timer interrupt with interrupts disabled.
+ * Longer work should be passed on with work_queue().
+ *
+ * @param timer The expired timer, may be armed again from here
+ * @param arg   Passed to timer_setup()
+ */
+typedef void (*timer_fn_t)(struct Timer *timer, void *arg);
+
+/**
+ * Timer, one-shot high resolution timer
+ *
+ * @param deadline Monotonic time in ns it expires at
+ * @param fn       Expiry callback
+ * @param arg      Passed to fn
+ * @param index    Position in the heap while armed
+ * @param armed    Timer is in the heap
+ */
+struct Timer {
+    uint64_t   deadline;
+    timer_fn_t fn;
+    void       *arg;
+    uint32_t   index;
+    bool       armed;
+};
+
+/**
+ * TimerState, clock source and event device
+ *
+ * The monotonic clock is the TSC scaled to ns by (cycles * ns_mult) >> ns_shift,
+ * calibrated against the PIT. Timer events come from the LAPIC timer when the
+ * APIC is active, else from PIT channel 0. In tickless mode only the earliest
+ * armed deadline is programmed, an idle CPU with no timers armed takes no timer
+ * interrupts at all. Otherwise the device ticks at TIMER_HZ.
+ *
+ * @param tsc_clock      Monotonic clock is read from the TSC, else counted in ticks
+ * @param lapic          Events come from the LAPIC timer
+ * @param tickless       One-shot events at the next deadline instead of a periodic tick
+ * @param tsc_khz        TSC frequency
+ * @param ns_mult        TSC cycles to ns multiplier
+ * @param ns_shift       TSC cycles to ns shift
+ * @param tsc_base       TSC at timer_init(), monotonic time 0
+ * @param lapic_per_ms   LAPIC timer counts per ms, divide by 16
+ * @param ticks          Periodic ticks, the clock when there is no TSC
+ * @param clock_lock     Lets clock_monotonic_ns() read the 64-bit ticks without tearing
+ * @param interrupts     Timer interrupts taken
+ * @param expired        Timer callbacks run
+ * @param boot_unix      RTC time at timer_init() in seconds since 1970
+ * @param heap           Armed timers, a binary min-heap on deadline
+ * @param heap_size      Armed timer count
+ * @param lock           Protects heap and the event device, timer callbacks run without it
+ */
+struct TimerState {
+    bool         tsc_clock;
+    bool         lapic;
+    bool         tickless;
+    uint32_t     tsc_khz;
+    uint32_t     ns_mult;
+    uint8_t      ns_shift;
+    uint64_t     tsc_base;
+    uint32_t     lapic_per_ms;
+    uint64_t     ticks;
+    struct Seqlock clock_lock;
+    uint32_t     interrupts;
+    uint32_t     expired;
+    uint32_t     boot_unix;
+    struct Timer *heap[TIMER_HEAP_CAPACITY];
+    uint32_t     heap_size;
+    struct Spinlock lock;
+};
+
+extern struct TimerState timer_state;
+
+/**
+ * Calibrate the TSC and LAPIC timer against the PIT, read the RTC and start the
+ * event device. Call after apic_init() and initialize_idt(). Tickless mode needs
+ * the TSC, without it the timer stays periodic.
+ *
+ * @param tickless Program deadlines one-shot instead of ticking at TIMER_HZ
+ */
+void timer_init(bool tickless);
+
+/**
+ * @return Nanoseconds since timer_init(), never decreasing
+ */
+uint64_t clock_monotonic_ns(void);
+
+/**
+ * @return Seconds since 1970-01-01 UTC, the RTC at boot plus the monotonic clock
+ */
+uint32_t clock_realtime(void);
+
+/**
+ * Prepare a timer, it is not armed
+ *
+ * @param timer Timer
+ * @param fn    Expiry callback
+ * @param arg   Passed to fn
+ */
+void timer_setup(struct Timer *timer, timer_fn_t fn, void *arg);
+
+/**
+ * Arm a timer for an absolute deadline, re-arming moves it. Call on the boot
+ * processor, the event device is its LAPIC timer.
+ *
+ * @param timer    Timer from timer_setup()
+ * @param deadline Monotonic time in ns
+ * @return         False when TIMER_HEAP_CAPACITY timers are already armed
+ */
+bool timer_arm(struct Timer *timer, uint64_t deadline);
+
+/**
+ * timer_arm() relative to now
+ *
+ * @param timer Timer from timer_setup()
+ * @param delay Nanoseconds from now
+ * @return      False when TIMER_HEAP_CAPACITY timers are already armed
+ */
+bool timer_arm_after(struct Timer *timer, uint64_t delay);
+
+/**
+ * Disarm a timer, nothing happens if it is not armed
+ *
+ * @param timer Timer
+ */
+void timer_cancel(struct Timer *timer);
+
+#endif
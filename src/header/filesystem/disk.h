@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "header/process/wait.h"
+#include "header/driver/timer.h"
+#include "header/cpu/workqueue.h"
 
 /* -- ATA PIO status codes -- */
 #define ATA_STATUS_BSY 0x80
@@ -12,36 +15,99 @@
 #define ATA_STATUS_DF 0x20
 #define ATA_STATUS_ERR 0x01
 
+#define ATA_CONTROL_PORT 0x3F6
+#define ATA_CONTROL_NIEN 0x02 // device raises no IRQ14, for polled transfers
+
 #define BLOCK_SIZE 512u
 #define HALF_BLOCK_SIZE (BLOCK_SIZE / 2)
 
+#define ATA_IRQ_TIMEOUT_NS    (1000 * NS_PER_MS) // a request still waiting after this finishes polled
+#define ATA_BENCHMARK_READS   64
+#define ATA_BENCHMARK_SECTORS 8
+#define ATA_BENCHMARK_PROBE   (1u << 20)         // xorshift rounds timed to size the computation
+
 // Block buffer data type - @param buf Byte buffer with size of BLOCK_SIZE
 struct BlockBuffer
 {
     uint8_t buf[BLOCK_SIZE];
 } __attribute__((packed));
 
+/**
+ * ATAState, primary channel. A thread on the boot processor issues the command
+ * and sleeps on done. The IRQ14 handler only reads the status register, which
+ * acknowledges the device, and queues work; the work item moves the sector and
+ * ends the request. Other callers transfer with the device interrupt masked and
+ * poll the status register.
+ *
+ * @param channel   Threads waiting for the channel, its lock guards busy
+ * @param busy      A request owns the channel
+ * @param irq_mode  IRQ14 is set up, threads may sleep on done
+ * @param active    The IRQ14 handler owns the request in flight
+ * @param write     Request writes sectors
+ * @param buffer    Next sector to transfer
+ * @param remaining Sectors the handler still transfers
+ * @param status    Last status register read for the request, ATA_STATUS_ERR or ATA_STATUS_DF when it failed
+ * @param done      Signalled by the work item when the request ended
+ * @param work      Bottom half of IRQ14, transfers a sector or ends the request
+ * @param lost_irqs Requests that timed out and finished polled
+ */
+struct ATAState {
+    struct WaitQueue  channel;
+    bool              busy;
+    bool              irq_mode;
+    volatile bool     active;
+    bool              write;
+    uint16_t          *buffer;
+    volatile uint32_t remaining;
+    volatile uint8_t  status;
+    struct Completion done;
+    struct WorkItem   work;
+    uint32_t          lost_irqs;
+};
+
+extern struct ATAState ata_state;
+
+/**
+ * Route IRQ14 to the driver, after which threads sleep during transfers instead
+ * of spinning. Call after thread_init() with interrupts set up.
+ */
+void ata_init(void);
+
 /**
  * ATA PIO logical block address read blocks. Will blocking until read is completed.
  * Note: ATA PIO will use 2-bytes per read/write operation.
+ * Safe from any processor. A thread sleeps until IRQ14 finished the transfer,
+ * other contexts poll. Not for interrupt handlers.
  * Recommended to use struct BlockBuffer
  *
  * @param ptr                   Pointer for storing reading data, this pointer should point to already allocated memory location.
  *                              With allocated size positive integer multiple of BLOCK_SIZE, ex: buf[1024]
  * @param logical_block_address Block address to read data from. Use LBA addressing
  * @param block_count           How many block to read, starting from block logical_block_address to lba-1
+ * @return                      False when the device reported an error, the request stops at the failed sector
  */
-void read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count);
+bool read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count);
 
 /**
  * ATA PIO logical block address write blocks. Will blocking until write is completed.
  * Note: ATA PIO will use 2-bytes per read/write operation.
+ * Safe from any processor. A thread sleeps until IRQ14 finished the transfer,
+ * other contexts poll. Not for interrupt handlers.
  * Recommended to use struct BlockBuffer
  *
  * @param ptr                   Pointer to data that to be written into disk. Memory pointed should be positive integer multiple of BLOCK_SIZE
  * @param logical_block_address Block address to write data into. Use LBA addressing
  * @param block_count           How many block to write, starting from block logical_block_address to lba-1
+ * @return                      False when the device reported an error, the request stops at the failed sector
+ */
+bool write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count);
+
+/**
+ * Time ATA_BENCHMARK_READS reads of ATA_BENCHMARK_SECTORS sectors and a computation
+ * of the same length, once one after the other and once with the reads in a
+ * second thread, then print both wall-clock times and the gain with kprintf().
+ * Call from a thread after ata_init().
  */
-void write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count);
+void ata_overlap_benchmark(void);
 
-#endif
\ No newline at end of file
+#endif
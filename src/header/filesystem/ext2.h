@@ -8,15 +8,55 @@
 
 
 /* -- IF2230 File System constants -- */
-#define BOOT_SECTOR 0 // legacy from FAT32 filesystem IF2230 OS
-#define DISK_SPACE 4194304u // 4MB disk space (because our disk or storage.bin is 4MB)
+#define DISK_SPACE 4194304u // 4MB disk space (because our disk or storage.bin is 4MB), used by create_ext2()
 #define EXT2_SUPER_MAGIC 0xEF53 // this indicating that the filesystem used by OS is ext2
-#define INODE_SIZE sizeof(struct EXT2INode) // size of inode
-#define INODES_PER_TABLE (BLOCK_SIZE / INODE_SIZE) // number of inode per block (512 / )
-#define GROUPS_COUNT (BLOCK_SIZE / sizeof(struct EXT2BlockGroupDescriptor)) / 2u // number of groups in the filesystem
-#define BLOCKS_PER_GROUP (DISK_SPACE / GROUPS_COUNT / BLOCK_SIZE) // number of blocks per group
-#define INODES_TABLE_BLOCK_COUNT 16u 
-#define INODES_PER_GROUP (INODES_PER_TABLE * INODES_TABLE_BLOCK_COUNT) // number of inodes per group
+#define EXT2_SUPERBLOCK_SECTOR 2u // superblock is always at byte 1024, whatever the block size
+#define EXT2_SUPERBLOCK_SECTORS 2u // and always 1024 bytes long
+#define EXT2_MAX_BLOCK_SIZE 4096u // 1, 2 and 4 KiB blocks are supported
+#define EXT2_MAX_GROUPS 128u // bgd table cached in memory, 4 KiB
+#define EXT2_ROOT_INO 2 // root directory inode
+#define EXT2_GOOD_OLD_FIRST_INO 11 // first non-reserved inode in revision 0
+#define EXT2_GOOD_OLD_INODE_SIZE 128 // inode size in revision 0
+#define EXT2_GOOD_OLD_REV 0
+#define EXT2_DYNAMIC_REV 1 // revision 1, variable inode size and feature flags
+#define EXT2_VALID_FS 1 // s_state, unmounted cleanly
+#define EXT2_ERRORS_CONTINUE 1 // s_errors
+#define EXT2_OS_LINUX 0 // s_creator_os, makes host tools treat the image as native
+#define EXT2_MKFS_LOG_BLOCK_SIZE 0u // create_ext2() uses 1 KiB blocks
+#define EXT2_MKFS_INODE_RATIO 4096u // create_ext2() makes one inode per this many bytes of disk
+#define FREE_BATCH_CAPACITY 256u // pending frees held before flush_free_batch() is forced
+#define DEFRAG_MAX_BLOCKS 512u // larger files are skipped by the defragmenter
+#define DEFRAG_CHUNK_SIZE 16384u // bytes copied per write command while relocating
+#define DEFRAG_MIN_EXTENTS 2u // files with fewer extents are left in place
+#define DEFRAG_STEP_BUDGET 64u // blocks of disk I/O per defragment_step() of the background pass
+#define DEFRAG_STEP_INTERVAL_MS 20u // pause between two steps, foreground I/O gets the disk meanwhile
+#define DEFRAG_THREAD_PRIORITY 30u // just above the idle thread
+#define EXT2_MAX_FILE_BLOCKS 2048u // data blocks allocate_node_blocks() maps for one node
+#define EXT2_BENCHMARK_ORDER 8u // buddy order of the data buffer of the benchmarks, 1 MiB, also the size of their large file
+#define EXT2_BENCHMARK_FILES 1000u // small files ext2_delete_benchmark() creates and deletes
+#define EXT2_BENCHMARK_LOOKUPS 1000u // random inodes ext2_inode_benchmark() loads
+
+/* -- Compression, groups of logical blocks stored as LZ4 frames -- */
+#define EXT2_COMPRESS_GROUP_SIZE 4096u // raw bytes per compressed frame
+#define EXT2_COMPRESS_MAX_SIZE 65536u // larger files are stored uncompressed
+#define EXT2_COMPRESS_BUFFER_SIZE (EXT2_COMPRESS_MAX_SIZE + 2u * (EXT2_COMPRESS_MAX_SIZE / EXT2_COMPRESS_GROUP_SIZE) + EXT2_MAX_BLOCK_SIZE)
+#define EXT2_COMPRESS_RAW_FRAME 0x8000u // frame header flag, payload stored without compression
+
+/**
+ * superblock feature flags
+ * - reference: https://www.nongnu.org/ext2-doc/ext2.html#s-feature-compat
+ * compat features can be ignored, a driver must not mount a filesystem with
+ * incompat features it does not know, nor write to one with unknown ro_compat features
+ */
+#define EXT2_FEATURE_COMPAT_EXT_ATTR 0x0008 // extended attribute blocks, left alone
+#define EXT2_FEATURE_COMPAT_RESIZE_INO 0x0010 // reserved gdt blocks, already marked used in the bitmaps
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020 // hashed directories, readable as linked lists
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002 // directory entries carry file_type
+#define EXT2_FEATURE_INCOMPAT_LZ4_FRAMES 0x80000000 // private, some node holds EXT2_LZ4_FL data; set on the first such write so other drivers refuse the image
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001 // superblock backups only in groups 0, 1 and powers of 3, 5, 7
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002 // size_high holds the upper file size bits
+#define EXT2_FEATURE_INCOMPAT_SUPP (EXT2_FEATURE_INCOMPAT_FILETYPE | EXT2_FEATURE_INCOMPAT_LZ4_FRAMES)
+#define EXT2_FEATURE_RO_COMPAT_SUPP (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
 
 
 
@@ -24,8 +64,17 @@
  * inodes constant 
  * - reference: https://www.nongnu.org/ext2-doc/ext2.html#inode-table
  */
+#define EXT2_S_IFMT 0xF000 // format mask
 #define EXT2_S_IFREG 0x8000 // regular file 
 #define EXT2_S_IFDIR 0x4000 // directory
+#define EXT2_S_IFLNK 0xA000 // symbolic link, short targets are stored in block[] instead of data blocks
+#define EXT2_DIR_PERMISSION 0755 // rwxr-xr-x, so the image is usable from the host
+
+/**
+ * inode flags
+ * - reference: https://www.nongnu.org/ext2-doc/ext2.html#i-flags
+ */
+#define EXT2_LZ4_FL 0x00800000 // private, no Linux flag uses the bit: data blocks hold EXT2_COMPRESS_GROUP_SIZE LZ4 frames
 
 
 /* FILE TYPE CONSTANT*/
@@ -65,6 +114,7 @@ struct EXT2DriverRequest
 /**
  * EXT2Superblock: 
  * - https://www.nongnu.org/ext2-doc/ext2.html#superblock
+ * Revision 1 layout, exactly 1024 bytes at byte offset 1024 of the disk
  */
 struct EXT2Superblock
 {
@@ -74,7 +124,9 @@ struct EXT2Superblock
     uint32_t r_blocks_count;      // 32bit value indicating the total number of blocks reserved for the usage of the super user. {maybe not used because there is no superuser in our system} 
     uint32_t free_blocks_count;   // 32bit value indicating the total number of free blocks, including the number of reserved blocks 
     uint32_t free_inodes_count;   // 32bit value indicating the total number of free inodes. This is a sum of all free inodes of all the block groups.
-    uint32_t first_data_block;    // 32bit value identifying the first data block, in other word the id of the block containing the superblock structure.
+    uint32_t first_data_block;    // 32bit value identifying the first data block, in other word the id of the block containing the superblock structure. (1 for 1 KiB blocks, 0 otherwise)
+    uint32_t log_block_size;      // block size = 1024 << log_block_size
+    uint32_t log_frag_size;       // fragments are not implemented, same as log_block_size
 
     uint32_t blocks_per_group;    
     /** 32bit value indicating the total number of blocks per group. 
@@ -93,14 +145,65 @@ struct EXT2Superblock
      * This value must be a perfect multiple of the number of inodes that can fit in a block ((1024<<s_log_block_size)/s_inode_size).
      */
 
+    uint32_t mtime; // last mount time [NOT USED]
+    uint32_t wtime; // last write time, set on every superblock sync
+    uint16_t mnt_count; // mounts since the last fsck
+    uint16_t max_mnt_count; // mounts allowed before a fsck is forced, 0xFFFF to disable
     uint16_t magic; // 16bit value indicating the file system type. For ext2, this value is 0xEF53.(DEFINE as EXT2_SUPER_MAGIC)
+    uint16_t state; // EXT2_VALID_FS when cleanly unmounted
+    uint16_t errors; // what to do when an error is detected (EXT2_ERRORS_CONTINUE)
+    uint16_t minor_rev_level;
+    uint32_t lastcheck; // time of last fsck, creation time for a new filesystem
+    uint32_t checkinterval; // maximum time between fsck, 0 to disable
+    uint32_t creator_os; // EXT2_OS_LINUX
+    uint32_t rev_level; // EXT2_GOOD_OLD_REV or EXT2_DYNAMIC_REV
+    uint16_t def_resuid; // default uid of reserved blocks
+    uint16_t def_resgid; // default gid of reserved blocks
+
+    /* -- EXT2_DYNAMIC_REV only -- */
     uint32_t first_ino; // 32bit value used as index to the first inode useable for standard files. In revision 0, the first non-reserved inode is fixed to 11 (EXT2_GOOD_OLD_FIRST_INO). In revision 1 and later this value may be set to any value.
+    uint16_t inode_size; // size of an on-disk inode record, 128 in revision 0
+    uint16_t block_group_nr; // group holding this superblock copy
+    uint32_t feature_compat; // EXT2_FEATURE_COMPAT_*
+    uint32_t feature_incompat; // EXT2_FEATURE_INCOMPAT_*
+    uint32_t feature_ro_compat; // EXT2_FEATURE_RO_COMPAT_*
+    uint8_t uuid[16]; // volume id
+    char volume_name[16]; // volume label, null terminated
+    char last_mounted[64]; // path of the last mount point [NOT USED]
+    uint32_t algo_bitmap; // compression algorithms [NOT USED]
 
     uint8_t prealloc_blocks; // 8bit value indicating the number of blocks to preallocate for files.
     uint8_t prealloc_dir_blocks; // 8bit value indicating the number of blocks to preallocate for directories.
+    uint16_t reserved_gdt_blocks; // gdt blocks reserved for online resize (EXT2_FEATURE_COMPAT_RESIZE_INO)
 
+    /* -- journaling, ext3 only [NOT USED] -- */
+    uint8_t journal_uuid[16];
+    uint32_t journal_inum;
+    uint32_t journal_dev;
+    uint32_t last_orphan;
 
-}__attribute__((packed));
+    /* -- directory indexing [NOT USED] -- */
+    uint32_t hash_seed[4];
+    uint8_t def_hash_version;
+    uint8_t padding[3];
+
+    uint32_t default_mount_options;
+    uint32_t first_meta_bg;
+    uint32_t reserved[190]; // pads the structure to 1024 bytes
+
+}__attribute__((aligned(64)));
+
+/**
+ * On-disk structures are laid out so every field sits on its natural boundary,
+ * no packing is needed and the compiler never emits unaligned accesses for them.
+ * These checks keep the layout in sync with the ext2 revision 1 format.
+ */
+_Static_assert(sizeof(struct EXT2Superblock) == 1024, "EXT2Superblock must be 1024 bytes");
+_Static_assert(offsetof(struct EXT2Superblock, magic) == 56, "EXT2Superblock magic offset");
+_Static_assert(offsetof(struct EXT2Superblock, rev_level) == 76, "EXT2Superblock rev_level offset");
+_Static_assert(offsetof(struct EXT2Superblock, first_ino) == 84, "EXT2Superblock first_ino offset");
+_Static_assert(offsetof(struct EXT2Superblock, feature_incompat) == 96, "EXT2Superblock feature_incompat offset");
+_Static_assert(offsetof(struct EXT2Superblock, reserved) == 264, "EXT2Superblock reserved offset");
 
 
 /**
@@ -149,7 +252,10 @@ struct EXT2BlockGroupDescriptor
      * 12 bytes of reserved space for future revisions.
      */
     uint32_t reserved[3]; // 12 bytes of reserved space for future revisions. 
-}__attribute__((packed));
+};
+
+_Static_assert(sizeof(struct EXT2BlockGroupDescriptor) == 32, "EXT2BlockGroupDescriptor must be 32 bytes");
+_Static_assert(offsetof(struct EXT2BlockGroupDescriptor, free_blocks_count) == 12, "EXT2BlockGroupDescriptor free_blocks_count offset");
 
 /**
  * reference: 
@@ -157,8 +263,8 @@ struct EXT2BlockGroupDescriptor
  */
 struct EXT2BlockGroupDescriptorTable
 {
-    struct EXT2BlockGroupDescriptor table[GROUPS_COUNT]; // can be change with fixed size array
-};
+    struct EXT2BlockGroupDescriptor table[EXT2_MAX_GROUPS]; // first groups_count entries are valid, whole blocks of the table are read and written
+}__attribute__((aligned(64)));
 
 
 /**
@@ -178,8 +284,9 @@ struct EXT2INode
 
     uint16_t gid; // 16bit value indicating the group ID of the file owner. [NOT USED]
     uint16_t links_count; // 16bit value indicating the number of hard links to the file.  [NOT USED]
-    uint32_t blocks; // 32bit value indicating the number of blocks used by the file.
-    uint32_t flags; // 32bit value indicating the file flags. [NOT USED]
+    uint32_t blocks; // 32bit value indicating the number of 512 byte sectors used by the file, indirect blocks included.
+    uint32_t flags; // 32bit value indicating the file flags. (EXT2_LZ4_FL for compressed files)
+    uint32_t osd1; // 32bit OS dependent value. [NOT USED]
 
     /**
      * 15 x 32bit block numbers pointing to the blocks containing the data for this inode
@@ -202,14 +309,53 @@ struct EXT2INode
 
     uint32_t faddr; // 32bit value indicating the fragment address. 
 
-    uint32_t osd1[3]; // 12 bytes of OS dependent data. [don't know what is this]
+    uint8_t osd2[12]; // 12 bytes of OS dependent data. [NOT USED]
 
 
-}__attribute__((packed));
+};
 
-struct EXT2INodeTable
+/**
+ * 128 bytes, two cache lines: records start on a line boundary in a 64 byte aligned
+ * EXT2BlockBuffer (inode_size is a power of two), the hot fields mode to block[] share the first line
+ */
+_Static_assert(sizeof(struct EXT2INode) == 128, "EXT2INode must be 128 bytes");
+_Static_assert(offsetof(struct EXT2INode, blocks) == 28, "EXT2INode blocks offset");
+_Static_assert(offsetof(struct EXT2INode, block) == 40, "EXT2INode block offset");
+_Static_assert(offsetof(struct EXT2INode, osd2) == 116, "EXT2INode osd2 offset");
+
+/**
+ * EXT2BlockBuffer
+ * One filesystem block, sized for the largest supported block size.
+ * Only the first ext2_geometry.block_size bytes are used.
+ */
+struct EXT2BlockBuffer
+{
+    uint8_t buf[EXT2_MAX_BLOCK_SIZE];
+}__attribute__((aligned(64)));
+
+/**
+ * EXT2Geometry
+ * Values derived from the superblock when the filesystem is mounted
+ *
+ * @param block_size         1024 << sblock.log_block_size
+ * @param sectors_per_block  disk sectors (BLOCK_SIZE) per filesystem block
+ * @param groups_count       number of block groups, the last one may be shorter
+ * @param bgd_blocks         blocks occupied by the bgd table
+ * @param inode_size         on-disk inode record size, at least sizeof(struct EXT2INode)
+ * @param inodes_per_block   inode records per inode table block
+ * @param pointers_per_block block numbers per indirect block
+ * @param first_ino          first inode available for files
+ */
+struct EXT2Geometry
 {
-    struct EXT2INode table[INODES_PER_GROUP]; // can be change with fixed size array
+    uint32_t block_size;
+    uint32_t sectors_per_block;
+    uint32_t groups_count;
+    uint32_t bgd_blocks;
+    uint32_t inode_size;
+    uint32_t inodes_per_block;
+    uint32_t pointers_per_block;
+    uint32_t first_ino;
 };
 
 /**
@@ -240,7 +386,74 @@ struct EXT2DirectoryEntry
      */
     uint8_t file_type;
 
-}__attribute__((packed));
+};
+
+_Static_assert(sizeof(struct EXT2DirectoryEntry) == 8, "EXT2DirectoryEntry must be 8 bytes");
+
+/**
+ * EXT2FreeBatch
+ * Block and inode numbers waiting to be released. Frees are collected while the
+ * block tree of one or more inodes is walked, then sorted and applied to the bitmaps
+ * one group at a time, so each bitmap block and the bgd table are written once per batch.
+ *
+ * @param blocks      pending block numbers
+ * @param block_count number of valid entries in blocks
+ * @param inodes      pending inode numbers
+ * @param inode_count number of valid entries in inodes
+ * @param dirs_freed  per group count of directory inodes in inodes (for used_dirs_count)
+ * @param depth       free_batch_begin() nesting, the batch is flushed when it drops to 0
+ * @param flushes     flush_free_batch() calls that applied something, for ext2_delete_benchmark()
+ * @param bitmap_writes bitmap blocks written by those
+ */
+struct EXT2FreeBatch
+{
+    uint32_t blocks[FREE_BATCH_CAPACITY];
+    uint32_t block_count;
+    uint32_t inodes[FREE_BATCH_CAPACITY];
+    uint32_t inode_count;
+    uint16_t dirs_freed[EXT2_MAX_GROUPS];
+    uint32_t depth;
+    uint32_t flushes;
+    uint32_t bitmap_writes;
+};
+
+/**
+ * EXT2DefragState
+ * Progress of an online defragmentation pass, one defragment_step() call
+ * continues from next_inode so the pass can be spread between foreground work.
+ * A file larger than one step's budget is copied over several steps, its old
+ * block list stays in defrag_old meanwhile, so only one pass runs at a time
+ *
+ * @param next_inode      next inode to examine, starts at 1
+ * @param files_scanned   inodes whose block map was scored
+ * @param files_moved     inodes relocated into a single extent
+ * @param files_skipped   inodes larger than DEFRAG_MAX_BLOCKS
+ * @param moves_restarted moves dropped because the node lock was taken by someone else between steps
+ * @param blocks_moved    data blocks copied
+ * @param extents_before  extents of all scanned inodes before the pass
+ * @param extents_after   extents of all scanned inodes after the pass
+ * @param move_inode      inode being moved, 0 when no move is in progress
+ * @param move_start      first block of the extent reserved for it
+ * @param move_count      data blocks of the inode
+ * @param move_done       data blocks copied so far
+ * @param move_seq        ext2_nodes_seq when the move last released the node lock
+ */
+struct EXT2DefragState
+{
+    uint32_t next_inode;
+    uint32_t files_scanned;
+    uint32_t files_moved;
+    uint32_t files_skipped;
+    uint32_t moves_restarted;
+    uint32_t blocks_moved;
+    uint32_t extents_before;
+    uint32_t extents_after;
+    uint32_t move_inode;
+    uint32_t move_start;
+    uint32_t move_count;
+    uint32_t move_done;
+    uint32_t move_seq;
+};
 
 /**
  *  REGULAR function
@@ -273,7 +486,7 @@ struct EXT2DirectoryEntry *get_next_directory_entry(struct EXT2DirectoryEntry *e
 
 /**
  * @brief get record length of a directory entry
- * that has dynamic size based on its name length, struct size is 12
+ * that has dynamic size based on its name length, struct size is 8
  * and after that the buffer will contain its name char * that needs to aligned at 4 bytes boundaries
  * @param name_len entry name length (includes null terminator)
  * @returns sizeof(EXT2DirectoryEntry) + name_len aligned 4 bytes
@@ -286,19 +499,34 @@ uint16_t get_entry_record_len(uint8_t name_len);
  */
 uint32_t get_dir_first_child_offset(void *ptr);
 
+/**
+ * @brief write "." and ".." into an empty directory block, ".." spans the rest of the block
+ * @param ptr directory block, ext2_geometry.block_size bytes
+ * @param inode inode of the directory
+ * @param parent_inode inode of the parent directory
+ */
+void build_directory_table(void *ptr, uint32_t inode, uint32_t parent_inode);
+
+/**
+ * @brief add an entry into a directory block by splitting the first entry with enough slack
+ * @param ptr directory block, ext2_geometry.block_size bytes
+ * @return false if the block has no room for the entry
+ */
+bool insert_directory_entry(void *ptr, uint32_t inode, char *name, uint8_t name_len, uint8_t file_type);
+
 
 /* =================== MAIN FUNCTION OF EXT32 FILESYSTEM ============================*/
 
 /**
  * @brief get bgd index from inode, inode will starts at index 1
- * @param inode 1 to INODES_PER_GROUP * GROUP_COUNT
- * @return bgd index (0 to GROUP_COUNT - 1)
+ * @param inode 1 to sblock.inodes_count
+ * @return bgd index (0 to groups_count - 1)
  */
 uint32_t inode_to_bgd(uint32_t inode);
 
 /**
  * @brief get inode local index in the corrresponding bgd
- * @param inode 1 to INODES_PER_GROUP * GROUP_COUNT
+ * @param inode 1 to sblock.inodes_count
  * @return local index
  */
 uint32_t inode_to_local(uint32_t inode);
@@ -310,26 +538,93 @@ uint32_t inode_to_local(uint32_t inode);
  * @param node pointer of inode
  * @param inode inode that already allocated
  * @param parent_inode inode of parent directory (if root directory, the parent is itself)
+ * @return false if no block is free, node and disk are left untouched then
+ */
+bool init_directory_table(struct EXT2INode *node, uint32_t inode, uint32_t parent_inode);
+
+/**
+ * @brief read count filesystem blocks, block numbers are in ext2_geometry.block_size units
+ * @return false if the disk reported an error, the read stops there
+ */
+bool read_fs_blocks(void *ptr, uint32_t block, uint32_t count);
+
+/**
+ * @brief write count filesystem blocks, block numbers are in ext2_geometry.block_size units
+ * @return false if the disk reported an error, the write stops there
+ */
+bool write_fs_blocks(const void *ptr, uint32_t block, uint32_t count);
+
+/**
+ * @brief derive ext2_geometry from sblock
+ * @return false if sblock is not an ext2 superblock this driver can mount
+ */
+bool load_geometry(void);
+
+/**
+ * @brief write the bgd table and the superblock, with superblock free counts summed from the groups
+ */
+void sync_bgd_table(void);
+
+/**
+ * @brief whether a group starts with a superblock and bgd table copy
+ * (every group, or only 0, 1 and powers of 3, 5 and 7 with sparse_super)
  */
-void init_directory_table(struct EXT2INode *node, uint32_t inode, uint32_t parent_inode);
+bool group_has_super(uint32_t bgd);
+
+/**
+ * @brief number of blocks in a group, the last group may be shorter
+ */
+uint32_t group_block_count(uint32_t bgd);
+
+/**
+ * @brief free block and inode counts of the mounted filesystem, safe from any processor.
+ * Read under ext2_metadata_lock, which every update of the counts in bgd_table and sblock takes
+ */
+void ext2_usage(uint32_t *free_blocks, uint32_t *free_inodes);
+
 /**
- * @brief check whether filesystem signature is missing or not in boot sector
+ * @brief initialize one block group for create_ext2(): bgd entry, bitmaps and an empty inode table.
+ * Only touches its own bgd entry and the running processor's mkfs_buffer, so groups are
+ * initialized in parallel with parallel_for()
+ */
+void init_block_group(uint32_t bgd);
+
+/**
+ * @brief check whether the ext2 superblock magic is missing
  *
- * @return true if memcmp(boot_sector, fs_signature) returning inequality
+ * @return true if the superblock at byte 1024 is not an ext2 superblock, false also when it cannot be read
  */
 bool is_empty_storage(void);
 
 /**
- * @brief create a new EXT2 filesystem. Will write fs_signature into boot sector,
- * initialize super block, bgd table, block and inode bitmap, and create root directory
+ * @brief create a new EXT2 filesystem in the standard revision 1 layout, DISK_SPACE bytes
+ * with 1 KiB blocks: superblock at byte 1024, bgd table, block and inode bitmap and inode table
+ * per group, reserved inodes 1 to 10, root directory (inode 2) and lost+found
  */
 void create_ext2(void);
 
 /**
- * @brief Initialize file system driver state, if is_empty_storage() then create_ext2()
- * Else, read and cache super block (located at block 1) and bgd table (located at block 2) into state
+ * @brief Initialize file system driver state, if is_empty_storage() then create_ext2().
+ * Else, read and cache super block (byte 1024) and bgd table (block after the superblock) into state.
+ * Call after task_pool_init() and smp_init()
+ * @return false if the superblock or bgd table cannot be read, or the disk holds an ext2
+ *         filesystem with features this driver does not support
+ */
+bool initialize_filesystem_ext2(void);
+
+/**
+ * @brief take the node lock, sleeping while another thread holds it (polling on
+ * processors without threads). ext2_create_node(), ext2_read_node() and
+ * deallocate_node() take it; code calling read_node_data() or write_node_data()
+ * directly holds it from load_node() to sync_node(), so the defragmenter never
+ * moves blocks under a node that is being read or changed. Not recursive
  */
-void initialize_filesystem_ext2(void);
+void ext2_lock_nodes(void);
+
+/**
+ * @brief release the node lock and count the release in ext2_nodes_seq
+ */
+void ext2_unlock_nodes(void);
 
 /**
  * @brief check whether a directory table has children or not
@@ -354,32 +649,331 @@ int8_t delete_entry(struct EXT2DriverRequest request);
 
 // int8_t move_dir(struct EXT2DriverRequest request_src, struct EXT2DriverRequest dst_request);
 
+/**
+ * @brief store size bytes of buf as the data of node. With EXT2_LZ4_FL set in node->flags
+ * the data is compressed first, the flag is dropped again if that does not save a block or the
+ * filesystem is revision 0 (no feature flags). The first compressed node sets
+ * EXT2_FEATURE_INCOMPAT_LZ4_FRAMES in the superblock
+ * @param node inode, size_low / flags / blocks / block are filled on success
+ * @param buf file content, readable up to a multiple of the block size
+ * @param size file size in bytes
+ * @param preferred_bgd group searched first for free blocks
+ * @return false if the data needs more than EXT2_MAX_FILE_BLOCKS blocks or the disk
+ * has too few free blocks, node and the bitmaps are left untouched then
+ */
+bool write_node_data(struct EXT2INode *node, void *buf, uint32_t size, uint32_t preferred_bgd);
+
+/**
+ * @brief load node->size_low bytes of file content, decompressing when EXT2_LZ4_FL is set
+ * @return false if the compressed data is corrupted
+ */
+bool read_node_data(struct EXT2INode *node, void *buf);
+
+/**
+ * @brief allocate an inode and store size bytes of buf as its data with write_node_data(),
+ * holding the node lock throughout
+ * @param mode EXT2_S_IFREG or EXT2_S_IFDIR with permission bits
+ * @param flags inode flags, EXT2_LZ4_FL to compress
+ * @return the inode, 0 if no inode or not enough blocks are free (nothing stays allocated then)
+ */
+uint32_t ext2_create_node(uint16_t mode, uint32_t flags, void *buf, uint32_t size);
+
+/**
+ * @brief load the data of inode with read_node_data(), holding the node lock
+ * @param capacity bytes buf holds
+ * @param size set to the file size
+ * @return false if the file is larger than capacity or its compressed data is corrupted
+ */
+bool ext2_read_node(uint32_t inode, void *buf, uint32_t capacity, uint32_t *size);
+
 /* =============================== MEMORY ==========================================*/
 
+/**
+ * @brief take the first free inode of the first group that has one
+ * @return inode number, 0 if every group is full
+ */
 uint32_t allocate_node(void); 
 
+/**
+ * @brief free an inode and every block it owns, holding the node lock. The frees are queued in the
+ * free batch, wrap several calls with free_batch_begin()/free_batch_end() to
+ * apply a whole tree delete in one pass
+ * @param inode inode to release
+ */
 void deallocate_node(uint32_t inode);
 
-void deallocate_blocks(void *loc, uint32_t blocks);
+/**
+ * @brief queue the data and indirect blocks of an inode block array for freeing
+ * @param loc node->block (15 entries), all 12 direct entries are walked and 0 entries skipped
+ */
+void deallocate_blocks(void *loc);
+
+/**
+ * @brief queue locations (and everything below them) for freeing
+ * @param locations block numbers, 0 entries are skipped
+ * @param blocks number of entries in locations
+ * @param depth 0 for data blocks, 1..3 for single, double, triple indirect blocks
+ */
+void deallocate_block(uint32_t *locations, uint32_t blocks, uint32_t depth);
+
+/**
+ * @brief open a free batch scope, nested scopes share the same batch
+ */
+void free_batch_begin(void);
+
+/**
+ * @brief close a free batch scope, the outermost one flushes the batch
+ */
+void free_batch_end(void);
 
-uint32_t deallocate_block(uint32_t *locations, uint32_t blocks, struct BlockBuffer *bitmap, uint32_t depth, uint32_t *last_bgd, bool bgd_loaded);
+/**
+ * @brief apply all queued frees: sort by group, clear bit ranges in each bitmap
+ * with one read and one write per group, then write the bgd table once
+ */
+void flush_free_batch(void);
 
-void allocate_node_blocks(void *ptr, struct EXT2INode *node, uint32_t preferred_bgd);
+/**
+ * @brief allocate and write data_blocks data blocks from ptr, plus the indirect blocks they need.
+ * node->block is filled and node->blocks is set to i_blocks (512 byte sectors, indirect blocks included)
+ * @param ptr data, data_blocks * block_size bytes
+ * @param data_blocks at most EXT2_MAX_FILE_BLOCKS
+ * @return false if data_blocks is too large or not enough blocks are free; nothing
+ * is marked used and node is not touched then
+ */
+bool allocate_node_blocks(void *ptr, struct EXT2INode *node, uint32_t data_blocks, uint32_t preferred_bgd);
+
+/**
+ * @brief read inode from its inode table block
+ * @param node destination
+ * @param inode 1 to sblock.inodes_count
+ */
+void load_node(struct EXT2INode *node, uint32_t inode);
 
 void sync_node(struct EXT2INode *node, uint32_t inode);
 
 /* ============================== UTILS ================================================ */
 
-uint32_t map_node_blocks(void *ptr, uint32_t blocks, uint32_t *locations, uint32_t *mapped_count, uint8_t depth);
+/**
+ * @brief fill one block map entry of the given depth, recursing into indirect tables
+ * @param locations blocks from search_blocks(), data blocks first then indirect blocks
+ * @param blocks number of data blocks, indirect blocks start at locations[blocks]
+ * @param data_count data blocks assigned so far
+ * @param meta_count indirect blocks assigned so far
+ * @param depth 0 for a data block, 1..3 for indirect levels
+ * @return block number stored in the entry
+ */
+uint32_t map_node_blocks(uint32_t *locations, uint32_t blocks, uint32_t *data_count, uint32_t *meta_count, uint8_t depth);
 
+/**
+ * @brief search free blocks starting from preferred_bgd, wrapping around the groups
+ * @param locations output, found blocks are appended from *found_count
+ * @param blocks wanted total of found blocks
+ * @param found_count number of entries already filled in locations
+ */
 void search_blocks(uint32_t preferred_bgd, uint32_t *locations, uint32_t blocks, uint32_t *found_count);
 
+/**
+ * @brief search free blocks in one group. The first free run long enough for the
+ * remaining blocks is returned whole, otherwise free blocks are taken in order.
+ * Blocks are not marked as used, block_buffer holds the group block bitmap afterwards
+ */
 void search_blocks_in_bgd(uint32_t bgd, uint32_t *locations, uint32_t blocks, uint32_t *found_count);
 
+/**
+ * @brief read size bytes of data following a block map
+ * @param ptr destination, size bytes
+ * @param _block node->block (15 entries)
+ */
 void load_inode_blocks(void *ptr, void *_block, uint32_t size);
 
-uint32_t load_blocks_rec(void *ptr, uint32_t block, uint32_t block_size, uint32_t size, uint8_t depth);
+/**
+ * @brief read data below an indirect block
+ * @return bytes loaded
+ */
+uint32_t load_blocks_rec(void *ptr, uint32_t block, uint32_t size, uint8_t depth);
+
+/**
+ * @brief read data blocks of one map level, consecutive blocks are read with one command
+ * @return bytes loaded
+ */
+uint32_t load_block_run(uint8_t *ptr, uint32_t *entries, uint32_t count, uint32_t size);
+
+/**
+ * @brief number of indirect blocks needed to map blocks data blocks
+ */
+uint32_t indirect_block_count(uint32_t blocks);
+
+/**
+ * @brief inverse of indirect_block_count(), data blocks in a node with total blocks (data and indirect)
+ */
+uint32_t data_block_count(uint32_t total);
+
+/**
+ * @brief mark blocks found by search_blocks() as used and update the group counters
+ */
+void mark_blocks_used(uint32_t *locations, uint32_t count);
 
 bool is_same_dir_entry(struct EXT2DirectoryEntry *entry, struct EXT2DriverRequest request, bool is_file);
 
+/**
+ * @brief get bgd index of a block
+ * @param block block number
+ * @return bgd index (0 to GROUP_COUNT - 1)
+ */
+uint32_t block_to_bgd(uint32_t block);
+
+/**
+ * @brief get block local index (bitmap bit) in the corresponding bgd
+ * @param block block number
+ * @return local index
+ */
+uint32_t block_to_local(uint32_t block);
+
+/**
+ * @brief check a bitmap bit, bit i is (byte i / 8) >> (i % 8) like Linux ext2
+ */
+bool is_bitmap_set(struct EXT2BlockBuffer *bitmap, uint32_t bit);
+
+/**
+ * @brief set count bits starting at bit start
+ */
+void set_bitmap_range(struct EXT2BlockBuffer *bitmap, uint32_t start, uint32_t count);
+
+/**
+ * @brief clear count bits starting at bit start, whole bytes are cleared at once
+ * @param bitmap block or inode bitmap
+ */
+void clear_bitmap_range(struct EXT2BlockBuffer *bitmap, uint32_t start, uint32_t count);
+
+/**
+ * @brief sort block / inode numbers ascending (insertion sort, input is usually nearly sorted)
+ */
+void sort_locations(uint32_t *locations, uint32_t count);
+
+/* ============================== DEFRAG ================================================ */
+
+/**
+ * @brief walk the data blocks of a block map in logical order
+ * @param entries block numbers of this level
+ * @param count number of entries
+ * @param depth 0 for data blocks, 1..3 for indirect levels
+ * @param locations collected data blocks, or replacement blocks when remap
+ * @param index position in locations, advanced per data block
+ * @param max capacity of locations
+ * @param remap write locations back into the map (indirect blocks are rewritten in place)
+ * @return false if the map holds more than max data blocks
+ */
+bool walk_block_map(uint32_t *entries, uint32_t count, uint32_t depth, uint32_t *locations, uint32_t *index, uint32_t max, bool remap);
+
+/**
+ * @brief walk_block_map() over the direct, single, double and triple indirect entries
+ * @param loc node->block (15 entries)
+ */
+bool walk_node_blocks(void *loc, uint32_t *locations, uint32_t *count, bool remap);
+
+/**
+ * @brief count runs of consecutive block numbers, the fragmentation score of a block map
+ */
+uint32_t count_extents(uint32_t *locations, uint32_t count);
+
+/**
+ * @brief find and mark used a contiguous free extent, starting from preferred_bgd
+ * @param start first block of the extent
+ * @return false if no group has a free run of that size
+ */
+bool reserve_extent(uint32_t preferred_bgd, uint32_t blocks, uint32_t *start);
+
+/**
+ * @brief copy blocks into the extent starting at start, DEFRAG_CHUNK_SIZE bytes per write command,
+ * until all are copied or the budget is spent. Every block costs a read and a write
+ * @param done blocks already copied, advanced
+ * @param block_budget blocks of disk I/O allowed, at least one block is copied
+ * @return blocks of disk I/O spent
+ */
+uint32_t copy_to_extent(uint32_t *locations, uint32_t count, uint32_t start, uint32_t *done, uint32_t block_budget);
+
+/**
+ * @brief score an inode and start moving it into a single extent when it is fragmented
+ * @return true if a move was started in state
+ */
+bool defragment_node(uint32_t inode, struct EXT2DefragState *state);
+
+/**
+ * @brief continue the move in state: copy within the budget and, once every block
+ * is copied, repoint the node and free its old blocks. Called with the node lock held.
+ * A move whose node may have changed since the last step is dropped and its inode scored again
+ * @return blocks of disk I/O spent
+ */
+uint32_t defragment_continue(struct EXT2DefragState *state, uint32_t block_budget);
+
+/**
+ * @brief start a new defragmentation pass
+ */
+void defragment_init(struct EXT2DefragState *state);
+
+/**
+ * @brief run the pass until block_budget blocks of disk I/O were spent, holding
+ * the node lock for the step. A small budget keeps each call short, so foreground
+ * I/O can run between steps; copying a file stops as well when the budget is spent
+ * @return true while inodes remain to be examined or a move is unfinished
+ */
+bool defragment_step(struct EXT2DefragState *state, uint32_t block_budget);
+
+/**
+ * @brief start a background pass: a DEFRAG_THREAD_PRIORITY thread times a read of
+ * every file, runs defragment_step() with DEFRAG_STEP_BUDGET every DEFRAG_STEP_INTERVAL_MS,
+ * reads everything again and prints the EXT2DefragState and both read rates with kprintf()
+ * @return false if no thread slot is free
+ */
+bool defragment_start(void);
+
+/* ============================== COMPRESSION =========================================== */
+
+/**
+ * @brief compress data as a chain of frames, one per EXT2_COMPRESS_GROUP_SIZE bytes.
+ * Frame: 16bit little endian payload length (EXT2_COMPRESS_RAW_FRAME if stored raw), then payload
+ * @param dst output, EXT2_COMPRESS_BUFFER_SIZE bytes
+ * @return compressed length, 0 if the file is too large or would not save a block
+ */
+uint32_t compress_node_data(const void *src, uint32_t size, uint8_t *dst);
+
+/**
+ * @brief decode frames written by compress_node_data()
+ * @param size original file size
+ * @return false on malformed frames
+ */
+bool decompress_node_data(const uint8_t *src, uint32_t src_size, void *dst, uint32_t size);
+
+/* ============================== BENCHMARK ============================================= */
+
+/**
+ * @brief create EXT2_BENCHMARK_FILES one block files and delete them one by one,
+ * again and delete them in one free batch, then one file of 2^EXT2_BENCHMARK_ORDER
+ * pages, and print bitmap writes, batch flushes and cycles of each delete with kprintf().
+ * Needs a mounted filesystem with that much room, leaves it as it was
+ */
+void ext2_delete_benchmark(void);
+
+/**
+ * @brief write EXT2_COMPRESS_MAX_SIZE bytes of text like and of log like data as files
+ * with and without EXT2_LZ4_FL, read each back and compare, and print sectors on disk
+ * and write / read cycles of every file with kprintf(). The files are deleted again,
+ * and EXT2_FEATURE_INCOMPAT_LZ4_FRAMES is cleared again if the benchmark set it
+ */
+void ext2_compress_benchmark(void);
+
+/**
+ * @brief load every inode in order, then EXT2_BENCHMARK_LOOKUPS random ones, once
+ * with load_node() reading the single sector of the record and once reading the whole
+ * inode table block like before, and print sectors and cycles per inode with kprintf()
+ */
+void ext2_inode_benchmark(void);
+
+/**
+ * @brief run create_ext2() under task_benchmark(), once per processor count, and print
+ * how the parallel block group setup scales. Every run formats the disk again, so all
+ * files are lost; the filesystem of the last run stays mounted
+ */
+void ext2_mkfs_benchmark(void);
+
 #endif
\ No newline at end of file
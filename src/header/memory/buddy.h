@@ -0,0 +1,152 @@
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/boot/multiboot.h"
+#include "header/cpu/lock.h"
+#include "header/memory/paging.h"
+
+#define BUDDY_MAX_ORDER        10          // largest block is 2^10 pages, 4 MiB
+#define BUDDY_ORDERS           (BUDDY_MAX_ORDER + 1)
+#define BUDDY_MIN_ADDRESS      0x00100000  // memory below 1 MiB holds the BIOS, VGA and the SMP trampoline
+#define BUDDY_ADDRESS_LIMIT    KERNEL_DIRECT_MAP_SIZE // handed out memory must be reachable through PHYS_TO_VIRT()
+#define BUDDY_BENCHMARK_ROUNDS 100000
+#define BUDDY_BENCHMARK_SLOTS  512
+
+_Static_assert(BUDDY_ORDERS <= 32, "free list bitmap is one dword");
+
+/* -- Page.flags -- */
+#define PAGE_RESERVED 0x01 // never handed out: firmware, kernel image, allocator metadata
+#define PAGE_FREE     0x02 // first page of a free block of Page.order
+#define PAGE_SLAB     0x04 // part of a slab, Page.slab says which
+
+extern uint8_t _kernel_start[];
+extern uint8_t _kernel_end[];
+
+/**
+ * Page, descriptor of one physical page. Only the first page of a block is
+ * linked into a free list, the others are untouched until the block splits.
+ * While a block is allocated its owner may use slab and order.
+ *
+ * @param next  Next free block of the same order
+ * @param slab  KmemSlab the page belongs to, with PAGE_SLAB
+ * @param prev  Previous free block of the same order
+ * @param order Block order while free, kmalloc() keeps the order of large allocations here
+ * @param flags PAGE_RESERVED, PAGE_FREE, PAGE_SLAB
+ */
+struct Page {
+    union {
+        struct Page *next;
+        void        *slab;
+    };
+    struct Page *prev;
+    uint16_t    order;
+    uint16_t    flags;
+};
+
+/**
+ * BuddyState, binary buddy allocator over usable RAM
+ * A free block of order k is 2^k pages starting at a multiple of 2^k pages; its
+ * buddy is the block at page ^ 2^k. Freeing merges with a free buddy of the same
+ * order until the buddy is in use, so every operation walks at most
+ * BUDDY_MAX_ORDER orders.
+ *
+ * @param lock        Protects everything below
+ * @param pages       Descriptor of every page below page_count
+ * @param page_count  Pages from address 0 to the end of the highest usable range
+ * @param bitmap      Bit k set when free_list[k] is not empty
+ * @param free_list   Free blocks of each order
+ * @param free_blocks Length of each free list
+ * @param total_pages Pages managed by the allocator
+ * @param free_pages  Pages in free blocks
+ * @param allocations Successful buddy_alloc() calls
+ * @param frees       buddy_free() calls
+ * @param failures    buddy_alloc() calls without a large enough block
+ * @param merges      Buddy pairs merged on free
+ * @param splits      Blocks split on allocation
+ */
+struct BuddyState {
+    struct Spinlock lock;
+    struct Page     *pages;
+    uint32_t        page_count;
+    uint32_t        bitmap;
+    struct Page     *free_list[BUDDY_ORDERS];
+    uint32_t        free_blocks[BUDDY_ORDERS];
+    uint32_t        total_pages;
+    uint32_t        free_pages;
+    uint32_t        allocations;
+    uint32_t        frees;
+    uint32_t        failures;
+    uint32_t        merges;
+    uint32_t        splits;
+};
+
+extern struct BuddyState buddy_state;
+
+/**
+ * Hand every page of the multiboot memory map marked available to the allocator,
+ * except memory below BUDDY_MIN_ADDRESS, the kernel image between _kernel_start
+ * and _kernel_end, the boot information itself and the Page array, which is
+ * placed in the first usable range after the kernel. Without a memory map
+ * mem_upper is used. Memory above KERNEL_DIRECT_MAP_SIZE is left out. Call once,
+ * after paging_init() and before anything allocates.
+ *
+ * @param magic Value of eax at boot, MULTIBOOT_BOOTLOADER_MAGIC
+ * @param mb    Boot information, through the direct map
+ */
+void buddy_init(uint32_t magic, struct MultibootInfo *mb);
+
+/**
+ * Take 2^order physically contiguous pages aligned to their size, e.g. for DMA
+ * buffers. Safe from any processor and from ISRs.
+ *
+ * @param order 0 to BUDDY_MAX_ORDER
+ * @return      Physical address of the first page, 0 when no block is large enough;
+ *              the memory is reachable at PHYS_TO_VIRT() of it
+ */
+uint32_t buddy_alloc(uint8_t order);
+
+/**
+ * Return a block taken with buddy_alloc()
+ *
+ * @param address Physical address returned by buddy_alloc()
+ * @param order   Order it was allocated with
+ */
+void buddy_free(uint32_t address, uint8_t order);
+
+/**
+ * @param address Physical address of a page
+ * @return        Its descriptor, NULL when the allocator does not know the page
+ */
+struct Page* buddy_page(uint32_t address);
+
+/**
+ * @param size Bytes
+ * @return     Smallest order whose blocks hold size bytes, BUDDY_ORDERS when none does
+ */
+uint8_t buddy_order(uint32_t size);
+
+/**
+ * External fragmentation at an order: the share of free memory in blocks too
+ * small to satisfy it, 0 when every free page could be handed out at that order
+ *
+ * @param order Order asked for
+ * @return      Percent, 0 to 100
+ */
+uint32_t buddy_fragmentation(uint8_t order);
+
+/**
+ * Print page totals, counters and free blocks of every order with kprintf()
+ */
+void buddy_dump(void);
+
+/**
+ * Time single page and mixed order alloc / free pairs, then report fragmentation
+ * after random churn and check that freeing everything merges all blocks back,
+ * printing the results with kprintf()
+ */
+void buddy_benchmark(void);
+
+#endif
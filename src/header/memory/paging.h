@@ -0,0 +1,192 @@
+#ifndef _PAGING_H
+#define _PAGING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/lock.h"
+
+#define KERNEL_VIRTUAL_BASE     0xC0000000u // keep in sync with linker.ld and kernel-entrypoint.s
+#define KERNEL_DIRECT_MAP_SIZE  0x30000000u // physical memory mapped at KERNEL_VIRTUAL_BASE, 768 MiB
+#define PAGING_MMIO_BASE        0xF0000000u // device memory outside the direct map is mapped from here up
+#define PAGING_MMIO_END         0xFFC00000u
+#define PAGING_MMIO_SLOTS       16
+#define PAGING_BENCHMARK_BASE   0x40000000u // scratch mapping in the empty lower half
+#define PAGING_BENCHMARK_ROUNDS 64
+
+#define PAGE_SIZE               4096u
+#define PAGE_SHIFT              12
+#define PAGE_LARGE_SIZE         0x00400000u // 4 MiB PSE page, one directory entry
+#define PAGE_LARGE_SHIFT        22
+#define PAGE_ENTRIES            1024
+
+/* -- Directory and table entry flags -- */
+#define PAGE_PRESENT        (1u << 0)
+#define PAGE_WRITABLE       (1u << 1)
+#define PAGE_USER           (1u << 2)
+#define PAGE_WRITE_THROUGH  (1u << 3)
+#define PAGE_CACHE_DISABLE  (1u << 4)
+#define PAGE_ACCESSED       (1u << 5)
+#define PAGE_DIRTY          (1u << 6)
+#define PAGE_LARGE          (1u << 7) // directory entry maps 4 MiB, needs CR4.PSE
+#define PAGE_GLOBAL         (1u << 8) // kept in the TLB across cr3 loads, needs CR4.PGE
+#define PAGE_UNCACHED       (PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH)
+#define PAGE_FRAME_MASK     0xFFFFF000u
+#define PAGE_LARGE_MASK     0xFFC00000u
+
+#define CR0_PAGING          (1u << 31)
+#define CR4_PSE             (1u << 4)
+#define CR4_PGE             (1u << 7)
+#define CPUID_FEATURE_EDX_PSE (1 << 3)
+#define CPUID_FEATURE_EDX_PGE (1 << 13)
+
+// Only for the direct map: physical memory below KERNEL_DIRECT_MAP_SIZE and kernel addresses above KERNEL_VIRTUAL_BASE
+#define PHYS_TO_VIRT(address) ((void*) ((uint32_t) (address) + KERNEL_VIRTUAL_BASE))
+#define VIRT_TO_PHYS(address) ((uint32_t) (address) - KERNEL_VIRTUAL_BASE)
+
+/**
+ * PageDirectory, top level of the two level i386 translation. Entry i maps the
+ * 4 MiB at i << 22, either directly (PAGE_LARGE) or through a page table of
+ * PAGE_ENTRIES 4 KiB entries.
+ */
+struct PageDirectory {
+    uint32_t entries[PAGE_ENTRIES];
+} __attribute__((aligned(4096)));
+
+/**
+ * PagingMMIO, one run of large pages in the MMIO window
+ *
+ * @param phys  Physical address of the first large page
+ * @param virt  Where it is mapped
+ * @param count Large pages in the run
+ * @param flags Cache flags it was mapped with
+ */
+struct PagingMMIO {
+    uint32_t phys;
+    uint32_t virt;
+    uint32_t count;
+    uint32_t flags;
+};
+
+/**
+ * PagingState
+ *
+ * The kernel directory maps KERNEL_DIRECT_MAP_SIZE of physical memory at
+ * KERNEL_VIRTUAL_BASE with global 4 MiB pages, which holds the kernel image,
+ * the allocator's memory and the BIOS area, so kernel paths need one TLB entry
+ * per 4 MiB. Devices above the direct map get large pages from the MMIO window.
+ * The lower 3 GiB are left for page tables built with paging_map().
+ *
+ * Other processors drop stale translations lazily: an unmap bumps
+ * tlb_generation and every processor flushes in paging_tlb_sync() when it is
+ * behind, which runs on each interrupt and before each task. Memory behind an
+ * unmapped page may only be reused once paging_tlb_quiesced() says so.
+ *
+ * @param lock             Protects the directory and page tables
+ * @param directory        Kernel page directory
+ * @param directory_phys   Its physical address, the value of cr3
+ * @param global           PAGE_GLOBAL when the CPU supports it, else 0
+ * @param mmio             Runs mapped in the MMIO window
+ * @param mmio_count       Used entries of mmio
+ * @param mmio_next        Next free address of the MMIO window
+ * @param tables           Page tables allocated by paging_map()
+ * @param tlb_generation   Bumped by every unmap
+ * @param tlb_flushes      Full flushes done by paging_tlb_sync()
+ */
+struct PagingState {
+    struct Spinlock      lock;
+    struct PageDirectory *directory;
+    uint32_t             directory_phys;
+    uint32_t             global;
+    struct PagingMMIO    mmio[PAGING_MMIO_SLOTS];
+    uint32_t             mmio_count;
+    uint32_t             mmio_next;
+    uint32_t             tables;
+    volatile uint32_t    tlb_generation;
+    uint32_t             tlb_flushes;
+};
+
+extern struct PagingState paging_state;
+
+/**
+ * Leave the 16 MiB boot mapping of kernel-entrypoint.s for the kernel directory.
+ * Identity mapped low memory is gone afterwards, physical addresses have to go
+ * through PHYS_TO_VIRT() or paging_map_physical(). Call first thing in kernel_setup().
+ */
+void paging_init(void);
+
+/**
+ * Map physical memory for the kernel, e.g. device registers or a framebuffer.
+ * Memory inside the direct map is returned from there, anything else gets 4 MiB
+ * pages in the MMIO window, shared with earlier calls covering the same pages.
+ *
+ * @param phys  Physical address
+ * @param size  Bytes, at least 1
+ * @param flags PAGE_UNCACHED for registers, 0 keeps the memory type the MTRRs give
+ * @return      Virtual address of phys, NULL when the MMIO window is full
+ */
+void* paging_map_physical(uint32_t phys, uint32_t size, uint32_t flags);
+
+/**
+ * Map or unmap physical memory 0 to 4 MiB at the same virtual addresses, needed
+ * while application processors leave the SMP trampoline for the higher half
+ *
+ * @param map True to add the mapping, false to remove it again
+ */
+void paging_identity_low(bool map);
+
+/**
+ * Map one 4 KiB page, allocating the page table from buddy_alloc() if needed
+ *
+ * @param directory Directory, paging_state.directory for the kernel
+ * @param virt      Page aligned virtual address outside the large page mappings
+ * @param phys      Page aligned physical address
+ * @param flags     PAGE_WRITABLE, PAGE_USER, PAGE_GLOBAL, cache flags
+ * @return          False when virt is in a large page or no page table could be allocated
+ */
+bool paging_map(struct PageDirectory *directory, uint32_t virt, uint32_t phys, uint32_t flags);
+
+/**
+ * Unmap one 4 KiB page and start a lazy shootdown with paging_tlb_shootdown()
+ *
+ * @param directory Directory
+ * @param virt      Virtual address
+ * @return          Physical address that was mapped, 0 when nothing was
+ */
+uint32_t paging_unmap(struct PageDirectory *directory, uint32_t virt);
+
+/**
+ * @param directory Directory
+ * @param virt      Virtual address
+ * @param phys      Physical address virt translates to, when mapped
+ * @return          True when virt is mapped
+ */
+bool paging_translate(struct PageDirectory *directory, uint32_t virt, uint32_t *phys);
+
+/**
+ * Drop virt from this processor's TLB now and from the others lazily
+ *
+ * @param virt Virtual address whose translation changed
+ * @return     Generation to pass to paging_tlb_quiesced()
+ */
+uint32_t paging_tlb_shootdown(uint32_t virt);
+
+/**
+ * Flush this processor's TLB if a shootdown happened since its last flush.
+ * Called on interrupt entry and by the task workers, cheap when nothing changed.
+ */
+void paging_tlb_sync(void);
+
+/**
+ * @param generation Value returned by paging_tlb_shootdown()
+ * @return           True when every online processor flushed since then
+ */
+bool paging_tlb_quiesced(uint32_t generation);
+
+/**
+ * Walk 4 MiB one page at a time through the direct map and through the same
+ * memory mapped with 4 KiB pages, and print cycles per access with kprintf()
+ */
+void paging_benchmark(void);
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/lock.h"
+#include "header/cpu/smp.h"
+
+#define CACHE_LINE_SIZE          64
+#define KMEM_MAGAZINE_SIZE       16  // objects per magazine, every processor has two per cache
+#define KMEM_MAX_SLAB_ORDER      3   // slabs of up to 8 pages
+#define KMEM_FREE_SLABS          1   // empty slabs a cache keeps, more go back to the buddy allocator
+#define KMALLOC_MIN_SHIFT        3   // smallest size class, 8 bytes
+#define KMALLOC_MAX_SHIFT        11  // largest size class, 2 KiB, larger requests take whole pages
+#define KMALLOC_CLASSES          (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMEM_BENCHMARK_ROUNDS    20000
+#define KMEM_BENCHMARK_INODES    64  // inodes and names kept cached while the benchmark walks files
+#define KMEM_BENCHMARK_BLOCK     1024
+#define KMEM_BENCHMARK_INODE     160 // struct EXT2INode plus in-memory bookkeeping
+
+typedef void (*kmem_ctor_t)(void *object);
+
+/**
+ * KmemSlab, header at the start of every slab. Slabs are buddy blocks aligned
+ * to their size, the objects follow the header after the slab's color offset.
+ * A free object keeps the next free one at KmemCache.free_offset.
+ *
+ * @param next  Next slab of the same list
+ * @param prev  Previous slab of the same list
+ * @param cache Cache the slab belongs to
+ * @param free  First free object, NULL when the slab is full
+ * @param inuse Objects taken from the slab, including those in magazines
+ */
+struct KmemSlab {
+    struct KmemSlab  *next;
+    struct KmemSlab  *prev;
+    struct KmemCache *cache;
+    void             *free;
+    uint32_t         inuse;
+};
+
+/**
+ * KmemMagazine, a stack of free objects owned by one processor
+ *
+ * @param count   Objects in the magazine
+ * @param objects The objects, the last one is handed out first
+ */
+struct KmemMagazine {
+    uint32_t count;
+    void     *objects[KMEM_MAGAZINE_SIZE];
+};
+
+/**
+ * KmemCPU, the per-processor layer of a cache. Allocations pop from loaded and
+ * frees push onto it without taking the cache lock. When loaded runs empty or
+ * full it is swapped with previous, and only when both are, a whole magazine
+ * goes to or comes from the slabs. So a processor that alternates allocations
+ * and frees around a boundary never reaches the lock.
+ *
+ * @param loaded    Magazine in use
+ * @param previous  The other one, full or empty
+ * @param magazines Storage of both
+ * @param hits      Allocations served from a magazine
+ * @param misses    Allocations that refilled from the slabs
+ * @param frees     Objects freed on this processor
+ */
+struct KmemCPU {
+    struct KmemMagazine *loaded;
+    struct KmemMagazine *previous;
+    struct KmemMagazine magazines[2];
+    uint32_t            hits;
+    uint32_t            misses;
+    uint32_t            frees;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/**
+ * KmemCache, objects of one size and constructor. Objects are constructed once
+ * when their slab is created and must be freed in constructed state, so
+ * kmem_cache_alloc() hands them out without further initialization.
+ * Consecutive slabs start their objects at different cache line offsets (the
+ * color), so the first objects of many slabs do not all compete for the same
+ * cache sets.
+ *
+ * @param name          Shown by kmem_dump()
+ * @param size          Object size asked for
+ * @param align         Object alignment
+ * @param stride        Distance between objects, size with the free pointer and alignment
+ * @param free_offset   Where a free object keeps its free list link, after the object when there is a constructor
+ * @param order         Buddy order of each slab
+ * @param per_slab      Objects per slab
+ * @param first         Offset of the first object of a slab with color 0
+ * @param colors        Distinct color offsets the unused tail of a slab allows
+ * @param color_step    Bytes between colors, a cache line or the alignment
+ * @param color_next    Color of the next slab
+ * @param ctor          Constructor, may be NULL
+ * @param lock          Protects the slab lists and the counters below
+ * @param full          Slabs without a free object
+ * @param partial       Slabs with free and used objects
+ * @param empty         Slabs without a used object
+ * @param slabs         Slabs of the cache
+ * @param empty_slabs   Length of empty
+ * @param free_objects  Objects on the free lists of the slabs
+ * @param slabs_created Slabs taken from the buddy allocator
+ * @param slabs_freed   Slabs returned to it
+ * @param failures      Allocations that found no memory
+ * @param cpus          Magazines of each processor, indexed by CPULocal.index
+ * @param next          Next cache in kmem_state.caches
+ */
+struct KmemCache {
+    const char      *name;
+    uint32_t        size;
+    uint32_t        align;
+    uint32_t        stride;
+    uint32_t        free_offset;
+    uint8_t         order;
+    uint32_t        per_slab;
+    uint32_t        first;
+    uint32_t        colors;
+    uint32_t        color_step;
+    uint32_t        color_next;
+    kmem_ctor_t     ctor;
+    struct Spinlock lock;
+    struct KmemSlab *full;
+    struct KmemSlab *partial;
+    struct KmemSlab *empty;
+    uint32_t        slabs;
+    uint32_t        empty_slabs;
+    uint32_t        free_objects;
+    uint32_t        slabs_created;
+    uint32_t        slabs_freed;
+    uint32_t        failures;
+    struct KmemCPU  cpus[SMP_MAX_CPUS];
+    struct KmemCache *next;
+};
+
+/**
+ * KmemCacheStats, snapshot taken by kmem_cache_stats()
+ *
+ * @param active_objects   Objects held by callers
+ * @param total_objects    Objects of all slabs
+ * @param magazine_objects Free objects sitting in magazines
+ * @param slabs            Slabs of the cache
+ * @param slab_bytes       Memory of those slabs
+ * @param allocations      kmem_cache_alloc() calls that returned an object
+ * @param hits             Allocations served from a magazine
+ * @param hit_percent      hits of all allocations, 0 to 100
+ */
+struct KmemCacheStats {
+    uint32_t active_objects;
+    uint32_t total_objects;
+    uint32_t magazine_objects;
+    uint32_t slabs;
+    uint32_t slab_bytes;
+    uint32_t allocations;
+    uint32_t hits;
+    uint32_t hit_percent;
+};
+
+/**
+ * KmemState
+ *
+ * @param lock          Protects caches
+ * @param caches        Every initialized cache, newest first
+ * @param kmalloc       Size class caches, 2^KMALLOC_MIN_SHIFT to 2^KMALLOC_MAX_SHIFT bytes
+ * @param large         kmalloc() calls served by whole buddy blocks
+ * @param large_pages   Pages held by those
+ */
+struct KmemState {
+    struct Spinlock  lock;
+    struct KmemCache *caches;
+    struct KmemCache kmalloc[KMALLOC_CLASSES];
+    uint32_t         large;
+    uint32_t         large_pages;
+};
+
+extern struct KmemState kmem_state;
+
+/**
+ * Set up the kmalloc() size classes. Call after buddy_init() and smp_init_bsp().
+ */
+void kmem_init(void);
+
+/**
+ * Set up a cache, the storage belongs to the caller. Slabs are only allocated
+ * once the first object is.
+ *
+ * @param cache Cache to set up
+ * @param name  Shown by kmem_dump(), must stay valid
+ * @param size  Object size
+ * @param align Object alignment, a power of two; 0 for pointer size, CACHE_LINE_SIZE for hot objects
+ * @param ctor  Called once on every object when its slab is created, may be NULL
+ * @return      False when an object does not fit a slab of KMEM_MAX_SLAB_ORDER
+ */
+bool kmem_cache_init(struct KmemCache *cache, const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+
+/**
+ * Free every slab and forget the cache. Only when no processor uses it anymore.
+ * A magazine belongs to its processor, so only the caller's are emptied here;
+ * every other processor that used the cache must call kmem_cache_shrink() first.
+ *
+ * @param cache Cache set up with kmem_cache_init()
+ * @return      False when another processor's magazines are not empty, nothing
+ *              changes then, or when objects are still allocated, their slabs are kept then
+ */
+bool kmem_cache_destroy(struct KmemCache *cache);
+
+/**
+ * Take an object. Safe from any processor and from ISRs.
+ *
+ * @param cache Cache
+ * @return      Constructed object, NULL when no memory is left
+ */
+void* kmem_cache_alloc(struct KmemCache *cache);
+
+/**
+ * Return an object, in constructed state if the cache has a constructor
+ *
+ * @param cache  Cache it came from
+ * @param object Object returned by kmem_cache_alloc(), NULL is ignored
+ */
+void kmem_cache_free(struct KmemCache *cache, void *object);
+
+/**
+ * Empty this processor's magazines of the cache and return all empty slabs to
+ * the buddy allocator
+ *
+ * @param cache Cache
+ * @return      Pages returned
+ */
+uint32_t kmem_cache_shrink(struct KmemCache *cache);
+
+/**
+ * Magazines and their counters belong to their processors and are read
+ * without stopping them, so the numbers are only exact while no other
+ * processor is online. active_objects never wraps below 0 either way.
+ *
+ * @param cache Cache
+ * @param stats Filled with the current numbers
+ * @return      True when the snapshot is exact, false when other processors may have changed it while it was taken
+ */
+bool kmem_cache_stats(struct KmemCache *cache, struct KmemCacheStats *stats);
+
+/**
+ * Allocate from the smallest size class that holds size bytes, aligned to the
+ * class size up to CACHE_LINE_SIZE. Larger requests get whole buddy blocks.
+ *
+ * @param size Bytes
+ * @return     Memory in the direct map, NULL when size is 0 or no memory is left
+ */
+void* kmalloc(uint32_t size);
+
+/**
+ * @param ptr Value returned by kmalloc(), NULL is ignored
+ */
+void kfree(void *ptr);
+
+/**
+ * Print the statistics of every cache with kprintf()
+ */
+void kmem_dump(void);
+
+/**
+ * Replay an ext2 style workload, inodes and names that stay cached for a while
+ * and block buffers freed right after use, on slab caches and on a first-fit
+ * free-list allocator, and print cycles per operation and cache statistics
+ * with kprintf()
+ */
+void kmem_benchmark(void);
+
+#endif
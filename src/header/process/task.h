@@ -0,0 +1,136 @@
+#ifndef _TASK_H
+#define _TASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/smp.h"
+
+#define TASK_DEQUE_CAPACITY   256         // power of two, a spawn into a full deque runs inline
+#define TASK_WAKE_VECTOR      0x3B        // IPI that ends the hlt of an idle worker
+#define TASK_BENCHMARK_BAR    40
+
+_Static_assert((TASK_DEQUE_CAPACITY & (TASK_DEQUE_CAPACITY - 1)) == 0, "deque index is masked");
+
+typedef void (*task_fn_t)(void *arg);
+typedef void (*parallel_fn_t)(uint32_t index, void *arg);
+
+/**
+ * TaskGroup, tasks a task_join() waits for
+ *
+ * @param pending Spawned tasks that have not finished
+ */
+struct TaskGroup {
+    volatile uint32_t pending;
+};
+
+/**
+ * Task, one unit of work. The storage belongs to the spawner and must stay valid
+ * until task_join() of its group returned, usually a local of the joining function.
+ *
+ * @param fn    Work function
+ * @param arg   Passed to fn
+ * @param group Group counting the task as pending
+ */
+struct Task {
+    task_fn_t        fn;
+    void             *arg;
+    struct TaskGroup *group;
+};
+
+/**
+ * TaskDeque, Chase-Lev work-stealing deque of one processor.
+ * The owner pushes and takes at bottom, thieves take at top with a CAS; only the
+ * last task is contended. Indices only grow, slot i is buffer[i % capacity].
+ *
+ * @param top      Next task a thief takes
+ * @param bottom   Next free slot of the owner
+ * @param buffer   Tasks between top and bottom
+ * @param executed Tasks run by this processor
+ * @param stolen   Tasks this processor took from another deque
+ * @param halts    Times the worker went to sleep with nothing to steal
+ */
+struct TaskDeque {
+    volatile int32_t top;
+    volatile int32_t bottom;
+    struct Task      *volatile buffer[TASK_DEQUE_CAPACITY];
+    uint32_t         executed;
+    uint32_t         stolen;
+    uint32_t         halts;
+} __attribute__((aligned(64)));
+
+/**
+ * TaskPoolState
+ *
+ * @param deques   Deque of each processor, indexed by CPULocal.index
+ * @param sleeping Bit i set while processor i waits in hlt for TASK_WAKE_VECTOR
+ * @param workers  Processors with an index below this run tasks, for scaling measurements
+ */
+struct TaskPoolState {
+    struct TaskDeque  deques[SMP_MAX_CPUS];
+    volatile uint32_t sleeping;
+    volatile uint32_t workers;
+};
+
+extern struct TaskPoolState task_pool_state;
+
+/**
+ * Set up the pool. Call before smp_init(), application processors enter
+ * task_worker_main() as soon as they are online.
+ */
+void task_pool_init(void);
+
+/**
+ * Worker loop of an application processor: run own tasks, steal from the other
+ * processors, hlt when there is nothing to steal. Never returns.
+ * DO NOT CALL THIS FUNCTION.
+ */
+void task_worker_main(void);
+
+/**
+ * @param group Group to empty
+ */
+void task_group_init(struct TaskGroup *group);
+
+/**
+ * Queue fn(arg) on the running processor, where idle processors can steal it.
+ * Not for interrupt context.
+ *
+ * @param group Group the task is joined with
+ * @param task  Storage for the task, valid until task_join(group) returns
+ * @param fn    Work function
+ * @param arg   Passed to fn
+ */
+void task_spawn(struct TaskGroup *group, struct Task *task, task_fn_t fn, void *arg);
+
+/**
+ * Run queued and stolen tasks until every task of group finished
+ *
+ * @param group Group spawned into
+ */
+void task_join(struct TaskGroup *group);
+
+/**
+ * Call fn(i, arg) for every i in [begin, end). The range is halved recursively
+ * and one half spawned until at most grain indices remain, so idle processors
+ * steal the largest pieces first.
+ *
+ * @param begin First index
+ * @param end   One past the last index
+ * @param grain Indices run serially by one task, at least 1
+ * @param fn    Body
+ * @param arg   Passed to fn
+ */
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, parallel_fn_t fn, void *arg);
+
+/**
+ * Run job once for each processor count from 1 to smp_state.cpu_count and print
+ * cycles and speedup over one processor as a bar chart with kprintf()
+ *
+ * @param name Label of the chart
+ * @param job  Parallel job, e.g. calling parallel_for()
+ * @param arg  Passed to job
+ */
+void task_benchmark(const char *name, task_fn_t job, void *arg);
+
+#endif
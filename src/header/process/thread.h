@@ -0,0 +1,196 @@
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/interrupt.h"
+#include "header/driver/timer.h"
+
+#define THREAD_MAX            16
+#define THREAD_STACK_SIZE     8192
+#define THREAD_PRIORITIES     32          // 0 is the highest, one run queue per priority
+#define THREAD_PRIORITY_IDLE  (THREAD_PRIORITIES - 1)
+#define THREAD_PRIORITY_NORMAL 16
+#define THREAD_SLICE_NS       (10 * NS_PER_MS)
+#define THREAD_NAME_LENGTH    16
+#define THREAD_YIELD_VECTOR   0x3C        // int THREAD_YIELD_VECTOR enters the scheduler from a thread
+
+_Static_assert(THREAD_PRIORITIES <= 32, "run queue bitmap is one dword");
+
+struct WaitQueue;
+
+enum ThreadState {
+    THREAD_UNUSED = 0,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+/**
+ * Thread, kernel thread control block
+ *
+ * A thread that is not running is suspended inside an interrupt: frame points at
+ * the InterruptFrame call_generic_handler saved on its own stack, and switching to
+ * it is returning that frame from main_interrupt_handler(). A new thread gets a
+ * frame built by thread_create() that "returns" into thread_start.
+ *
+ * @param frame       Saved CPU state while not running
+ * @param id          Thread id, 0 is the boot thread
+ * @param state       Scheduling state
+ * @param priority    Run queue index, 0 runs first
+ * @param fn          Entry function
+ * @param arg         Passed to fn
+ * @param next        Next thread in the same run queue
+ * @param wait_queue  WaitQueue the thread is blocked on, NULL when none
+ * @param wait_next   Next thread in wait_queue
+ * @param stack       Bottom of the stack, NULL for the boot thread which keeps kernel_stack
+ * @param sleep_timer Wakes the thread from thread_sleep_ns()
+ * @param switches    Times the thread was switched in
+ * @param name        Null terminated name for debugging
+ */
+struct Thread {
+    struct InterruptFrame *frame;
+    uint32_t              id;
+    enum ThreadState      state;
+    uint8_t               priority;
+    void                  (*fn)(void *arg);
+    void                  *arg;
+    struct Thread         *next;
+    struct WaitQueue      *wait_queue;
+    struct Thread         *wait_next;
+    uint8_t               *stack;
+    struct Timer          sleep_timer;
+    uint32_t              switches;
+    char                  name[THREAD_NAME_LENGTH];
+};
+
+/**
+ * RunQueue, O(1) priority queue of ready threads
+ * Bit p of bitmap is set when queue p is not empty, the next thread is the head
+ * of queue ctz(bitmap). Threads of one priority take turns in FIFO order.
+ *
+ * @param bitmap Non empty queues
+ * @param head   First ready thread of each priority
+ * @param tail   Last ready thread of each priority
+ */
+struct RunQueue {
+    uint32_t      bitmap;
+    struct Thread *head[THREAD_PRIORITIES];
+    struct Thread *tail[THREAD_PRIORITIES];
+};
+
+/**
+ * SchedulerState
+ *
+ * @param current       Running thread
+ * @param idle          Runs when nothing else is ready, never queued
+ * @param run_queue     Ready threads
+ * @param need_resched  Pick the next thread when the outermost interrupt returns
+ * @param slice_timer   Preempts the current thread after THREAD_SLICE_NS when others are ready
+ * @param next_id       Id of the next thread created
+ * @param switches      Context switches done
+ * @param threads       Thread control blocks
+ */
+struct SchedulerState {
+    struct Thread   *current;
+    struct Thread   *idle;
+    struct RunQueue run_queue;
+    bool            need_resched;
+    struct Timer    slice_timer;
+    uint32_t        next_id;
+    uint32_t        switches;
+    struct Thread   threads[THREAD_MAX];
+};
+
+extern struct SchedulerState scheduler_state;
+
+/**
+ * Turn the running boot context into thread 0 and create the idle thread.
+ * Call after timer_init(), time slices use a timer.
+ */
+void thread_init(void);
+
+/**
+ * Create a ready thread
+ *
+ * @param fn       Entry function, returning from it ends the thread
+ * @param arg      Passed to fn
+ * @param priority 0 (highest) to THREAD_PRIORITY_IDLE
+ * @param name     Name for debugging, cut to THREAD_NAME_LENGTH - 1
+ * @return         The thread, NULL when THREAD_MAX threads exist
+ */
+struct Thread* thread_create(void (*fn)(void *arg), void *arg, uint8_t priority, const char *name);
+
+/**
+ * @return Running thread
+ */
+struct Thread* thread_current(void);
+
+/**
+ * Let other ready threads of the same or higher priority run
+ */
+void thread_yield(void);
+
+/**
+ * Stop running until thread_wake(). Call with interrupts disabled, after checking
+ * the condition being waited for, so a wake from an ISR cannot be missed in
+ * between. Returns with interrupts still disabled. Not for interrupt context.
+ */
+void thread_block(void);
+
+/**
+ * Make a blocked thread ready, safe from ISRs. Preempts the running thread at the
+ * next interrupt return when thread has a higher priority.
+ *
+ * @param thread Thread, nothing happens if it is not blocked
+ */
+void thread_wake(struct Thread *thread);
+
+/**
+ * thread_wake() without switching: the thread is queued and a reschedule is
+ * requested when it should preempt, the caller switches once it released its
+ * locks. Safe from ISRs.
+ *
+ * @param thread Thread, nothing happens if it is not blocked
+ * @return       True when the thread should run before the current one
+ */
+bool thread_make_ready(struct Thread *thread);
+
+/**
+ * @return True when the caller is a thread on the boot processor outside of an
+ *         interrupt handler, so it may block instead of polling
+ */
+bool thread_can_block(void);
+
+/**
+ * Block the running thread for at least ns nanoseconds
+ *
+ * @param ns Nanoseconds
+ */
+void thread_sleep_ns(uint64_t ns);
+
+/**
+ * End the running thread, its slot is reused by a later thread_create()
+ */
+void thread_exit(void);
+
+/**
+ * Switch threads if a reschedule is pending. Called by main_interrupt_handler()
+ * on the outermost interrupt with interrupts disabled.
+ * DO NOT CALL THIS FUNCTION.
+ *
+ * @param frame Frame of the interrupted thread
+ * @return      Frame to resume, of the same or another thread
+ */
+struct InterruptFrame* scheduler_switch(struct InterruptFrame *frame);
+
+/**
+ * Ping-pong two threads through thread_block() / thread_wake() and time periodic
+ * thread_sleep_ns() wake ups, then print switch latency and wake up jitter with
+ * kprintf(). Blocks the calling thread until both measurements are done.
+ */
+void thread_benchmark(void);
+
+#endif
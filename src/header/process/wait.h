@@ -0,0 +1,138 @@
+#ifndef _WAIT_H
+#define _WAIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/lock.h"
+
+struct Thread;
+
+typedef bool (*wait_condition_t)(void *arg);
+
+/**
+ * WaitQueue, threads blocked until an event. The condition a waiter checks is
+ * read with lock held, and a waker changes it before taking lock, so the change
+ * is either seen by the check or the waiter is already queued when it wakes.
+ * Waiters are threads on the boot processor; wakers may be ISRs, deferred work
+ * or threads there. Processors without threads poll instead of waiting.
+ *
+ * @param lock Protects the queue and, for users that want it, the condition
+ * @param head Longest waiting thread, linked through Thread.wait_next
+ * @param tail Last waiting thread
+ */
+struct WaitQueue {
+    struct Spinlock lock;
+    struct Thread   *head;
+    struct Thread   *tail;
+};
+
+#define WAIT_QUEUE_INIT(queue_name) {.lock = SPINLOCK_INIT(queue_name), .head = NULL, .tail = NULL}
+
+/**
+ * Completion, counts events that wait_for_completion() consumes one by one.
+ * A complete() before the wait is not lost, the count keeps it.
+ *
+ * @param done  Events not consumed yet, UINT32_MAX after complete_all()
+ * @param queue Threads waiting for done to become non zero
+ */
+struct Completion {
+    volatile uint32_t done;
+    struct WaitQueue  queue;
+};
+
+#define COMPLETION_INIT(completion_name) {.done = 0, .queue = WAIT_QUEUE_INIT(completion_name)}
+
+/**
+ * @param queue Queue to empty, same as WAIT_QUEUE_INIT
+ * @param name  Name of the queue lock in lock statistics
+ */
+void wait_queue_init(struct WaitQueue *queue, const char *name);
+
+/**
+ * Block until ready(arg) is true. ready() runs with queue->lock held and
+ * interrupts disabled, it must not block.
+ *
+ * @param queue Queue the event is signalled on
+ * @param ready Condition
+ * @param arg   Passed to ready
+ */
+void wait_event(struct WaitQueue *queue, wait_condition_t ready, void *arg);
+
+/**
+ * wait_event() for a caller already holding queue->lock with interrupts disabled,
+ * so state guarded by the lock can be updated together with the check.
+ * The lock is dropped while blocked and held again on return.
+ *
+ * @param queue Queue the event is signalled on, lock held
+ * @param ready Condition
+ * @param arg   Passed to ready
+ */
+void wait_event_locked(struct WaitQueue *queue, wait_condition_t ready, void *arg);
+
+/**
+ * Wake the longest waiting thread. Safe from ISRs on the boot processor.
+ *
+ * @param queue Queue
+ * @return      True when a thread was woken
+ */
+bool wake_up(struct WaitQueue *queue);
+
+/**
+ * Wake every waiting thread, each checks its condition again
+ *
+ * @param queue Queue
+ */
+void wake_up_all(struct WaitQueue *queue);
+
+/**
+ * @param completion Completion to reset, same as COMPLETION_INIT
+ * @param name       Name of the queue lock in lock statistics
+ */
+void completion_init(struct Completion *completion, const char *name);
+
+/**
+ * Forget events signalled so far, for reuse by the next operation
+ *
+ * @param completion Completion nobody is waiting on
+ */
+void completion_reinit(struct Completion *completion);
+
+/**
+ * Signal one event and wake one waiter. Safe from ISRs and deferred work.
+ *
+ * @param completion Completion
+ */
+void complete(struct Completion *completion);
+
+/**
+ * Signal that every present and future wait returns at once
+ *
+ * @param completion Completion
+ */
+void complete_all(struct Completion *completion);
+
+/**
+ * Block until an event is signalled and consume it. Not for interrupt context.
+ *
+ * @param completion Completion
+ */
+void wait_for_completion(struct Completion *completion);
+
+/**
+ * wait_for_completion() that gives up after timeout_ns, woken by the sleep timer
+ * of the calling thread
+ *
+ * @param completion Completion
+ * @param timeout_ns Longest wait in nanoseconds
+ * @return           True when an event was consumed, false on timeout
+ */
+bool wait_for_completion_timeout(struct Completion *completion, uint64_t timeout_ns);
+
+/**
+ * @param completion Completion
+ * @return           True when wait_for_completion() would return without blocking
+ */
+bool completion_done(struct Completion *completion);
+
+#endif
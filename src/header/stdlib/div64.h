@@ -0,0 +1,17 @@
+#ifndef _DIV64_H
+#define _DIV64_H
+
+#include <stdint.h>
+
+/**
+ * Divide a 64-bit value by a 32-bit one. The kernel is not linked with libgcc,
+ * so a plain 64-bit '/' or '%' fails to link; this uses two 32-bit divl instead.
+ *
+ * @param dividend  Value to divide
+ * @param divisor   Non zero divisor
+ * @param remainder Receives dividend % divisor, may be NULL
+ * @return          dividend / divisor
+ */
+uint64_t div64_32(uint64_t dividend, uint32_t divisor, uint32_t *remainder);
+
+#endif
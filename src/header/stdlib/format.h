@@ -0,0 +1,27 @@
+#ifndef _FORMAT_H
+#define _FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+/**
+ * Minimal vsnprintf for the kernel, no floating point and no 64 bit integers.
+ * Supported conversions: %d %i %u %x %X %p %s %c %%, with an optional
+ * '-' or '0' flag and a field width. The 'l' length modifier is accepted and ignored.
+ *
+ * @param buf  Output buffer, always null terminated when size > 0
+ * @param size Size of buf in byte
+ * @param fmt  Format string
+ * @param args Arguments for fmt
+ *
+ * @return Length of the whole output like snprintf, buf holds its first size - 1 characters
+ */
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+
+/**
+ * kvsnprintf() with variadic arguments
+ */
+int ksnprintf(char *buf, size_t size, const char *fmt, ...);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* -- LZ4 block format constants -- */
+#define LZ4_MIN_MATCH      4u      // shortest match that can be encoded
+#define LZ4_MFLIMIT        12u     // last match must start at least this far from the end of input
+#define LZ4_LAST_LITERALS  5u      // last bytes of input are always literals
+#define LZ4_MAX_OFFSET     65535u  // matches reach back at most this many bytes
+#define LZ4_HASH_LOG       12u
+#define LZ4_HASH_SIZE      (1u << LZ4_HASH_LOG)
+#define LZ4_MAX_INPUT_SIZE 65535u  // positions are kept as uint16_t in the hash table
+
+/**
+ * Worst case compressed size for n bytes of input
+ * (literals only, plus one length byte per 255 literals and the token)
+ */
+#define LZ4_COMPRESS_BOUND(n) ((n) + (n) / 255u + 16u)
+
+/**
+ * Compress src into the LZ4 block format (no frame header), greedy single-probe matcher.
+ *
+ * @param src      Input data
+ * @param size     Input size in byte, at most LZ4_MAX_INPUT_SIZE
+ * @param dst      Output buffer
+ * @param capacity Output buffer size in byte
+ *
+ * @return Compressed size in byte, 0 if the output does not fit into capacity
+ */
+uint32_t lz4_compress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity);
+
+/**
+ * Decompress an LZ4 block. Every length and offset is checked against both buffers,
+ * so corrupted input fails instead of writing out of bounds.
+ *
+ * @param src      Compressed data
+ * @param size     Compressed size in byte
+ * @param dst      Output buffer
+ * @param capacity Output buffer size in byte
+ *
+ * @return Decompressed size in byte, -1 on malformed input
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity);
+
+#endif
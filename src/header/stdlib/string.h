@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define STRING_BENCHMARK_MAX   65536     // largest size string_benchmark() times
+#define STRING_BENCHMARK_BYTES (1u << 20) // bytes moved per size and function
+
 /**
  * C standard memset, check man memset or
  * https://man7.org/linux/man-pages/man3/memset.3.html for more details
@@ -52,4 +55,21 @@ int memcmp(const void *s1, const void *s2, size_t n);
 */
 void *memmove(void *dest, const void *src, size_t n);
 
+/**
+ * C standard strlen, check man strlen or
+ * https://man7.org/linux/man-pages/man3/strlen.3.html for more details
+ * 
+ * @param s Null terminated string
+ * 
+ * @return Number of bytes before the null terminator
+*/
+size_t strlen(const char *s);
+
+/**
+ * Time memcpy, memset, memmove (overlapping, so the backward path) and memcmp
+ * (equal buffers) at sizes from 1 B to STRING_BENCHMARK_MAX and print bytes per
+ * cycle of each with kprintf()
+*/
+void string_benchmark(void);
+
 #endif
\ No newline at end of file
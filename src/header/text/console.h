@@ -0,0 +1,127 @@
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/text/framebuffer.h"
+#include "header/cpu/lock.h"
+
+#define CONSOLE_RING_ROWS      (BUFFER_HEIGHT - SCREEN_HEIGHT) // VGA rows used for live output
+#define CONSOLE_VIEW_ROW       CONSOLE_RING_ROWS               // last SCREEN_HEIGHT rows hold the scrollback view
+#define CONSOLE_HISTORY_LINES  512                             // lines kept after they scroll off the screen
+#define CONSOLE_TAB_WIDTH      4
+#define CONSOLE_PRINTF_BUFFER  512                             // kprintf output longer than this is cut
+#define CONSOLE_BENCHMARK_LINES 2000                           // lines written by console_benchmark() per run
+
+/**
+ * Scrolling text console over the framebuffer
+ *
+ * Rows 0 to CONSOLE_RING_ROWS - 1 of VGA memory are used as a ring: a newline on
+ * the last screen row only moves the CRTC start address one row down. When the
+ * visible page reaches the end of the ring it is copied back to row 0, the only
+ * time the whole screen is copied. Rows leaving the top of the screen are saved
+ * into history, which console_scroll_view() pages through.
+ *
+ * Once graphics_init() has set a framebuffer mode, output is forwarded to the
+ * graphics console instead and the VGA ring and history are no longer used.
+ *
+ * @param top          VGA row shown at the top of the screen
+ * @param row          Cursor row, relative to top
+ * @param col          Cursor column
+ * @param fg           Foreground color of new characters
+ * @param bg           Background color of new characters
+ * @param history      Lines that scrolled off, a ring of CONSOLE_HISTORY_LINES
+ * @param history_count Lines ever pushed into history
+ * @param view_offset  Lines the view is scrolled back, 0 when showing live output
+ * @param lock         Guards every field, taken by each public console function, so output
+ *                     and view changes are serialized across processors and interrupts
+ */
+struct ConsoleState {
+    uint8_t  top;
+    uint8_t  row;
+    uint8_t  col;
+    uint8_t  fg;
+    uint8_t  bg;
+    uint16_t history[CONSOLE_HISTORY_LINES][BUFFER_WIDTH];
+    uint32_t history_count;
+    uint32_t view_offset;
+    struct Spinlock lock;
+};
+
+extern struct ConsoleState console_state;
+
+/**
+ * Clear the screen and history and put the cursor at the top left
+ */
+void console_init(void);
+
+/**
+ * Write n characters at the cursor. Handles '\n', '\r', '\t' and '\b',
+ * wraps at the end of the line and scrolls at the bottom of the screen.
+ * Runs of printable characters are stored with framebuffer_write_n(), and the
+ * hardware cursor is updated once at the end instead of after every character.
+ * Output jumps the view back to live output if it was scrolled back.
+ *
+ * @param s Characters
+ * @param n Number of characters
+ */
+void console_write(const char *s, size_t n);
+
+/**
+ * console_write() for a null terminated string
+ *
+ * @param s Null terminated string
+ */
+void console_puts(const char *s);
+
+/**
+ * console_write() for one character
+ *
+ * @param c Character
+ */
+void console_putchar(char c);
+
+/**
+ * Format with kvsnprintf() and write the result in one console_write() batch
+ *
+ * @param fmt Format string, see kvsnprintf()
+ * @return Length of the formatted output
+ */
+int kprintf(const char *fmt, ...);
+
+/**
+ * Start a new line, scrolling the screen by one row if the cursor is on the last row,
+ * and move the hardware cursor there
+ */
+void console_newline(void);
+
+/**
+ * Set color used by following output
+ *
+ * @param fg Foreground / Character color
+ * @param bg Background color
+ */
+void console_set_color(uint8_t fg, uint8_t bg);
+
+/**
+ * Move the view through history, positive lines go back in time.
+ * The view is clamped between live output and the oldest saved line.
+ *
+ * @param lines Lines to scroll back (positive) or forward (negative)
+ */
+void console_scroll_view(int32_t lines);
+
+/**
+ * Return the view to live output
+ */
+void console_view_live(void);
+
+/**
+ * Write CONSOLE_BENCHMARK_LINES short lines and then as many full-row lines
+ * through console_write(), so nearly every line scrolls the screen, and print
+ * lines per second and cycles per line of each run with kprintf()
+ */
+void console_benchmark(void);
+
+#endif
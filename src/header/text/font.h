@@ -0,0 +1,16 @@
+#ifndef _FONT_H
+#define _FONT_H
+
+#include <stdint.h>
+
+#define FONT_WIDTH       8
+#define FONT_HEIGHT      16
+#define FONT_GLYPH_COUNT 128 // ASCII, control characters are blank
+
+/**
+ * Bitmap font embedded in the kernel, there is no filesystem font to load at boot.
+ * font_glyphs[c][y] is row y of character c, bit 7 is the leftmost pixel.
+ */
+extern const uint8_t font_glyphs[FONT_GLYPH_COUNT][FONT_HEIGHT];
+
+#endif
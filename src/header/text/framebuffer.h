@@ -4,13 +4,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "header/memory/paging.h"
 
-#define FRAMEBUFFER_MEMORY_OFFSET ((uint8_t*) 0xB8000)
+#define FRAMEBUFFER_MEMORY_OFFSET ((uint8_t*) PHYS_TO_VIRT(0xB8000))
 #define CURSOR_PORT_CMD    0x03D4
 #define CURSOR_PORT_DATA   0x03D5
+#define CRTC_START_ADDRESS_HIGH 0x0C
+#define CRTC_START_ADDRESS_LOW  0x0D
 //#define BASE_MEMORY_OFFSET 0xB8000
+#define FRAMEBUFFER_MEMORY_SIZE 0x8000 // the whole 32 KiB text window at 0xB8000, not just the visible page
 #define BUFFER_WIDTH 80
-#define BUFFER_HEIGHT 100
+#define BUFFER_HEIGHT (FRAMEBUFFER_MEMORY_SIZE / 2 / BUFFER_WIDTH) // 204 rows of VGA memory
+#define SCREEN_HEIGHT 25 // rows visible from the CRTC start address
+#define FRAMEBUFFER_BLANK_CELL  0x0700 // empty character, gray on black
+#define FRAMEBUFFER_DIRTY_WORDS ((BUFFER_HEIGHT + 31) / 32)
 
 
 struct FramebufferState{
@@ -21,9 +28,27 @@ struct FramebufferState{
 
 }__attribute((packed)); 
 
+/**
+ * RAM copy of the text buffer. Writes land here and mark their row dirty,
+ * framebuffer_flush() copies only the dirty rows to VGA memory. MMIO writes
+ * to 0xB8000 are uncached and far slower than RAM, and a row copied with
+ * memcpy goes out as dword stores instead of one store per character.
+ * There is no flush timer: the console, the only writer, ends every batch with
+ * framebuffer_set_cursor() or framebuffer_set_start(), which both flush, so no
+ * dirty row waits for a later event. A timer would wake a tickless idle
+ * processor and race the console's writers from interrupt context.
+ *
+ * @param cells Character and attribute word per cell, same layout as VGA memory
+ * @param dirty One bit per row, set when the row differs from VGA memory
+ */
+struct FramebufferShadow {
+    uint16_t cells[BUFFER_HEIGHT][BUFFER_WIDTH];
+    uint32_t dirty[FRAMEBUFFER_DIRTY_WORDS];
+};
+
 /**
  * Terminal framebuffer
- * Resolution: 80x25
+ * Resolution: 80x25, shown from any row of the BUFFER_HEIGHT rows of VGA memory
  * Starting at FRAMEBUFFER_MEMORY_OFFSET,
  * - Even number memory: Character, 8-bit
  * - Odd number memory:  Character color lower 4-bit, Background color upper 4-bit
@@ -31,9 +56,10 @@ struct FramebufferState{
 
 /**
  * Set framebuffer character and color with corresponding parameter values.
+ * The cell is written to the shadow buffer, it reaches the screen on the next framebuffer_flush().
  * More details: https://en.wikipedia.org/wiki/BIOS_color_attributes
  *
- * @param row Vertical location (index start 0)
+ * @param row Vertical location in VGA memory (index start 0, below BUFFER_HEIGHT)
  * @param col Horizontal location (index start 0)
  * @param c   Character
  * @param fg  Foreground / Character color
@@ -42,7 +68,33 @@ struct FramebufferState{
 void framebuffer_write(uint8_t row, uint8_t col, char c, uint8_t fg, uint8_t bg);
 
 /**
- * Set cursor to specified location. Row and column starts from 0
+ * Write n characters starting at row, col with one color, in a single pass over the row.
+ * No cursor update and no wrapping, the run must fit in the row.
+ *
+ * @param row Vertical location in VGA memory
+ * @param col Horizontal location of the first character
+ * @param s   Characters, control characters are stored as is
+ * @param n   Number of characters, at most BUFFER_WIDTH - col
+ * @param fg  Foreground / Character color
+ * @param bg  Background color
+ */
+void framebuffer_write_n(uint8_t row, uint8_t col, const char *s, size_t n, uint8_t fg, uint8_t bg);
+
+/**
+ * framebuffer_write_n() for a null terminated string, cut at the end of the row
+ *
+ * @param row Vertical location in VGA memory
+ * @param col Horizontal location of the first character
+ * @param s   Null terminated string
+ * @param fg  Foreground / Character color
+ * @param bg  Background color
+ */
+void framebuffer_puts(uint8_t row, uint8_t col, const char *s, uint8_t fg, uint8_t bg);
+
+/**
+ * Set cursor to specified location. Row and column starts from 0, row counts from the start of VGA memory
+ * Also flushes the shadow buffer, so text written before the move is visible.
+ * The CRTC is only reprogrammed when the position changes.
  * 
  * @param r row
  * @param c column
@@ -57,4 +109,51 @@ void framebuffer_set_cursor(uint8_t r, uint8_t c);
  */
 void framebuffer_clear(void);
 
+/**
+ * Copy every dirty row of the shadow buffer to VGA memory.
+ * Called on cursor moves, call it directly after output that leaves the cursor in place.
+ */
+void framebuffer_flush(void);
+
+/**
+ * Shadow buffer cells of one row, in VGA memory layout
+ *
+ * @param row Row in VGA memory
+ * @return Pointer to BUFFER_WIDTH cells, valid until the next write to the row
+ */
+const uint16_t *framebuffer_row(uint8_t row);
+
+/**
+ * Replace a whole row with BUFFER_WIDTH cells
+ *
+ * @param row   Row in VGA memory
+ * @param cells Character and attribute words, same layout as VGA memory
+ */
+void framebuffer_write_row(uint8_t row, const uint16_t *cells);
+
+/**
+ * Copy one row of the shadow buffer to another
+ *
+ * @param dst Destination row
+ * @param src Source row
+ */
+void framebuffer_copy_row(uint8_t dst, uint8_t src);
+
+/**
+ * Fill a row with spaces
+ *
+ * @param row Row in VGA memory
+ * @param fg  Foreground / Character color
+ * @param bg  Background color
+ */
+void framebuffer_clear_row(uint8_t row, uint8_t fg, uint8_t bg);
+
+/**
+ * Show VGA memory from row onward by programming the CRTC start address,
+ * scrolling the screen without moving any cell. Pending writes are flushed first.
+ *
+ * @param row First visible row, at most BUFFER_HEIGHT - SCREEN_HEIGHT
+ */
+void framebuffer_set_start(uint8_t row);
+
 #endif
\ No newline at end of file
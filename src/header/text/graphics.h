@@ -0,0 +1,163 @@
+#ifndef _GRAPHICS_H
+#define _GRAPHICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/boot/multiboot.h"
+#include "header/text/font.h"
+
+/**
+ * Bochs / QEMU std VGA display interface (DISPI)
+ * - reference: https://wiki.osdev.org/Bochs_VBE_Extensions
+ * Index written to VBE_DISPI_IOPORT_INDEX, value read / written at VBE_DISPI_IOPORT_DATA
+ */
+#define VBE_DISPI_IOPORT_INDEX  0x01CE
+#define VBE_DISPI_IOPORT_DATA   0x01CF
+#define VBE_DISPI_INDEX_ID      0x0
+#define VBE_DISPI_INDEX_XRES    0x1
+#define VBE_DISPI_INDEX_YRES    0x2
+#define VBE_DISPI_INDEX_BPP     0x3
+#define VBE_DISPI_INDEX_ENABLE  0x4
+#define VBE_DISPI_ID_MIN        0xB0C0
+#define VBE_DISPI_ID_MAX        0xB0C5
+#define VBE_DISPI_ENABLED       0x01
+#define VBE_DISPI_LFB_ENABLED   0x40
+
+/* PCI configuration mechanism #1, used to find the linear framebuffer address in BAR0 */
+#define PCI_CONFIG_ADDRESS      0x0CF8
+#define PCI_CONFIG_DATA         0x0CFC
+#define PCI_BAR0                0x10
+#define BOCHS_VGA_VENDOR_ID     0x1234
+#define BOCHS_VGA_DEVICE_ID     0x1111
+#define BOCHS_VGA_DEFAULT_LFB   0xFD000000 // QEMU / Bochs address when PCI lookup fails
+
+#define GRAPHICS_WIDTH          1024
+#define GRAPHICS_HEIGHT         768
+#define GRAPHICS_BPP            32
+#define GRAPHICS_COLUMNS        (GRAPHICS_WIDTH / FONT_WIDTH)   // 128 text columns
+#define GRAPHICS_ROWS           (GRAPHICS_HEIGHT / FONT_HEIGHT) // 48 text rows
+#define GRAPHICS_TAB_WIDTH      4
+#define GRAPHICS_BENCHMARK_SCREENS 32 // screens drawn per graphics_benchmark() run
+
+/**
+ * Pixel console on a 32 bpp linear framebuffer
+ *
+ * Everything is drawn into back_buffer in RAM, a rectangle covering the changed
+ * pixels is copied to the framebuffer by graphics_flush(). Reads from the
+ * framebuffer are never needed, scrolling moves the back buffer and the flush
+ * writes the result. Glyph rows are expanded through expand, a table from one
+ * nibble of font bits to four pixels, so a glyph is drawn with dword stores
+ * only and no per-pixel branch.
+ *
+ * @param active      Framebuffer mode is set, console output goes here instead of VGA text
+ * @param lfb         Linear framebuffer address
+ * @param pitch       Bytes per framebuffer scanline
+ * @param width       Visible width in pixels
+ * @param height      Visible height in pixels
+ * @param columns     Text columns, width / FONT_WIDTH
+ * @param rows        Text rows, height / FONT_HEIGHT
+ * @param row         Cursor text row
+ * @param col         Cursor text column
+ * @param cursor_row  Text row of the cursor drawn on the framebuffer
+ * @param cursor_col  Text column of the cursor drawn on the framebuffer
+ * @param dirty_x0    Dirty rectangle, left pixel (inclusive)
+ * @param dirty_y0    Dirty rectangle, top pixel (inclusive)
+ * @param dirty_x1    Dirty rectangle, right pixel (exclusive), 0 when nothing is dirty
+ * @param dirty_y1    Dirty rectangle, bottom pixel (exclusive)
+ * @param expand_fg   Foreground color expand was built for
+ * @param expand_bg   Background color expand was built for
+ * @param expand      Four pixels for every nibble of glyph bits, msb first
+ */
+struct GraphicsState {
+    bool      active;
+    uint8_t  *lfb;
+    uint32_t  pitch;
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  columns;
+    uint32_t  rows;
+    uint32_t  row;
+    uint32_t  col;
+    uint32_t  cursor_row;
+    uint32_t  cursor_col;
+    uint32_t  dirty_x0;
+    uint32_t  dirty_y0;
+    uint32_t  dirty_x1;
+    uint32_t  dirty_y1;
+    uint8_t   expand_fg;
+    uint8_t   expand_bg;
+    uint32_t  expand[16][4];
+};
+
+/**
+ * Switch to a GRAPHICS_WIDTH x GRAPHICS_HEIGHT x 32 linear framebuffer.
+ * A framebuffer set up by the bootloader (multiboot flag bit 12) is used when it
+ * is 32 bpp RGB and fits the back buffer, else the Bochs VBE interface is programmed.
+ *
+ * @param magic Value of eax at kernel entry
+ * @param mb    Multiboot information from ebx at kernel entry
+ * @return      True when the graphics console is active
+ */
+bool graphics_init(uint32_t magic, struct MultibootInfo *mb);
+
+/**
+ * @return True when console output goes to the graphics console
+ */
+bool graphics_active(void);
+
+/**
+ * Fill a rectangle of the back buffer, clipped to the screen
+ *
+ * @param x     Left pixel
+ * @param y     Top pixel
+ * @param w     Width in pixels
+ * @param h     Height in pixels
+ * @param color 0x00RRGGBB pixel
+ */
+void graphics_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
+
+/**
+ * Draw one character cell into the back buffer
+ *
+ * @param row Text row
+ * @param col Text column
+ * @param c   Character, non ASCII is drawn blank
+ * @param fg  Foreground color, VGA palette index 0-15
+ * @param bg  Background color, VGA palette index 0-15
+ */
+void graphics_put_char(uint32_t row, uint32_t col, char c, uint8_t fg, uint8_t bg);
+
+/**
+ * Write n characters at the cursor and flush once at the end. Handles '\n', '\r',
+ * '\t' and '\b', wraps at the end of the line and scrolls at the bottom.
+ *
+ * @param s  Characters
+ * @param n  Number of characters
+ * @param fg Foreground color, VGA palette index 0-15
+ * @param bg Background color, VGA palette index 0-15
+ */
+void graphics_console_write(const char *s, size_t n, uint8_t fg, uint8_t bg);
+
+/**
+ * Clear the screen to bg and put the cursor at the top left
+ *
+ * @param bg Background color, VGA palette index 0-15
+ */
+void graphics_console_clear(uint8_t bg);
+
+/**
+ * Copy the dirty rectangle of the back buffer to the framebuffer and draw the cursor
+ */
+void graphics_flush(void);
+
+/**
+ * Measure the graphics console and print with kprintf(): glyphs per second
+ * drawn into the back buffer, the time of a full-screen flush to the
+ * framebuffer, and a full-screen redraw, every glyph plus the flush.
+ * Each takes GRAPHICS_BENCHMARK_SCREENS screens; the console lock is held
+ * throughout and the screen is cleared afterwards. Does nothing in text mode.
+ */
+void graphics_benchmark(void);
+
+#endif
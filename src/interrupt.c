@@ -1,7 +1,28 @@
 #include "header/cpu/interrupt.h"
 #include "header/cpu/portio.h"
 #include "header/cpu/gdt.h"
-#include "header/driver/keyboard.h"
+#include "header/cpu/idt.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/workqueue.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/smp.h"
+#include "header/memory/paging.h"
+#include "header/process/thread.h"
+#include "header/text/console.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+
+_Static_assert(INTERRUPT_VECTOR_COUNT == ISR_STUB_TABLE_LIMIT, "handler table must cover isr_stub_table");
+
+static void default_interrupt_handler(struct InterruptFrame *frame, void *ctx);
+
+uint32_t unhandled_interrupt_count[INTERRUPT_VECTOR_COUNT];
+uint64_t interrupt_disabled_max_cycles;
+uint32_t interrupt_nesting;
+
+struct InterruptHandlerEntry interrupt_handlers[INTERRUPT_VECTOR_COUNT] = {
+    [0 ... INTERRUPT_VECTOR_COUNT - 1] = {.handler = default_interrupt_handler, .ctx = NULL},
+};
 
 void io_wait(void) {
     out(0x80, 0);
@@ -37,16 +58,171 @@ void pic_remap(void) {
     out(PIC2_DATA, PIC_DISABLE_ALL_MASK);
 }
 
-void main_interrupt_handler(struct InterruptFrame frame) {
-    switch (frame.int_number) {
-        case IRQ_KEYBOARD + PIC1_OFFSET:
-            keyboard_isr();
-            break;
+void interrupt_wait_until(bool (*ready)(void)) {
+    __asm__ volatile("cli" ::: "memory");
+    while (!ready())
+        __asm__ volatile("sti; hlt; cli" ::: "memory");
+    __asm__ volatile("sti" ::: "memory");
+}
+
+static void default_interrupt_handler(struct InterruptFrame *frame, void *ctx) {
+    (void) ctx;
+    unhandled_interrupt_count[frame->int_number]++;
+    // an unacknowledged PIC IRQ would block every IRQ of lower priority
+    if (frame->int_number >= PIC1_OFFSET && frame->int_number < PIC2_OFFSET + 8)
+        irq_eoi(frame->int_number - PIC1_OFFSET);
+}
+
+bool register_irq_handler(uint8_t vector, irq_handler_t fn, void *ctx) {
+    if (vector >= INTERRUPT_VECTOR_COUNT || fn == NULL)
+        return false;
+    // ctx first, the handler can run as soon as it is stored
+    interrupt_handlers[vector].ctx = ctx;
+    __atomic_store_n(&interrupt_handlers[vector].handler, fn, __ATOMIC_RELEASE);
+    return true;
+}
+
+void unregister_irq_handler(uint8_t vector) {
+    if (vector < INTERRUPT_VECTOR_COUNT)
+        __atomic_store_n(&interrupt_handlers[vector].handler, default_interrupt_handler, __ATOMIC_RELEASE);
+}
+
+// IRQ7 / IRQ15 with the in-service bit clear was withdrawn before the CPU acknowledged it, it gets no EOI
+static bool pic_spurious(uint8_t irq) {
+    uint16_t command = irq == IRQ_LPT1_SPUR ? PIC1_COMMAND : PIC2_COMMAND;
+    out(command, PIC_READ_ISR);
+    if (in(command) & (1 << 7))
+        return false;
+    // the master did see the slave on its cascade line and still waits for an EOI
+    if (irq == IRQ_SECOND_ATA)
+        out(PIC1_COMMAND, PIC_ACK);
+    return true;
+}
+
+struct InterruptFrame* main_interrupt_handler(struct InterruptFrame *frame) {
+    paging_tlb_sync();
+    if (!apic_state.active) {
+        if (frame->int_number == PIC1_OFFSET + IRQ_LPT1_SPUR && pic_spurious(IRQ_LPT1_SPUR)) {
+            cpu_local()->interrupt_stats.spurious_irq7++;
+            return frame;
+        }
+        if (frame->int_number == PIC1_OFFSET + IRQ_SECOND_ATA && pic_spurious(IRQ_SECOND_ATA)) {
+            cpu_local()->interrupt_stats.spurious_irq15++;
+            return frame;
+        }
+    }
+
+    struct InterruptHandlerEntry *entry = &interrupt_handlers[frame->int_number];
+    // application processors only idle, deferred work and threads stay on the boot processor
+    if (!smp_is_bsp()) {
+        entry->handler(frame, entry->ctx);
+        return frame;
+    }
+
+    interrupt_nesting++;
+    uint64_t start = cpu_rdtsc();
+    entry->handler(frame, entry->ctx);
+
+    uint64_t cycles = cpu_rdtsc() - start;
+    if (cycles > interrupt_disabled_max_cycles)
+        interrupt_disabled_max_cycles = cycles;
+
+    // bottom halves of this and earlier interrupts, with interrupts enabled
+    work_run_pending();
+    interrupt_nesting--;
+
+    // a nested interrupt returns into the handler it interrupted, only the outermost one switches threads
+    if (interrupt_nesting == 0)
+        frame = scheduler_switch(frame);
+    return frame;
+}
+
+void irq_eoi(uint8_t irq) {
+    if (apic_state.active)
+        apic_eoi();
+    else
+        pic_ack(irq);
+}
+
+void irq_enable(uint8_t irq) {
+    if (apic_state.active)
+        apic_enable_irq(irq);
+    else if (irq < 8)
+        out(PIC1_DATA, in(PIC1_DATA) & ~(1 << irq));
+    else {
+        out(PIC2_DATA, in(PIC2_DATA) & ~(1 << (irq - 8)));
+        out(PIC1_DATA, in(PIC1_DATA) & ~(1 << IRQ_CASCADE));
     }
 }
 
+void irq_disable(uint8_t irq) {
+    if (apic_state.active)
+        apic_disable_irq(irq);
+    else if (irq < 8)
+        out(PIC1_DATA, in(PIC1_DATA) | (1 << irq));
+    else
+        out(PIC2_DATA, in(PIC2_DATA) | (1 << (irq - 8)));
+}
+
 void activate_keyboard_interrupt(void) {
-    out(PIC1_DATA, in(PIC1_DATA) & ~(1 << IRQ_KEYBOARD));
+    irq_enable(IRQ_KEYBOARD);
 }
 
+void interrupt_stats_record(uint32_t vector, uint64_t entry_tsc) {
+    if (vector >= INTERRUPT_VECTOR_COUNT)
+        return;
+    uint64_t cycles = cpu_rdtsc() - entry_tsc;
+    uint32_t clamped = cycles >> 32 ? UINT32_MAX : (uint32_t) cycles;
 
+    struct InterruptVectorStats *stats = &cpu_local()->interrupt_stats.vectors[vector];
+    stats->count++;
+    stats->total_cycles += cycles;
+    if (clamped > stats->max_cycles)
+        stats->max_cycles = clamped;
+    stats->histogram[31 - __builtin_clz(clamped | 1)]++;
+}
+
+bool interrupt_get_stats(uint8_t vector, struct InterruptVectorStats *stats) {
+    if (vector >= INTERRUPT_VECTOR_COUNT)
+        return false;
+    memset(stats, 0, sizeof(*stats));
+    uint32_t flags = cpu_interrupt_save();
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        const struct InterruptVectorStats *local = &smp_state.cpus[cpu].interrupt_stats.vectors[vector];
+        stats->count        += local->count;
+        stats->total_cycles += local->total_cycles;
+        if (local->max_cycles > stats->max_cycles)
+            stats->max_cycles = local->max_cycles;
+        for (uint8_t bucket = 0; bucket < INTERRUPT_HISTOGRAM_BUCKETS; bucket++)
+            stats->histogram[bucket] += local->histogram[bucket];
+    }
+    cpu_interrupt_restore(flags);
+    return true;
+}
+
+void interrupt_stats_reset(void) {
+    uint32_t flags = cpu_interrupt_save();
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        memset(&smp_state.cpus[cpu].interrupt_stats, 0, sizeof(struct InterruptStats));
+    cpu_interrupt_restore(flags);
+}
+
+void interrupt_stats_dump(void) {
+    struct InterruptVectorStats stats;
+    kprintf("vector      count  avg cycles  max cycles\n");
+    for (uint8_t vector = 0; vector < INTERRUPT_VECTOR_COUNT; vector++) {
+        interrupt_get_stats(vector, &stats);
+        if (stats.count == 0)
+            continue;
+        kprintf("  0x%02x %10u  %10u  %10u\n", vector, stats.count,
+                (uint32_t) div64_32(stats.total_cycles, stats.count, NULL), stats.max_cycles);
+        kprintf("       ");
+        for (uint8_t bucket = 0; bucket < INTERRUPT_HISTOGRAM_BUCKETS; bucket++)
+            if (stats.histogram[bucket])
+                kprintf(" 2^%u:%u", bucket, stats.histogram[bucket]);
+        kprintf("\n");
+    }
+    // the 8259 only interrupts the boot processor
+    const struct InterruptStats *bsp = &smp_state.cpus[0].interrupt_stats;
+    kprintf("spurious irq7 %u, irq15 %u\n", bsp->spurious_irq7, bsp->spurious_irq15);
+}
@@ -1,4 +1,5 @@
 extern main_interrupt_handler
+extern interrupt_stats_record
 global isr_stub_table
 
 ; Generic handler section for interrupt
@@ -22,18 +23,39 @@ call_generic_handler:
     ; eax, ecx, edx, ebx, ebp, esp, esi, edi
     ; CPURegister.general & CPURegister.index
     pushad
+    ; The SysV ABI promises C code a clear direction flag, the interrupted code may have
+    ; been in the middle of a backward string copy; iret restores its eflags
+    cld
 
-    ; Set segment registers to kernel_code before handling interrupt
+    ; Set segment registers to kernel_code before handling interrupt,
+    ; gs reloads from this processor's GDT and so always points at its CPULocal
     push eax
     mov ax, 0x10
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x20
     mov gs, ax
     pop eax
 
-    ; Call the C function
+    ; Entry timestamp into callee-saved registers, all three are restored by popad
+    mov  ebx, esp
+    rdtsc
+    mov  esi, eax
+    mov  edi, edx
+
+    ; Call the C function with a pointer to the frame built above, InterruptFrame
+    push ebx
     call main_interrupt_handler
+    ; the returned frame is the one to resume, another thread's after a switch
+    mov  esp, eax
+
+    ; interrupt_stats_record(int_number, entry_tsc), int_number follows the 48 byte CPURegister
+    push edi
+    push esi
+    push dword [ebx + 48]
+    call interrupt_stats_record
+    add  esp, 12
 
     ; Restore general-purpose & index register
     popad
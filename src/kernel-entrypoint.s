@@ -4,25 +4,80 @@ extern kernel_setup ; kernel
 
 KERNEL_STACK_SIZE equ 4096           ; size of stack in bytes
 MAGIC_NUMBER      equ 0x1BADB002     ; define the magic number constant
-FLAGS             equ 0x0            ; multiboot flags
-CHECKSUM          equ -MAGIC_NUMBER  ; calculate the checksum
+MB_PAGE_ALIGN     equ 1 << 0         ; load modules on page boundaries
+MB_MEMORY_INFO    equ 1 << 1         ; provide mem_* and mmap_* in the boot information
+MB_VIDEO_MODE     equ 1 << 2         ; ask the bootloader for the video mode below
+%ifdef VBE_MULTIBOOT
+FLAGS             equ MB_PAGE_ALIGN | MB_MEMORY_INFO | MB_VIDEO_MODE
+%else
+; GRUB legacy in other/grub1 refuses to boot a kernel that sets MB_VIDEO_MODE,
+; graphics_init() sets the mode through the Bochs VBE registers instead
+FLAGS             equ MB_PAGE_ALIGN | MB_MEMORY_INFO
+%endif
+CHECKSUM          equ -(MAGIC_NUMBER + FLAGS) ; calculate the checksum
                                      ; (magic number + checksum + flags should equal 0)
 
+KERNEL_VIRTUAL_BASE equ 0xC0000000   ; keep in sync with linker.ld and header/memory/paging.h
+KERNEL_PDE_INDEX    equ KERNEL_VIRTUAL_BASE >> 22
+BOOT_LARGE_PAGES    equ 4            ; 16 MiB for the image, its bss and the boot information
+BOOT_PDE_FLAGS      equ 0x83         ; present, writable, 4 MiB page
+CR0_PAGING          equ 1 << 31
+CR4_PSE             equ 1 << 4
+
 section .bss
 align 4                              ; align at 4 bytes
 kernel_stack:                        ; label points to beginning of memory
     resb KERNEL_STACK_SIZE           ; reserve stack for the kernel
 
+; Maps the first 16 MiB twice, at 0 where loader starts and at KERNEL_VIRTUAL_BASE
+; where the kernel is linked. paging_init() replaces it with the kernel directory.
+section .data
+align 4096
+boot_page_directory:
+%assign i 0
+%rep BOOT_LARGE_PAGES
+    dd (i << 22) | BOOT_PDE_FLAGS
+%assign i i+1
+%endrep
+    times (KERNEL_PDE_INDEX - BOOT_LARGE_PAGES) dd 0
+%assign i 0
+%rep BOOT_LARGE_PAGES
+    dd (i << 22) | BOOT_PDE_FLAGS
+%assign i i+1
+%endrep
+    times (1024 - KERNEL_PDE_INDEX - BOOT_LARGE_PAGES) dd 0
+
 section .multiboot                   ; GNU GRUB Multiboot header
 align 4                              ; the code must be 4 byte aligned
     dd MAGIC_NUMBER                  ; write the magic number to the machine code,
     dd FLAGS                         ; the flags,
     dd CHECKSUM                      ; and the checksum
+    dd 0, 0, 0, 0, 0                 ; address fields, unused for ELF kernels
+    dd 0                             ; video mode type, linear framebuffer
+    dd 1024                          ; width
+    dd 768                           ; height
+    dd 32                            ; depth
 
 
 section .text                                  ; start of the text (code) 
 loader:                                        ; the loader label (defined as entry point in linker script)
+    ; GRUB jumps here at the physical address with paging off, everything up to
+    ; higher_half may only use physical addresses; eax and ebx hold the boot values
+    mov  ecx, boot_page_directory - KERNEL_VIRTUAL_BASE
+    mov  cr3, ecx
+    mov  ecx, cr4
+    or   ecx, CR4_PSE
+    mov  cr4, ecx
+    mov  ecx, cr0
+    or   ecx, CR0_PAGING
+    mov  cr0, ecx
+    lea  ecx, [higher_half]                    ; absolute, linked in the higher half
+    jmp  ecx
+
+higher_half:
     mov  esp, kernel_stack + KERNEL_STACK_SIZE ; setup stack register to proper location
+    push ebx                                   ; multiboot information structure
+    push eax                                   ; multiboot magic, 0x2BADB002
     call kernel_setup
 .loop:
     jmp .loop                                  ; loop forever
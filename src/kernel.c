@@ -3,42 +3,57 @@
 #include "header/cpu/gdt.h"
 #include "header/kernel-entrypoint.h"
 #include "header/text/framebuffer.h"
+#include "header/text/console.h"
+#include "header/text/graphics.h"
+#include "header/boot/multiboot.h"
 #include "header/cpu/interrupt.h"
 #include "header/cpu/idt.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/smp.h"
 #include "header/driver/keyboard.h"
+#include "header/driver/timer.h"
+#include "header/process/thread.h"
+#include "header/process/task.h"
 #include "header/filesystem/disk.h"
+#include "header/filesystem/ext2.h"
+#include "header/memory/buddy.h"
+#include "header/memory/paging.h"
+#include "header/memory/slab.h"
 
 // void kernel_setup(void) {
 //     load_gdt(&_gdt_gdtr);
 //     while (true);
 // } 
 
-void kernel_setup(void) {
+void kernel_setup(uint32_t multiboot_magic, struct MultibootInfo *multiboot_info) {
     load_gdt(&_gdt_gdtr);
+    smp_init_bsp();
+    paging_init();
+    // GRUB passes physical addresses, the low identity mapping is gone now
+    multiboot_info = (struct MultibootInfo*) PHYS_TO_VIRT(multiboot_info);
+    buddy_init(multiboot_magic, multiboot_info);
+    kmem_init();
     pic_remap();
+    apic_init();
     initialize_idt();
+    timer_init(true);
+    thread_init();
     activate_keyboard_interrupt();
-    framebuffer_clear();
-    framebuffer_set_cursor(0, 0);
+    ata_init();
+    console_init();
+    graphics_init(multiboot_magic, multiboot_info);
+    task_pool_init();
+    smp_init();
+    if (!initialize_filesystem_ext2())
+        kprintf("ext2: disk unreadable or filesystem unsupported, not mounted\n");
+    else if (!defragment_start())
+        kprintf("ext2: no thread for the defragmenter\n");
    
-    int row = 0, col = 0;
     keyboard_state_activate();
-    struct BlockBuffer b;
-    for (int i = 0; i < 512; i++) b.buf[i] = 0x61;
-    write_blocks(&b, 17, 1);
     while (true) {
-        char c;
-        get_keyboard_buffer(&c);
-        if (c) {
-            framebuffer_write(row, col, c, 0xF, 0);
-            if (col >= BUFFER_WIDTH) {
-                ++row;
-                col = 0;
-            } else {
-                ++col;
-            }
-           framebuffer_set_cursor(row, col);
-        }
+        char buf[KEYBOARD_RING_SIZE];
+        keyboard_wait_input();
+        console_write(buf, keyboard_read(buf, sizeof(buf)));
     }
 }
 
@@ -1,13 +1,16 @@
 #include "header/driver/keyboard.h"
 #include "header/cpu/portio.h"
 #include "header/cpu/interrupt.h"
+#include "header/process/thread.h"
+#include "header/process/wait.h"
+#include "header/stdlib/string.h"
 #include <stdint.h>
 
 
 struct KeyboardDriverState keyboard_state = {
 	.read_extended_mode = false,
     .keyboard_input_on = false,
-    .keyboard_buffer = '\0',
+    .input = WAIT_QUEUE_INIT("keyboard"),
 };
 
 
@@ -33,17 +36,58 @@ const char keyboard_scancode_1_to_ascii_map[256] = {
 };
 
 
-void keyboard_isr(void) {
+// producer side, only called from keyboard_isr()
+static void keyboard_ring_push(struct KeyboardRing *ring, uint8_t value) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == KEYBOARD_RING_SIZE) {
+        ring->overflow++;
+        return;
+    }
+    ring->data[head & KEYBOARD_RING_MASK] = value;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// consumer side, copies at most two contiguous pieces and frees them with one tail update
+static size_t keyboard_ring_read(struct KeyboardRing *ring, uint8_t *buf, size_t n) {
+    uint32_t tail  = ring->tail;
+    uint32_t count = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    if (n > count)
+        n = count;
+
+    size_t offset = tail & KEYBOARD_RING_MASK;
+    size_t first  = KEYBOARD_RING_SIZE - offset < n ? KEYBOARD_RING_SIZE - offset : n;
+    memcpy(buf, ring->data + offset, first);
+    memcpy(buf + first, ring->data, n - first);
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+void keyboard_isr(struct InterruptFrame *frame, void *ctx) {
+    (void) frame;
+    (void) ctx;
     uint8_t scancode = in(KEYBOARD_DATA_PORT);
-	pic_ack(IRQ_KEYBOARD + PIC1_OFFSET);
+	irq_eoi(IRQ_KEYBOARD);
 	
 	//Ketika keyboard_state.keyboard_input_on bernilai true
     if (keyboard_state.keyboard_input_on) {
-		keyboard_state.keyboard_buffer = keyboard_scancode_1_to_ascii_map[scancode];
+        keyboard_ring_push(&keyboard_state.scancodes, scancode);
+        if (scancode == EXTENDED_SCANCODE_BYTE) {
+            keyboard_state.read_extended_mode = true;
+            return;
+        }
+
+        // extended keys (arrows, keypad enter, ...) share make codes with plain keys, never decode them
+        char c = keyboard_state.read_extended_mode ? 0 : keyboard_scancode_1_to_ascii_map[scancode];
+        keyboard_state.read_extended_mode = false;
+        if (c) {
+            keyboard_ring_push(&keyboard_state.chars, c);
+            wake_up(&keyboard_state.input);
+        }
 	}
 }
 
 void keyboard_state_activate(void){
+    register_irq_handler(PIC1_OFFSET + IRQ_KEYBOARD, keyboard_isr, NULL);
 	keyboard_state.keyboard_input_on = true;
 }
 
@@ -52,6 +96,38 @@ void keyboard_state_deactivate(void){
 }
 
 void get_keyboard_buffer(char *buf){
-	*buf = keyboard_state.keyboard_buffer;
-  keyboard_state.keyboard_buffer = '\0';
+    if (!keyboard_read(buf, 1))
+        *buf = '\0';
+}
+
+size_t keyboard_read(char *buf, size_t n) {
+    return keyboard_ring_read(&keyboard_state.chars, (uint8_t*) buf, n);
+}
+
+size_t keyboard_read_scancodes(uint8_t *buf, size_t n) {
+    return keyboard_ring_read(&keyboard_state.scancodes, buf, n);
+}
+
+bool keyboard_has_input(void) {
+    return __atomic_load_n(&keyboard_state.chars.head, __ATOMIC_ACQUIRE) != keyboard_state.chars.tail;
+}
+
+static bool keyboard_input_ready(void *arg) {
+    (void) arg;
+    return keyboard_has_input();
+}
+
+void keyboard_wait_input(void) {
+    if (thread_can_block())
+        wait_event(&keyboard_state.input, keyboard_input_ready, NULL);
+    else
+        interrupt_wait_until(keyboard_has_input);
+}
+
+uint32_t keyboard_char_overflow(void) {
+    return keyboard_state.chars.overflow;
+}
+
+uint32_t keyboard_scancode_overflow(void) {
+    return keyboard_state.scancodes.overflow;
 }
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/lock.h"
+#include "header/cpu/cpu.h"
+#include "header/text/console.h"
+#include "header/stdlib/div64.h"
+
+/* -- Statistics -- */
+
+#ifdef LOCK_STATS
+static struct LockStats *volatile lock_stats_head;
+
+// locks with a static initializer are linked in on their first acquisition
+static void lock_stats_register(struct LockStats *stats) {
+    if (__atomic_test_and_set((volatile void*) &stats->registered, __ATOMIC_ACQ_REL))
+        return;
+    struct LockStats *head = __atomic_load_n(&lock_stats_head, __ATOMIC_RELAXED);
+    do {
+        stats->next = head;
+    } while (!__atomic_compare_exchange_n(&lock_stats_head, &head, stats, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// called with the lock held exclusively
+static void lock_stats_acquired(struct LockStats *stats, uint64_t start, bool contended) {
+    uint64_t now = cpu_rdtsc();
+    if (!stats->registered)
+        lock_stats_register(stats);
+    stats->acquisitions++;
+    if (contended)
+        stats->contended++;
+    stats->wait_cycles += now - start;
+    stats->hold_start   = now;
+}
+
+static void lock_stats_released(struct LockStats *stats) {
+    uint64_t held = cpu_rdtsc() - stats->hold_start;
+    stats->hold_cycles += held;
+    if (held > stats->max_hold_cycles)
+        stats->max_hold_cycles = held;
+}
+#endif
+
+void lock_stats_dump(void) {
+#ifdef LOCK_STATS
+    kprintf("%-16s %10s %10s %10s %10s %10s\n", "lock", "acquired", "contended", "avg wait", "avg hold", "max hold");
+    for (struct LockStats *stats = lock_stats_head; stats; stats = stats->next) {
+        uint32_t count = stats->acquisitions ? stats->acquisitions : 1;
+        kprintf("%-16s %10u %10u %10u %10u %10u\n", stats->name ? stats->name : "?",
+                stats->acquisitions, stats->contended,
+                (uint32_t) div64_32(stats->wait_cycles, count, NULL),
+                (uint32_t) div64_32(stats->hold_cycles, count, NULL),
+                (uint32_t) stats->max_hold_cycles);
+    }
+#else
+    kprintf("lock statistics are off, build with LOCK_STATS=1\n");
+#endif
+}
+
+/* -- Ticket spinlock -- */
+
+void spinlock_init(struct Spinlock *lock, const char *name) {
+    *lock = (struct Spinlock) SPINLOCK_INIT(name);
+    (void) name;
+}
+
+void spin_lock(struct Spinlock *lock) {
+#ifdef LOCK_STATS
+    uint64_t start     = cpu_rdtsc();
+    bool     contended = false;
+#endif
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+#ifdef LOCK_STATS
+        contended = true;
+#endif
+        __asm__ volatile("pause");
+    }
+#ifdef LOCK_STATS
+    lock_stats_acquired(&lock->stats, start, contended);
+#endif
+}
+
+void spin_unlock(struct Spinlock *lock) {
+#ifdef LOCK_STATS
+    lock_stats_released(&lock->stats);
+#endif
+    // only the holder writes owner, a plain increment is enough
+    __atomic_store_n(&lock->owner, (uint16_t) (lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+bool spin_trylock(struct Spinlock *lock) {
+#ifdef LOCK_STATS
+    uint64_t start = cpu_rdtsc();
+#endif
+    // free when no ticket is outstanding, claiming the next one takes it
+    uint16_t ticket = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&lock->next, &ticket, (uint16_t) (ticket + 1), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+#ifdef LOCK_STATS
+    lock_stats_acquired(&lock->stats, start, false);
+#endif
+    return true;
+}
+
+uint32_t spin_lock_irqsave(struct Spinlock *lock) {
+    uint32_t flags = cpu_interrupt_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(struct Spinlock *lock, uint32_t flags) {
+    spin_unlock(lock);
+    cpu_interrupt_restore(flags);
+}
+
+/* -- Reader-writer lock -- */
+
+void rwlock_init(struct RWLock *lock, const char *name) {
+    *lock = (struct RWLock) RWLOCK_INIT(name);
+    (void) name;
+}
+
+uint32_t read_lock_irqsave(struct RWLock *lock) {
+    uint32_t flags = cpu_interrupt_save();
+    while (true) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (!(state & (RWLOCK_WRITER | RWLOCK_WAITING))
+                && __atomic_compare_exchange_n(&lock->state, &state, state + RWLOCK_READER, true,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+#ifdef LOCK_STATS
+        __atomic_add_fetch(&lock->stats.contended, 1, __ATOMIC_RELAXED);
+#endif
+        __asm__ volatile("pause");
+    }
+#ifdef LOCK_STATS
+    __atomic_add_fetch(&lock->stats.acquisitions, 1, __ATOMIC_RELAXED);
+#endif
+    return flags;
+}
+
+void read_unlock_irqrestore(struct RWLock *lock, uint32_t flags) {
+    __atomic_sub_fetch(&lock->state, RWLOCK_READER, __ATOMIC_RELEASE);
+    cpu_interrupt_restore(flags);
+}
+
+uint32_t write_lock_irqsave(struct RWLock *lock) {
+    uint32_t flags = cpu_interrupt_save();
+#ifdef LOCK_STATS
+    uint64_t start     = cpu_rdtsc();
+    bool     contended = false;
+#endif
+    while (true) {
+        // clearing RWLOCK_WAITING on success is fine, other waiting writers set it again
+        uint32_t state = __atomic_or_fetch(&lock->state, RWLOCK_WAITING, __ATOMIC_RELAXED);
+        if (state == RWLOCK_WAITING
+                && __atomic_compare_exchange_n(&lock->state, &state, RWLOCK_WRITER, false,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+#ifdef LOCK_STATS
+        contended = true;
+#endif
+        __asm__ volatile("pause");
+    }
+#ifdef LOCK_STATS
+    lock_stats_acquired(&lock->stats, start, contended);
+#endif
+    return flags;
+}
+
+void write_unlock_irqrestore(struct RWLock *lock, uint32_t flags) {
+#ifdef LOCK_STATS
+    lock_stats_released(&lock->stats);
+#endif
+    __atomic_and_fetch(&lock->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+    cpu_interrupt_restore(flags);
+}
+
+/* -- Sequence lock -- */
+
+void seqlock_init(struct Seqlock *lock, const char *name) {
+    lock->sequence = 0;
+    spinlock_init(&lock->lock, name);
+}
+
+uint32_t write_seqlock_irqsave(struct Seqlock *lock) {
+    uint32_t flags = spin_lock_irqsave(&lock->lock);
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+    // the odd sequence becomes visible before any of the data written after it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return flags;
+}
+
+void write_sequnlock_irqrestore(struct Seqlock *lock, uint32_t flags) {
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&lock->lock, flags);
+}
+
+uint32_t read_seqbegin(const struct Seqlock *lock) {
+    uint32_t sequence;
+    while ((sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1)
+        __asm__ volatile("pause");
+    return sequence;
+}
+
+bool read_seqretry(const struct Seqlock *lock, uint32_t start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != start;
+}
@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/memory/paging.h"
+#include "header/memory/buddy.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/smp.h"
+#include "header/cpu/lock.h"
+#include "header/process/task.h"
+#include "header/text/console.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+
+struct PagingState paging_state = {
+    .lock      = SPINLOCK_INIT("paging"),
+    .mmio_next = PAGING_MMIO_BASE,
+};
+
+static struct PageDirectory kernel_page_directory;
+
+/* -- Control registers and TLB -- */
+
+static uint32_t read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static void write_cr4(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static void write_cr3(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static void tlb_flush_page(uint32_t virt) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+// a cr3 load keeps global entries, toggling CR4.PGE drops them too
+static void tlb_flush_all(void) {
+    if (paging_state.global) {
+        uint32_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(paging_state.directory_phys);
+    }
+}
+
+/* -- Setup -- */
+
+void paging_init(void) {
+    uint32_t edx;
+    cpu_cpuid(CPUID_FEATURES, NULL, NULL, NULL, &edx);
+    paging_state.global = (edx & CPUID_FEATURE_EDX_PGE) ? PAGE_GLOBAL : 0;
+
+    // kernel-entrypoint.s already turned on CR4.PSE, the boot directory uses large pages too
+    struct PageDirectory *directory = &kernel_page_directory;
+    for (uint32_t phys = 0; phys < KERNEL_DIRECT_MAP_SIZE; phys += PAGE_LARGE_SIZE)
+        directory->entries[(KERNEL_VIRTUAL_BASE + phys) >> PAGE_LARGE_SHIFT]
+            = phys | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE | paging_state.global;
+    paging_state.directory      = directory;
+    paging_state.directory_phys = VIRT_TO_PHYS(directory);
+
+    if (paging_state.global)
+        write_cr4(read_cr4() | CR4_PGE);
+    write_cr3(paging_state.directory_phys);
+}
+
+void paging_identity_low(bool map) {
+    uint32_t flags = spin_lock_irqsave(&paging_state.lock);
+    paging_state.directory->entries[0] = map ? PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE : 0;
+    write_cr3(paging_state.directory_phys);
+    spin_unlock_irqrestore(&paging_state.lock, flags);
+}
+
+void* paging_map_physical(uint32_t phys, uint32_t size, uint32_t flags) {
+    if (size == 0)
+        size = 1;
+    uint64_t end = (uint64_t) phys + size;
+    if (end <= KERNEL_DIRECT_MAP_SIZE)
+        return PHYS_TO_VIRT(phys);
+
+    uint32_t first = phys & PAGE_LARGE_MASK;
+    uint32_t count = (uint32_t) ((end - first + PAGE_LARGE_SIZE - 1) >> PAGE_LARGE_SHIFT);
+    void     *virt = NULL;
+    uint32_t lock  = spin_lock_irqsave(&paging_state.lock);
+
+    // the LAPIC and IOAPIC share a large page, so do ACPI tables read header first
+    for (uint32_t i = 0; i < paging_state.mmio_count && !virt; i++) {
+        struct PagingMMIO *mmio = &paging_state.mmio[i];
+        uint32_t covered = mmio->count << PAGE_LARGE_SHIFT;
+        if (mmio->flags == flags && first >= mmio->phys && end - mmio->phys <= covered)
+            virt = (void*) (mmio->virt + (phys - mmio->phys));
+    }
+
+    if (!virt && paging_state.mmio_count < PAGING_MMIO_SLOTS
+            && count <= (PAGING_MMIO_END - paging_state.mmio_next) >> PAGE_LARGE_SHIFT) {
+        struct PagingMMIO *mmio = &paging_state.mmio[paging_state.mmio_count++];
+        mmio->phys  = first;
+        mmio->virt  = paging_state.mmio_next;
+        mmio->count = count;
+        mmio->flags = flags;
+        for (uint32_t i = 0; i < count; i++)
+            paging_state.directory->entries[(mmio->virt >> PAGE_LARGE_SHIFT) + i]
+                = (first + (i << PAGE_LARGE_SHIFT)) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE
+                | paging_state.global | flags;
+        paging_state.mmio_next += count << PAGE_LARGE_SHIFT;
+        virt = (void*) (mmio->virt + (phys - first));
+    }
+    spin_unlock_irqrestore(&paging_state.lock, lock);
+    return virt;
+}
+
+/* -- 4 KiB pages -- */
+
+// called with the lock held, NULL when virt has no page table
+static uint32_t* paging_table(struct PageDirectory *directory, uint32_t virt, bool create, uint32_t flags) {
+    uint32_t *entry = &directory->entries[virt >> PAGE_LARGE_SHIFT];
+    if (*entry & PAGE_LARGE)
+        return NULL;
+    if (!(*entry & PAGE_PRESENT)) {
+        uint32_t table = create ? buddy_alloc(0) : 0;
+        if (!table)
+            return NULL;
+        memset(PHYS_TO_VIRT(table), 0, PAGE_SIZE);
+        // permissions are decided per page, the directory entry allows everything
+        *entry = table | PAGE_PRESENT | PAGE_WRITABLE | (flags & PAGE_USER);
+        paging_state.tables++;
+    }
+    return (uint32_t*) PHYS_TO_VIRT(*entry & PAGE_FRAME_MASK);
+}
+
+bool paging_map(struct PageDirectory *directory, uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t lock   = spin_lock_irqsave(&paging_state.lock);
+    uint32_t *table = paging_table(directory, virt, true, flags);
+    bool     remap  = false;
+    if (table) {
+        uint32_t *entry = &table[(virt >> PAGE_SHIFT) & (PAGE_ENTRIES - 1)];
+        remap  = *entry & PAGE_PRESENT;
+        *entry = (phys & PAGE_FRAME_MASK) | (flags & ~PAGE_FRAME_MASK & ~PAGE_LARGE) | PAGE_PRESENT;
+    }
+    spin_unlock_irqrestore(&paging_state.lock, lock);
+    // a new mapping cannot be cached anywhere, a changed one can
+    if (remap)
+        paging_tlb_shootdown(virt);
+    return table != NULL;
+}
+
+uint32_t paging_unmap(struct PageDirectory *directory, uint32_t virt) {
+    uint32_t lock   = spin_lock_irqsave(&paging_state.lock);
+    uint32_t *table = paging_table(directory, virt, false, 0);
+    uint32_t phys   = 0;
+    if (table) {
+        uint32_t *entry = &table[(virt >> PAGE_SHIFT) & (PAGE_ENTRIES - 1)];
+        if (*entry & PAGE_PRESENT)
+            phys = *entry & PAGE_FRAME_MASK;
+        *entry = 0;
+    }
+    spin_unlock_irqrestore(&paging_state.lock, lock);
+    if (phys)
+        paging_tlb_shootdown(virt);
+    return phys;
+}
+
+bool paging_translate(struct PageDirectory *directory, uint32_t virt, uint32_t *phys) {
+    uint32_t lock  = spin_lock_irqsave(&paging_state.lock);
+    uint32_t entry = directory->entries[virt >> PAGE_LARGE_SHIFT];
+    bool     found = false;
+    if ((entry & PAGE_PRESENT) && (entry & PAGE_LARGE)) {
+        *phys = (entry & PAGE_LARGE_MASK) | (virt & ~PAGE_LARGE_MASK);
+        found = true;
+    } else if (entry & PAGE_PRESENT) {
+        uint32_t page = ((uint32_t*) PHYS_TO_VIRT(entry & PAGE_FRAME_MASK))[(virt >> PAGE_SHIFT) & (PAGE_ENTRIES - 1)];
+        if (page & PAGE_PRESENT) {
+            *phys = (page & PAGE_FRAME_MASK) | (virt & ~PAGE_FRAME_MASK);
+            found = true;
+        }
+    }
+    spin_unlock_irqrestore(&paging_state.lock, lock);
+    return found;
+}
+
+/* -- Lazy shootdown -- */
+
+uint32_t paging_tlb_shootdown(uint32_t virt) {
+    struct CPULocal *local = cpu_local();
+    tlb_flush_page(virt);
+    uint32_t generation = __atomic_add_fetch(&paging_state.tlb_generation, 1, __ATOMIC_SEQ_CST);
+    // this processor is only up to date if it was before, older shootdowns may still be pending here
+    if (local->tlb_generation == generation - 1)
+        local->tlb_generation = generation;
+    return generation;
+}
+
+void paging_tlb_sync(void) {
+    struct CPULocal *local     = cpu_local();
+    uint32_t        generation = __atomic_load_n(&paging_state.tlb_generation, __ATOMIC_ACQUIRE);
+    if (local->tlb_generation == generation)
+        return;
+    tlb_flush_all();
+    local->tlb_generation = generation;
+    __atomic_add_fetch(&paging_state.tlb_flushes, 1, __ATOMIC_RELAXED);
+}
+
+bool paging_tlb_quiesced(uint32_t generation) {
+    for (uint32_t i = 0; i < smp_state.cpu_count; i++) {
+        // wrap safe, generations are compared by distance
+        int32_t behind = (int32_t) (generation - __atomic_load_n(&smp_state.cpus[i].tlb_generation, __ATOMIC_ACQUIRE));
+        if (smp_state.cpus[i].online && behind > 0)
+            return false;
+    }
+    return true;
+}
+
+/* -- Benchmark -- */
+
+// one load per page, pages visited in a scrambled order so the prefetcher cannot run ahead
+static uint32_t paging_benchmark_walk(volatile uint8_t *base) {
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t round = 0; round < PAGING_BENCHMARK_ROUNDS; round++)
+        for (uint32_t i = 0; i < PAGE_ENTRIES; i++)
+            (void) base[((i * 389) & (PAGE_ENTRIES - 1)) << PAGE_SHIFT];
+    return div64_32(cpu_rdtsc() - start, PAGING_BENCHMARK_ROUNDS * PAGE_ENTRIES, NULL);
+}
+
+void paging_benchmark(void) {
+    uint32_t block = buddy_alloc(BUDDY_MAX_ORDER);
+    if (!block) {
+        kprintf("paging: no free 4 MiB block\n");
+        return;
+    }
+
+    uint32_t mapped = 0;
+    while (mapped < PAGE_ENTRIES
+            && paging_map(paging_state.directory, PAGING_BENCHMARK_BASE + (mapped << PAGE_SHIFT),
+                          block + (mapped << PAGE_SHIFT), PAGE_WRITABLE))
+        mapped++;
+
+    if (mapped == PAGE_ENTRIES) {
+        uint32_t large = paging_benchmark_walk((volatile uint8_t*) PHYS_TO_VIRT(block));
+        uint32_t small = paging_benchmark_walk((volatile uint8_t*) PAGING_BENCHMARK_BASE);
+        kprintf("paging: one load per page over 4 MiB, 4 MiB page %u cycles, 4 KiB pages %u cycles\n", large, small);
+    } else {
+        kprintf("paging: no memory for the page table\n");
+    }
+
+    for (uint32_t i = 0; i < mapped; i++)
+        paging_unmap(paging_state.directory, PAGING_BENCHMARK_BASE + (i << PAGE_SHIFT));
+    // the others flush on their next interrupt, a halted one is woken for it; until then the block stays allocated
+    uint32_t generation = paging_state.tlb_generation;
+    for (uint32_t i = 1; i < smp_state.cpu_count; i++)
+        apic_send_ipi(smp_state.cpus[i].apic_id, TASK_WAKE_VECTOR);
+    while (!paging_tlb_quiesced(generation))
+        __asm__ volatile("pause");
+    buddy_free(block, BUDDY_MAX_ORDER);
+    kprintf("paging: %u page tables, %u lazy flushes\n", paging_state.tables, paging_state.tlb_flushes);
+}
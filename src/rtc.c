@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "header/driver/rtc.h"
+#include "header/cpu/portio.h"
+#include "header/stdlib/string.h"
+
+static uint8_t cmos_read(uint8_t reg) {
+    out(CMOS_ADDRESS, reg);
+    return in(CMOS_DATA);
+}
+
+static void rtc_read_raw(struct RTCTime *time) {
+    while (cmos_read(RTC_STATUS_A) & RTC_STATUS_A_UPDATING);
+    time->second = cmos_read(RTC_SECONDS);
+    time->minute = cmos_read(RTC_MINUTES);
+    time->hour   = cmos_read(RTC_HOURS);
+    time->day    = cmos_read(RTC_DAY);
+    time->month  = cmos_read(RTC_MONTH);
+    time->year   = cmos_read(RTC_YEAR);
+}
+
+static uint8_t bcd_to_binary(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+void rtc_read(struct RTCTime *time) {
+    struct RTCTime last;
+    rtc_read_raw(time);
+    do {
+        memcpy(&last, time, sizeof(last));
+        rtc_read_raw(time);
+    } while (memcmp(&last, time, sizeof(last)) != 0);
+
+    uint8_t status = cmos_read(RTC_STATUS_B);
+    bool pm = time->hour & RTC_HOUR_PM;
+    time->hour &= ~RTC_HOUR_PM;
+    if (!(status & RTC_STATUS_B_BINARY)) {
+        time->second = bcd_to_binary(time->second);
+        time->minute = bcd_to_binary(time->minute);
+        time->hour   = bcd_to_binary(time->hour);
+        time->day    = bcd_to_binary(time->day);
+        time->month  = bcd_to_binary(time->month);
+        time->year   = bcd_to_binary(time->year);
+    }
+    // 12 hour mode counts 12, 1, ..., 11
+    if (!(status & RTC_STATUS_B_24_HOUR))
+        time->hour = time->hour % 12 + (pm ? 12 : 0);
+    time->year += RTC_CENTURY;
+}
+
+uint32_t rtc_to_unix(const struct RTCTime *time) {
+    // days from civil, with March as the first month so the leap day ends the year
+    uint32_t year  = time->year - (time->month <= 2);
+    uint32_t era   = year / 400;
+    uint32_t yoe   = year - era * 400;
+    uint32_t month = time->month > 2 ? time->month - 3 : time->month + 9;
+    uint32_t doy   = (153 * month + 2) / 5 + time->day - 1;
+    uint32_t doe   = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    uint32_t days  = era * 146097 + doe - 719468; // 719468 days from 0000-03-01 to 1970-01-01
+
+    return days * 86400 + time->hour * 3600 + time->minute * 60 + time->second;
+}
@@ -0,0 +1,601 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/memory/slab.h"
+#include "header/memory/buddy.h"
+#include "header/memory/paging.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/smp.h"
+#include "header/cpu/lock.h"
+#include "header/text/console.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+
+struct KmemState kmem_state = {
+    .lock = SPINLOCK_INIT("kmem"),
+};
+
+static const char *const kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+/* -- Slab lists, called with the cache lock held -- */
+
+static void slab_list_push(struct KmemSlab **list, struct KmemSlab *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(struct KmemSlab **list, struct KmemSlab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static struct KmemSlab** slab_list(struct KmemCache *cache, struct KmemSlab *slab) {
+    if (slab->inuse == 0)
+        return &cache->empty;
+    if (slab->inuse == cache->per_slab)
+        return &cache->full;
+    return &cache->partial;
+}
+
+// after inuse changed, from is the list slab_list() gave before
+static void slab_relist(struct KmemCache *cache, struct KmemSlab *slab, struct KmemSlab **from) {
+    struct KmemSlab **to = slab_list(cache, slab);
+    if (to == from)
+        return;
+    slab_list_remove(from, slab);
+    slab_list_push(to, slab);
+    if (from == &cache->empty)
+        cache->empty_slabs--;
+    if (to == &cache->empty)
+        cache->empty_slabs++;
+}
+
+static void** object_link(struct KmemCache *cache, void *object) {
+    return (void**) ((uint8_t*) object + cache->free_offset);
+}
+
+/* -- Slabs -- */
+
+// outside the cache lock, constructors may take a while
+static struct KmemSlab* slab_create(struct KmemCache *cache) {
+    uint32_t phys = buddy_alloc(cache->order);
+    if (!phys)
+        return NULL;
+    struct KmemSlab *slab = PHYS_TO_VIRT(phys);
+    for (uint32_t i = 0; i < 1u << cache->order; i++) {
+        struct Page *page = buddy_page(phys + (i << PAGE_SHIFT));
+        page->flags |= PAGE_SLAB;
+        page->slab   = slab;
+    }
+
+    uint32_t color  = __atomic_fetch_add(&cache->color_next, 1, __ATOMIC_RELAXED) % cache->colors;
+    uint8_t  *first = (uint8_t*) slab + cache->first + color * cache->color_step;
+    slab->next  = NULL;
+    slab->prev  = NULL;
+    slab->cache = cache;
+    slab->free  = NULL;
+    slab->inuse = 0;
+    // linked back to front, so a fresh slab hands out objects in address order
+    for (uint32_t i = cache->per_slab; i-- > 0;) {
+        void *object = first + i * cache->stride;
+        if (cache->ctor)
+            cache->ctor(object);
+        *object_link(cache, object) = slab->free;
+        slab->free = object;
+    }
+    return slab;
+}
+
+// slabs detached by kmem_cache_trim(), after the cache lock was dropped
+static uint32_t slab_release(struct KmemCache *cache, struct KmemSlab *slab) {
+    uint32_t pages = 0;
+    while (slab) {
+        struct KmemSlab *next = slab->next;
+        uint32_t        phys  = VIRT_TO_PHYS(slab);
+        for (uint32_t i = 0; i < 1u << cache->order; i++) {
+            struct Page *page = buddy_page(phys + (i << PAGE_SHIFT));
+            page->flags &= ~PAGE_SLAB;
+            page->slab   = NULL;
+        }
+        buddy_free(phys, cache->order);
+        pages += 1u << cache->order;
+        slab = next;
+    }
+    return pages;
+}
+
+/* -- Slab layer, called with the cache lock held -- */
+
+static struct KmemSlab* kmem_cache_trim(struct KmemCache *cache, uint32_t keep) {
+    struct KmemSlab *release = NULL;
+    while (cache->empty_slabs > keep) {
+        struct KmemSlab *slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        cache->empty_slabs--;
+        cache->slabs--;
+        cache->slabs_freed++;
+        cache->free_objects -= cache->per_slab;
+        slab->next = release;
+        release    = slab;
+    }
+    return release;
+}
+
+// fullest slabs first, so the partial ones fill up and empty ones can be returned
+static void kmem_cache_refill(struct KmemCache *cache, struct KmemMagazine *magazine) {
+    while (magazine->count < KMEM_MAGAZINE_SIZE) {
+        struct KmemSlab *slab = cache->partial ? cache->partial : cache->empty;
+        if (!slab) {
+            spin_unlock(&cache->lock);
+            slab = slab_create(cache);
+            spin_lock(&cache->lock);
+            if (!slab)
+                break;
+            slab_list_push(&cache->empty, slab);
+            cache->empty_slabs++;
+            cache->slabs++;
+            cache->slabs_created++;
+            cache->free_objects += cache->per_slab;
+            continue;
+        }
+
+        struct KmemSlab **from = slab_list(cache, slab);
+        while (slab->free && magazine->count < KMEM_MAGAZINE_SIZE) {
+            void *object = slab->free;
+            slab->free = *object_link(cache, object);
+            slab->inuse++;
+            cache->free_objects--;
+            magazine->objects[magazine->count++] = object;
+        }
+        slab_relist(cache, slab, from);
+    }
+}
+
+static void kmem_cache_flush(struct KmemCache *cache, struct KmemMagazine *magazine) {
+    uint32_t mask = ~((PAGE_SIZE << cache->order) - 1);
+    while (magazine->count) {
+        void            *object = magazine->objects[--magazine->count];
+        struct KmemSlab *slab   = (struct KmemSlab*) ((uint32_t) object & mask);
+        struct KmemSlab **from  = slab_list(cache, slab);
+        *object_link(cache, object) = slab->free;
+        slab->free = object;
+        slab->inuse--;
+        cache->free_objects++;
+        slab_relist(cache, slab, from);
+    }
+}
+
+/* -- Caches -- */
+
+bool kmem_cache_init(struct KmemCache *cache, const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    // a constructed object must survive being free, so the link goes behind it then
+    uint32_t free_offset = ctor ? (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1) : 0;
+    uint32_t object      = ctor ? free_offset + sizeof(void*) : (size > sizeof(void*) ? size : sizeof(void*));
+    uint32_t stride      = (object + align - 1) & ~(align - 1);
+    uint32_t first       = (sizeof(struct KmemSlab) + align - 1) & ~(align - 1);
+
+    // smallest slab that wastes at most an eighth of itself, else the largest
+    uint8_t  order    = 0;
+    uint32_t per_slab = 0, waste = 0;
+    for (uint8_t candidate = 0; candidate <= KMEM_MAX_SLAB_ORDER; candidate++) {
+        uint32_t slab_size = PAGE_SIZE << candidate;
+        if (first + stride > slab_size)
+            continue;
+        order    = candidate;
+        per_slab = (slab_size - first) / stride;
+        waste    = slab_size - first - per_slab * stride;
+        if (waste * 8 <= slab_size)
+            break;
+    }
+    if (per_slab == 0)
+        return false;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->name        = name;
+    cache->size        = size;
+    cache->align       = align;
+    cache->stride      = stride;
+    cache->free_offset = free_offset;
+    cache->order       = order;
+    cache->per_slab    = per_slab;
+    cache->first       = first;
+    cache->color_step  = align > CACHE_LINE_SIZE ? align : CACHE_LINE_SIZE;
+    cache->colors      = waste / cache->color_step + 1;
+    cache->ctor        = ctor;
+    spinlock_init(&cache->lock, name);
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cache->cpus[i].loaded   = &cache->cpus[i].magazines[0];
+        cache->cpus[i].previous = &cache->cpus[i].magazines[1];
+    }
+
+    uint32_t flags = spin_lock_irqsave(&kmem_state.lock);
+    cache->next       = kmem_state.caches;
+    kmem_state.caches = cache;
+    spin_unlock_irqrestore(&kmem_state.lock, flags);
+    return true;
+}
+
+// objects in the magazines of a processor, from their storage so a concurrent kmem_swap() cannot count one twice
+static uint32_t kmem_cpu_objects(struct KmemCPU *cpu) {
+    return __atomic_load_n(&cpu->magazines[0].count, __ATOMIC_RELAXED)
+         + __atomic_load_n(&cpu->magazines[1].count, __ATOMIC_RELAXED);
+}
+
+bool kmem_cache_destroy(struct KmemCache *cache) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    // only the owner may touch a magazine, the other processors must have drained theirs
+    uint32_t self = cpu_local()->index;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i != self && kmem_cpu_objects(&cache->cpus[i])) {
+            spin_unlock_irqrestore(&cache->lock, flags);
+            return false;
+        }
+    }
+    kmem_cache_flush(cache, cache->cpus[self].loaded);
+    kmem_cache_flush(cache, cache->cpus[self].previous);
+    struct KmemSlab *release = kmem_cache_trim(cache, 0);
+    bool            empty    = cache->slabs == 0;
+    spin_unlock(&cache->lock);
+    slab_release(cache, release);
+
+    if (empty) {
+        spin_lock(&kmem_state.lock);
+        for (struct KmemCache **link = &kmem_state.caches; *link; link = &(*link)->next) {
+            if (*link == cache) {
+                *link = cache->next;
+                break;
+            }
+        }
+        spin_unlock(&kmem_state.lock);
+    }
+    cpu_interrupt_restore(flags);
+    return empty;
+}
+
+static void kmem_swap(struct KmemCPU *cpu) {
+    struct KmemMagazine *loaded = cpu->loaded;
+    cpu->loaded   = cpu->previous;
+    cpu->previous = loaded;
+}
+
+void* kmem_cache_alloc(struct KmemCache *cache) {
+    uint32_t       flags = cpu_interrupt_save();
+    struct KmemCPU *cpu  = &cache->cpus[cpu_local()->index];
+    if (cpu->loaded->count == 0 && cpu->previous->count > 0)
+        kmem_swap(cpu);
+
+    if (cpu->loaded->count > 0) {
+        cpu->hits++;
+    } else {
+        cpu->misses++;
+        spin_lock(&cache->lock);
+        kmem_cache_refill(cache, cpu->loaded);
+        if (cpu->loaded->count == 0)
+            cache->failures++;
+        spin_unlock(&cache->lock);
+    }
+    void *object = cpu->loaded->count ? cpu->loaded->objects[--cpu->loaded->count] : NULL;
+    cpu_interrupt_restore(flags);
+    return object;
+}
+
+void kmem_cache_free(struct KmemCache *cache, void *object) {
+    if (!object)
+        return;
+    uint32_t        flags   = cpu_interrupt_save();
+    struct KmemCPU  *cpu    = &cache->cpus[cpu_local()->index];
+    struct KmemSlab *release = NULL;
+    // previous is full or empty, a full one goes back to the slabs
+    if (cpu->loaded->count == KMEM_MAGAZINE_SIZE) {
+        if (cpu->previous->count > 0) {
+            spin_lock(&cache->lock);
+            kmem_cache_flush(cache, cpu->previous);
+            release = kmem_cache_trim(cache, KMEM_FREE_SLABS);
+            spin_unlock(&cache->lock);
+        }
+        kmem_swap(cpu);
+    }
+    cpu->loaded->objects[cpu->loaded->count++] = object;
+    cpu->frees++;
+    slab_release(cache, release);
+    cpu_interrupt_restore(flags);
+}
+
+uint32_t kmem_cache_shrink(struct KmemCache *cache) {
+    uint32_t       flags = cpu_interrupt_save();
+    struct KmemCPU *cpu  = &cache->cpus[cpu_local()->index];
+    spin_lock(&cache->lock);
+    kmem_cache_flush(cache, cpu->loaded);
+    kmem_cache_flush(cache, cpu->previous);
+    struct KmemSlab *release = kmem_cache_trim(cache, 0);
+    spin_unlock(&cache->lock);
+    uint32_t pages = slab_release(cache, release);
+    cpu_interrupt_restore(flags);
+    return pages;
+}
+
+bool kmem_cache_stats(struct KmemCache *cache, struct KmemCacheStats *stats) {
+    uint32_t misses = 0;
+    memset(stats, 0, sizeof(*stats));
+    // with interrupts off the own processor's magazines hold still, other processors may keep allocating
+    uint32_t flags = cpu_interrupt_save();
+    bool     exact = smp_state.cpu_count == 1;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        struct KmemCPU *cpu = &cache->cpus[i];
+        stats->magazine_objects += kmem_cpu_objects(cpu);
+        stats->hits             += __atomic_load_n(&cpu->hits, __ATOMIC_RELAXED);
+        misses                  += __atomic_load_n(&cpu->misses, __ATOMIC_RELAXED);
+    }
+
+    spin_lock(&cache->lock);
+    uint32_t free  = cache->free_objects;
+    stats->slabs         = cache->slabs;
+    stats->total_objects = cache->slabs * cache->per_slab;
+    stats->allocations   = stats->hits + misses - cache->failures;
+    spin_unlock(&cache->lock);
+    cpu_interrupt_restore(flags);
+
+    stats->slab_bytes = stats->slabs * (PAGE_SIZE << cache->order);
+    // the magazines were read unlocked, do not let a racing free make this wrap
+    if (free + stats->magazine_objects < stats->total_objects)
+        stats->active_objects = stats->total_objects - free - stats->magazine_objects;
+    if (stats->allocations)
+        stats->hit_percent = div64_32((uint64_t) stats->hits * 100, stats->allocations, NULL);
+    return exact;
+}
+
+/* -- kmalloc -- */
+
+void kmem_init(void) {
+    for (uint8_t i = 0; i < KMALLOC_CLASSES; i++) {
+        uint32_t size = 1u << (KMALLOC_MIN_SHIFT + i);
+        kmem_cache_init(&kmem_state.kmalloc[i], kmalloc_names[i], size,
+                        size < CACHE_LINE_SIZE ? size : CACHE_LINE_SIZE, NULL);
+    }
+}
+
+// size class of 1 to 2^KMALLOC_MAX_SHIFT bytes
+static struct KmemCache* kmalloc_cache(uint32_t size) {
+    uint32_t shift = size <= 1u << KMALLOC_MIN_SHIFT ? KMALLOC_MIN_SHIFT : 32 - __builtin_clz(size - 1);
+    return &kmem_state.kmalloc[shift - KMALLOC_MIN_SHIFT];
+}
+
+void* kmalloc(uint32_t size) {
+    if (size == 0)
+        return NULL;
+    if (size <= 1u << KMALLOC_MAX_SHIFT)
+        return kmem_cache_alloc(kmalloc_cache(size));
+
+    uint8_t  order = buddy_order(size);
+    uint32_t phys  = order <= BUDDY_MAX_ORDER ? buddy_alloc(order) : 0;
+    if (!phys)
+        return NULL;
+    // kfree() finds the order in the first page, which carries no PAGE_SLAB
+    buddy_page(phys)->order = order;
+    __atomic_add_fetch(&kmem_state.large, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&kmem_state.large_pages, 1u << order, __ATOMIC_RELAXED);
+    return PHYS_TO_VIRT(phys);
+}
+
+void kfree(void *ptr) {
+    if (!ptr)
+        return;
+    uint32_t    phys = VIRT_TO_PHYS(ptr);
+    struct Page *page = buddy_page(phys);
+    if (!page)
+        return;
+    if (page->flags & PAGE_SLAB) {
+        struct KmemSlab *slab = page->slab;
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+    uint8_t order = page->order;
+    __atomic_sub_fetch(&kmem_state.large, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&kmem_state.large_pages, 1u << order, __ATOMIC_RELAXED);
+    buddy_free(phys, order);
+}
+
+void kmem_dump(void) {
+    uint32_t flags = spin_lock_irqsave(&kmem_state.lock);
+    for (struct KmemCache *cache = kmem_state.caches; cache; cache = cache->next) {
+        struct KmemCacheStats stats;
+        bool exact = kmem_cache_stats(cache, &stats);
+        kprintf("%s: %u of %u objects active, %u in magazines%s, %u slabs of %u KiB, hit rate %u%%\n",
+                cache->name, stats.active_objects, stats.total_objects, stats.magazine_objects,
+                exact ? "" : " (approximate)", stats.slabs, (PAGE_SIZE << cache->order) / 1024, stats.hit_percent);
+    }
+    spin_unlock_irqrestore(&kmem_state.lock, flags);
+    kprintf("kmalloc: %u large allocations holding %u pages\n", kmem_state.large, kmem_state.large_pages);
+}
+
+/* -- Benchmark -- */
+
+#define KMEM_BENCHMARK_KIND_INODE 0
+#define KMEM_BENCHMARK_KIND_NAME  1
+#define KMEM_BENCHMARK_KIND_BLOCK 2
+
+/**
+ * FreeListBlock, a block of the first-fit allocator the benchmark compares
+ * against. Every block starts with its size including the 8 byte header, free
+ * blocks are kept in address order so neighbours coalesce on free.
+ */
+struct FreeListBlock {
+    uint32_t             size;
+    struct FreeListBlock *next;
+};
+
+static struct KmemCache     kmem_benchmark_inodes;
+static struct FreeListBlock *freelist_head;
+static uint32_t             freelist_walked;
+
+static void freelist_init(void *arena, uint32_t size) {
+    freelist_head       = arena;
+    freelist_head->size = size;
+    freelist_head->next = NULL;
+    freelist_walked     = 0;
+}
+
+static void* freelist_alloc(uint32_t size) {
+    uint32_t need = (size + sizeof(struct FreeListBlock) + 7) & ~7u;
+    for (struct FreeListBlock **link = &freelist_head; *link; link = &(*link)->next) {
+        struct FreeListBlock *block = *link;
+        freelist_walked++;
+        if (block->size < need)
+            continue;
+        // the tail is cut off, the free block stays linked where it is
+        if (block->size - need >= sizeof(struct FreeListBlock)) {
+            block->size -= need;
+            block = (struct FreeListBlock*) ((uint8_t*) block + block->size);
+            block->size = need;
+        } else {
+            *link = block->next;
+        }
+        return block + 1;
+    }
+    return NULL;
+}
+
+static void freelist_free(void *ptr) {
+    struct FreeListBlock *block = (struct FreeListBlock*) ptr - 1;
+    struct FreeListBlock *prev  = NULL, *next = freelist_head;
+    while (next && next < block) {
+        prev = next;
+        next = next->next;
+        freelist_walked++;
+    }
+    if (next && (uint8_t*) block + block->size == (uint8_t*) next) {
+        block->size += next->size;
+        block->next  = next->next;
+    } else {
+        block->next = next;
+    }
+    if (prev && (uint8_t*) prev + prev->size == (uint8_t*) block) {
+        prev->size += block->size;
+        prev->next  = block->next;
+    } else if (prev) {
+        prev->next = block;
+    } else {
+        freelist_head = block;
+    }
+}
+
+static void kmem_benchmark_inode_ctor(void *object) {
+    memset(object, 0, KMEM_BENCHMARK_INODE);
+}
+
+static void* kmem_benchmark_slab_alloc(uint8_t kind, uint32_t size) {
+    return kind == KMEM_BENCHMARK_KIND_INODE ? kmem_cache_alloc(&kmem_benchmark_inodes) : kmalloc(size);
+}
+
+static void kmem_benchmark_slab_free(uint8_t kind, void *object) {
+    if (kind == KMEM_BENCHMARK_KIND_INODE)
+        kmem_cache_free(&kmem_benchmark_inodes, object);
+    else
+        kfree(object);
+}
+
+// an inode has to be in the state the constructor leaves, so the free list pays for the clearing
+static void* kmem_benchmark_freelist_alloc(uint8_t kind, uint32_t size) {
+    void *object = freelist_alloc(size);
+    if (object && kind == KMEM_BENCHMARK_KIND_INODE)
+        kmem_benchmark_inode_ctor(object);
+    return object;
+}
+
+static void kmem_benchmark_freelist_free(uint8_t kind, void *object) {
+    (void) kind;
+    if (object)
+        freelist_free(object);
+}
+
+static uint32_t kmem_benchmark_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// a directory walk: every file gets an inode and a name that stay cached for
+// KMEM_BENCHMARK_INODES files, and one block buffer that is dropped right after the read
+static uint32_t kmem_benchmark_run(void* (*alloc)(uint8_t, uint32_t), void (*release)(uint8_t, void*),
+                                   uint32_t *operations, uint32_t *failed) {
+    static void *inodes[KMEM_BENCHMARK_INODES];
+    static void *names[KMEM_BENCHMARK_INODES];
+    uint32_t random = 2463534242u;
+    *operations = 0;
+    *failed     = 0;
+
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t i = 0; i < KMEM_BENCHMARK_ROUNDS; i++) {
+        uint32_t slot = i % KMEM_BENCHMARK_INODES;
+        if (inodes[slot]) {
+            release(KMEM_BENCHMARK_KIND_INODE, inodes[slot]);
+            release(KMEM_BENCHMARK_KIND_NAME, names[slot]);
+            *operations += 2;
+        }
+        inodes[slot] = alloc(KMEM_BENCHMARK_KIND_INODE, KMEM_BENCHMARK_INODE);
+        names[slot]  = alloc(KMEM_BENCHMARK_KIND_NAME, 8 + (kmem_benchmark_random(&random) & 63));
+
+        uint8_t *block = alloc(KMEM_BENCHMARK_KIND_BLOCK, KMEM_BENCHMARK_BLOCK);
+        if (block) {
+            block[0] = block[KMEM_BENCHMARK_BLOCK - 1] = (uint8_t) i;
+            release(KMEM_BENCHMARK_KIND_BLOCK, block);
+        }
+        *failed     += !inodes[slot] + !names[slot] + !block;
+        *operations += 4;
+    }
+    uint32_t cycles = div64_32(cpu_rdtsc() - start, *operations, NULL);
+
+    for (uint32_t i = 0; i < KMEM_BENCHMARK_INODES; i++) {
+        if (inodes[i])
+            release(KMEM_BENCHMARK_KIND_INODE, inodes[i]);
+        if (names[i])
+            release(KMEM_BENCHMARK_KIND_NAME, names[i]);
+        inodes[i] = names[i] = NULL;
+    }
+    return cycles;
+}
+
+void kmem_benchmark(void) {
+    uint32_t arena = buddy_alloc(BUDDY_MAX_ORDER);
+    if (!arena || !kmem_cache_init(&kmem_benchmark_inodes, "benchmark-inode", KMEM_BENCHMARK_INODE,
+                                   CACHE_LINE_SIZE, kmem_benchmark_inode_ctor)) {
+        kprintf("kmem: no memory for the benchmark\n");
+        if (arena)
+            buddy_free(arena, BUDDY_MAX_ORDER);
+        return;
+    }
+
+    uint32_t operations, failed;
+    uint32_t slab = kmem_benchmark_run(kmem_benchmark_slab_alloc, kmem_benchmark_slab_free, &operations, &failed);
+    kprintf("kmem: ext2 pattern on slab caches %u cycles per operation, %u failed\n", slab, failed);
+    struct KmemCache *caches[] = {&kmem_benchmark_inodes, kmalloc_cache(KMEM_BENCHMARK_BLOCK)};
+    for (uint32_t i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+        struct KmemCacheStats stats;
+        kmem_cache_stats(caches[i], &stats);
+        kprintf("kmem: %s hit rate %u%%, %u slabs\n", caches[i]->name, stats.hit_percent, stats.slabs);
+    }
+
+    freelist_init(PHYS_TO_VIRT(arena), PAGE_SIZE << BUDDY_MAX_ORDER);
+    uint32_t list = kmem_benchmark_run(kmem_benchmark_freelist_alloc, kmem_benchmark_freelist_free, &operations, &failed);
+    kprintf("kmem: same pattern on a first-fit free list %u cycles per operation, %u failed, %u blocks walked per operation\n",
+            list, failed, freelist_walked / operations);
+
+    kmem_cache_destroy(&kmem_benchmark_inodes);
+    buddy_free(arena, BUDDY_MAX_ORDER);
+}
@@ -0,0 +1,69 @@
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_gdtr
+global smp_trampoline_stack
+global smp_trampoline_cr3
+global smp_trampoline_cr4
+extern smp_ap_main
+
+SMP_TRAMPOLINE_ADDR equ 0x8000 ; keep in sync with header/cpu/smp.h
+CR0_PAGING          equ 1 << 31
+
+; Address of a trampoline label once smp_init() copied the code to SMP_TRAMPOLINE_ADDR
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE_ADDR + (label - smp_trampoline_start))
+
+; An application processor leaves reset in real mode at cs:ip = (vector << 8):0000,
+; this code is copied there and takes it to protected mode with the kernel GDT,
+; turns on paging with the kernel directory and calls smp_ap_main() in the higher
+; half on the stack smp_init() left in smp_trampoline_stack. smp_init() maps the
+; first 4 MiB at their physical addresses meanwhile, so the code keeps running here.
+section .text
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor  ax, ax
+    mov  ds, ax
+    o32 lgdt [TRAMPOLINE(smp_trampoline_gdtr)]
+
+    mov  eax, cr0
+    or   eax, 1
+    mov  cr0, eax
+    jmp  dword 0x8:TRAMPOLINE(smp_trampoline_protected)
+
+bits 32
+smp_trampoline_protected:
+    mov  ax, 0x10
+    mov  ds, ax
+    mov  es, ax
+    mov  fs, ax
+    mov  gs, ax
+    mov  ss, ax
+
+    mov  eax, [TRAMPOLINE(smp_trampoline_cr4)] ; PSE for the large pages, PGE if the boot processor has it
+    mov  cr4, eax
+    mov  eax, [TRAMPOLINE(smp_trampoline_cr3)]
+    mov  cr3, eax
+    mov  eax, cr0
+    or   eax, CR0_PAGING
+    mov  cr0, eax
+
+    mov  esp, [TRAMPOLINE(smp_trampoline_stack)]
+    mov  eax, smp_ap_main          ; absolute, the kernel is not linked against this copy
+    call eax
+.loop:
+    hlt
+    jmp  .loop
+
+align 4
+smp_trampoline_gdtr:               ; GDTR of global_descriptor_table with its physical address, set by smp_init()
+    dw 0
+    dd 0
+align 4
+smp_trampoline_stack:              ; stack top of the processor being started, set by smp_init()
+    dd 0
+smp_trampoline_cr3:                ; paging_state.directory_phys, set by smp_init()
+    dd 0
+smp_trampoline_cr4:                ; cr4 of the boot processor, set by smp_init()
+    dd 0
+smp_trampoline_end:
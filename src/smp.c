@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/smp.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/gdt.h"
+#include "header/cpu/idt.h"
+#include "header/kernel-entrypoint.h"
+#include "header/memory/paging.h"
+#include "header/process/task.h"
+#include "header/driver/timer.h"
+#include "header/text/console.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+
+#define TSS_TYPE_AVAILABLE 0x9
+#define DATA_TYPE_WRITABLE 0x2
+
+struct SMPState smp_state = {
+    .cpu_count = 0,
+};
+
+// the boot processor keeps kernel_stack, slot 0 is unused
+uint8_t smp_stacks[SMP_MAX_CPUS][SMP_STACK_SIZE] __attribute__((aligned(16)));
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_gdtr[];
+extern uint8_t smp_trampoline_stack[];
+extern uint8_t smp_trampoline_cr3[];
+extern uint8_t smp_trampoline_cr4[];
+
+// where a trampoline variable lives once the code is copied to SMP_TRAMPOLINE_ADDR
+static void* trampoline_address(uint8_t *symbol) {
+    return PHYS_TO_VIRT(SMP_TRAMPOLINE_ADDR + (symbol - smp_trampoline_start));
+}
+
+static void gdt_set_entry(struct SegmentDescriptor *entry, uint32_t base, uint32_t limit, uint8_t type, bool system) {
+    entry->segment_low                = limit & 0xFFFF;
+    entry->segment_mid                = (limit >> 16) & 0xF;
+    entry->base_low                   = base & 0xFFFF;
+    entry->base_mid                   = (base >> 16) & 0xFF;
+    entry->base_high                  = base >> 24;
+    entry->type_bit                   = type;
+    entry->non_system                 = !system;
+    entry->descriptor_privilege_level = 0;
+    entry->p_flag                     = 1;
+    entry->available_for_software     = 0;
+    entry->bit64_segment              = 0;
+    entry->default_operation_size     = !system; // must be clear in a TSS descriptor
+    entry->granularity                = 0;       // byte limit, both segments are small
+}
+
+// own copy of the GDT with this processor's TSS and CPULocal, loaded and put into tr and gs
+static void smp_cpu_local_init(struct CPULocal *local) {
+    local->self = local;
+    local->gdt  = global_descriptor_table;
+    gdt_set_entry(&local->gdt.table[GDT_TSS_SELECTOR / sizeof(struct SegmentDescriptor)],
+                  (uint32_t) &local->tss, sizeof(local->tss) - 1, TSS_TYPE_AVAILABLE, true);
+    gdt_set_entry(&local->gdt.table[GDT_CPU_LOCAL_SELECTOR / sizeof(struct SegmentDescriptor)],
+                  (uint32_t) local, sizeof(*local) - 1, DATA_TYPE_WRITABLE, false);
+
+    memset(&local->tss, 0, sizeof(local->tss));
+    local->tss.ss0        = GDT_KERNEL_DATA_SEGMENT_SELECTOR;
+    local->tss.esp0       = local->stack ? (uint32_t) (local->stack + SMP_STACK_SIZE) : 0;
+    local->tss.iomap_base = sizeof(local->tss);
+
+    local->gdtr.size    = sizeof(local->gdt) - 1;
+    local->gdtr.address = &local->gdt;
+    load_gdt(&local->gdtr);
+    __asm__ volatile("ltr %w0" : : "r"((uint16_t) GDT_TSS_SELECTOR));
+    __asm__ volatile("mov %w0, %%gs" : : "r"((uint16_t) GDT_CPU_LOCAL_SELECTOR) : "memory");
+}
+
+struct CPULocal* cpu_local(void) {
+    struct CPULocal *self;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(self));
+    return self;
+}
+
+bool smp_is_bsp(void) {
+    return cpu_local()->index == 0;
+}
+
+void smp_init_bsp(void) {
+    struct CPULocal *bsp = &smp_state.cpus[0];
+    bsp->index  = 0;
+    bsp->stack  = NULL;
+    bsp->online = true;
+    smp_cpu_local_init(bsp);
+    smp_state.cpu_count = 1;
+}
+
+void smp_ap_main(void) {
+    struct CPULocal *local = smp_state.booting;
+    smp_cpu_local_init(local);
+    __asm__ volatile("lidt %0" : : "m"(_idt_idtr));
+    apic_init_ap();
+    local->online = true;
+
+    // IRQs are not routed here, the processor only runs stolen tasks and idles in between
+    task_worker_main();
+}
+
+static bool smp_wait_online(struct CPULocal *local, uint64_t timeout_ns) {
+    uint64_t deadline = clock_monotonic_ns() + timeout_ns;
+    while (!local->online && clock_monotonic_ns() < deadline)
+        __asm__ volatile("pause");
+    return local->online;
+}
+
+// Intel x86 Vol 3a - 8.4.4.1, INIT, wait 10 ms, then up to two SIPIs 200 us apart
+static bool smp_start_cpu(struct CPULocal *local) {
+    *(uint32_t*) trampoline_address(smp_trampoline_stack) = (uint32_t) (local->stack + SMP_STACK_SIZE);
+    smp_state.booting = local;
+    // starts with an empty TLB, nothing to catch up on
+    local->tlb_generation = paging_state.tlb_generation;
+
+    apic_send_ipi(local->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    uint64_t start = clock_monotonic_ns();
+    while (clock_monotonic_ns() - start < SMP_INIT_DELAY_NS)
+        __asm__ volatile("pause");
+
+    start = clock_monotonic_ns();
+    for (uint8_t i = 0; i < 2 && !local->online; i++) {
+        apic_send_ipi(local->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        smp_wait_online(local, SMP_STARTUP_DELAY_NS);
+    }
+    if (!smp_wait_online(local, SMP_ONLINE_TIMEOUT_NS))
+        return false;
+    local->boot_ns = clock_monotonic_ns() - start;
+    return true;
+}
+
+uint32_t smp_init(void) {
+    struct CPULocal *bsp = &smp_state.cpus[0];
+    if (!apic_state.active)
+        return smp_state.cpu_count;
+    bsp->apic_id = apic_current_id();
+
+    memcpy(PHYS_TO_VIRT(SMP_TRAMPOLINE_ADDR), smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+    // lgdt runs before paging, the trampoline needs the physical address of the table
+    struct GDTR gdtr = _gdt_gdtr;
+    gdtr.address     = (struct GlobalDescriptorTable*) VIRT_TO_PHYS(_gdt_gdtr.address);
+    memcpy(trampoline_address(smp_trampoline_gdtr), &gdtr, sizeof(gdtr));
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    *(uint32_t*) trampoline_address(smp_trampoline_cr3) = paging_state.directory_phys;
+    *(uint32_t*) trampoline_address(smp_trampoline_cr4) = cr4;
+
+    // the trampoline turns on paging while it still runs from low memory
+    paging_identity_low(true);
+
+    for (uint8_t i = 0; i < apic_state.cpu_count && smp_state.cpu_count < SMP_MAX_CPUS; i++) {
+        if (apic_state.cpu_apic_id[i] == bsp->apic_id)
+            continue;
+        struct CPULocal *local = &smp_state.cpus[smp_state.cpu_count];
+        local->index   = smp_state.cpu_count;
+        local->apic_id = apic_state.cpu_apic_id[i];
+        local->stack   = smp_stacks[local->index];
+        if (!smp_start_cpu(local)) {
+            // a late start would run on the next processor's stack, stop here
+            kprintf("cpu apic id %u did not start\n", local->apic_id);
+            break;
+        }
+        kprintf("cpu %u: apic id %u online in %u us\n",
+                local->index, local->apic_id, (uint32_t) div64_32(local->boot_ns, 1000, NULL));
+        smp_state.cpu_count++;
+    }
+    paging_identity_low(false);
+    return smp_state.cpu_count;
+}
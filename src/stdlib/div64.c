@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "header/stdlib/div64.h"
+
+uint64_t div64_32(uint64_t dividend, uint32_t divisor, uint32_t *remainder) {
+    uint32_t high      = dividend >> 32;
+    uint32_t low       = (uint32_t) dividend;
+    uint32_t quot_high = high / divisor;
+    uint32_t rem       = high % divisor;
+    uint32_t quot_low;
+
+    // rem < divisor, so rem:low / divisor fits in 32 bits and divl cannot fault
+    __asm__(
+        "divl %4"
+        : "=a"(quot_low), "=d"(rem)
+        : "a"(low), "d"(rem), "rm"(divisor)
+    );
+    if (remainder)
+        *remainder = rem;
+    return (uint64_t) quot_high << 32 | quot_low;
+}
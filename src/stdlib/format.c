@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "header/stdlib/format.h"
+
+struct FormatBuffer {
+    char   *buf;
+    size_t size;
+    size_t len;
+};
+
+static void format_putc(struct FormatBuffer *out, char c) {
+    if (out->len + 1 < out->size)
+        out->buf[out->len] = c;
+    out->len++;
+}
+
+static void format_field(struct FormatBuffer *out, const char *s, size_t n, size_t width, bool left, char pad) {
+    size_t fill = width > n ? width - n : 0;
+    // a zero padded negative number keeps its sign in front of the zeros
+    if (pad == '0' && n > 0 && s[0] == '-') {
+        format_putc(out, '-');
+        s++;
+        n--;
+    }
+    if (!left)
+        for (size_t i = 0; i < fill; i++)
+            format_putc(out, pad);
+    for (size_t i = 0; i < n; i++)
+        format_putc(out, s[i]);
+    if (left)
+        for (size_t i = 0; i < fill; i++)
+            format_putc(out, ' ');
+}
+
+// digits are produced from the end of tmp, 32 bit division only (libgcc is not linked)
+static size_t format_number(char *tmp, uint32_t value, uint32_t base, bool upper, bool negative) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *end = tmp + 12;
+    char *p   = end;
+    do {
+        *--p = digits[value % base];
+        value /= base;
+    } while (value);
+    if (negative)
+        *--p = '-';
+
+    size_t n = end - p;
+    for (size_t i = 0; i < n; i++)
+        tmp[i] = p[i];
+    return n;
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args) {
+    struct FormatBuffer out = {.buf = buf, .size = size, .len = 0};
+    char tmp[12];
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            format_putc(&out, *fmt);
+            continue;
+        }
+
+        fmt++;
+        bool left = false;
+        char pad  = ' ';
+        for (; *fmt == '-' || *fmt == '0'; fmt++) {
+            if (*fmt == '-')
+                left = true;
+            else
+                pad = '0';
+        }
+        if (left)
+            pad = ' ';
+        size_t width = 0;
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+            width = width * 10 + (*fmt - '0');
+        while (*fmt == 'l')
+            fmt++;
+
+        switch (*fmt) {
+            case 'd':
+            case 'i': {
+                int32_t value = va_arg(args, int32_t);
+                uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+                format_field(&out, tmp, format_number(tmp, magnitude, 10, false, value < 0), width, left, pad);
+                break;
+            }
+            case 'u':
+                format_field(&out, tmp, format_number(tmp, va_arg(args, uint32_t), 10, false, false), width, left, pad);
+                break;
+            case 'x':
+            case 'X':
+                format_field(&out, tmp, format_number(tmp, va_arg(args, uint32_t), 16, *fmt == 'X', false), width, left, pad);
+                break;
+            case 'p':
+                format_putc(&out, '0');
+                format_putc(&out, 'x');
+                format_field(&out, tmp, format_number(tmp, (uint32_t) (uintptr_t) va_arg(args, void*), 16, false, false), 8, false, '0');
+                break;
+            case 's': {
+                const char *s = va_arg(args, const char*);
+                if (!s)
+                    s = "(null)";
+                size_t n = 0;
+                while (s[n])
+                    n++;
+                format_field(&out, s, n, width, left, ' ');
+                break;
+            }
+            case 'c':
+                tmp[0] = (char) va_arg(args, int);
+                format_field(&out, tmp, 1, width, left, ' ');
+                break;
+            case '%':
+                format_putc(&out, '%');
+                break;
+            case '\0':
+                fmt--; // lone '%' at the end, stop at the terminator
+                break;
+            default:
+                // unknown conversion, print it back verbatim
+                format_putc(&out, '%');
+                format_putc(&out, *fmt);
+                break;
+        }
+    }
+
+    if (size > 0)
+        buf[out.len < size ? out.len : size - 1] = '\0';
+    return out.len;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
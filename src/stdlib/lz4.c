@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "header/stdlib/lz4.h"
+#include "header/stdlib/string.h"
+
+// Input positions + 1, 0 marks an empty slot
+static uint16_t lz4_hash_table[LZ4_HASH_SIZE];
+
+static uint32_t lz4_read32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static uint8_t *lz4_write_length(uint8_t *op, uint32_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len  -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+uint32_t lz4_compress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity) {
+    uint8_t *op         = dst;
+    uint8_t *op_end     = dst + capacity;
+    uint32_t anchor     = 0;
+    uint32_t ip         = 0;
+
+    if (size > LZ4_MAX_INPUT_SIZE)
+        return 0;
+
+    if (size > LZ4_MFLIMIT) {
+        uint32_t match_start_limit = size - LZ4_MFLIMIT;
+        uint32_t match_end_limit   = size - LZ4_LAST_LITERALS;
+        memset(lz4_hash_table, 0, sizeof(lz4_hash_table));
+
+        while (ip < match_start_limit) {
+            uint32_t sequence = lz4_read32(src + ip);
+            uint32_t h        = lz4_hash(sequence);
+            uint32_t slot     = lz4_hash_table[h];
+            lz4_hash_table[h] = (uint16_t) (ip + 1);
+
+            if (slot == 0 || ip - (slot - 1) > LZ4_MAX_OFFSET || lz4_read32(src + slot - 1) != sequence) {
+                ip++;
+                continue;
+            }
+
+            uint32_t ref = slot - 1;
+            uint32_t len = LZ4_MIN_MATCH;
+            while (ip + len < match_end_limit && src[ref + len] == src[ip + len])
+                len++;
+
+            // token + literal length bytes + literals + offset + match length bytes
+            uint32_t literals = ip - anchor;
+            if (op + 1 + literals / 255 + 1 + literals + 2 + (len - LZ4_MIN_MATCH) / 255 + 1 > op_end)
+                return 0;
+
+            uint8_t *token = op++;
+            if (literals >= 15) {
+                *token = 15 << 4;
+                op     = lz4_write_length(op, literals - 15);
+            } else {
+                *token = (uint8_t) (literals << 4);
+            }
+            memcpy(op, src + anchor, literals);
+            op += literals;
+
+            uint32_t offset = ip - ref;
+            *op++ = (uint8_t) offset;
+            *op++ = (uint8_t) (offset >> 8);
+
+            uint32_t match_code = len - LZ4_MIN_MATCH;
+            if (match_code >= 15) {
+                *token |= 15;
+                op      = lz4_write_length(op, match_code - 15);
+            } else {
+                *token |= (uint8_t) match_code;
+            }
+
+            ip    += len;
+            anchor = ip;
+        }
+    }
+
+    // Last sequence, literals only
+    uint32_t literals = size - anchor;
+    if (op + 1 + literals / 255 + 1 + literals > op_end)
+        return 0;
+    uint8_t *token = op++;
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op     = lz4_write_length(op, literals - 15);
+    } else {
+        *token = (uint8_t) (literals << 4);
+    }
+    memcpy(op, src + anchor, literals);
+    op += literals;
+
+    return op - dst;
+}
+
+int32_t lz4_decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity) {
+    const uint8_t *ip     = src;
+    const uint8_t *ip_end = src + size;
+    uint8_t *op           = dst;
+    uint8_t *op_end       = dst + capacity;
+
+    while (ip < ip_end) {
+        uint8_t token     = *ip++;
+        uint32_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end)
+                    return -1;
+                b         = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (uint32_t) (ip_end - ip) || literals > (uint32_t) (op_end - op))
+            return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // Last sequence has no match part
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return -1;
+        uint32_t offset = ip[0] | ((uint32_t) ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t) (op - dst))
+            return -1;
+
+        uint32_t len = token & 15;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end)
+                    return -1;
+                b    = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += LZ4_MIN_MATCH;
+        if (len > (uint32_t) (op_end - op))
+            return -1;
+
+        // Byte copy, source and destination overlap when offset < len
+        const uint8_t *match = op - offset;
+        for (uint32_t i = 0; i < len; i++)
+            op[i] = match[i];
+        op += len;
+    }
+
+    return op - dst;
+}
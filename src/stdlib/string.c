@@ -1,25 +1,78 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "header/stdlib/string.h"
+#include "header/cpu/cpu.h"
+#include "header/text/console.h"
+#include "header/stdlib/div64.h"
+
+// below this size the setup of a string instruction costs more than a byte loop
+#define STRING_WORD_THRESHOLD 16
+
+typedef uint32_t __attribute__((may_alias)) word_t;
 
 void* memset(void *s, int c, size_t n) {
     uint8_t *buf = (uint8_t*) s;
+    uint8_t byte = (uint8_t) c;
+    if (n >= STRING_WORD_THRESHOLD) {
+        // head up to a dword boundary, whole dwords with rep stosd, then the tail
+        while ((uintptr_t) buf & 3) {
+            *buf++ = byte;
+            n--;
+        }
+        size_t dwords = n / 4;
+        n %= 4;
+        __asm__ volatile (
+            "rep stosl"
+            : "+D"(buf), "+c"(dwords)
+            : "a"(byte * 0x01010101u)
+            : "memory"
+        );
+    }
     for (size_t i = 0; i < n; i++)
-        buf[i] = (uint8_t) c;
+        buf[i] = byte;
     return s;
 }
 
-void* memcpy(void* restrict dest, const void* restrict src, size_t n) {
-    uint8_t *dstbuf       = (uint8_t*) dest;
-    const uint8_t *srcbuf = (const uint8_t*) src;
+/**
+ * Ascending copy shared by memcpy and memmove, safe for overlap when dest is below src
+ * since every dword is read before anything at or above it is written
+ */
+static void copy_forward(uint8_t *dstbuf, const uint8_t *srcbuf, size_t n) {
+    if (n >= STRING_WORD_THRESHOLD) {
+        // aligning the destination is what matters, misaligned loads are cheap on x86
+        while ((uintptr_t) dstbuf & 3) {
+            *dstbuf++ = *srcbuf++;
+            n--;
+        }
+        size_t dwords = n / 4;
+        n %= 4;
+        __asm__ volatile (
+            "rep movsl"
+            : "+D"(dstbuf), "+S"(srcbuf), "+c"(dwords)
+            :
+            : "memory"
+        );
+    }
     for (size_t i = 0; i < n; i++)
         dstbuf[i] = srcbuf[i];
-    return dstbuf;
+}
+
+void* memcpy(void* restrict dest, const void* restrict src, size_t n) {
+    copy_forward((uint8_t*) dest, (const uint8_t*) src, n);
+    return dest;
 }
 
 int memcmp(const void *s1, const void *s2, size_t n) {
     const uint8_t *buf1 = (const uint8_t*) s1;
     const uint8_t *buf2 = (const uint8_t*) s2;
+
+    // skip equal dwords, the first differing one is settled byte by byte below
+    while (n >= 4 && *(const word_t*) buf1 == *(const word_t*) buf2) {
+        buf1 += 4;
+        buf2 += 4;
+        n    -= 4;
+    }
+
     for (size_t i = 0; i < n; i++) {
         if (buf1[i] < buf2[i])
             return -1;
@@ -33,13 +86,77 @@ int memcmp(const void *s1, const void *s2, size_t n) {
 void *memmove(void *dest, const void *src, size_t n) {
     uint8_t *dstbuf       = (uint8_t*) dest;
     const uint8_t *srcbuf = (const uint8_t*) src;
-    if (dstbuf < srcbuf) {
-        for (size_t i = 0; i < n; i++)
-            dstbuf[i]   = srcbuf[i];
-    } else {
-        for (size_t i = n; i != 0; i--)
-            dstbuf[i-1] = srcbuf[i-1];
+    if (dstbuf <= srcbuf || dstbuf >= srcbuf + n) {
+        copy_forward(dstbuf, srcbuf, n);
+        return dest;
+    }
+
+    // overlapping with dest above src, copy from the end: tail bytes, then dwords with the direction flag set
+    while (n % 4) {
+        n--;
+        dstbuf[n] = srcbuf[n];
+    }
+    if (n > 0) {
+        size_t dwords = n / 4;
+        uint8_t *dstword       = dstbuf + n - 4;
+        const uint8_t *srcword = srcbuf + n - 4;
+        // no handler may run with the direction flag set, keep interrupts off until cld
+        uint32_t flags = cpu_interrupt_save();
+        __asm__ volatile (
+            "std\n\t"
+            "rep movsl\n\t"
+            "cld"
+            : "+D"(dstword), "+S"(srcword), "+c"(dwords)
+            :
+            : "memory"
+        );
+        cpu_interrupt_restore(flags);
     }
 
     return dest;
-}
\ No newline at end of file
+}
+
+size_t strlen(const char *s) {
+    size_t n = 0;
+    while (s[n])
+        n++;
+    return n;
+}
+
+// memmove copies up by a dword inside one buffer, so the source and the destination overlap
+static uint8_t           string_benchmark_src[STRING_BENCHMARK_MAX + 4];
+static uint8_t           string_benchmark_dst[STRING_BENCHMARK_MAX];
+static volatile int      string_benchmark_sink;
+
+enum StringBenchmarkFunction {STRING_MEMCPY, STRING_MEMSET, STRING_MEMMOVE, STRING_MEMCMP, STRING_FUNCTIONS};
+
+static void string_benchmark_run(enum StringBenchmarkFunction function, size_t size, uint32_t rounds) {
+    for (uint32_t i = 0; i < rounds; i++) {
+        switch (function) {
+        case STRING_MEMCPY:  memcpy(string_benchmark_dst, string_benchmark_src, size); break;
+        case STRING_MEMSET:  memset(string_benchmark_dst, (int) i, size); break;
+        case STRING_MEMMOVE: memmove(string_benchmark_src + 4, string_benchmark_src, size); break;
+        default:             string_benchmark_sink += memcmp(string_benchmark_dst, string_benchmark_dst, size); break;
+        }
+    }
+}
+
+void string_benchmark(void) {
+    kprintf("bytes per cycle   memcpy  memset memmove  memcmp\n");
+    for (size_t size = 1; size <= STRING_BENCHMARK_MAX; size *= 4) {
+        uint32_t rounds = STRING_BENCHMARK_BYTES / size;
+        kprintf("%6u B       ", (uint32_t) size);
+        for (uint32_t function = 0; function < STRING_FUNCTIONS; function++) {
+            string_benchmark_run(function, size, 1); // warm the caches
+            uint32_t flags  = cpu_interrupt_save();
+            uint64_t start  = cpu_rdtsc();
+            string_benchmark_run(function, size, rounds);
+            uint64_t cycles = cpu_rdtsc() - start;
+            cpu_interrupt_restore(flags);
+            // hundredths of a byte per cycle
+            uint32_t rate = cycles ? (uint32_t) div64_32((uint64_t) size * rounds * 100, cycles >> 32 ? UINT32_MAX : (uint32_t) cycles, NULL) : 0;
+            kprintf(" %3u.%02u", rate / 100, rate % 100);
+        }
+        kprintf("\n");
+    }
+}
@@ -0,0 +1,263 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/process/task.h"
+#include "header/cpu/smp.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/interrupt.h"
+#include "header/memory/paging.h"
+#include "header/text/console.h"
+#include "header/stdlib/div64.h"
+
+#define TASK_DEQUE_MASK (TASK_DEQUE_CAPACITY - 1)
+
+struct TaskPoolState task_pool_state = {
+    .sleeping = 0,
+    .workers  = SMP_MAX_CPUS,
+};
+
+/* -- Chase-Lev deque, Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models" -- */
+
+// owner only
+static bool deque_push(struct TaskDeque *deque, struct Task *task) {
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int32_t top    = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= TASK_DEQUE_CAPACITY)
+        return false;
+    deque->buffer[bottom & TASK_DEQUE_MASK] = task;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// owner only, newest task first so the spawner keeps working on what is warm in its cache
+static struct Task* deque_take(struct TaskDeque *deque) {
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    struct Task *task = NULL;
+    if (top <= bottom) {
+        task = deque->buffer[bottom & TASK_DEQUE_MASK];
+        if (top != bottom)
+            return task;
+        // last task, race the thieves for it
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+// any processor, oldest task first, which for parallel_for() is the largest range
+static struct Task* deque_steal(struct TaskDeque *deque) {
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom)
+        return NULL;
+
+    struct Task *task = deque->buffer[top & TASK_DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return task;
+}
+
+/* -- Pool -- */
+
+static uint32_t task_worker_count(void) {
+    return smp_state.cpu_count < task_pool_state.workers ? smp_state.cpu_count : task_pool_state.workers;
+}
+
+static struct Task* task_find(uint32_t self) {
+    struct TaskDeque *own = &task_pool_state.deques[self];
+    // the boot processor shares its deque between threads, an owner operation must not be preempted
+    uint32_t flags = cpu_interrupt_save();
+    struct Task *task = deque_take(own);
+    cpu_interrupt_restore(flags);
+    if (task)
+        return task;
+
+    uint32_t count = task_worker_count();
+    for (uint32_t i = 1; i < count; i++) {
+        task = deque_steal(&task_pool_state.deques[(self + i) % count]);
+        if (task) {
+            own->stolen++;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static bool task_pool_has_work(void) {
+    uint32_t count = task_worker_count();
+    for (uint32_t i = 0; i < count; i++) {
+        struct TaskDeque *deque = &task_pool_state.deques[i];
+        if (__atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) < __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE))
+            return true;
+    }
+    return false;
+}
+
+static void task_run(struct Task *task, struct TaskDeque *deque) {
+    // the spawner may reuse task as soon as pending drops, it is not touched after that
+    struct TaskGroup *group = task->group;
+    task->fn(task->arg);
+    deque->executed++;
+    __atomic_sub_fetch(&group->pending, 1, __ATOMIC_RELEASE);
+}
+
+// claim one sleeping worker and IPI it, the next spawn then wakes another one
+static void task_wake_one(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t count    = task_worker_count();
+    uint32_t allowed  = count >= 32 ? UINT32_MAX : (1u << count) - 1;
+    uint32_t sleeping = __atomic_load_n(&task_pool_state.sleeping, __ATOMIC_RELAXED) & allowed;
+    while (sleeping) {
+        uint32_t cpu = __builtin_ctz(sleeping);
+        uint32_t bit = 1u << cpu;
+        if (__atomic_fetch_and(&task_pool_state.sleeping, ~bit, __ATOMIC_SEQ_CST) & bit) {
+            apic_send_ipi(smp_state.cpus[cpu].apic_id, TASK_WAKE_VECTOR);
+            return;
+        }
+        sleeping &= ~bit;
+    }
+}
+
+static void task_wake_handler(struct InterruptFrame *frame, void *ctx) {
+    (void) frame;
+    (void) ctx;
+    apic_eoi();
+}
+
+void task_pool_init(void) {
+    register_irq_handler(TASK_WAKE_VECTOR, task_wake_handler, NULL);
+}
+
+void task_worker_main(void) {
+    struct CPULocal  *local = cpu_local();
+    struct TaskDeque *own   = &task_pool_state.deques[local->index];
+    uint32_t         bit    = 1u << local->index;
+
+    while (true) {
+        bool worker = local->index < task_pool_state.workers;
+        struct Task *task = worker ? task_find(local->index) : NULL;
+        if (task) {
+            paging_tlb_sync();
+            task_run(task, own);
+            continue;
+        }
+
+        // announce the sleep before the last look, a spawner pushes before it reads sleeping
+        __asm__ volatile("cli");
+        __atomic_or_fetch(&task_pool_state.sleeping, bit, __ATOMIC_SEQ_CST);
+        if (worker && task_pool_has_work()) {
+            __atomic_and_fetch(&task_pool_state.sleeping, ~bit, __ATOMIC_SEQ_CST);
+            __asm__ volatile("sti");
+            continue;
+        }
+        own->halts++;
+        // sti takes effect after hlt starts, an IPI sent since the cli still wakes it
+        __asm__ volatile("sti; hlt" : : : "memory");
+        __atomic_and_fetch(&task_pool_state.sleeping, ~bit, __ATOMIC_SEQ_CST);
+        local->idle_wakeups++;
+    }
+}
+
+void task_group_init(struct TaskGroup *group) {
+    group->pending = 0;
+}
+
+void task_spawn(struct TaskGroup *group, struct Task *task, task_fn_t fn, void *arg) {
+    struct TaskDeque *own = &task_pool_state.deques[cpu_local()->index];
+    task->fn    = fn;
+    task->arg   = arg;
+    task->group = group;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+
+    uint32_t flags  = cpu_interrupt_save();
+    bool     queued = deque_push(own, task);
+    cpu_interrupt_restore(flags);
+    if (!queued) {
+        task_run(task, own);
+        return;
+    }
+    task_wake_one();
+}
+
+void task_join(struct TaskGroup *group) {
+    uint32_t         self = cpu_local()->index;
+    struct TaskDeque *own = &task_pool_state.deques[self];
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+        struct Task *task = task_find(self);
+        if (task)
+            task_run(task, own);
+        else
+            __asm__ volatile("pause");
+    }
+}
+
+/* -- Parallel for -- */
+
+struct ParallelRange {
+    uint32_t      begin;
+    uint32_t      end;
+    uint32_t      grain;
+    parallel_fn_t fn;
+    void          *arg;
+};
+
+static void parallel_range_run(void *arg) {
+    struct ParallelRange *range = (struct ParallelRange*) arg;
+    if (range->end - range->begin <= range->grain) {
+        for (uint32_t i = range->begin; i < range->end; i++)
+            range->fn(i, range->arg);
+        return;
+    }
+
+    uint32_t middle = range->begin + (range->end - range->begin) / 2;
+    struct ParallelRange left  = {range->begin, middle, range->grain, range->fn, range->arg};
+    struct ParallelRange right = {middle, range->end, range->grain, range->fn, range->arg};
+    struct TaskGroup group;
+    struct Task      task;
+    task_group_init(&group);
+    task_spawn(&group, &task, parallel_range_run, &right);
+    parallel_range_run(&left);
+    task_join(&group);
+}
+
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, parallel_fn_t fn, void *arg) {
+    if (begin >= end)
+        return;
+    struct ParallelRange range = {begin, end, grain ? grain : 1, fn, arg};
+    parallel_range_run(&range);
+}
+
+/* -- Benchmark -- */
+
+void task_benchmark(const char *name, task_fn_t job, void *arg) {
+    uint32_t saved = task_pool_state.workers;
+    uint32_t base  = 0;
+    for (uint32_t cpus = 1; cpus <= smp_state.cpu_count; cpus++) {
+        task_pool_state.workers = cpus;
+        uint64_t start = cpu_rdtsc();
+        job(arg);
+        uint32_t kcycles = div64_32(cpu_rdtsc() - start, 1000, NULL);
+        if (kcycles == 0)
+            kcycles = 1;
+        if (cpus == 1)
+            base = kcycles;
+
+        // speedup in hundredths, one bar character per 0.25x
+        uint32_t speedup = div64_32((uint64_t) base * 100, kcycles, NULL);
+        uint32_t length  = speedup / 25 < TASK_BENCHMARK_BAR ? speedup / 25 : TASK_BENCHMARK_BAR;
+        char bar[TASK_BENCHMARK_BAR + 1];
+        for (uint32_t i = 0; i < length; i++)
+            bar[i] = '#';
+        bar[length] = '\0';
+        kprintf("%s %2u cpu %10u kcycles %3u.%02ux %s\n",
+                name, cpus, kcycles, speedup / 100, speedup % 100, bar);
+    }
+    task_pool_state.workers = saved;
+}
@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/process/thread.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/gdt.h"
+#include "header/cpu/interrupt.h"
+#include "header/cpu/smp.h"
+#include "header/driver/timer.h"
+#include "header/text/console.h"
+#include "header/stdlib/string.h"
+#include "header/stdlib/div64.h"
+
+#define THREAD_EFLAGS_INITIAL (EFLAGS_INTERRUPT_ENABLE | 0x2) // bit 1 is reserved and always set
+
+struct SchedulerState scheduler_state = {
+    .current = NULL,
+};
+
+// slot 0 is the boot thread, it keeps running on kernel_stack
+uint8_t thread_stacks[THREAD_MAX][THREAD_STACK_SIZE] __attribute__((aligned(16)));
+
+/* -- Run queue -- */
+
+static void run_queue_push(struct Thread *thread) {
+    struct RunQueue *queue = &scheduler_state.run_queue;
+    uint8_t priority = thread->priority;
+    thread->next = NULL;
+    if (queue->tail[priority])
+        queue->tail[priority]->next = thread;
+    else
+        queue->head[priority] = thread;
+    queue->tail[priority] = thread;
+    queue->bitmap |= 1u << priority;
+}
+
+static struct Thread* run_queue_pop(void) {
+    struct RunQueue *queue = &scheduler_state.run_queue;
+    if (queue->bitmap == 0)
+        return NULL;
+
+    uint8_t priority = __builtin_ctz(queue->bitmap);
+    struct Thread *thread = queue->head[priority];
+    queue->head[priority] = thread->next;
+    if (!thread->next) {
+        queue->tail[priority] = NULL;
+        queue->bitmap &= ~(1u << priority);
+    }
+    thread->next = NULL;
+    return thread;
+}
+
+/* -- Scheduler -- */
+
+static void scheduler_yield_handler(struct InterruptFrame *frame, void *ctx) {
+    (void) frame;
+    (void) ctx;
+    scheduler_state.need_resched = true;
+}
+
+static void scheduler_slice_expired(struct Timer *timer, void *arg) {
+    (void) timer;
+    (void) arg;
+    scheduler_state.need_resched = true;
+}
+
+struct InterruptFrame* scheduler_switch(struct InterruptFrame *frame) {
+    struct Thread *prev = scheduler_state.current;
+    if (!scheduler_state.need_resched || !prev)
+        return frame;
+    scheduler_state.need_resched = false;
+
+    // a preempted or yielding thread goes behind the others of its priority
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != scheduler_state.idle)
+            run_queue_push(prev);
+    }
+    struct Thread *next = run_queue_pop();
+    if (!next)
+        next = scheduler_state.idle;
+    next->state = THREAD_RUNNING;
+
+    // slices only matter between threads of one priority, a higher one preempts on wake and a lower one waits
+    if (scheduler_state.run_queue.head[next->priority])
+        timer_arm_after(&scheduler_state.slice_timer, THREAD_SLICE_NS);
+    else
+        timer_cancel(&scheduler_state.slice_timer);
+
+    if (next == prev)
+        return frame;
+    prev->frame = frame;
+    scheduler_state.current = next;
+    scheduler_state.switches++;
+    next->switches++;
+    return next->frame;
+}
+
+/* -- Threads -- */
+
+static void thread_start(void) {
+    struct Thread *self = scheduler_state.current;
+    self->fn(self->arg);
+    thread_exit();
+}
+
+static void thread_sleep_expired(struct Timer *timer, void *arg) {
+    (void) timer;
+    thread_wake((struct Thread*) arg);
+}
+
+// reserve a slot and build a frame that iret leaves at thread_start on the new stack
+static struct Thread* thread_alloc(void (*fn)(void *arg), void *arg, uint8_t priority, const char *name) {
+    struct Thread *thread = NULL;
+    for (uint32_t i = 1; i < THREAD_MAX; i++) {
+        struct Thread *slot = &scheduler_state.threads[i];
+        if ((slot->state == THREAD_UNUSED || slot->state == THREAD_DEAD) && slot != scheduler_state.current) {
+            thread        = slot;
+            thread->stack = thread_stacks[i];
+            break;
+        }
+    }
+    if (!thread)
+        return NULL;
+
+    thread->id       = scheduler_state.next_id++;
+    thread->priority = priority < THREAD_PRIORITIES ? priority : THREAD_PRIORITY_IDLE;
+    thread->fn       = fn;
+    thread->arg      = arg;
+    thread->next       = NULL;
+    thread->wait_queue = NULL;
+    thread->wait_next  = NULL;
+    thread->switches   = 0;
+    size_t length = 0;
+    while (name[length] && length < THREAD_NAME_LENGTH - 1) {
+        thread->name[length] = name[length];
+        length++;
+    }
+    thread->name[length] = '\0';
+    timer_setup(&thread->sleep_timer, thread_sleep_expired, thread);
+
+    // zero dword above the frame is the return address thread_start never uses
+    uint32_t *top = (uint32_t*) (thread->stack + THREAD_STACK_SIZE) - 1;
+    *top = 0;
+    struct InterruptFrame *frame = (struct InterruptFrame*) top - 1;
+    memset(frame, 0, sizeof(*frame));
+    frame->cpu.segment.ds     = GDT_KERNEL_DATA_SEGMENT_SELECTOR;
+    frame->cpu.segment.es     = GDT_KERNEL_DATA_SEGMENT_SELECTOR;
+    frame->cpu.segment.fs     = GDT_KERNEL_DATA_SEGMENT_SELECTOR;
+    frame->cpu.segment.gs     = GDT_CPU_LOCAL_SELECTOR;
+    frame->int_stack.eip      = (uint32_t) thread_start;
+    frame->int_stack.cs       = GDT_KERNEL_CODE_SEGMENT_SELECTOR;
+    frame->int_stack.eflags   = THREAD_EFLAGS_INITIAL;
+    thread->frame = frame;
+    thread->state = THREAD_READY;
+    return thread;
+}
+
+static void thread_idle(void *arg) {
+    (void) arg;
+    while (true)
+        __asm__ volatile("sti; hlt" ::: "memory");
+}
+
+void thread_init(void) {
+    struct Thread *boot = &scheduler_state.threads[0];
+    memcpy(boot->name, "kernel", 7);
+    boot->id       = scheduler_state.next_id++;
+    boot->state    = THREAD_RUNNING;
+    boot->priority = THREAD_PRIORITY_NORMAL;
+    boot->stack    = NULL;
+    timer_setup(&boot->sleep_timer, thread_sleep_expired, boot);
+    timer_setup(&scheduler_state.slice_timer, scheduler_slice_expired, NULL);
+    register_irq_handler(THREAD_YIELD_VECTOR, scheduler_yield_handler, NULL);
+
+    scheduler_state.idle    = thread_alloc(thread_idle, NULL, THREAD_PRIORITY_IDLE, "idle");
+    scheduler_state.current = boot;
+}
+
+struct Thread* thread_create(void (*fn)(void *arg), void *arg, uint8_t priority, const char *name) {
+    uint32_t flags = cpu_interrupt_save();
+    struct Thread *thread = thread_alloc(fn, arg, priority, name);
+    if (thread) {
+        // queued as blocked-then-woken, so a higher priority thread starts right away
+        thread->state = THREAD_BLOCKED;
+        thread_wake(thread);
+    }
+    cpu_interrupt_restore(flags);
+    return thread;
+}
+
+struct Thread* thread_current(void) {
+    return scheduler_state.current;
+}
+
+void thread_yield(void) {
+    __asm__ volatile("int %0" : : "i"(THREAD_YIELD_VECTOR) : "memory");
+}
+
+void thread_block(void) {
+    scheduler_state.current->state = THREAD_BLOCKED;
+    thread_yield();
+}
+
+bool thread_make_ready(struct Thread *thread) {
+    uint32_t flags = cpu_interrupt_save();
+    if (thread->state != THREAD_BLOCKED) {
+        cpu_interrupt_restore(flags);
+        return false;
+    }
+    thread->state = THREAD_READY;
+    run_queue_push(thread);
+
+    struct Thread *current = scheduler_state.current;
+    bool preempt = thread->priority < current->priority || current == scheduler_state.idle;
+    if (preempt)
+        scheduler_state.need_resched = true;
+    cpu_interrupt_restore(flags);
+    return preempt;
+}
+
+void thread_wake(struct Thread *thread) {
+    uint32_t flags = cpu_interrupt_save();
+    // in thread context switch now, an ISR switches when the outermost interrupt returns
+    if (thread_make_ready(thread) && interrupt_nesting == 0)
+        thread_yield();
+    cpu_interrupt_restore(flags);
+}
+
+bool thread_can_block(void) {
+    // interrupt_nesting is only counted on the boot processor, check it first
+    return scheduler_state.current && smp_is_bsp() && interrupt_nesting == 0
+        && scheduler_state.current != scheduler_state.idle;
+}
+
+void thread_sleep_ns(uint64_t ns) {
+    uint32_t flags = cpu_interrupt_save();
+    timer_arm_after(&scheduler_state.current->sleep_timer, ns);
+    thread_block();
+    cpu_interrupt_restore(flags);
+}
+
+void thread_exit(void) {
+    cpu_interrupt_save();
+    scheduler_state.current->state = THREAD_DEAD;
+    timer_cancel(&scheduler_state.current->sleep_timer);
+    thread_yield();
+    while (true); // never scheduled again
+}
+
+/* -- Benchmark -- */
+
+#define BENCHMARK_ROUNDS      10000
+#define BENCHMARK_SLEEPS      200
+#define BENCHMARK_SLEEP_NS    NS_PER_MS
+
+struct PingPong {
+    struct Thread *ping;
+    struct Thread *pong;
+    volatile bool pong_turn;
+    volatile bool done;
+};
+
+static void benchmark_pong(void *arg) {
+    struct PingPong *game = (struct PingPong*) arg;
+    uint32_t flags = cpu_interrupt_save();
+    while (!game->done) {
+        while (!game->pong_turn && !game->done)
+            thread_block();
+        game->pong_turn = false;
+        thread_wake(game->ping);
+    }
+    cpu_interrupt_restore(flags);
+}
+
+static uint32_t cycles_to_ns(uint64_t cycles) {
+    return div64_32(cycles * 1000000, timer_state.tsc_khz ? timer_state.tsc_khz : 1, NULL);
+}
+
+void thread_benchmark(void) {
+    struct Thread *self = scheduler_state.current;
+    struct PingPong game = {.ping = self, .pong_turn = false, .done = false};
+
+    // pong runs at a higher priority, so it is blocked waiting for its turn before the first round
+    game.pong = thread_create(benchmark_pong, &game, self->priority > 0 ? self->priority - 1 : 0, "pong");
+    if (!game.pong)
+        return;
+
+    uint32_t flags = cpu_interrupt_save();
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t i = 0; i < BENCHMARK_ROUNDS; i++) {
+        game.pong_turn = true;
+        thread_wake(game.pong);
+        while (game.pong_turn)
+            thread_block();
+    }
+    uint64_t cycles = cpu_rdtsc() - start;
+    game.done = true;
+    thread_wake(game.pong);
+    cpu_interrupt_restore(flags);
+
+    // every round is two switches, block/wake included
+    uint32_t switch_cycles = div64_32(cycles, 2 * BENCHMARK_ROUNDS, NULL);
+    kprintf("ping-pong: %u rounds, %u cycles (%u ns) per switch\n",
+            BENCHMARK_ROUNDS, switch_cycles, cycles_to_ns(switch_cycles));
+
+    uint64_t late_total = 0;
+    uint32_t late_min   = UINT32_MAX;
+    uint32_t late_max   = 0;
+    for (uint32_t i = 0; i < BENCHMARK_SLEEPS; i++) {
+        uint64_t before = clock_monotonic_ns();
+        thread_sleep_ns(BENCHMARK_SLEEP_NS);
+        uint64_t late = clock_monotonic_ns() - before - BENCHMARK_SLEEP_NS;
+        uint32_t clamped = late >> 32 ? UINT32_MAX : (uint32_t) late;
+        late_total += clamped;
+        if (clamped < late_min)
+            late_min = clamped;
+        if (clamped > late_max)
+            late_max = clamped;
+    }
+    kprintf("sleep %u ns x %u: late min %u ns, avg %u ns, max %u ns, jitter %u ns\n",
+            BENCHMARK_SLEEP_NS, BENCHMARK_SLEEPS, late_min,
+            (uint32_t) div64_32(late_total, BENCHMARK_SLEEPS, NULL), late_max, late_max - late_min);
+}
@@ -0,0 +1,288 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/driver/timer.h"
+#include "header/driver/rtc.h"
+#include "header/cpu/apic.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/interrupt.h"
+#include "header/cpu/portio.h"
+#include "header/stdlib/div64.h"
+
+#define TIMER_MAX_DELTA_NS NS_PER_SEC // longer deadlines are reached in steps, keeps the LAPIC count math in 64 bits
+
+struct TimerState timer_state = {
+    .heap_size  = 0,
+    .clock_lock = SEQLOCK_INIT("clock"),
+    .lock       = SPINLOCK_INIT("timer"),
+};
+
+/* -- Calibration and clock -- */
+
+// TSC cycles and LAPIC timer counts over TIMER_CALIBRATE_MS of PIT channel 2, which raises no IRQ
+static void timer_calibrate(void) {
+    uint16_t count = PIT_FREQUENCY / 1000 * TIMER_CALIBRATE_MS;
+    uint8_t  gate  = in(PIT_GATE_PORT) & ~(PIT_GATE_SPEAKER | PIT_GATE_CHANNEL2);
+    out(PIT_GATE_PORT, gate);
+    out(PIT_COMMAND, PIT_CHANNEL2_ONESHOT);
+    out(PIT_CHANNEL2, count & 0xFF);
+    out(PIT_CHANNEL2, count >> 8);
+
+    if (timer_state.lapic) {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+        lapic_write(LAPIC_TIMER_INITIAL, UINT32_MAX);
+    }
+    uint64_t start = cpu_rdtsc();
+    out(PIT_GATE_PORT, gate | PIT_GATE_CHANNEL2); // channel 2 starts counting on the rising gate
+    while (!(in(PIT_GATE_PORT) & PIT_OUTPUT_CHANNEL2));
+    uint64_t cycles = cpu_rdtsc() - start;
+    uint32_t lapic_counts = timer_state.lapic ? UINT32_MAX - lapic_read(LAPIC_TIMER_CURRENT) : 0;
+    out(PIT_GATE_PORT, gate);
+
+    // the window is count / PIT_FREQUENCY seconds, slightly under TIMER_CALIBRATE_MS
+    uint32_t window_ms_scaled = (uint32_t) count * 1000; // PIT_FREQUENCY units per ms
+    timer_state.tsc_khz       = div64_32(cycles * PIT_FREQUENCY, window_ms_scaled, NULL);
+    timer_state.lapic_per_ms  = div64_32((uint64_t) lapic_counts * PIT_FREQUENCY, window_ms_scaled, NULL);
+    if (timer_state.lapic)
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    // largest shift that keeps the multiplier in 32 bits, ns = cycles * 10^6 / tsc_khz
+    timer_state.ns_shift = 32;
+    while (timer_state.ns_shift > 0
+            && div64_32((uint64_t) 1000000 << timer_state.ns_shift, timer_state.tsc_khz, NULL) >> 32)
+        timer_state.ns_shift--;
+    timer_state.ns_mult = div64_32((uint64_t) 1000000 << timer_state.ns_shift, timer_state.tsc_khz, NULL);
+}
+
+static uint64_t tsc_to_ns(uint64_t cycles) {
+    // (cycles * ns_mult) >> ns_shift without a 96-bit product
+    uint64_t high = (uint64_t) (uint32_t) (cycles >> 32) * timer_state.ns_mult;
+    uint64_t low  = (uint64_t) (uint32_t) cycles * timer_state.ns_mult;
+    return (high << (32 - timer_state.ns_shift)) + (low >> timer_state.ns_shift);
+}
+
+uint64_t clock_monotonic_ns(void) {
+    if (timer_state.tsc_clock)
+        return tsc_to_ns(cpu_rdtsc() - timer_state.tsc_base);
+
+    // two 32-bit loads, a tick in between would tear them
+    uint32_t sequence;
+    uint64_t ticks;
+    do {
+        sequence = read_seqbegin(&timer_state.clock_lock);
+        ticks    = timer_state.ticks;
+    } while (read_seqretry(&timer_state.clock_lock, sequence));
+    return ticks * (NS_PER_SEC / TIMER_HZ);
+}
+
+uint32_t clock_realtime(void) {
+    return timer_state.boot_unix + (uint32_t) div64_32(clock_monotonic_ns(), NS_PER_SEC, NULL);
+}
+
+/* -- Event device -- */
+
+static void timer_device_oneshot(uint64_t delta) {
+    if (delta < TIMER_MIN_DELTA_NS)
+        delta = TIMER_MIN_DELTA_NS;
+    if (delta > TIMER_MAX_DELTA_NS)
+        delta = TIMER_MAX_DELTA_NS;
+
+    if (timer_state.lapic) {
+        uint32_t count = div64_32(delta * timer_state.lapic_per_ms, NS_PER_MS, NULL);
+        lapic_write(LAPIC_TIMER_INITIAL, count ? count : 1);
+    } else {
+        uint64_t count = div64_32(delta * PIT_FREQUENCY, NS_PER_SEC, NULL);
+        if (count > PIT_MAX_COUNT)
+            count = PIT_MAX_COUNT;
+        if (count == 0)
+            count = 1;
+        out(PIT_COMMAND, PIT_CHANNEL0_ONESHOT);
+        out(PIT_CHANNEL0, count & 0xFF);
+        out(PIT_CHANNEL0, count >> 8);
+    }
+}
+
+static void timer_device_stop(void) {
+    // a PIT in mode 0 raises one IRQ at terminal count and then stays quiet, nothing to stop
+    if (timer_state.lapic)
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
+
+static void timer_device_periodic(void) {
+    if (timer_state.lapic) {
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+        lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+        lapic_write(LAPIC_TIMER_INITIAL, timer_state.lapic_per_ms * 1000 / TIMER_HZ);
+    } else {
+        uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+        out(PIT_COMMAND, PIT_CHANNEL0_PERIODIC);
+        out(PIT_CHANNEL0, divisor & 0xFF);
+        out(PIT_CHANNEL0, divisor >> 8);
+    }
+}
+
+/* -- Timer heap -- */
+
+static void heap_place(struct Timer *timer, uint32_t index) {
+    timer_state.heap[index] = timer;
+    timer->index = index;
+}
+
+static void heap_sift_up(uint32_t index) {
+    struct Timer *timer = timer_state.heap[index];
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (timer_state.heap[parent]->deadline <= timer->deadline)
+            break;
+        heap_place(timer_state.heap[parent], index);
+        index = parent;
+    }
+    heap_place(timer, index);
+}
+
+static void heap_sift_down(uint32_t index) {
+    struct Timer *timer = timer_state.heap[index];
+    while (true) {
+        uint32_t child = 2 * index + 1;
+        if (child >= timer_state.heap_size)
+            break;
+        if (child + 1 < timer_state.heap_size
+                && timer_state.heap[child + 1]->deadline < timer_state.heap[child]->deadline)
+            child++;
+        if (timer->deadline <= timer_state.heap[child]->deadline)
+            break;
+        heap_place(timer_state.heap[child], index);
+        index = child;
+    }
+    heap_place(timer, index);
+}
+
+static void heap_remove(struct Timer *timer) {
+    uint32_t index = timer->index;
+    struct Timer *last = timer_state.heap[--timer_state.heap_size];
+    timer->armed = false;
+    if (last == timer)
+        return;
+    heap_place(last, index);
+    heap_sift_down(index);
+    heap_sift_up(last->index);
+}
+
+static void timer_program_next(void) {
+    if (timer_state.heap_size == 0) {
+        timer_device_stop();
+        return;
+    }
+    uint64_t now      = clock_monotonic_ns();
+    uint64_t deadline = timer_state.heap[0]->deadline;
+    timer_device_oneshot(deadline > now ? deadline - now : 0);
+}
+
+// callbacks run unlocked, they may arm timers again
+static void timer_run_expired(void) {
+    uint64_t now = clock_monotonic_ns();
+    spin_lock(&timer_state.lock);
+    while (timer_state.heap_size > 0 && timer_state.heap[0]->deadline <= now) {
+        struct Timer *timer = timer_state.heap[0];
+        heap_remove(timer);
+        timer_state.expired++;
+        spin_unlock(&timer_state.lock);
+        timer->fn(timer, timer->arg);
+        spin_lock(&timer_state.lock);
+    }
+    if (timer_state.tickless)
+        timer_program_next();
+    spin_unlock(&timer_state.lock);
+}
+
+static void timer_interrupt(struct InterruptFrame *frame, void *ctx) {
+    (void) frame;
+    (void) ctx;
+    timer_state.interrupts++;
+    if (!timer_state.tickless) {
+        uint32_t flags = write_seqlock_irqsave(&timer_state.clock_lock);
+        timer_state.ticks++;
+        write_sequnlock_irqrestore(&timer_state.clock_lock, flags);
+    }
+    if (timer_state.lapic)
+        apic_eoi();
+    else
+        irq_eoi(IRQ_TIMER);
+
+    timer_run_expired();
+}
+
+/* -- Interface -- */
+
+void timer_init(bool tickless) {
+    uint32_t edx;
+    cpu_cpuid(CPUID_FEATURES, NULL, NULL, NULL, &edx);
+    timer_state.tsc_clock = edx & CPUID_FEATURE_EDX_TSC;
+    timer_state.lapic     = apic_state.active;
+    timer_state.tickless  = tickless && timer_state.tsc_clock;
+
+    if (timer_state.tsc_clock)
+        timer_calibrate();
+    timer_state.tsc_base = timer_state.tsc_clock ? cpu_rdtsc() : 0;
+
+    struct RTCTime now;
+    rtc_read(&now);
+    timer_state.boot_unix = rtc_to_unix(&now);
+
+    if (timer_state.lapic) {
+        register_irq_handler(APIC_TIMER_VECTOR, timer_interrupt, NULL);
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+        lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR); // one-shot until timer_device_periodic()
+    } else {
+        register_irq_handler(PIC1_OFFSET + IRQ_TIMER, timer_interrupt, NULL);
+        irq_enable(IRQ_TIMER);
+    }
+
+    uint32_t flags = spin_lock_irqsave(&timer_state.lock);
+    if (timer_state.tickless)
+        timer_program_next();
+    else
+        timer_device_periodic();
+    spin_unlock_irqrestore(&timer_state.lock, flags);
+}
+
+void timer_setup(struct Timer *timer, timer_fn_t fn, void *arg) {
+    timer->deadline = 0;
+    timer->fn       = fn;
+    timer->arg      = arg;
+    timer->index    = 0;
+    timer->armed    = false;
+}
+
+bool timer_arm(struct Timer *timer, uint64_t deadline) {
+    uint32_t flags = spin_lock_irqsave(&timer_state.lock);
+    if (timer->armed)
+        heap_remove(timer);
+    if (timer_state.heap_size == TIMER_HEAP_CAPACITY) {
+        spin_unlock_irqrestore(&timer_state.lock, flags);
+        return false;
+    }
+
+    timer->deadline = deadline;
+    timer->armed    = true;
+    heap_place(timer, timer_state.heap_size++);
+    heap_sift_up(timer->index);
+
+    // only a new earliest deadline changes what the device has to wake up for
+    if (timer_state.tickless && timer_state.heap[0] == timer)
+        timer_program_next();
+    spin_unlock_irqrestore(&timer_state.lock, flags);
+    return true;
+}
+
+bool timer_arm_after(struct Timer *timer, uint64_t delay) {
+    return timer_arm(timer, clock_monotonic_ns() + delay);
+}
+
+void timer_cancel(struct Timer *timer) {
+    uint32_t flags = spin_lock_irqsave(&timer_state.lock);
+    if (timer->armed)
+        heap_remove(timer);
+    spin_unlock_irqrestore(&timer_state.lock, flags);
+}
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/process/wait.h"
+#include "header/process/thread.h"
+#include "header/cpu/cpu.h"
+#include "header/cpu/interrupt.h"
+#include "header/driver/timer.h"
+
+/* -- Queue -- */
+
+static void wait_queue_push(struct WaitQueue *queue, struct Thread *thread) {
+    thread->wait_next  = NULL;
+    thread->wait_queue = queue;
+    if (queue->tail)
+        queue->tail->wait_next = thread;
+    else
+        queue->head = thread;
+    queue->tail = thread;
+}
+
+static struct Thread* wait_queue_pop(struct WaitQueue *queue) {
+    struct Thread *thread = queue->head;
+    if (!thread)
+        return NULL;
+    queue->head = thread->wait_next;
+    if (!queue->head)
+        queue->tail = NULL;
+    thread->wait_next  = NULL;
+    thread->wait_queue = NULL;
+    return thread;
+}
+
+// only for a waiter woken by something else, e.g. its timeout, so the walk is rare
+static void wait_queue_remove(struct WaitQueue *queue, struct Thread *thread) {
+    struct Thread *prev = NULL;
+    for (struct Thread *walk = queue->head; walk; prev = walk, walk = walk->wait_next) {
+        if (walk != thread)
+            continue;
+        if (prev)
+            prev->wait_next = walk->wait_next;
+        else
+            queue->head = walk->wait_next;
+        if (queue->tail == walk)
+            queue->tail = prev;
+        break;
+    }
+    thread->wait_next  = NULL;
+    thread->wait_queue = NULL;
+}
+
+// queued and marked blocked before the lock is dropped, a wake_up() after that finds the thread
+static void wait_queue_block(struct WaitQueue *queue, struct Thread *self) {
+    wait_queue_push(queue, self);
+    self->state = THREAD_BLOCKED;
+    spin_unlock(&queue->lock);
+    thread_yield();
+    spin_lock(&queue->lock);
+    if (self->wait_queue == queue)
+        wait_queue_remove(queue, self);
+}
+
+void wait_queue_init(struct WaitQueue *queue, const char *name) {
+    spinlock_init(&queue->lock, name);
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+void wait_event_locked(struct WaitQueue *queue, wait_condition_t ready, void *arg) {
+    struct Thread *self = thread_current();
+    while (!ready(arg))
+        wait_queue_block(queue, self);
+}
+
+void wait_event(struct WaitQueue *queue, wait_condition_t ready, void *arg) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    wait_event_locked(queue, ready, arg);
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// woken threads are made ready under the lock, the switch to one of them waits until it is dropped
+static void wake_up_locked(struct WaitQueue *queue, uint32_t flags, bool all) {
+    bool preempt = false;
+    struct Thread *thread;
+    while ((thread = wait_queue_pop(queue))) {
+        preempt |= thread_make_ready(thread);
+        if (!all)
+            break;
+    }
+    spin_unlock(&queue->lock);
+    if (preempt && interrupt_nesting == 0)
+        thread_yield();
+    cpu_interrupt_restore(flags);
+}
+
+bool wake_up(struct WaitQueue *queue) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    bool     woken = queue->head != NULL;
+    wake_up_locked(queue, flags, false);
+    return woken;
+}
+
+void wake_up_all(struct WaitQueue *queue) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    wake_up_locked(queue, flags, true);
+}
+
+/* -- Completion -- */
+
+static bool completion_ready(void *arg) {
+    return ((struct Completion*) arg)->done != 0;
+}
+
+// called with the queue lock held
+static void completion_consume(struct Completion *completion) {
+    if (completion->done != UINT32_MAX)
+        completion->done--;
+}
+
+void completion_init(struct Completion *completion, const char *name) {
+    completion->done = 0;
+    wait_queue_init(&completion->queue, name);
+}
+
+void completion_reinit(struct Completion *completion) {
+    uint32_t flags = spin_lock_irqsave(&completion->queue.lock);
+    completion->done = 0;
+    spin_unlock_irqrestore(&completion->queue.lock, flags);
+}
+
+void complete(struct Completion *completion) {
+    uint32_t flags = spin_lock_irqsave(&completion->queue.lock);
+    if (completion->done < UINT32_MAX - 1)
+        completion->done++;
+    wake_up_locked(&completion->queue, flags, false);
+}
+
+void complete_all(struct Completion *completion) {
+    uint32_t flags = spin_lock_irqsave(&completion->queue.lock);
+    completion->done = UINT32_MAX;
+    wake_up_locked(&completion->queue, flags, true);
+}
+
+void wait_for_completion(struct Completion *completion) {
+    uint32_t flags = spin_lock_irqsave(&completion->queue.lock);
+    wait_event_locked(&completion->queue, completion_ready, completion);
+    completion_consume(completion);
+    spin_unlock_irqrestore(&completion->queue.lock, flags);
+}
+
+bool wait_for_completion_timeout(struct Completion *completion, uint64_t timeout_ns) {
+    struct Thread *self     = thread_current();
+    uint64_t      deadline  = clock_monotonic_ns() + timeout_ns;
+    uint32_t      flags     = spin_lock_irqsave(&completion->queue.lock);
+    while (!completion->done && clock_monotonic_ns() < deadline) {
+        // the sleep timer wakes the thread like thread_sleep_ns(), it then leaves the queue itself
+        timer_arm(&self->sleep_timer, deadline);
+        wait_queue_block(&completion->queue, self);
+    }
+    timer_cancel(&self->sleep_timer);
+
+    bool done = completion->done != 0;
+    if (done)
+        completion_consume(completion);
+    spin_unlock_irqrestore(&completion->queue.lock, flags);
+    return done;
+}
+
+bool completion_done(struct Completion *completion) {
+    return __atomic_load_n(&completion->done, __ATOMIC_ACQUIRE) != 0;
+}
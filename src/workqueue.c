@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/cpu/workqueue.h"
+#include "header/cpu/cpu.h"
+
+struct WorkQueueState work_queue_state = {
+    .head    = NULL,
+    .tail    = NULL,
+    .running = false,
+};
+
+void work_init(struct WorkItem *item, void (*fn)(void *arg), void *arg) {
+    item->fn         = fn;
+    item->arg        = arg;
+    item->next       = NULL;
+    item->pending    = false;
+    item->queued     = 0;
+    item->coalesced  = 0;
+    item->runs       = 0;
+    item->max_cycles = 0;
+}
+
+bool work_queue(struct WorkItem *item) {
+    uint32_t flags = cpu_interrupt_save();
+    bool added = !item->pending;
+    if (added) {
+        item->pending = true;
+        item->next    = NULL;
+        if (work_queue_state.tail)
+            work_queue_state.tail->next = item;
+        else
+            work_queue_state.head = item;
+        work_queue_state.tail = item;
+        item->queued++;
+    } else {
+        item->coalesced++;
+    }
+    cpu_interrupt_restore(flags);
+    return added;
+}
+
+void work_run_pending(void) {
+    uint32_t flags = cpu_interrupt_save();
+    if (work_queue_state.running) {
+        // interrupt that arrived during an item, the outer loop will run what it queued
+        cpu_interrupt_restore(flags);
+        return;
+    }
+
+    work_queue_state.running = true;
+    while (work_queue_state.head) {
+        // unlink with interrupts off, the item may be queued again as soon as pending is cleared
+        struct WorkItem *item = work_queue_state.head;
+        work_queue_state.head = item->next;
+        if (!work_queue_state.head)
+            work_queue_state.tail = NULL;
+        item->next    = NULL;
+        item->pending = false;
+
+        __asm__ volatile("sti" ::: "memory");
+        uint64_t start = cpu_rdtsc();
+        item->fn(item->arg);
+        uint64_t cycles = cpu_rdtsc() - start;
+        __asm__ volatile("cli" ::: "memory");
+
+        item->runs++;
+        if (cycles > item->max_cycles)
+            item->max_cycles = cycles;
+    }
+    work_queue_state.running = false;
+    cpu_interrupt_restore(flags);
+}